@@ -183,6 +183,8 @@ extern ctf_file_t *ctf_bufopen(const ctf_sect_t *, const ctf_sect_t *,
     const ctf_sect_t *, int *);
 extern ctf_file_t *ctf_fdopen(int, int *);
 extern ctf_file_t *ctf_open(const char *, int *);
+extern ctf_file_t *ctf_cache_open(const char *, const ctf_sect_t *,
+    const ctf_sect_t *, const ctf_sect_t *, int *);
 extern ctf_file_t *ctf_create(int *);
 extern void ctf_close(ctf_file_t *);
 
@@ -46,7 +46,14 @@ ctf_hash_create(ctf_hash_t *hp, unsigned long nelems)
 		return (0);
 	}
 
-	hp->h_nbuckets = 211;		/* use a prime number of hash buckets */
+	/*
+	 * Use a power-of-two number of buckets, at least as many as there are
+	 * elements, so that chains stay short on large containers.
+	 */
+	hp->h_nbuckets = 16;
+	while (hp->h_nbuckets < nelems && hp->h_nbuckets < (1U << 31))
+		hp->h_nbuckets <<= 1;
+
 	hp->h_nelems = nelems + 1;	/* we use index zero as a sentinel */
 	hp->h_free = 1;			/* first free element is index 1 */
 
@@ -70,22 +77,27 @@ ctf_hash_size(const ctf_hash_t *hp)
 	return (hp->h_nelems ? hp->h_nelems - 1 : 0);
 }
 
-static unsigned long
+/*
+ * Hash a string using FNV-1a, followed by the MurmurHash3 finalizer so that
+ * the low-order bits we use to select a bucket depend on every input byte.
+ */
+uint32_t
 ctf_hash_compute(const char *key, size_t len)
 {
-	unsigned long g, h = 0;
-	const char *p, *q = key + len;
-	size_t n = 0;
-
-	for (p = key; p < q; p++, n++) {
-		h = (h << 4) + *p;
+	const uint8_t *p = (const uint8_t *)key, *q = p + len;
+	uint32_t h = 2166136261U;
 
-		if ((g = (h & 0xf0000000)) != 0) {
-			h ^= (g >> 24);
-			h ^= g;
-		}
+	for (; p < q; p++) {
+		h ^= *p;
+		h *= 16777619U;
 	}
 
+	h ^= h >> 16;
+	h *= 0x85ebca6bU;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35U;
+	h ^= h >> 16;
+
 	return (h);
 }
 
@@ -95,7 +107,7 @@ ctf_hash_insert(ctf_hash_t *hp, ctf_file_t *fp, uint32_t type, uint32_t name)
 	ctf_strs_t *ctsp = &fp->ctf_str[CTF_NAME_STID(name)];
 	const char *str = ctsp->cts_strs + CTF_NAME_OFFSET(name);
 	ctf_helem_t *hep = &hp->h_chains[hp->h_free];
-	unsigned long h;
+	uint32_t h;
 
 	if (type == 0)
 		return (EINVAL);
@@ -112,11 +124,12 @@ ctf_hash_insert(ctf_hash_t *hp, ctf_file_t *fp, uint32_t type, uint32_t name)
 	if (str[0] == '\0')
 		return (0); /* just ignore empty strings on behalf of caller */
 
+	h = ctf_hash_compute(str, strlen(str));
 	hep->h_name = name;
 	hep->h_type = type;
-	h = ctf_hash_compute(str, strlen(str)) % hp->h_nbuckets;
-	hep->h_next = hp->h_buckets[h];
-	hp->h_buckets[h] = hp->h_free++;
+	hep->h_hash = h;
+	hep->h_next = hp->h_buckets[h & (hp->h_nbuckets - 1)];
+	hp->h_buckets[h & (hp->h_nbuckets - 1)] = hp->h_free++;
 
 	return (0);
 }
@@ -147,10 +160,13 @@ ctf_hash_lookup(ctf_hash_t *hp, ctf_file_t *fp, const char *key, size_t len)
 	const char *str;
 	uint32_t i;
 
-	unsigned long h = ctf_hash_compute(key, len) % hp->h_nbuckets;
+	uint32_t h = ctf_hash_compute(key, len);
 
-	for (i = hp->h_buckets[h]; i != 0; i = hep->h_next) {
+	for (i = hp->h_buckets[h & (hp->h_nbuckets - 1)]; i != 0;
+	    i = hep->h_next) {
 		hep = &hp->h_chains[i];
+		if (hep->h_hash != h)
+			continue; /* names with different hashes differ */
 		ctsp = &fp->ctf_str[CTF_NAME_STID(hep->h_name)];
 		str = ctsp->cts_strs + CTF_NAME_OFFSET(hep->h_name);
 
@@ -164,7 +180,7 @@ ctf_hash_lookup(ctf_hash_t *hp, ctf_file_t *fp, const char *key, size_t len)
 void
 ctf_hash_destroy(ctf_hash_t *hp)
 {
-	if (hp->h_buckets != NULL && hp->h_nbuckets != 1) {
+	if (hp->h_buckets != NULL && hp->h_buckets != _CTF_EMPTY) {
 		ctf_free(hp->h_buckets, sizeof (uint32_t) * hp->h_nbuckets);
 		hp->h_buckets = NULL;
 	}
@@ -174,3 +190,21 @@ ctf_hash_destroy(ctf_hash_t *hp)
 		hp->h_chains = NULL;
 	}
 }
+
+/*
+ * Compute a 64-bit FNV-1a hash of a buffer.  This is used to recognize the
+ * CTF section that a cached CTF image was built from (see ctf_image_open()).
+ */
+uint64_t
+ctf_hash_image(const void *buf, size_t len)
+{
+	const uint8_t *p = buf, *q = p + len;
+	uint64_t h = 14695981039346656037ULL;
+
+	for (; p < q; p++) {
+		h ^= *p;
+		h *= 1099511628211ULL;
+	}
+
+	return (h);
+}
@@ -71,16 +71,44 @@ typedef struct ctf_helem {
 	uint32_t h_name;		/* reference to name in string table */
 	uint32_t h_type;	/* corresponding type ID number */
 	uint32_t h_next;	/* index of next element in hash chain */
+	uint32_t h_hash;	/* hash value of name */
 } ctf_helem_t;
 
 typedef struct ctf_hash {
 	uint32_t *h_buckets;	/* hash bucket array (chain indices) */
 	ctf_helem_t *h_chains;	/* hash chains buffer */
-	uint32_t h_nbuckets;	/* number of elements in bucket array */
+	uint32_t h_nbuckets;	/* size of bucket array (a power of two) */
 	uint32_t h_nelems;	/* number of elements in hash table */
 	uint32_t h_free;		/* index of next free hash element */
 } ctf_hash_t;
 
+typedef struct ctf_membent {
+	uint32_t cme_name;	/* reference to member name in string table */
+	uint32_t cme_next;	/* index of next element in hash chain */
+	uint32_t cme_hash;	/* hash value of name */
+	uint32_t cme_index;	/* position of member in struct or union */
+	uint32_t cme_type;	/* member type ID number */
+	unsigned long cme_offset;	/* member offset in bits */
+} ctf_membent_t;
+
+typedef struct ctf_membhash {
+	uint32_t *cmh_buckets;	/* hash bucket array (chain indices) */
+	ctf_membent_t *cmh_chains;	/* named members (index zero is unused) */
+	ctf_membent_t *cmh_anon;	/* anonymous members in member order */
+	uint32_t cmh_nbuckets;	/* number of elements in bucket array */
+	uint32_t cmh_nelems;	/* number of elements in cmh_chains */
+	uint32_t cmh_nanon;	/* number of elements in cmh_anon */
+	size_t cmh_size;	/* size of this structure and its arrays */
+} ctf_membhash_t;
+
+#define	CTF_LMEMO_SIZE	64	/* number of ctf_lookup_by_name() memo entries */
+
+typedef struct ctf_lmemo {
+	char *clm_name;		/* name passed to ctf_lookup_by_name() */
+	uint32_t clm_hash;	/* hash value of clm_name */
+	ctf_id_t clm_type;	/* type found in this container, or CTF_ERR */
+} ctf_lmemo_t;
+
 typedef struct ctf_strs {
 	const char *cts_strs;	/* base address of string table */
 	size_t cts_len;		/* size of string table in bytes */
@@ -170,6 +198,44 @@ typedef struct ctf_dtdef {
 	} dtd_u;
 } ctf_dtdef_t;
 
+/*
+ * A CTF image is a flat, position-independent copy of an opened container:
+ * the uncompressed CTF header and data followed by the type and pointer
+ * translation tables and the four name hashes built by init_types().  Images
+ * are written to a cache file by ctf_cache_open() and later mapped read-only,
+ * so that repeated opens of the same CTF section skip decompression and type
+ * indexing entirely.  All offsets are relative to the start of the image and
+ * all data is in native byte order; an image is only reused if the size and
+ * content hash of the source CTF section match those recorded in its header.
+ */
+#define	CTF_IMAGE_MAGIC		0x43544649	/* "CTFI" */
+#define	CTF_IMAGE_VERSION	1		/* bump on any layout change */
+#define	CTF_IMAGE_ALIGN		8		/* alignment of image sections */
+
+typedef struct ctf_imghash {
+	uint64_t cih_buckets;	/* offset of bucket array */
+	uint64_t cih_chains;	/* offset of chain array */
+	uint32_t cih_nbuckets;	/* number of buckets */
+	uint32_t cih_nelems;	/* number of chain elements (incl. sentinel) */
+	uint32_t cih_free;	/* index of next free chain element */
+	uint32_t cih_pad;	/* reserved for future use */
+} ctf_imghash_t;
+
+typedef struct ctf_imghdr {
+	uint32_t cim_magic;	/* CTF_IMAGE_MAGIC */
+	uint32_t cim_version;	/* CTF_IMAGE_VERSION */
+	uint64_t cim_size;	/* total size of image in bytes */
+	uint64_t cim_srcsize;	/* size of source CTF section */
+	uint64_t cim_srchash;	/* hash of source CTF section */
+	uint64_t cim_ctfoff;	/* offset of uncompressed CTF header + data */
+	uint64_t cim_ctfsize;	/* size of uncompressed CTF header + data */
+	uint64_t cim_txlate;	/* offset of type translation table */
+	uint64_t cim_ptrtab;	/* offset of pointer translation table */
+	uint32_t cim_typemax;	/* maximum valid type ID number */
+	uint32_t cim_flags;	/* LCTF_CHILD if container is a child */
+	ctf_imghash_t cim_hash[4]; /* structs, unions, enums, names */
+} ctf_imghdr_t;
+
 typedef struct ctf_bundle {
 	ctf_file_t *ctb_file;	/* CTF container handle */
 	ctf_id_t ctb_type;	/* CTF type identifier */
@@ -206,6 +272,8 @@ struct ctf_file {
 	unsigned long ctf_nsyms;	/* number of entries in symtab xlate table */
 	uint32_t *ctf_txlate;	/* translation table for type IDs */
 	uint32_t *ctf_ptrtab;	/* translation table for pointer-to lookups */
+	ctf_membhash_t **ctf_membhash;	/* member name hashes by type index */
+	ctf_lmemo_t *ctf_lmemo;	/* memo of recent ctf_lookup_by_name() calls */
 	unsigned long ctf_typemax;	/* maximum valid type ID number */
 	const ctf_dmodel_t *ctf_dmodel;	/* data model pointer (see above) */
 	struct ctf_file *ctf_parent;	/* parent CTF container (if any) */
@@ -222,6 +290,8 @@ struct ctf_file {
 	unsigned long ctf_dtnextid;	/* next dynamic type id to assign */
 	unsigned long ctf_dtoldid;	/* oldest id that has been committed */
 	void *ctf_specific;	/* data for ctf_get/setspecific */
+	void *ctf_image;	/* mapped CTF image (if LCTF_IMAGE) */
+	size_t ctf_imagesz;	/* size of mapped CTF image */
 };
 
 #define	LCTF_INDEX_TO_TYPEPTR(fp, i) \
@@ -241,6 +311,7 @@ struct ctf_file {
 #define	LCTF_CHILD	0x0002	/* CTF container is a child */
 #define	LCTF_RDWR	0x0004	/* CTF container is writable */
 #define	LCTF_DIRTY	0x0008	/* CTF container has been modified */
+#define	LCTF_IMAGE	0x0010	/* tables live in ctf_image; munmap on close */
 
 #define	ECTF_BASE	1000	/* base value for libctf errnos */
 
@@ -305,6 +376,11 @@ extern uint64_t ctf_get_ctt_lsize(const ctf_file_t *, const void *);
 
 extern const void *ctf_lookup_by_id(ctf_file_t **, ctf_id_t);
 
+extern void ctf_membhash_destroy(ctf_file_t *);
+extern void ctf_lmemo_destroy(ctf_file_t *);
+
+extern uint32_t ctf_hash_compute(const char *, size_t);
+extern uint64_t ctf_hash_image(const void *, size_t);
 extern int ctf_hash_create(ctf_hash_t *, unsigned long);
 extern int ctf_hash_insert(ctf_hash_t *, ctf_file_t *, uint32_t, uint32_t);
 extern int ctf_hash_define(ctf_hash_t *, ctf_file_t *, uint32_t, uint32_t);
@@ -351,6 +427,9 @@ extern void ctf_dprintf(const char *, ...);
 
 extern void *ctf_zopen(int *);
 
+extern ctf_file_t *ctf_image_open(void *, size_t, const ctf_sect_t *,
+    const ctf_sect_t *, const ctf_sect_t *, int *);
+
 extern const char _CTF_SECTION[];	/* name of CTF ELF section */
 extern const char _CTF_NULLSTR[];	/* empty string */
 
@@ -436,6 +436,166 @@ ctf_write(ctf_file_t *fp, int fd)
 	return (0);
 }
 
+/*
+ * Write a CTF image of the specified container, which must have just been
+ * opened by ctf_bufopen() from ctfsect, to the specified file descriptor.
+ */
+static int
+ctf_image_write(ctf_file_t *fp, const ctf_sect_t *ctfsect, int fd)
+{
+	ctf_hash_t *hashes[4];
+	ctf_imghdr_t *ip;
+	size_t size, tsize;
+	uint8_t *img, *p;
+	ssize_t len, resid;
+	int i, err = 0;
+
+	hashes[0] = &fp->ctf_structs;
+	hashes[1] = &fp->ctf_unions;
+	hashes[2] = &fp->ctf_enums;
+	hashes[3] = &fp->ctf_names;
+
+	tsize = sizeof (uint32_t) * (fp->ctf_typemax + 1);
+
+	size = P2ROUNDUP(sizeof (ctf_imghdr_t), CTF_IMAGE_ALIGN);
+	size += P2ROUNDUP(fp->ctf_size, CTF_IMAGE_ALIGN);
+	size += P2ROUNDUP(tsize, CTF_IMAGE_ALIGN) * 2;
+
+	for (i = 0; i < 4; i++) {
+		size += P2ROUNDUP(sizeof (uint32_t) * hashes[i]->h_nbuckets,
+		    CTF_IMAGE_ALIGN);
+		size += P2ROUNDUP(sizeof (ctf_helem_t) * hashes[i]->h_nelems,
+		    CTF_IMAGE_ALIGN);
+	}
+
+	if ((img = ctf_alloc(size)) == NULL)
+		return (EAGAIN);
+
+	bzero(img, size);
+	ip = (ctf_imghdr_t *)img;
+	ip->cim_magic = CTF_IMAGE_MAGIC;
+	ip->cim_version = CTF_IMAGE_VERSION;
+	ip->cim_size = size;
+	ip->cim_srcsize = ctfsect->cts_size;
+	ip->cim_srchash = ctf_hash_image(ctfsect->cts_data, ctfsect->cts_size);
+	ip->cim_typemax = (uint32_t)fp->ctf_typemax;
+	ip->cim_flags = fp->ctf_flags & LCTF_CHILD;
+
+	p = img + P2ROUNDUP(sizeof (ctf_imghdr_t), CTF_IMAGE_ALIGN);
+
+	ip->cim_ctfoff = p - img;
+	ip->cim_ctfsize = fp->ctf_size;
+	bcopy(fp->ctf_base, p, fp->ctf_size);
+	p += P2ROUNDUP(fp->ctf_size, CTF_IMAGE_ALIGN);
+
+	ip->cim_txlate = p - img;
+	bcopy(fp->ctf_txlate, p, tsize);
+	p += P2ROUNDUP(tsize, CTF_IMAGE_ALIGN);
+
+	ip->cim_ptrtab = p - img;
+	bcopy(fp->ctf_ptrtab, p, tsize);
+	p += P2ROUNDUP(tsize, CTF_IMAGE_ALIGN);
+
+	for (i = 0; i < 4; i++) {
+		const ctf_hash_t *hp = hashes[i];
+		ctf_imghash_t *ihp = &ip->cim_hash[i];
+
+		ihp->cih_nbuckets = hp->h_nbuckets;
+		ihp->cih_nelems = hp->h_nelems;
+		ihp->cih_free = hp->h_free;
+
+		ihp->cih_buckets = p - img;
+		bcopy(hp->h_buckets, p, sizeof (uint32_t) * hp->h_nbuckets);
+		p += P2ROUNDUP(sizeof (uint32_t) * hp->h_nbuckets,
+		    CTF_IMAGE_ALIGN);
+
+		ihp->cih_chains = p - img;
+		if (hp->h_nelems != 0)
+			bcopy(hp->h_chains, p,
+			    sizeof (ctf_helem_t) * hp->h_nelems);
+		p += P2ROUNDUP(sizeof (ctf_helem_t) * hp->h_nelems,
+		    CTF_IMAGE_ALIGN);
+	}
+
+	for (p = img, resid = size; resid != 0; resid -= len, p += len) {
+		if ((len = write(fd, p, resid)) <= 0) {
+			err = len < 0 ? errno : EIO;
+			break;
+		}
+	}
+
+	ctf_free(img, size);
+	return (err);
+}
+
+/*
+ * Open a CTF container for the specified sections, using the CTF image cached
+ * at path if there is one that was built from the same CTF section.  The cache
+ * file must be a regular file owned by the effective user and writable only by
+ * it.  If there is no usable image, we open the sections with ctf_bufopen()
+ * and then write a new image to path for subsequent opens to map, replacing
+ * any previous one.  Failure to read or write the cache is not an error.
+ */
+ctf_file_t *
+ctf_cache_open(const char *path, const ctf_sect_t *ctfsect,
+    const ctf_sect_t *symsect, const ctf_sect_t *strsect, int *errp)
+{
+	ctf_file_t *fp;
+	struct stat st;
+	size_t len;
+	char *tmp;
+	void *img;
+	int fd, err;
+
+	if ((fd = open(path, O_RDONLY | O_NOFOLLOW)) != -1) {
+		if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+		    st.st_uid == geteuid() &&
+		    (st.st_mode & (S_IWGRP | S_IWOTH)) == 0 &&
+		    (img = mmap(NULL, (size_t)st.st_size, PROT_READ,
+		    MAP_SHARED, fd, 0)) != MAP_FAILED) {
+			fp = ctf_image_open(img, (size_t)st.st_size,
+			    ctfsect, symsect, strsect, &err);
+
+			if (fp != NULL) {
+				(void) close(fd);
+				return (fp);
+			}
+
+			ctf_dprintf("ignoring CTF image %s: %s\n",
+			    path, ctf_errmsg(err));
+			(void) munmap(img, (size_t)st.st_size);
+		}
+		(void) close(fd);
+	}
+
+	if ((fp = ctf_bufopen(ctfsect, symsect, strsect, errp)) == NULL)
+		return (NULL);
+
+	len = strlen(path) + 16;
+	if ((tmp = ctf_alloc(len)) == NULL)
+		return (fp);
+
+	(void) snprintf(tmp, len, "%s.%d", path, (int)getpid());
+
+	if ((fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW,
+	    0600)) != -1) {
+		err = ctf_image_write(fp, ctfsect, fd);
+
+		if (close(fd) == -1 && err == 0)
+			err = errno;
+		if (err == 0 && rename(tmp, path) == -1)
+			err = errno;
+		if (err != 0) {
+			ctf_dprintf("failed to write CTF image %s: %s\n",
+			    path, ctf_errmsg(err));
+			(void) unlink(tmp);
+		}
+	}
+
+	ctf_free(tmp, len);
+	return (fp);
+}
+
 /*
  * Set the CTF library client version to the specified version.  If version is
  * zero, we just return the default library version number.
@@ -72,9 +72,11 @@ isqualifier(const char *s, size_t len)
  * Instead, this function implements a very simple conversion algorithm that
  * finds the things that we actually care about: structs, unions, enums,
  * integers, floats, typedefs, and pointers to any of these named types.
+ * This function only looks in the given container: ctf_lookup_by_name(),
+ * below, falls back to the parent container when the type is not found.
  */
-ctf_id_t
-ctf_lookup_by_name(ctf_file_t *fp, const char *name)
+static ctf_id_t
+ctf_lookup_local(ctf_file_t *fp, const char *name)
 {
 	static const char delimiters[] = " \t\n\r\v\f*";
 
@@ -82,9 +84,7 @@ ctf_lookup_by_name(ctf_file_t *fp, const char *name)
 	const ctf_helem_t *hp;
 	const char *p, *q, *end;
 	ctf_id_t type = 0;
-	ctf_id_t ntype, ptype;
-	if (name == NULL)
-		return (ctf_set_errno(fp, EINVAL));
+	ctf_id_t ntype;
 
 	for (p = name, end = name + strlen(name); *p != '\0'; p = q) {
 		while (isspace(*p))
@@ -105,14 +105,19 @@ ctf_lookup_by_name(ctf_file_t *fp, const char *name)
 			 * that instead.  This helps with cases where the CTF
 			 * data includes "struct foo *" but not "foo_t *" and
 			 * the user tries to access "foo_t *" in the debugger.
+			 * A base type that lives in the parent container has
+			 * no entry in our ctf_ptrtab.
 			 */
 			ntype = fp->ctf_ptrtab[LCTF_TYPE_TO_INDEX(fp, type)];
 			if (ntype == 0) {
 				ntype = ctf_type_resolve(fp, type);
-				if (ntype == CTF_ERR || (ntype = fp->ctf_ptrtab[
+				if (ntype == CTF_ERR ||
+				    ((fp->ctf_flags & LCTF_CHILD) &&
+				    LCTF_TYPE_ISPARENT(fp, ntype)) ||
+				    (ntype = fp->ctf_ptrtab[
 				    LCTF_TYPE_TO_INDEX(fp, ntype)]) == 0) {
-					(void) ctf_set_errno(fp, ECTF_NOTYPE);
-					goto err;
+					return (ctf_set_errno(fp,
+					    ECTF_NOTYPE));
 				}
 			}
 
@@ -144,8 +149,8 @@ ctf_lookup_by_name(ctf_file_t *fp, const char *name)
 
 				if ((hp = ctf_hash_lookup(lp->ctl_hash, fp, p,
 				    (size_t)(q - p))) == NULL) {
-					(void) ctf_set_errno(fp, ECTF_NOTYPE);
-					goto err;
+					return (ctf_set_errno(fp,
+					    ECTF_NOTYPE));
 				}
 
 				type = hp->h_type;
@@ -153,18 +158,75 @@ ctf_lookup_by_name(ctf_file_t *fp, const char *name)
 			}
 		}
 
-		if (lp->ctl_prefix == NULL) {
-			(void) ctf_set_errno(fp, ECTF_NOTYPE);
-			goto err;
-		}
+		if (lp->ctl_prefix == NULL)
+			return (ctf_set_errno(fp, ECTF_NOTYPE));
 	}
 
 	if (*p != '\0' || type == 0)
 		return (ctf_set_errno(fp, ECTF_SYNTAX));
 
 	return (type);
+}
+
+/*
+ * Look up a type by name, in the given container and then in its parent.
+ * Programs such as dtrace(1M) look up the same few names over and over, in
+ * every container they have open, so we remember the outcome of the last
+ * lookup of each name in a small direct-mapped memo.  The memo only records
+ * what was found in this container, which cannot change until ctf_update()
+ * replaces its contents, memo included; lookups in the parent go through the
+ * parent's own memo.
+ */
+ctf_id_t
+ctf_lookup_by_name(ctf_file_t *fp, const char *name)
+{
+	ctf_lmemo_t *lmp = NULL;
+	ctf_id_t type, ptype;
+	uint32_t h;
+
+	if (name == NULL)
+		return (ctf_set_errno(fp, EINVAL));
+
+	h = ctf_hash_compute(name, strlen(name));
+
+	if (fp->ctf_lmemo == NULL &&
+	    (fp->ctf_lmemo = ctf_alloc(sizeof (ctf_lmemo_t) *
+	    CTF_LMEMO_SIZE)) != NULL)
+		bzero(fp->ctf_lmemo, sizeof (ctf_lmemo_t) * CTF_LMEMO_SIZE);
+
+	if (fp->ctf_lmemo != NULL) {
+		lmp = &fp->ctf_lmemo[h & (CTF_LMEMO_SIZE - 1)];
 
-err:
+		if (lmp->clm_name != NULL && lmp->clm_hash == h &&
+		    strcmp(lmp->clm_name, name) == 0) {
+			type = lmp->clm_type;
+			if (type != CTF_ERR)
+				return (type);
+			(void) ctf_set_errno(fp, ECTF_NOTYPE);
+			goto parent;
+		}
+	}
+
+	/*
+	 * Only names that are either found or missing from this container are
+	 * worth remembering: any other error is a syntax error in the name.
+	 */
+	if ((type = ctf_lookup_local(fp, name)) == CTF_ERR &&
+	    ctf_errno(fp) != ECTF_NOTYPE)
+		return (CTF_ERR);
+
+	if (lmp != NULL) {
+		if (lmp->clm_name != NULL)
+			ctf_free(lmp->clm_name, strlen(lmp->clm_name) + 1);
+		lmp->clm_name = ctf_strdup(name);
+		lmp->clm_hash = h;
+		lmp->clm_type = type;
+	}
+
+	if (type != CTF_ERR)
+		return (type);
+
+parent:
 	if (fp->ctf_parent != NULL &&
 	    (ptype = ctf_lookup_by_name(fp->ctf_parent, name)) != CTF_ERR)
 		return (ptype);
@@ -172,6 +234,26 @@ err:
 	return (CTF_ERR);
 }
 
+void
+ctf_lmemo_destroy(ctf_file_t *fp)
+{
+	int i;
+
+	if (fp->ctf_lmemo == NULL)
+		return;
+
+	for (i = 0; i < CTF_LMEMO_SIZE; i++) {
+		if (fp->ctf_lmemo[i].clm_name != NULL) {
+			ctf_free(fp->ctf_lmemo[i].clm_name,
+			    strlen(fp->ctf_lmemo[i].clm_name) + 1);
+		}
+	}
+
+	ctf_free(fp->ctf_lmemo, sizeof (ctf_lmemo_t) * CTF_LMEMO_SIZE);
+	fp->ctf_lmemo = NULL;
+}
+
+
 /*
  * Given a symbol table index, return the type of the data object described
  * by the corresponding entry in the symbol table.
@@ -801,15 +801,129 @@ init_types(ctf_file_t *fp, const ctf_header_t *cth)
 	return (0);
 }
 
+/*
+ * Return true if [off, off + len) lies within the CTF image and off is
+ * suitably aligned for the table stored there.
+ */
+static int
+image_range(const ctf_imghdr_t *ip, uint64_t off, uint64_t len)
+{
+	return (off <= ip->cim_size && len <= ip->cim_size - off &&
+	    (off & (CTF_IMAGE_ALIGN - 1)) == 0);
+}
+
+/*
+ * Initialize the type ID translation table, pointer table, and name hashes
+ * from a CTF image rather than by walking the types as init_types() does.
+ * The tables are used in place, so before pointing the container at them we
+ * check that every index and offset they hold is within bounds; an image that
+ * fails any check is rejected and the caller falls back to ctf_bufopen().
+ */
+static int
+init_image(ctf_file_t *fp, const ctf_header_t *cth, void *img)
+{
+	const ctf_imghdr_t *ip = img;
+	ctf_hash_t *hashes[4];
+	ctf_hash_t hash[4];
+	const uint32_t *txlate, *ptrtab;
+	int child = (ip->cim_flags & LCTF_CHILD) != 0;
+	uint64_t tsize;
+	unsigned long id;
+	uint32_t i, j;
+
+	hashes[0] = &fp->ctf_structs;
+	hashes[1] = &fp->ctf_unions;
+	hashes[2] = &fp->ctf_enums;
+	hashes[3] = &fp->ctf_names;
+
+	tsize = sizeof (uint32_t) * ((uint64_t)ip->cim_typemax + 1);
+
+	if (!image_range(ip, ip->cim_txlate, tsize) ||
+	    !image_range(ip, ip->cim_ptrtab, tsize))
+		return (ECTF_CORRUPT);
+
+	txlate = (const uint32_t *)((uintptr_t)img + ip->cim_txlate);
+	ptrtab = (const uint32_t *)((uintptr_t)img + ip->cim_ptrtab);
+
+	for (id = 1; id <= ip->cim_typemax; id++) {
+		if (txlate[id] < cth->cth_typeoff ||
+		    txlate[id] >= cth->cth_stroff || (txlate[id] & 3) != 0 ||
+		    ptrtab[id] > ip->cim_typemax)
+			return (ECTF_CORRUPT);
+	}
+
+	for (i = 0; i < 4; i++) {
+		const ctf_imghash_t *ihp = &ip->cim_hash[i];
+		ctf_hash_t *hp = &hash[i];
+
+		if (ihp->cih_nbuckets == 0 ||
+		    (ihp->cih_nbuckets & (ihp->cih_nbuckets - 1)) != 0 ||
+		    ihp->cih_free > ihp->cih_nelems ||
+		    (ihp->cih_nelems != 0 && ihp->cih_free == 0) ||
+		    !image_range(ip, ihp->cih_buckets,
+		    sizeof (uint32_t) * (uint64_t)ihp->cih_nbuckets) ||
+		    !image_range(ip, ihp->cih_chains,
+		    sizeof (ctf_helem_t) * (uint64_t)ihp->cih_nelems))
+			return (ECTF_CORRUPT);
+
+		hp->h_buckets = (uint32_t *)((uintptr_t)img + ihp->cih_buckets);
+		hp->h_chains = (ctf_helem_t *)((uintptr_t)img + ihp->cih_chains);
+		hp->h_nbuckets = ihp->cih_nbuckets;
+		hp->h_nelems = ihp->cih_nelems;
+		hp->h_free = ihp->cih_free;
+
+		/*
+		 * Chains are built by pushing each new element onto the head
+		 * of its bucket, so every link must point to an element that
+		 * was inserted earlier; this also rules out cycles.
+		 */
+		for (j = 0; j < hp->h_nbuckets; j++) {
+			if (hp->h_buckets[j] != 0 &&
+			    hp->h_buckets[j] >= hp->h_free)
+				return (ECTF_CORRUPT);
+		}
+
+		for (j = 1; j < hp->h_free; j++) {
+			const ctf_helem_t *hep = &hp->h_chains[j];
+			const ctf_strs_t *ctsp =
+			    &fp->ctf_str[CTF_NAME_STID(hep->h_name)];
+
+			if (hep->h_next >= j || ctsp->cts_strs == NULL ||
+			    ctsp->cts_len <= CTF_NAME_OFFSET(hep->h_name))
+				return (ECTF_CORRUPT);
+
+			if (LCTF_TYPE_ISCHILD(fp, hep->h_type) != child ||
+			    LCTF_TYPE_TO_INDEX(fp, hep->h_type) == 0 ||
+			    LCTF_TYPE_TO_INDEX(fp, hep->h_type) > ip->cim_typemax)
+				return (ECTF_CORRUPT);
+		}
+	}
+
+	fp->ctf_typemax = ip->cim_typemax;
+	fp->ctf_txlate = (uint32_t *)txlate;
+	fp->ctf_ptrtab = (uint32_t *)ptrtab;
+
+	for (i = 0; i < 4; i++)
+		*hashes[i] = hash[i];
+
+	fp->ctf_image = img;
+	fp->ctf_imagesz = ip->cim_size;
+	fp->ctf_flags |= LCTF_IMAGE | (ip->cim_flags & LCTF_CHILD);
+
+	ctf_dprintf("%lu types mapped from CTF image %p\n",
+	    fp->ctf_typemax, img);
+
+	return (0);
+}
+
 /*
  * Decode the specified CTF buffer and optional symbol table and create a new
- * CTF container representing the symbolic debugging information.  This code
- * can be used directly by the debugger, or it can be used as the engine for
- * ctf_fdopen() or ctf_open(), below.
+ * CTF container.  If img is non-NULL, ctfsect is the uncompressed CTF data
+ * embedded in that CTF image and the type tables are taken from the image.
  */
-ctf_file_t *
-ctf_bufopen(const ctf_sect_t *ctfsect, const ctf_sect_t *symsect,
-    const ctf_sect_t *strsect, int *errp)
+static ctf_file_t *
+bufopen(const ctf_sect_t *ctfsect, const ctf_sect_t *symsect,
+    const ctf_sect_t *strsect, void *img, int *errp)
 {
 	const ctf_preamble_t *pp;
 	ctf_header_t hp;
@@ -895,6 +1009,14 @@ ctf_bufopen(const ctf_sect_t *ctfsect, const ctf_sect_t *symsect,
 	    (hp.cth_funcoff & 1) || (hp.cth_typeoff & 3))
 		return (ctf_set_open_errno(errp, ECTF_CORRUPT));
 
+	/*
+	 * The CTF data embedded in an image is always stored uncompressed and
+	 * must account for the whole of its section.
+	 */
+	if (img != NULL && ((hp.cth_flags & CTF_F_COMPRESS) ||
+	    ctfsect->cts_size != size + hdrsz))
+		return (ctf_set_open_errno(errp, ECTF_CORRUPT));
+
 	/*
 	 * Once everything is determined to be valid, attempt to decompress
 	 * the CTF data buffer if it is compressed.  Otherwise we just put
@@ -1017,7 +1139,12 @@ ctf_bufopen(const ctf_sect_t *ctfsect, const ctf_sect_t *symsect,
 		}
 	}
 
-	if ((err = init_types(fp, &hp)) != 0) {
+	if (img != NULL)
+		err = init_image(fp, &hp, img);
+	else
+		err = init_types(fp, &hp);
+
+	if (err != 0) {
 		(void) ctf_set_open_errno(errp, err);
 		goto bad;
 	}
@@ -1063,6 +1190,56 @@ bad:
 	return (NULL);
 }
 
+/*
+ * Decode the specified CTF buffer and optional symbol table and create a new
+ * CTF container representing the symbolic debugging information.  This code
+ * can be used directly by the debugger, or it can be used as the engine for
+ * ctf_fdopen() or ctf_open(), below.
+ */
+ctf_file_t *
+ctf_bufopen(const ctf_sect_t *ctfsect, const ctf_sect_t *symsect,
+    const ctf_sect_t *strsect, int *errp)
+{
+	return (bufopen(ctfsect, symsect, strsect, NULL, errp));
+}
+
+/*
+ * Create a CTF container from a CTF image of the section ctfsect (see the
+ * comment above ctf_imghdr_t).  The image must have been built from exactly
+ * the same section data; if it was not, or if it is damaged, we fail and the
+ * caller should use ctf_bufopen() instead.  On success the container takes
+ * ownership of the image mapping and will munmap it when it is closed.
+ */
+ctf_file_t *
+ctf_image_open(void *img, size_t imgsz, const ctf_sect_t *ctfsect,
+    const ctf_sect_t *symsect, const ctf_sect_t *strsect, int *errp)
+{
+	const ctf_imghdr_t *ip = img;
+	ctf_sect_t sect;
+
+	if (ctfsect == NULL || ctfsect->cts_data == NULL)
+		return (ctf_set_open_errno(errp, EINVAL));
+
+	if (imgsz < sizeof (ctf_imghdr_t) || ip->cim_magic != CTF_IMAGE_MAGIC ||
+	    ip->cim_version != CTF_IMAGE_VERSION || ip->cim_size != imgsz)
+		return (ctf_set_open_errno(errp, ECTF_NOCTFBUF));
+
+	if (ip->cim_srcsize != ctfsect->cts_size || ip->cim_srchash !=
+	    ctf_hash_image(ctfsect->cts_data, ctfsect->cts_size)) {
+		ctf_dprintf("ctf_image_open: image %p is stale\n", img);
+		return (ctf_set_open_errno(errp, ECTF_NOCTFBUF));
+	}
+
+	if (!image_range(ip, ip->cim_ctfoff, ip->cim_ctfsize))
+		return (ctf_set_open_errno(errp, ECTF_CORRUPT));
+
+	bcopy(ctfsect, &sect, sizeof (ctf_sect_t));
+	sect.cts_data = (const void *)((uintptr_t)img + ip->cim_ctfoff);
+	sect.cts_size = ip->cim_ctfsize;
+
+	return (bufopen(&sect, symsect, strsect, img, errp));
+}
+
 /*
  * Close the specified CTF container and free associated data structures.  Note
  * that ctf_close() is a reference counted operation: if the specified file is
@@ -1135,20 +1312,31 @@ ctf_close(ctf_file_t *fp)
 			ctf_free(fp->ctf_sxlate, sizeof (uint32_t) * fp->ctf_nsyms);
 	}
 
-	if (fp->ctf_txlate != NULL) {
-		ctf_free(fp->ctf_txlate,
-		    sizeof (uint32_t) * (fp->ctf_typemax + 1));
-	}
+	ctf_membhash_destroy(fp);
+	ctf_lmemo_destroy(fp);
 
-	if (fp->ctf_ptrtab != NULL) {
-		ctf_free(fp->ctf_ptrtab,
-		    sizeof (uint32_t) * (fp->ctf_typemax + 1));
-	}
+	/*
+	 * If the container was opened from a CTF image, the translation
+	 * tables and hashes (and the CTF data itself) live in the mapping.
+	 */
+	if (fp->ctf_flags & LCTF_IMAGE) {
+		(void) munmap(fp->ctf_image, fp->ctf_imagesz);
+	} else {
+		if (fp->ctf_txlate != NULL) {
+			ctf_free(fp->ctf_txlate,
+			    sizeof (uint32_t) * (fp->ctf_typemax + 1));
+		}
+
+		if (fp->ctf_ptrtab != NULL) {
+			ctf_free(fp->ctf_ptrtab,
+			    sizeof (uint32_t) * (fp->ctf_typemax + 1));
+		}
 
-	ctf_hash_destroy(&fp->ctf_structs);
-	ctf_hash_destroy(&fp->ctf_unions);
-	ctf_hash_destroy(&fp->ctf_enums);
-	ctf_hash_destroy(&fp->ctf_names);
+		ctf_hash_destroy(&fp->ctf_structs);
+		ctf_hash_destroy(&fp->ctf_unions);
+		ctf_hash_destroy(&fp->ctf_enums);
+		ctf_hash_destroy(&fp->ctf_names);
+	}
 
 	ctf_free(fp, sizeof (ctf_file_t));
 }
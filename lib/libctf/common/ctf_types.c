@@ -760,14 +760,177 @@ ctf_type_compat_helper(ctf_file_t *lfp, ctf_id_t ltype, ctf_file_t *rfp,  ctf_id
 	}
 }
 
+/*
+ * Structs and unions with at least this many members get a member name hash
+ * the first time one of their members is looked up by name.  Smaller ones are
+ * cheaper to scan than to index.
+ */
+#define	CTF_MEMBHASH_THRESH	16
+
+static void
+ctf_membhash_add(ctf_membhash_t *mhp, uint32_t name, uint32_t type,
+    unsigned long offset, uint32_t index)
+{
+	ctf_membent_t *mep;
+
+	if (name == 0)
+		mep = &mhp->cmh_anon[mhp->cmh_nanon++];
+	else
+		mep = &mhp->cmh_chains[mhp->cmh_nelems++];
+
+	mep->cme_name = name;
+	mep->cme_next = 0;
+	mep->cme_index = index;
+	mep->cme_type = type;
+	mep->cme_offset = offset;
+}
+
+/*
+ * Build the member name hash of the struct or union type pointed to by tp.
+ * Named members are chained in member order so that a lookup finds the first
+ * member with a given name, as a scan of the member list would.  Anonymous
+ * members are kept aside: the members they contain are found by recursing
+ * into them, which lets each of them use its own member name hash.
+ */
+static ctf_membhash_t *
+ctf_membhash_create(ctf_file_t *fp, const void *tp, ssize_t size,
+    ssize_t increment)
+{
+	uint32_t vlen = LCTF_INFO_VLEN(fp, get_type_ctt_info(fp, tp));
+	ctf_membhash_t *mhp;
+	ctf_membent_t *mep;
+	size_t msize;
+	uint32_t i, h;
+
+	msize = sizeof (ctf_membhash_t) + sizeof (uint32_t) * vlen +
+	    sizeof (ctf_membent_t) * (vlen * 2 + 1);
+
+	if ((mhp = ctf_alloc(msize)) == NULL)
+		return (NULL);
+
+	bzero(mhp, msize);
+	mhp->cmh_size = msize;
+	mhp->cmh_nbuckets = vlen;
+	mhp->cmh_nelems = 1; /* we use index zero as a sentinel */
+	mhp->cmh_chains = (ctf_membent_t *)(mhp + 1);
+	mhp->cmh_anon = mhp->cmh_chains + vlen + 1;
+	mhp->cmh_buckets = (uint32_t *)(mhp->cmh_anon + vlen);
+
+	if (fp->ctf_version == CTF_VERSION_1 || size < CTF_LSTRUCT_THRESH) {
+		if (fp->ctf_version == CTF_VERSION_4) {
+			const ctf_member_t *mp = (const ctf_member_t *)
+			    ((uintptr_t)tp + increment);
+
+			for (i = 0; i < vlen; i++, mp++) {
+				ctf_membhash_add(mhp, mp->ctm_name,
+				    mp->ctm_type, mp->ctm_offset, i);
+			}
+		} else {
+			const ctf_member_v1_t *mp = (const ctf_member_v1_t *)
+			    ((uintptr_t)tp + increment);
+
+			for (i = 0; i < vlen; i++, mp++) {
+				ctf_membhash_add(mhp, mp->ctm_name,
+				    mp->ctm_type, mp->ctm_offset, i);
+			}
+		}
+	} else {
+		if (fp->ctf_version == CTF_VERSION_4) {
+			const ctf_lmember_t *lmp = (const ctf_lmember_t *)
+			    ((uintptr_t)tp + increment);
+
+			for (i = 0; i < vlen; i++, lmp++) {
+				ctf_membhash_add(mhp, lmp->ctlm_name,
+				    lmp->ctlm_type,
+				    (unsigned long)CTF_LMEM_OFFSET(lmp), i);
+			}
+		} else {
+			const ctf_lmember_v1_t *lmp = (const ctf_lmember_v1_t *)
+			    ((uintptr_t)tp + increment);
+
+			for (i = 0; i < vlen; i++, lmp++) {
+				ctf_membhash_add(mhp, lmp->ctlm_name,
+				    lmp->ctlm_type,
+				    (unsigned long)CTF_LMEM_OFFSET(lmp), i);
+			}
+		}
+	}
+
+	/*
+	 * Push the named members onto their chains from last to first, so
+	 * that each chain ends up in member order.
+	 */
+	for (i = mhp->cmh_nelems - 1; i != 0; i--) {
+		const char *str = ctf_strptr(fp, mhp->cmh_chains[i].cme_name);
+
+		mep = &mhp->cmh_chains[i];
+		mep->cme_hash = ctf_hash_compute(str, strlen(str));
+		h = mep->cme_hash % mhp->cmh_nbuckets;
+		mep->cme_next = mhp->cmh_buckets[h];
+		mhp->cmh_buckets[h] = i;
+	}
+
+	return (mhp);
+}
+
+/*
+ * Return the member name hash of the struct or union type, building it if
+ * needed, or NULL if the type is too small to be worth hashing or if we ran
+ * out of memory, in which case the caller scans the member list instead.
+ */
+static ctf_membhash_t *
+ctf_membhash_lookup(ctf_file_t *fp, ctf_id_t type, const void *tp,
+    ssize_t size, ssize_t increment)
+{
+	unsigned long index = LCTF_TYPE_TO_INDEX(fp, type);
+	size_t tsize = sizeof (ctf_membhash_t *) * (fp->ctf_typemax + 1);
+
+	if (LCTF_INFO_VLEN(fp, get_type_ctt_info(fp, tp)) < CTF_MEMBHASH_THRESH)
+		return (NULL);
+
+	if (fp->ctf_membhash == NULL) {
+		if ((fp->ctf_membhash = ctf_alloc(tsize)) == NULL)
+			return (NULL);
+		bzero(fp->ctf_membhash, tsize);
+	}
+
+	if (fp->ctf_membhash[index] == NULL) {
+		fp->ctf_membhash[index] =
+		    ctf_membhash_create(fp, tp, size, increment);
+	}
+
+	return (fp->ctf_membhash[index]);
+}
+
+void
+ctf_membhash_destroy(ctf_file_t *fp)
+{
+	ctf_membhash_t *mhp;
+	unsigned long i;
+
+	if (fp->ctf_membhash == NULL)
+		return;
+
+	for (i = 0; i <= fp->ctf_typemax; i++) {
+		if ((mhp = fp->ctf_membhash[i]) != NULL)
+			ctf_free(mhp, mhp->cmh_size);
+	}
+
+	ctf_free(fp->ctf_membhash,
+	    sizeof (ctf_membhash_t *) * (fp->ctf_typemax + 1));
+	fp->ctf_membhash = NULL;
+}
+
 static int
 _ctf_member_info(ctf_file_t *fp, ctf_id_t type, const char *name, unsigned long off,
     ctf_membinfo_t *mip)
 {
 	ctf_file_t *ofp = fp;
+	ctf_membhash_t *mhp;
+	const ctf_membent_t *mep = NULL;
 	const void *tp;
 	ssize_t size, increment;
-	uint32_t kind, n;
+	uint32_t kind, n, i;
 
 	if ((type = ctf_type_resolve(fp, type)) == CTF_ERR)
 		return (CTF_ERR); /* errno is set for us */
@@ -781,6 +944,45 @@ _ctf_member_info(ctf_file_t *fp, ctf_id_t type, const char *name, unsigned long
 	if (kind != CTF_K_STRUCT && kind != CTF_K_UNION)
 		return (ctf_set_errno(ofp, ECTF_NOTSOU));
 
+	/*
+	 * If the type has a member name hash, find the first member with this
+	 * name.  Members of the anonymous members that come before it still
+	 * take precedence, so recurse into those first.  The empty name can
+	 * only be matched by a scan, which compares it to anonymous members.
+	 */
+	if (name[0] != '\0' &&
+	    (mhp = ctf_membhash_lookup(fp, type, tp, size, increment)) != NULL) {
+		uint32_t h = ctf_hash_compute(name, strlen(name));
+
+		for (i = mhp->cmh_buckets[h % mhp->cmh_nbuckets]; i != 0;
+		    i = mep->cme_next) {
+			mep = &mhp->cmh_chains[i];
+			if (mep->cme_hash == h &&
+			    strcmp(ctf_strptr(fp, mep->cme_name), name) == 0)
+				break;
+		}
+
+		if (i == 0)
+			mep = NULL;
+
+		for (i = 0; i < mhp->cmh_nanon; i++) {
+			const ctf_membent_t *amp = &mhp->cmh_anon[i];
+
+			if (mep != NULL && amp->cme_index > mep->cme_index)
+				break;
+			if (_ctf_member_info(fp, amp->cme_type, name,
+			    amp->cme_offset + off, mip) == 0)
+				return (0);
+		}
+
+		if (mep == NULL)
+			return (ctf_set_errno(ofp, ECTF_NOMEMBNAM));
+
+		mip->ctm_type = mep->cme_type;
+		mip->ctm_offset = mep->cme_offset + off;
+		return (0);
+	}
+
 	if (fp->ctf_version == CTF_VERSION_1 || size < CTF_LSTRUCT_THRESH) {
 		if (fp->ctf_version == CTF_VERSION_4) {
 			const ctf_member_t *mp = (const ctf_member_t *)
@@ -820,7 +1022,7 @@ _ctf_member_info(ctf_file_t *fp, ctf_id_t type, const char *name, unsigned long
 
 			for (n = LCTF_INFO_VLEN(fp, get_type_ctt_info(fp, tp)); n != 0; n--, lmp++) {
 				if (lmp->ctlm_name == 0 &&
-					_ctf_member_info(fp, lmp->ctlm_name, name,
+					_ctf_member_info(fp, lmp->ctlm_type, name,
 					(unsigned long)CTF_LMEM_OFFSET(lmp) + off, mip) == 0)
 					return (0);
 				if (strcmp(ctf_strptr(fp, lmp->ctlm_name), name) == 0) {
@@ -836,7 +1038,7 @@ _ctf_member_info(ctf_file_t *fp, ctf_id_t type, const char *name, unsigned long
 
 			for (n = LCTF_INFO_VLEN(fp, get_type_ctt_info(fp, tp)); n != 0; n--, lmp++) {
 				if (lmp->ctlm_name == 0 &&
-					_ctf_member_info(fp, lmp->ctlm_name, name,
+					_ctf_member_info(fp, lmp->ctlm_type, name,
 					(unsigned long)CTF_LMEM_OFFSET(lmp) + off, mip) == 0)
 					return (0);
 				if (strcmp(ctf_strptr(fp, lmp->ctlm_name), name) == 0) {
@@ -64,11 +64,8 @@ dt_pid_create_entry_probe(struct ps_prochandle *P, dtrace_hdl_t *dtp,
 	ftp->ftps_noffs = 1;
 	ftp->ftps_offs[0] = 0;
 
-	if (ioctl(dtp->dt_ftfd, FASTTRAPIOC_MAKEPROBE, ftp) != 0) {
-		dt_dprintf("fasttrap probe creation ioctl failed: %s",
-		    strerror(errno));
-		return (dt_set_errno(dtp, errno));
-	}
+	if (dt_pid_makeprobe(dtp, ftp) != 0)
+		return (-1);
 
 	return (1);
 }
@@ -134,7 +131,8 @@ dt_pid_create_return_probe32(struct ps_prochandle *P, dtrace_hdl_t *dtp,
 	if ((ftp->ftps_arch_subinfo == 2) && (symp->st_value & 2))
 		text = text + 2;
 
-	if (Pread(P, text, symp->st_size, symp->st_value) != symp->st_size) {
+	if (dt_pid_read(P, dtp, text, symp->st_size, symp->st_value) !=
+	    symp->st_size) {
 		dt_dprintf("mr sparkle: Pread() failed");
 		free(allocated_text);
 		free(constants);
@@ -385,11 +383,8 @@ is_ret_thumb:
 	free(allocated_text);
 	free(constants);
 	if (ftp->ftps_noffs > 0) {
-		if (ioctl(dtp->dt_ftfd, FASTTRAPIOC_MAKEPROBE, ftp) != 0) {
-			dt_dprintf("fasttrap probe creation ioctl failed: %s",
-				strerror(errno));
-			return (dt_set_errno(dtp, errno));
-		}
+		if (dt_pid_makeprobe(dtp, ftp) != 0)
+			return (-1);
 	}
 
 	return (ftp->ftps_noffs);
@@ -419,7 +414,8 @@ dt_pid_create_return_probe64(struct ps_prochandle *P, dtrace_hdl_t *dtp,
 		return (DT_PROC_ERR);
 	}
 
-	if (Pread(P, text, symp->st_size, symp->st_value) != symp->st_size) {
+	if (dt_pid_read(P, dtp, text, symp->st_size, symp->st_value) !=
+	    symp->st_size) {
 		dt_dprintf("mr sparkle: Pread() failed");
 		free(text);
 		return (DT_PROC_ERR);
@@ -457,11 +453,8 @@ is_ret:
 
 	free(text);
 	if (ftp->ftps_noffs > 0) {
-		if (ioctl(dtp->dt_ftfd, FASTTRAPIOC_MAKEPROBE, ftp) != 0) {
-			dt_dprintf("fasttrap probe creation ioctl failed: %s",
-				strerror(errno));
-			return (dt_set_errno(dtp, errno));
-		}
+		if (dt_pid_makeprobe(dtp, ftp) != 0)
+			return (-1);
 	}
 
 	return (ftp->ftps_noffs);
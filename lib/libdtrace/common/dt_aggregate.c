@@ -33,11 +33,20 @@
 #include <errno.h>
 #include <unistd.h>
 #include <dt_impl.h>
+#include <dt_module.h>
 #include <assert.h>
 #include <alloca.h>
 #include <limits.h>
+#include <pthread.h>
 
-#define	DTRACE_AHASHSIZE	32779		/* big 'ol prime */
+#define	DTRACE_AHASHSIZE	1024		/* initial size; must be power of 2 */
+
+/*
+ * The aggregation hash is kept at most three-quarters full; an insertion that
+ * would exceed that load factor first doubles the size of the table.
+ */
+#define	DTRACE_AHASHFULL(hash)	\
+	(((hash)->dtah_nelems + 1) * 4 > (hash)->dtah_size * 3)
 
 /*
  * Because qsort(3C) does not allow an argument to be passed to a comparison
@@ -348,22 +357,14 @@ dt_aggregate_usym(dtrace_hdl_t *dtp, uint64_t *data)
 {
 	uint64_t pid = data[0];
 	uint64_t *pc = &data[1];
-	struct ps_prochandle *P;
-	GElf_Sym sym;
+	const dt_usym_t *dus;
 
 	if (dtp->dt_vector != NULL)
 		return;
 
-	if ((P = dt_proc_grab(dtp, pid, PGRAB_RDONLY | PGRAB_FORCE, 0)) == NULL)
-		return;
-
-	dt_proc_lock(dtp, P);
-
-	if (Plookup_by_addr(P, *pc, NULL, 0, &sym) == 0)
-		*pc = sym.st_value;
-
-	dt_proc_unlock(dtp, P);
-	dt_proc_release(dtp, P);
+	if ((dus = dt_proc_usym_lookup(dtp, pid, *pc)) != NULL &&
+	    (dus->dus_flags & DT_USYM_SYM))
+		*pc = dus->dus_sym.st_value;
 }
 
 static void
@@ -371,33 +372,25 @@ dt_aggregate_umod(dtrace_hdl_t *dtp, uint64_t *data)
 {
 	uint64_t pid = data[0];
 	uint64_t *pc = &data[1];
-	struct ps_prochandle *P;
-	prmap_t thread_local_map;
-	const prmap_t *map;
+	const dt_usym_t *dus;
 
 	if (dtp->dt_vector != NULL)
 		return;
 
-	if ((P = dt_proc_grab(dtp, pid, PGRAB_RDONLY | PGRAB_FORCE, 0)) == NULL)
-		return;
-
-	dt_proc_lock(dtp, P);
-
-	if ((map = Paddr_to_map(P, *pc, &thread_local_map)) != NULL)
-		*pc = map->pr_vaddr;
-
-	dt_proc_unlock(dtp, P);
-	dt_proc_release(dtp, P);
+	if ((dus = dt_proc_usym_lookup(dtp, pid, *pc)) != NULL &&
+	    (dus->dus_flags & DT_USYM_MAP))
+		*pc = dus->dus_vaddr;
 }
 
 static void
 dt_aggregate_sym(dtrace_hdl_t *dtp, uint64_t *data)
 {
-	GElf_Sym sym;
+	const dt_ksym_t *dks;
 	uint64_t *pc = data;
 
-	if (dtrace_lookup_by_addr(dtp, *pc, NULL, 0, &sym, NULL) == 0)
-		*pc = sym.st_value;
+	if ((dks = dt_module_lookup_ksym(dtp, *pc)) != NULL &&
+	    (dks->dks_flags & DT_KSYM_SYM))
+		*pc = dks->dks_sym.st_value;
 }
 
 static void
@@ -418,13 +411,8 @@ dt_aggregate_mod(dtrace_hdl_t *dtp, uint64_t *data)
 		return;
 	}
 
-	for (dmp = dt_list_next(&dtp->dt_modlist); dmp != NULL;
-	    dmp = dt_list_next(dmp)) {
-		if (*pc - dmp->dm_text_va < dmp->dm_text_size) {
-			*pc = dmp->dm_text_va;
-			return;
-		}
-	}
+	if ((dmp = dt_module_lookup_by_text(dtp, *pc)) != NULL)
+		*pc = dmp->dm_text_va;
 }
 
 static dtrace_aggvarid_t
@@ -448,58 +436,708 @@ dt_aggregate_aggvarid(dt_ahashent_t *ent)
 	return (agg->dtagd_varid);
 }
 
+#define	DT_AGGCHUNK_HDRSIZE	\
+	P2ROUNDUP(sizeof (dt_aggchunk_t), DT_AGGARENA_QUANTUM)
+
+#define	DT_AGGCHUNK_DATA(c)	((caddr_t)(c) + DT_AGGCHUNK_HDRSIZE)
+
+/*
+ * Shared chunks are aligned on their size, so that the chunk that a small
+ * block was carved from can be found from the address of the block.
+ */
+#define	DT_AGGCHUNK_OF(p)	((dt_aggchunk_t *)((uintptr_t)(p) & \
+	~((uintptr_t)DT_AGGARENA_CHUNKSIZE - 1)))
+
+#define	DT_AGGCHUNK_ISFULL(c)	((c)->dtac_free == NULL && \
+	(c)->dtac_size - (c)->dtac_used < (c)->dtac_class * DT_AGGARENA_QUANTUM)
+
+static void
+dt_aggchunk_insert(dt_aggchunk_t **list, dt_aggchunk_t *c)
+{
+	c->dtac_prev = NULL;
+
+	if ((c->dtac_next = *list) != NULL)
+		c->dtac_next->dtac_prev = c;
+
+	*list = c;
+}
+
+static void
+dt_aggchunk_remove(dt_aggchunk_t **list, dt_aggchunk_t *c)
+{
+	if (c->dtac_prev != NULL) {
+		c->dtac_prev->dtac_next = c->dtac_next;
+	} else {
+		assert(*list == c);
+		*list = c->dtac_next;
+	}
+
+	if (c->dtac_next != NULL)
+		c->dtac_next->dtac_prev = c->dtac_prev;
+}
+
+static void
+dt_aggchunk_splice(dt_aggchunk_t **list, dt_aggchunk_t *chunks)
+{
+	dt_aggchunk_t *c;
+
+	if (chunks == NULL)
+		return;
+
+	for (c = chunks; c->dtac_next != NULL; c = c->dtac_next)
+		continue;
+
+	if ((c->dtac_next = *list) != NULL)
+		c->dtac_next->dtac_prev = c;
+
+	*list = chunks;
+}
+
+static void
+dt_aggchunk_destroy(dt_aggchunk_t *c)
+{
+	dt_aggchunk_t *next;
+
+	for (; c != NULL; c = next) {
+		next = c->dtac_next;
+		free(c);
+	}
+}
+
+static void *
+dt_aggarena_alloc(dt_aggarena_t *arena, size_t size)
+{
+	size_t ndx = (size + DT_AGGARENA_QUANTUM - 1) / DT_AGGARENA_QUANTUM;
+	dt_aggchunk_t *c;
+	void *p;
+
+	assert(size != 0);
+
+	if (ndx >= DT_AGGARENA_NCLASS) {
+		/*
+		 * This is too large to share a chunk; give it its own.
+		 */
+		if ((c = malloc(DT_AGGCHUNK_HDRSIZE + size)) == NULL)
+			return (NULL);
+
+		c->dtac_size = c->dtac_used = size;
+		c->dtac_free = NULL;
+		c->dtac_class = 0;
+		c->dtac_nalloc = 1;
+		dt_aggchunk_insert(&arena->dtaa_large, c);
+
+		arena->dtaa_size += DT_AGGCHUNK_HDRSIZE + size;
+		arena->dtaa_nalloc++;
+
+		return (DT_AGGCHUNK_DATA(c));
+	}
+
+	if ((c = arena->dtaa_avail[ndx]) == NULL) {
+		if (posix_memalign((void **)&c, DT_AGGARENA_CHUNKSIZE,
+		    DT_AGGARENA_CHUNKSIZE) != 0)
+			return (NULL);
+
+		c->dtac_size = DT_AGGARENA_CHUNKSIZE - DT_AGGCHUNK_HDRSIZE;
+		c->dtac_used = 0;
+		c->dtac_free = NULL;
+		c->dtac_class = ndx;
+		c->dtac_nalloc = 0;
+		dt_aggchunk_insert(&arena->dtaa_avail[ndx], c);
+
+		arena->dtaa_size += DT_AGGARENA_CHUNKSIZE;
+	}
+
+	if ((p = c->dtac_free) != NULL) {
+		c->dtac_free = *(void **)p;
+	} else {
+		p = DT_AGGCHUNK_DATA(c) + c->dtac_used;
+		c->dtac_used += ndx * DT_AGGARENA_QUANTUM;
+	}
+
+	c->dtac_nalloc++;
+	arena->dtaa_nalloc++;
+
+	if (DT_AGGCHUNK_ISFULL(c)) {
+		dt_aggchunk_remove(&arena->dtaa_avail[ndx], c);
+		dt_aggchunk_insert(&arena->dtaa_full, c);
+	}
+
+	return (p);
+}
+
+static void
+dt_aggarena_destroy(dt_aggarena_t *arena)
+{
+	int i;
+
+	for (i = 0; i < DT_AGGARENA_NCLASS; i++)
+		dt_aggchunk_destroy(arena->dtaa_avail[i]);
+
+	dt_aggchunk_destroy(arena->dtaa_full);
+	dt_aggchunk_destroy(arena->dtaa_large);
+
+	bzero(arena, sizeof (dt_aggarena_t));
+}
+
+static void
+dt_aggarena_free(dt_aggarena_t *arena, void *p, size_t size)
+{
+	size_t ndx = (size + DT_AGGARENA_QUANTUM - 1) / DT_AGGARENA_QUANTUM;
+	dt_aggchunk_t *c;
+
+	assert(arena->dtaa_nalloc > 0);
+
+	if (--arena->dtaa_nalloc == 0) {
+		/*
+		 * That was the last block in use; release everything.
+		 */
+		dt_aggarena_destroy(arena);
+		return;
+	}
+
+	if (ndx >= DT_AGGARENA_NCLASS) {
+		c = (dt_aggchunk_t *)((caddr_t)p - DT_AGGCHUNK_HDRSIZE);
+		dt_aggchunk_remove(&arena->dtaa_large, c);
+		arena->dtaa_size -= DT_AGGCHUNK_HDRSIZE + c->dtac_size;
+		free(c);
+		return;
+	}
+
+	c = DT_AGGCHUNK_OF(p);
+	assert(c->dtac_class == ndx && c->dtac_nalloc > 0);
+
+	if (DT_AGGCHUNK_ISFULL(c)) {
+		dt_aggchunk_remove(&arena->dtaa_full, c);
+		dt_aggchunk_insert(&arena->dtaa_avail[ndx], c);
+	}
+
+	*(void **)p = c->dtac_free;
+	c->dtac_free = p;
+
+	if (--c->dtac_nalloc == 0 &&
+	    (c->dtac_prev != NULL || c->dtac_next != NULL)) {
+		/*
+		 * The chunk is empty, and isn't the only one of its size class
+		 * with room left; give it back.
+		 */
+		dt_aggchunk_remove(&arena->dtaa_avail[ndx], c);
+		arena->dtaa_size -= DT_AGGARENA_CHUNKSIZE;
+		free(c);
+	}
+}
+
+/*
+ * Move all of the chunks of one arena into another, leaving the source arena
+ * empty.
+ */
+static void
+dt_aggarena_adopt(dt_aggarena_t *dst, dt_aggarena_t *src)
+{
+	int i;
+
+	for (i = 0; i < DT_AGGARENA_NCLASS; i++)
+		dt_aggchunk_splice(&dst->dtaa_avail[i], src->dtaa_avail[i]);
+
+	dt_aggchunk_splice(&dst->dtaa_full, src->dtaa_full);
+	dt_aggchunk_splice(&dst->dtaa_large, src->dtaa_large);
+
+	dst->dtaa_nalloc += src->dtaa_nalloc;
+	dst->dtaa_size += src->dtaa_size;
+
+	bzero(src, sizeof (dt_aggarena_t));
+}
+
+static size_t
+dt_ahash_ndx(dt_ahash_t *hash, uint64_t hashval)
+{
+	/*
+	 * The table size is a power of two, so we mix the high bits of the
+	 * hash value into the low bits before masking it.
+	 */
+	hashval ^= hashval >> 33;
+	hashval *= 0xff51afd7ed558ccdULL;
+	hashval ^= hashval >> 33;
+
+	return (hashval & (hash->dtah_size - 1));
+}
+
+static void
+dt_ahash_place(dt_ahash_t *hash, dt_ahashent_t *h)
+{
+	size_t mask = hash->dtah_size - 1;
+	size_t ndx = dt_ahash_ndx(hash, h->dtahe_hashval);
+
+	while (hash->dtah_hash[ndx].dtahs_ent != NULL)
+		ndx = (ndx + 1) & mask;
+
+	hash->dtah_hash[ndx].dtahs_hashval = h->dtahe_hashval;
+	hash->dtah_hash[ndx].dtahs_ent = h;
+}
 
 static int
-dt_aggregate_snap_cpu(dtrace_hdl_t *dtp, processorid_t cpu)
+dt_ahash_resize(dt_ahash_t *hash, size_t size)
 {
-	dtrace_epid_t id;
-	uint64_t hashval;
-	size_t offs, roffs, size, ndx;
-	int i, j, rval;
-	caddr_t addr, data;
-	dtrace_recdesc_t *rec;
-	dt_aggregate_t *agp = &dtp->dt_aggregate;
-	dtrace_aggdesc_t *agg;
-	dt_ahash_t *hash = &agp->dtat_hash;
+	dt_ahashslot_t *old = hash->dtah_hash;
+	size_t i, osize = hash->dtah_size;
+
+	assert((size & (size - 1)) == 0 && size > hash->dtah_nelems);
+
+	if ((hash->dtah_hash = calloc(size, sizeof (dt_ahashslot_t))) == NULL) {
+		hash->dtah_hash = old;
+		return (-1);
+	}
+
+	hash->dtah_size = size;
+
+	for (i = 0; i < osize; i++) {
+		if (old[i].dtahs_ent != NULL)
+			dt_ahash_place(hash, old[i].dtahs_ent);
+	}
+
+	free(old);
+
+	return (0);
+}
+
+static int
+dt_ahash_insert(dt_ahash_t *hash, dt_ahashent_t *h)
+{
+	if (hash->dtah_hash == NULL &&
+	    dt_ahash_resize(hash, DTRACE_AHASHSIZE) != 0)
+		return (-1);
+
+	if (DTRACE_AHASHFULL(hash) &&
+	    dt_ahash_resize(hash, hash->dtah_size << 1) != 0)
+		return (-1);
+
+	dt_ahash_place(hash, h);
+	hash->dtah_nelems++;
+
+	if (hash->dtah_all != NULL)
+		hash->dtah_all->dtahe_prevall = h;
+
+	h->dtahe_prevall = NULL;
+	h->dtahe_nextall = hash->dtah_all;
+	hash->dtah_all = h;
+
+	return (0);
+}
+
+static void
+dt_ahash_remove(dt_ahash_t *hash, dt_ahashent_t *h)
+{
+	dt_ahashslot_t *slots = hash->dtah_hash;
+	size_t mask = hash->dtah_size - 1, i, j, home;
+
+	/*
+	 * First, find the slot that holds this entry and vacate it.  Because
+	 * the table is linearly probed without tombstones, any entries in the
+	 * run that follows must be shifted back if the vacated slot lies
+	 * between their home slot and their current slot.
+	 */
+	for (i = dt_ahash_ndx(hash, h->dtahe_hashval);
+	    slots[i].dtahs_ent != h; i = (i + 1) & mask)
+		assert(slots[i].dtahs_ent != NULL);
+
+	for (j = (i + 1) & mask; slots[j].dtahs_ent != NULL;
+	    j = (j + 1) & mask) {
+		home = dt_ahash_ndx(hash, slots[j].dtahs_hashval);
+
+		if (((j - home) & mask) < ((j - i) & mask))
+			continue;
+
+		slots[i] = slots[j];
+		i = j;
+	}
+
+	slots[i].dtahs_ent = NULL;
+	hash->dtah_nelems--;
+
+	/*
+	 * Now remove it from the list of all hash entries.
+	 */
+	if (h->dtahe_prevall != NULL) {
+		h->dtahe_prevall->dtahe_nextall = h->dtahe_nextall;
+	} else {
+		assert(hash->dtah_all == h);
+		hash->dtah_all = h->dtahe_nextall;
+	}
+
+	if (h->dtahe_nextall != NULL)
+		h->dtahe_nextall->dtahe_prevall = h->dtahe_prevall;
+}
+
+static dt_ahashent_t *
+dt_ahash_lookup(dt_ahash_t *hash, dtrace_aggdesc_t *agg, caddr_t addr,
+    uint64_t hashval)
+{
+	size_t ndx, roffs;
+	dt_ahashslot_t *slot;
 	dt_ahashent_t *h;
-	dtrace_bufdesc_t b = agp->dtat_buf, *buf = &b;
-	dtrace_aggdata_t *aggdata;
-	int flags = agp->dtat_flags;
+	dtrace_recdesc_t *rec;
+	caddr_t data;
+	int j;
 
-	buf->dtbd_cpu = cpu;
+	if (hash->dtah_hash == NULL)
+		return (NULL);
 
-	if (dt_ioctl(dtp, DTRACEIOC_AGGSNAP, buf) == -1) {
-		if (errno == ENOENT) {
-			/*
-			 * If that failed with ENOENT, it may be because the
-			 * CPU was unconfigured.  This is okay; we'll just
-			 * do nothing but return success.
-			 */
-			return (0);
+	for (ndx = dt_ahash_ndx(hash, hashval);
+	    (h = (slot = &hash->dtah_hash[ndx])->dtahs_ent) != NULL;
+	    ndx = (ndx + 1) & (hash->dtah_size - 1)) {
+		if (slot->dtahs_hashval != hashval)
+			continue;
+
+		if (h->dtahe_size != agg->dtagd_size)
+			continue;
+
+		data = h->dtahe_data.dtada_data;
+
+		for (j = 0; j < agg->dtagd_nrecs - 1; j++) {
+			rec = &agg->dtagd_rec[j];
+			roffs = rec->dtrd_offset;
+
+			if (bcmp(&addr[roffs], &data[roffs],
+			    rec->dtrd_size) != 0)
+				break;
 		}
 
-		return (dt_set_errno(dtp, errno));
+		if (j == agg->dtagd_nrecs - 1)
+			return (h);
 	}
 
-	if (buf->dtbd_drops != 0) {
-		if (dt_handle_cpudrop(dtp, cpu,
-		    DTRACEDROP_AGGREGATION, buf->dtbd_drops) == -1)
-			return (-1);
+	return (NULL);
+}
+
+/*
+ * Returns the size of the per-CPU data for an entry:  an array of max_cpus
+ * pointers followed by max_cpus copies of the value record.
+ */
+static size_t
+dt_aggregate_percpusize(dt_aggregate_t *agp, dtrace_aggdesc_t *agg)
+{
+	dtrace_recdesc_t *rec = &agg->dtagd_rec[agg->dtagd_nrecs - 1];
+	size_t size = P2ROUNDUP(rec->dtrd_size, sizeof (uint64_t));
+
+	return (agp->dtat_maxcpu * (sizeof (caddr_t) + size));
+}
+
+static void
+dt_aggregate_freeent(dt_aggregate_t *agp, dt_ahash_t *hash, dt_ahashent_t *h)
+{
+	dtrace_aggdata_t *aggdata = &h->dtahe_data;
+
+	if (aggdata->dtada_percpu != NULL) {
+		dt_aggarena_free(&hash->dtah_arena, aggdata->dtada_percpu,
+		    dt_aggregate_percpusize(agp, aggdata->dtada_desc));
 	}
 
-	if (buf->dtbd_size == 0)
-		return (0);
+	dt_aggarena_free(&hash->dtah_arena, h,
+	    sizeof (dt_ahashent_t) + h->dtahe_size);
+}
+
+/*
+ * Returns non-zero if any of the keys of the specified aggregation must be
+ * normalized by dt_aggregate_normalize() before the record can be hashed.
+ */
+static int
+dt_aggregate_neednormal(dtrace_aggdesc_t *agg)
+{
+	int j;
+
+	for (j = 0; j < agg->dtagd_nrecs - 1; j++) {
+		switch (agg->dtagd_rec[j].dtrd_action) {
+		case DTRACEACT_USTACK:
+		case DTRACEACT_USYM:
+		case DTRACEACT_UMOD:
+		case DTRACEACT_SYM:
+		case DTRACEACT_MOD:
+			return (1);
+
+		default:
+			break;
+		}
+	}
+
+	return (0);
+}
+
+static void
+dt_aggregate_normalize(dtrace_hdl_t *dtp, dtrace_aggdesc_t *agg, caddr_t addr)
+{
+	dtrace_recdesc_t *rec;
+	size_t roffs;
+	int j;
+
+	for (j = 0; j < agg->dtagd_nrecs - 1; j++) {
+		rec = &agg->dtagd_rec[j];
+		roffs = rec->dtrd_offset;
+
+		switch (rec->dtrd_action) {
+		case DTRACEACT_USTACK:
+			dt_aggregate_ustack(dtp,
+			    (uint64_t *)&addr[roffs]);
+			break;
+
+		case DTRACEACT_USYM:
+			dt_aggregate_usym(dtp,
+			    /* LINTED - alignment */
+			    (uint64_t *)&addr[roffs]);
+			break;
+
+		case DTRACEACT_UMOD:
+			dt_aggregate_umod(dtp,
+			    /* LINTED - alignment */
+			    (uint64_t *)&addr[roffs]);
+			break;
+
+		case DTRACEACT_SYM:
+			/* LINTED - alignment */
+			dt_aggregate_sym(dtp, (uint64_t *)&addr[roffs]);
+			break;
 
-	if (hash->dtah_hash == NULL) {
-		hash->dtah_size = DTRACE_AHASHSIZE;
-		size = hash->dtah_size * sizeof (dt_ahashent_t *);
+		case DTRACEACT_MOD:
+			/* LINTED - alignment */
+			dt_aggregate_mod(dtp, (uint64_t *)&addr[roffs]);
+			break;
 
-		if ((hash->dtah_hash = malloc(size)) == NULL)
-			return (dt_set_errno(dtp, EDT_NOMEM));
+		default:
+			break;
+		}
+	}
+}
+
+static uint64_t
+dt_aggregate_hash(dtrace_aggdesc_t *agg, caddr_t addr)
+{
+	dtrace_recdesc_t *rec;
+	uint64_t hashval = 0;
+	int j;
 
-		bzero(hash->dtah_hash, size);
+	for (j = 0; j < agg->dtagd_nrecs - 1; j++) {
+		rec = &agg->dtagd_rec[j];
+		hashval = dt_hash64(&addr[rec->dtrd_offset], rec->dtrd_size,
+		    hashval);
 	}
 
+	return (hashval);
+}
+
+/*
+ * Allocate a hash entry for the aggregation record at addr.  On success, the
+ * entry is returned in *hp; on failure, the error number is returned.  The
+ * caller is responsible for looking up the enabled probe description and the
+ * aggregation variable ID, both of which require access to the handle.
+ */
+static int
+dt_aggregate_newent(dtrace_hdl_t *dtp, dt_ahash_t *hash, dtrace_aggdesc_t *agg,
+    caddr_t addr, uint64_t hashval, dt_ahashent_t **hp)
+{
+	dtrace_recdesc_t *rec = &agg->dtagd_rec[agg->dtagd_nrecs - 1];
+	size_t size = agg->dtagd_size;
+	dtrace_aggdata_t *aggdata;
+	dt_ahashent_t *h;
+	void (*func)(int64_t *, int64_t *, size_t);
+
+	switch (rec->dtrd_action) {
+	case DTRACEAGG_MIN:
+		func = dt_aggregate_min;
+		break;
+
+	case DTRACEAGG_MAX:
+		func = dt_aggregate_max;
+		break;
+
+	case DTRACEAGG_LQUANTIZE:
+		func = dt_aggregate_lquantize;
+		break;
+
+	case DTRACEAGG_LLQUANTIZE:
+		func = dt_aggregate_llquantize;
+		break;
+
+	case DTRACEAGG_COUNT:
+	case DTRACEAGG_SUM:
+	case DTRACEAGG_AVG:
+	case DTRACEAGG_STDDEV:
+	case DTRACEAGG_QUANTIZE:
+		func = dt_aggregate_count;
+		break;
+
+	default:
+		return (EDT_BADAGG);
+	}
+
+	/*
+	 * The entry and its data are allocated together so that the key bytes
+	 * are adjacent to the entry that we compare.
+	 */
+	if ((h = dt_aggarena_alloc(&hash->dtah_arena,
+	    sizeof (dt_ahashent_t) + size)) == NULL)
+		return (EDT_NOMEM);
+
+	bzero(h, sizeof (dt_ahashent_t));
+	aggdata = &h->dtahe_data;
+	aggdata->dtada_data = (caddr_t)(h + 1);
+
+	bcopy(addr, aggdata->dtada_data, size);
+	aggdata->dtada_size = size;
+	aggdata->dtada_desc = agg;
+	aggdata->dtada_handle = dtp;
+	aggdata->dtada_normal = 1;
+
+	h->dtahe_hashval = hashval;
+	h->dtahe_gen = dtp->dt_aggregate.dtat_gen;
+	h->dtahe_size = size;
+	h->dtahe_aggregate = func;
+
+	*hp = h;
+
+	return (0);
+}
+
+/*
+ * Allocate the per-CPU data for an entry, initializing the data for the
+ * specified CPU from the entry's aggregated value and zeroing the rest.
+ */
+static int
+dt_aggregate_percpu(dt_aggregate_t *agp, dt_ahash_t *hash, dt_ahashent_t *h,
+    processorid_t cpu)
+{
+	dtrace_aggdata_t *aggdata = &h->dtahe_data;
+	dtrace_aggdesc_t *agg = aggdata->dtada_desc;
+	dtrace_recdesc_t *rec = &agg->dtagd_rec[agg->dtagd_nrecs - 1];
+	size_t size = P2ROUNDUP(rec->dtrd_size, sizeof (uint64_t));
+	int j, max_cpus = agp->dtat_maxcpu;
+	caddr_t *percpu, data;
+
+	if ((percpu = dt_aggarena_alloc(&hash->dtah_arena,
+	    dt_aggregate_percpusize(agp, agg))) == NULL)
+		return (EDT_NOMEM);
+
+	data = (caddr_t)&percpu[max_cpus];
+
+	for (j = 0; j < max_cpus; j++) {
+		percpu[j] = data + j * size;
+
+		if (j == cpu) {
+			bcopy(&aggdata->dtada_data[rec->dtrd_offset],
+			    percpu[j], rec->dtrd_size);
+		} else {
+			bzero(percpu[j], rec->dtrd_size);
+		}
+	}
+
+	aggdata->dtada_percpu = percpu;
+
+	return (0);
+}
+
+/*
+ * Apply the aggregating action for the record at addr to an existing entry,
+ * and to its data for the specified CPU if we're keeping per CPU data.
+ */
+static void
+dt_aggregate_apply(dt_ahashent_t *h, dtrace_aggdesc_t *agg, caddr_t addr,
+    processorid_t cpu)
+{
+	dtrace_aggdata_t *aggdata = &h->dtahe_data;
+	dtrace_recdesc_t *rec = &agg->dtagd_rec[agg->dtagd_nrecs - 1];
+	size_t roffs = rec->dtrd_offset;
+
+	/* LINTED - alignment */
+	h->dtahe_aggregate((int64_t *)&aggdata->dtada_data[roffs],
+	    /* LINTED - alignment */
+	    (int64_t *)&addr[roffs], rec->dtrd_size);
+
+	if (aggdata->dtada_percpu != NULL) {
+		/* LINTED - alignment */
+		h->dtahe_aggregate((int64_t *)aggdata->dtada_percpu[cpu],
+		    /* LINTED - alignment */
+		    (int64_t *)&addr[roffs], rec->dtrd_size);
+	}
+}
+
+/*
+ * When the "aggsnapthreads" option is set, the per-CPU aggregation buffers
+ * are snapshotted by a pool of worker threads.  Each worker repeatedly claims
+ * the next CPU, snapshots its buffer and reduces the records into a hash that
+ * is private to that CPU.  Once the workers are done, the consumer thread
+ * merges the private hashes into the aggregate in CPU order.  Because each
+ * private hash preserves the order in which its keys were first seen, the
+ * resulting aggregate -- including the order of dtah_all -- is the same as
+ * that built by snapshotting the CPUs one at a time.
+ *
+ * Workers stay away from the state shared through the handle.  They find the
+ * aggregation descriptions in a copy of dt_aggdesc[] that the consumer thread
+ * takes before starting them, and only take dtas_lock to describe an
+ * aggregation that is missing from it.  Everything else that needs the handle
+ * -- normalizing keys that hold symbols or stacks, and looking up the enabled
+ * probe description and variable ID of each entry -- is left to the consumer
+ * thread when it merges the private hashes.  A worker thus keeps keys that
+ * have yet to be normalized apart; they are combined by the merge, where the
+ * first of them still comes first.
+ */
+typedef struct dt_aggsnap_cpu {
+	dt_ahash_t dtasc_hash;		/* private hash for this CPU */
+	uint64_t dtasc_drops;		/* aggregation drops on this CPU */
+	int dtasc_claimed;		/* boolean: CPU claimed by a worker */
+	int dtasc_err;			/* error number from worker, if any */
+} dt_aggsnap_cpu_t;
+
+typedef struct dt_aggsnap {
+	dtrace_hdl_t *dtas_dtp;		/* pointer to libdtrace handle */
+	pthread_mutex_t dtas_lock;	/* lock for dtas_next and the handle */
+	dt_aggsnap_cpu_t *dtas_cpus;	/* per-CPU snapshot state */
+	int dtas_next;			/* index of next CPU to be claimed */
+	dtrace_aggdesc_t **dtas_aggs;	/* copy of dt_aggdesc[] */
+	dtrace_id_t dtas_naggs;		/* number of entries in dtas_aggs[] */
+} dt_aggsnap_t;
+
+/*
+ * Find the description of an aggregation from a worker thread, returning 0
+ * or an error number.
+ */
+static int
+dt_aggsnap_lookup(dt_aggsnap_t *snap, dtrace_aggid_t id,
+    dtrace_aggdesc_t **adp)
+{
+	dtrace_hdl_t *dtp = snap->dtas_dtp;
+	int err = 0;
+
+	if (id < snap->dtas_naggs && (*adp = snap->dtas_aggs[id]) != NULL)
+		return (0);
+
+	(void) pthread_mutex_lock(&snap->dtas_lock);
+
+	if (dt_aggid_lookup(dtp, id, adp) != 0)
+		err = dtp->dt_errno;
+
+	(void) pthread_mutex_unlock(&snap->dtas_lock);
+
+	return (err);
+}
+
+/*
+ * Aggregate the records in a snapshot of the specified CPU's aggregation
+ * buffer into the specified hash, returning 0 or an error number.  If snap is
+ * non-NULL, we are running on an aggregation snapshot worker thread, and the
+ * hash is private to the CPU:  its entries are completed by
+ * dt_aggregate_merge().
+ */
+static int
+dt_aggregate_snap_buf(dtrace_hdl_t *dtp, dtrace_bufdesc_t *buf,
+    processorid_t cpu, dt_ahash_t *hash, dt_aggsnap_t *snap)
+{
+	dt_aggregate_t *agp = &dtp->dt_aggregate;
+	dtrace_epid_t id;
+	dtrace_aggdesc_t *agg;
+	dt_ahashent_t *h;
+	dtrace_aggdata_t *aggdata;
+	uint64_t hashval;
+	size_t offs;
+	caddr_t addr;
+	int err;
+
 	for (offs = 0; offs < buf->dtbd_size; ) {
 		/*
 		 * We're guaranteed to have an ID.
@@ -516,208 +1154,334 @@ dt_aggregate_snap_cpu(dtrace_hdl_t *dtp, processorid_t cpu)
 			continue;
 		}
 
-		if ((rval = dt_aggid_lookup(dtp, id, &agg)) != 0)
-			return (rval);
+		addr = buf->dtbd_data + offs;
+
+		if (snap != NULL) {
+			if ((err = dt_aggsnap_lookup(snap, id, &agg)) != 0)
+				return (err);
+		} else {
+			if (dt_aggid_lookup(dtp, id, &agg) != 0)
+				return (dtp->dt_errno);
+
+			if (dt_aggregate_neednormal(agg))
+				dt_aggregate_normalize(dtp, agg, addr);
+		}
+
+		offs += agg->dtagd_size;
+
+		hashval = dt_aggregate_hash(agg, addr);
+
+		if ((h = dt_ahash_lookup(hash, agg, addr, hashval)) != NULL) {
+			/*
+			 * We found it.  Now we need to apply the aggregating
+			 * action on the data here.
+			 */
+			dt_aggregate_apply(h, agg, addr, cpu);
+			h->dtahe_gen = agp->dtat_gen;
+			continue;
+		}
+
+		/*
+		 * If we're here, we couldn't find an entry for this record.
+		 */
+		if ((err = dt_aggregate_newent(dtp, hash, agg, addr, hashval,
+		    &h)) != 0)
+			return (err);
+
+		if (snap == NULL) {
+			aggdata = &h->dtahe_data;
+
+			(void) dt_epid_lookup(dtp, agg->dtagd_epid,
+			    &aggdata->dtada_edesc, &aggdata->dtada_pdesc);
+			(void) dt_aggregate_aggvarid(h);
+
+			if ((agp->dtat_flags & DTRACE_A_PERCPU) &&
+			    (err = dt_aggregate_percpu(agp, hash, h,
+			    cpu)) != 0) {
+				dt_aggregate_freeent(agp, hash, h);
+				return (err);
+			}
+		}
+
+		if (dt_ahash_insert(hash, h) != 0) {
+			dt_aggregate_freeent(agp, hash, h);
+			return (EDT_NOMEM);
+		}
+	}
+
+	return (0);
+}
+
+static int
+dt_aggregate_snap_cpu(dtrace_hdl_t *dtp, processorid_t cpu)
+{
+	dt_aggregate_t *agp = &dtp->dt_aggregate;
+	dtrace_bufdesc_t b = agp->dtat_buf, *buf = &b;
+	int err;
+
+	buf->dtbd_cpu = cpu;
+
+	if (dt_ioctl(dtp, DTRACEIOC_AGGSNAP, buf) == -1) {
+		if (errno == ENOENT) {
+			/*
+			 * If that failed with ENOENT, it may be because the
+			 * CPU was unconfigured.  This is okay; we'll just
+			 * do nothing but return success.
+			 */
+			return (0);
+		}
+
+		return (dt_set_errno(dtp, errno));
+	}
+
+	if (buf->dtbd_drops != 0) {
+		if (dt_handle_cpudrop(dtp, cpu,
+		    DTRACEDROP_AGGREGATION, buf->dtbd_drops) == -1)
+			return (-1);
+	}
+
+	if (buf->dtbd_size == 0)
+		return (0);
 
-		addr = buf->dtbd_data + offs;
-		size = agg->dtagd_size;
-		hashval = 0;
+	if ((err = dt_aggregate_snap_buf(dtp, buf, cpu,
+	    &agp->dtat_hash, NULL)) != 0)
+		return (dt_set_errno(dtp, err));
 
-		for (j = 0; j < agg->dtagd_nrecs - 1; j++) {
-			rec = &agg->dtagd_rec[j];
-			roffs = rec->dtrd_offset;
+	return (0);
+}
 
-			switch (rec->dtrd_action) {
-			case DTRACEACT_USTACK:
-				dt_aggregate_ustack(dtp,
-				    (uint64_t *)&addr[roffs]);
-				break;
+static void *
+dt_aggregate_snap_worker(void *arg)
+{
+	dt_aggsnap_t *snap = arg;
+	dtrace_hdl_t *dtp = snap->dtas_dtp;
+	dt_aggregate_t *agp = &dtp->dt_aggregate;
+	dtrace_bufdesc_t buf;
+	dt_aggsnap_cpu_t *sc;
+	caddr_t data;
+	int i;
 
-			case DTRACEACT_USYM:
-				dt_aggregate_usym(dtp,
-				    /* LINTED - alignment */
-				    (uint64_t *)&addr[roffs]);
-				break;
+	/*
+	 * If we can't allocate a snapshot buffer, we simply don't claim any
+	 * CPUs; the consumer thread will snapshot any unclaimed CPUs itself.
+	 */
+	if ((data = malloc(agp->dtat_buf.dtbd_size)) == NULL)
+		return (NULL);
 
-			case DTRACEACT_UMOD:
-				dt_aggregate_umod(dtp,
-				    /* LINTED - alignment */
-				    (uint64_t *)&addr[roffs]);
-				break;
+	for (;;) {
+		(void) pthread_mutex_lock(&snap->dtas_lock);
+		i = snap->dtas_next++;
+		(void) pthread_mutex_unlock(&snap->dtas_lock);
 
-			case DTRACEACT_SYM:
-				/* LINTED - alignment */
-				dt_aggregate_sym(dtp, (uint64_t *)&addr[roffs]);
-				break;
+		if (i >= agp->dtat_ncpus)
+			break;
 
-			case DTRACEACT_MOD:
-				/* LINTED - alignment */
-				dt_aggregate_mod(dtp, (uint64_t *)&addr[roffs]);
-				break;
+		sc = &snap->dtas_cpus[i];
+		sc->dtasc_claimed = 1;
 
-			default:
-				break;
-			}
+		buf = agp->dtat_buf;
+		buf.dtbd_data = data;
+		buf.dtbd_cpu = agp->dtat_cpus[i];
 
-			for (i = 0; i < rec->dtrd_size; i++)
-				hashval += addr[roffs + i];
+		if (dt_ioctl(dtp, DTRACEIOC_AGGSNAP, &buf) == -1) {
+			if (errno != ENOENT)
+				sc->dtasc_err = errno;
+			continue;
 		}
 
-		ndx = hashval % hash->dtah_size;
-
-		for (h = hash->dtah_hash[ndx]; h != NULL; h = h->dtahe_next) {
-			if (h->dtahe_hashval != hashval)
-				continue;
+		sc->dtasc_drops = buf.dtbd_drops;
 
-			if (h->dtahe_size != size)
-				continue;
+		if (buf.dtbd_size == 0)
+			continue;
 
-			aggdata = &h->dtahe_data;
-			data = aggdata->dtada_data;
+		sc->dtasc_err = dt_aggregate_snap_buf(dtp, &buf,
+		    buf.dtbd_cpu, &sc->dtasc_hash, snap);
+	}
 
-			for (j = 0; j < agg->dtagd_nrecs - 1; j++) {
-				rec = &agg->dtagd_rec[j];
-				roffs = rec->dtrd_offset;
+	free(data);
 
-				for (i = 0; i < rec->dtrd_size; i++)
-					if (addr[roffs + i] != data[roffs + i])
-						goto hashnext;
-			}
+	return (NULL);
+}
 
-			/*
-			 * We found it.  Now we need to apply the aggregating
-			 * action on the data here.
-			 */
-			rec = &agg->dtagd_rec[agg->dtagd_nrecs - 1];
-			roffs = rec->dtrd_offset;
-			/* LINTED - alignment */
-			h->dtahe_aggregate((int64_t *)&data[roffs],
-			    /* LINTED - alignment */
-			    (int64_t *)&addr[roffs], rec->dtrd_size);
+/*
+ * Destroy a hash and all of its entries.  Everything is allocated from the
+ * hash's arena, so the entries needn't be visited individually.
+ */
+static void
+dt_ahash_destroy(dt_ahash_t *hash)
+{
+	dt_aggarena_destroy(&hash->dtah_arena);
+	free(hash->dtah_hash);
+	bzero(hash, sizeof (dt_ahash_t));
+}
 
-			/*
-			 * If we're keeping per CPU data, apply the aggregating
-			 * action there as well.
-			 */
-			if (aggdata->dtada_percpu != NULL) {
-				data = aggdata->dtada_percpu[cpu];
+/*
+ * Merge a CPU's private hash into the aggregate, consuming it.  This is where
+ * the keys of its entries are normalized, and where the entries that are new
+ * to the aggregate get their enabled probe description and variable ID.
+ */
+static int
+dt_aggregate_merge(dtrace_hdl_t *dtp, dt_ahash_t *part, processorid_t cpu)
+{
+	dt_aggregate_t *agp = &dtp->dt_aggregate;
+	dt_ahash_t *hash = &agp->dtat_hash;
+	dt_ahashent_t *h, *p, *prev;
+	dtrace_aggdesc_t *agg;
+	caddr_t addr;
+	int err = 0;
 
-				/* LINTED - alignment */
-				h->dtahe_aggregate((int64_t *)data,
-				    /* LINTED - alignment */
-				    (int64_t *)&addr[roffs], rec->dtrd_size);
-			}
+	/*
+	 * The private hash's storage becomes part of the aggregate's arena;
+	 * its entries are then either moved into the aggregate or freed.
+	 */
+	dt_aggarena_adopt(&hash->dtah_arena, &part->dtah_arena);
 
-			goto bufnext;
-hashnext:
-			continue;
+	/*
+	 * Entries are added to the head of dtah_all, so we walk the private
+	 * hash from its tail to add its keys in the order they were found.
+	 */
+	for (p = part->dtah_all; p != NULL && p->dtahe_nextall != NULL;
+	    p = p->dtahe_nextall)
+		continue;
+
+	for (; p != NULL; p = prev) {
+		prev = p->dtahe_prevall;
+		agg = p->dtahe_data.dtada_desc;
+		addr = p->dtahe_data.dtada_data;
+
+		if (dt_aggregate_neednormal(agg)) {
+			dt_aggregate_normalize(dtp, agg, addr);
+			p->dtahe_hashval = dt_aggregate_hash(agg, addr);
 		}
 
-		/*
-		 * If we're here, we couldn't find an entry for this record.
-		 */
-		if ((h = malloc(sizeof (dt_ahashent_t))) == NULL)
-			return (dt_set_errno(dtp, EDT_NOMEM));
-		bzero(h, sizeof (dt_ahashent_t));
-		aggdata = &h->dtahe_data;
-
-		if ((aggdata->dtada_data = malloc(size)) == NULL) {
-			free(h);
-			return (dt_set_errno(dtp, EDT_NOMEM));
+		if ((h = dt_ahash_lookup(hash, agg, addr,
+		    p->dtahe_hashval)) != NULL) {
+			dt_aggregate_apply(h, agg, addr, cpu);
+			h->dtahe_gen = p->dtahe_gen;
+			dt_aggregate_freeent(agp, hash, p);
+			continue;
 		}
 
-		bcopy(addr, aggdata->dtada_data, size);
-		aggdata->dtada_size = size;
-		aggdata->dtada_desc = agg;
-		aggdata->dtada_handle = dtp;
 		(void) dt_epid_lookup(dtp, agg->dtagd_epid,
-		    &aggdata->dtada_edesc, &aggdata->dtada_pdesc);
-		aggdata->dtada_normal = 1;
-
-		h->dtahe_hashval = hashval;
-		h->dtahe_size = size;
-		(void) dt_aggregate_aggvarid(h);
+		    &p->dtahe_data.dtada_edesc, &p->dtahe_data.dtada_pdesc);
+		(void) dt_aggregate_aggvarid(p);
 
-		rec = &agg->dtagd_rec[agg->dtagd_nrecs - 1];
+		if ((agp->dtat_flags & DTRACE_A_PERCPU) &&
+		    (err = dt_aggregate_percpu(agp, hash, p, cpu)) != 0)
+			break;
 
-		if (flags & DTRACE_A_PERCPU) {
-			int max_cpus = agp->dtat_maxcpu;
-			caddr_t *percpu = malloc(max_cpus * sizeof (caddr_t));
+		if (dt_ahash_insert(hash, p) != 0) {
+			err = EDT_NOMEM;
+			break;
+		}
+	}
 
-			if (percpu == NULL) {
-				free(aggdata->dtada_data);
-				free(h);
-				return (dt_set_errno(dtp, EDT_NOMEM));
-			}
+	/*
+	 * If we failed, free the entries that we didn't get to.
+	 */
+	for (; p != NULL; p = prev) {
+		prev = p->dtahe_prevall;
+		dt_aggregate_freeent(agp, hash, p);
+	}
 
-			for (j = 0; j < max_cpus; j++) {
-				percpu[j] = malloc(rec->dtrd_size);
+	free(part->dtah_hash);
+	bzero(part, sizeof (dt_ahash_t));
 
-				if (percpu[j] == NULL) {
-					while (--j >= 0)
-						free(percpu[j]);
+	return (err);
+}
 
-					free(aggdata->dtada_data);
-					free(h);
-					return (dt_set_errno(dtp, EDT_NOMEM));
-				}
+static int
+dt_aggregate_snap_parallel(dtrace_hdl_t *dtp, int nthreads)
+{
+	dt_aggregate_t *agp = &dtp->dt_aggregate;
+	dt_aggsnap_t snap;
+	dt_aggsnap_cpu_t *sc;
+	pthread_t *tids;
+	processorid_t cpu;
+	int i, nstarted, err, rval = 0;
+
+	bzero(&snap, sizeof (snap));
+	snap.dtas_dtp = dtp;
+	(void) pthread_mutex_init(&snap.dtas_lock, NULL);
+
+	snap.dtas_cpus = dt_zalloc(dtp,
+	    agp->dtat_ncpus * sizeof (dt_aggsnap_cpu_t));
+	tids = dt_alloc(dtp, nthreads * sizeof (pthread_t));
+
+	if (snap.dtas_cpus == NULL || tids == NULL) {
+		rval = -1;
+		goto out;
+	}
 
-				if (j == cpu) {
-					bcopy(&addr[rec->dtrd_offset],
-					    percpu[j], rec->dtrd_size);
-				} else {
-					bzero(percpu[j], rec->dtrd_size);
-				}
-			}
+	/*
+	 * The workers read the aggregation descriptions from a copy of
+	 * dt_aggdesc[], which a worker describing a new aggregation could
+	 * otherwise reallocate under the others.  The descriptions themselves
+	 * never move.
+	 */
+	if (dtp->dt_maxagg != 0) {
+		snap.dtas_aggs = dt_alloc(dtp,
+		    dtp->dt_maxagg * sizeof (dtrace_aggdesc_t *));
 
-			aggdata->dtada_percpu = percpu;
+		if (snap.dtas_aggs == NULL) {
+			rval = -1;
+			goto out;
 		}
 
-		switch (rec->dtrd_action) {
-		case DTRACEAGG_MIN:
-			h->dtahe_aggregate = dt_aggregate_min;
-			break;
-
-		case DTRACEAGG_MAX:
-			h->dtahe_aggregate = dt_aggregate_max;
-			break;
+		bcopy(dtp->dt_aggdesc, snap.dtas_aggs,
+		    dtp->dt_maxagg * sizeof (dtrace_aggdesc_t *));
+		snap.dtas_naggs = dtp->dt_maxagg;
+	}
 
-		case DTRACEAGG_LQUANTIZE:
-			h->dtahe_aggregate = dt_aggregate_lquantize;
+	for (nstarted = 0; nstarted < nthreads; nstarted++) {
+		if (pthread_create(&tids[nstarted], NULL,
+		    dt_aggregate_snap_worker, &snap) != 0)
 			break;
+	}
 
-		case DTRACEAGG_LLQUANTIZE:
-			h->dtahe_aggregate = dt_aggregate_llquantize;
-			break;
+	for (i = 0; i < nstarted; i++)
+		(void) pthread_join(tids[i], NULL);
 
-		case DTRACEAGG_COUNT:
-		case DTRACEAGG_SUM:
-		case DTRACEAGG_AVG:
-		case DTRACEAGG_STDDEV:
-		case DTRACEAGG_QUANTIZE:
-			h->dtahe_aggregate = dt_aggregate_count;
-			break;
+	for (i = 0; i < agp->dtat_ncpus; i++) {
+		sc = &snap.dtas_cpus[i];
+		cpu = agp->dtat_cpus[i];
 
-		default:
-			return (dt_set_errno(dtp, EDT_BADAGG));
+		if (!sc->dtasc_claimed) {
+			if ((rval = dt_aggregate_snap_cpu(dtp, cpu)) != 0)
+				break;
+			continue;
 		}
 
-		if (hash->dtah_hash[ndx] != NULL)
-			hash->dtah_hash[ndx]->dtahe_prev = h;
+		if (sc->dtasc_drops != 0 && dt_handle_cpudrop(dtp, cpu,
+		    DTRACEDROP_AGGREGATION, sc->dtasc_drops) == -1) {
+			rval = -1;
+			break;
+		}
 
-		h->dtahe_next = hash->dtah_hash[ndx];
-		hash->dtah_hash[ndx] = h;
+		if (sc->dtasc_err != 0) {
+			rval = dt_set_errno(dtp, sc->dtasc_err);
+			break;
+		}
 
-		if (hash->dtah_all != NULL)
-			hash->dtah_all->dtahe_prevall = h;
+		if ((err = dt_aggregate_merge(dtp, &sc->dtasc_hash,
+		    cpu)) != 0) {
+			rval = dt_set_errno(dtp, err);
+			break;
+		}
+	}
 
-		h->dtahe_nextall = hash->dtah_all;
-		hash->dtah_all = h;
-bufnext:
-		offs += agg->dtagd_size;
+out:
+	if (snap.dtas_cpus != NULL) {
+		for (i = 0; i < agp->dtat_ncpus; i++)
+			dt_ahash_destroy(&snap.dtas_cpus[i].dtasc_hash);
 	}
 
-	return (0);
+	(void) pthread_mutex_destroy(&snap.dtas_lock);
+	dt_free(dtp, snap.dtas_aggs);
+	dt_free(dtp, snap.dtas_cpus);
+	dt_free(dtp, tids);
+
+	return (rval);
 }
 
 int
@@ -727,6 +1491,7 @@ dtrace_aggregate_snap(dtrace_hdl_t *dtp)
 	dt_aggregate_t *agp = &dtp->dt_aggregate;
 	hrtime_t now = gethrtime();
 	dtrace_optval_t interval = dtp->dt_options[DTRACEOPT_AGGRATE];
+	int nthreads = MIN((int)dtp->dt_aggsnapthreads, agp->dtat_ncpus);
 
 	if (dtp->dt_lastagg != 0) {
 		if (now - dtp->dt_lastagg < interval)
@@ -743,6 +1508,15 @@ dtrace_aggregate_snap(dtrace_hdl_t *dtp)
 	if (agp->dtat_buf.dtbd_size == 0)
 		return (0);
 
+	/*
+	 * Every entry that this snapshot creates or changes is marked with
+	 * the new generation.
+	 */
+	agp->dtat_gen++;
+
+	if (nthreads > 1)
+		return (dt_aggregate_snap_parallel(dtp, nthreads));
+
 	for (i = 0; i < agp->dtat_ncpus; i++) {
 		if ((rval = dt_aggregate_snap_cpu(dtp, agp->dtat_cpus[i])))
 			return (rval);
@@ -1230,55 +2004,19 @@ dt_aggwalk_rval(dtrace_hdl_t *dtp, dt_ahashent_t *h, int rval)
 
 		return (0);
 
-	case DTRACE_AGGWALK_REMOVE: {
-		dtrace_aggdata_t *aggdata = &h->dtahe_data;
-		int max_cpus = agp->dtat_maxcpu;
-
-		/*
-		 * First, remove this hash entry from its hash chain.
-		 */
-		if (h->dtahe_prev != NULL) {
-			h->dtahe_prev->dtahe_next = h->dtahe_next;
-		} else {
-			dt_ahash_t *hash = &agp->dtat_hash;
-			size_t ndx = h->dtahe_hashval % hash->dtah_size;
-
-			assert(hash->dtah_hash[ndx] == h);
-			hash->dtah_hash[ndx] = h->dtahe_next;
-		}
-
-		if (h->dtahe_next != NULL)
-			h->dtahe_next->dtahe_prev = h->dtahe_prev;
-
+	case DTRACE_AGGWALK_REMOVE:
 		/*
-		 * Now remove it from the list of all hash entries.
+		 * First, remove this hash entry from the hash table and from
+		 * the list of all hash entries.
 		 */
-		if (h->dtahe_prevall != NULL) {
-			h->dtahe_prevall->dtahe_nextall = h->dtahe_nextall;
-		} else {
-			dt_ahash_t *hash = &agp->dtat_hash;
-
-			assert(hash->dtah_all == h);
-			hash->dtah_all = h->dtahe_nextall;
-		}
-
-		if (h->dtahe_nextall != NULL)
-			h->dtahe_nextall->dtahe_prevall = h->dtahe_prevall;
+		dt_ahash_remove(&agp->dtat_hash, h);
 
 		/*
 		 * We're unlinked.  We can safely destroy the data.
 		 */
-		if (aggdata->dtada_percpu != NULL) {
-			for (i = 0; i < max_cpus; i++)
-				free(aggdata->dtada_percpu[i]);
-			free(aggdata->dtada_percpu);
-		}
-
-		free(aggdata->dtada_data);
-		free(h);
+		dt_aggregate_freeent(agp, &agp->dtat_hash, h);
 
 		return (0);
-	}
 
 	default:
 		return (dt_set_errno(dtp, EDT_BADRVAL));
@@ -1318,6 +2056,35 @@ dt_aggregate_qsort(dtrace_hdl_t *dtp, void *base, size_t nel, size_t width,
 	dt_keypos = keypos;
 }
 
+int
+dtrace_aggregate_stat(dtrace_hdl_t *dtp, dtrace_aggstat_t *stat)
+{
+	dt_ahash_t *hash = &dtp->dt_aggregate.dtat_hash;
+	size_t i, mask = hash->dtah_size - 1, probe;
+
+	bzero(stat, sizeof (dtrace_aggstat_t));
+	stat->dtas_nentries = hash->dtah_nelems;
+	stat->dtas_nslots = hash->dtah_size;
+	stat->dtas_memsize = hash->dtah_arena.dtaa_size;
+
+	for (i = 0; i < hash->dtah_size; i++) {
+		if (hash->dtah_hash[i].dtahs_ent == NULL)
+			continue;
+
+		/*
+		 * The probe length of an entry is its distance from its home
+		 * slot, plus one for the home slot itself.
+		 */
+		probe = ((i - dt_ahash_ndx(hash,
+		    hash->dtah_hash[i].dtahs_hashval)) & mask) + 1;
+
+		if (probe > stat->dtas_maxprobe)
+			stat->dtas_maxprobe = probe;
+	}
+
+	return (0);
+}
+
 int
 dtrace_aggregate_walk(dtrace_hdl_t *dtp, dtrace_aggregate_f *func, void *arg)
 {
@@ -1339,6 +2106,86 @@ dtrace_aggregate_walk(dtrace_hdl_t *dtp, dtrace_aggregate_f *func, void *arg)
 	return (0);
 }
 
+/*
+ * Walk the entries that aggregation snapshots have created or changed since
+ * generation *genp, and set *genp to the current generation.  A consumer
+ * that starts with a generation of zero and always passes back the updated
+ * generation is handed each change exactly once.
+ */
+int
+dtrace_aggregate_walk_delta(dtrace_hdl_t *dtp, uint64_t *genp,
+    dtrace_aggregate_f *func, void *arg)
+{
+	dt_ahashent_t *h, *next;
+	dt_ahash_t *hash = &dtp->dt_aggregate.dtat_hash;
+	uint64_t gen = *genp;
+
+	for (h = hash->dtah_all; h != NULL; h = next) {
+		next = h->dtahe_nextall;
+
+		if (h->dtahe_gen <= gen)
+			continue;
+
+		if (dt_aggwalk_rval(dtp, h, func(&h->dtahe_data, arg)) == -1)
+			return (-1);
+	}
+
+	*genp = dtp->dt_aggregate.dtat_gen;
+
+	return (0);
+}
+
+/*
+ * In delta mode (the "aggdelta" option), the sorted and joined walks only visit
+ * the entries that have changed since their aggregation variable was last
+ * printed with printa().  A walk on behalf of a truncation must always see
+ * everything.
+ */
+static int
+dt_aggregate_changed(dt_aggregate_t *agp, dt_ahashent_t *h)
+{
+	dtrace_aggvarid_t id = h->dtahe_data.dtada_desc->dtagd_varid;
+
+	if (!(agp->dtat_flags & DTRACE_A_DELTA) ||
+	    (agp->dtat_flags & DTRACE_A_TRUNC))
+		return (1);
+
+	if (id < 0 || id >= agp->dtat_nprintgen)
+		return (1);
+
+	return (h->dtahe_gen > agp->dtat_printgen[id]);
+}
+
+void
+dt_aggregate_printed(dtrace_hdl_t *dtp, dtrace_aggvarid_t id)
+{
+	dt_aggregate_t *agp = &dtp->dt_aggregate;
+	dtrace_aggvarid_t n = agp->dtat_nprintgen;
+	uint64_t *printgen;
+
+	if (!(agp->dtat_flags & DTRACE_A_DELTA) || id < 0)
+		return;
+
+	if (id >= n) {
+		n = MAX(id + 1, n * 2);
+
+		/*
+		 * If we can't grow the array, we'll simply print every entry
+		 * of this variable the next time around.
+		 */
+		if ((printgen = realloc(agp->dtat_printgen,
+		    n * sizeof (uint64_t))) == NULL)
+			return;
+
+		bzero(&printgen[agp->dtat_nprintgen],
+		    (n - agp->dtat_nprintgen) * sizeof (uint64_t));
+		agp->dtat_printgen = printgen;
+		agp->dtat_nprintgen = n;
+	}
+
+	agp->dtat_printgen[id] = agp->dtat_gen;
+}
+
 static int
 dt_aggregate_total(dtrace_hdl_t *dtp, boolean_t clear)
 {
@@ -1564,6 +2411,64 @@ dt_aggregate_minmaxbin(dtrace_hdl_t *dtp, boolean_t clear)
 	return (0);
 }
 
+static void
+dt_aggregate_heapdown(dt_ahashent_t **heap, size_t n, size_t i,
+    int (*sfunc)(const void *, const void *))
+{
+	dt_ahashent_t *h;
+	size_t child;
+
+	while ((child = 2 * i + 1) < n) {
+		if (child + 1 < n && sfunc(&heap[child + 1], &heap[child]) > 0)
+			child++;
+
+		if (sfunc(&heap[child], &heap[i]) <= 0)
+			break;
+
+		h = heap[i];
+		heap[i] = heap[child];
+		heap[child] = h;
+		i = child;
+	}
+}
+
+/*
+ * Rearrange the specified entries such that the first k of them are the k
+ * entries that sort first with respect to sfunc, in sorted order; the
+ * remaining entries are left in no particular order.  The first k entries
+ * are kept in a heap with the entry that sorts last at its root, so this is
+ * O(n log k) rather than the O(n log n) of sorting all of the entries.
+ */
+static void
+dt_aggregate_topk(dt_ahashent_t **ents, size_t n, size_t k,
+    int (*sfunc)(const void *, const void *))
+{
+	dt_ahashent_t *h;
+	size_t i;
+
+	if (k == 0)
+		return;
+
+	if (k < n) {
+		for (i = k / 2; i-- > 0; )
+			dt_aggregate_heapdown(ents, k, i, sfunc);
+
+		for (i = k; i < n; i++) {
+			if (sfunc(&ents[i], &ents[0]) >= 0)
+				continue;
+
+			h = ents[0];
+			ents[0] = ents[i];
+			ents[i] = h;
+			dt_aggregate_heapdown(ents, k, 0, sfunc);
+		}
+	} else {
+		k = n;
+	}
+
+	qsort(ents, k, sizeof (dt_ahashent_t *), sfunc);
+}
+
 static int
 dt_aggregate_walk_sorted(dtrace_hdl_t *dtp,
     dtrace_aggregate_f *func, void *arg,
@@ -1572,7 +2477,7 @@ dt_aggregate_walk_sorted(dtrace_hdl_t *dtp,
 	dt_aggregate_t *agp = &dtp->dt_aggregate;
 	dt_ahashent_t *h, **sorted;
 	dt_ahash_t *hash = &agp->dtat_hash;
-	size_t i, nentries = 0;
+	size_t i, nentries = 0, ntrunc = 0;
 	int rval = -1;
 
 	agp->dtat_flags &= ~(DTRACE_A_TOTAL | DTRACE_A_MINMAXBIN);
@@ -1599,12 +2504,38 @@ dt_aggregate_walk_sorted(dtrace_hdl_t *dtp,
 	if (sorted == NULL)
 		goto out;
 
-	for (h = hash->dtah_all, i = 0; h != NULL; h = h->dtahe_nextall)
-		sorted[i++] = h;
+	for (h = hash->dtah_all, i = 0; h != NULL; h = h->dtahe_nextall) {
+		if (dt_aggregate_changed(agp, h))
+			sorted[i++] = h;
+	}
+
+	nentries = i;
 
 	(void) pthread_mutex_lock(&dt_qsort_lock);
 
-	if (sfunc == NULL) {
+	if (sfunc != NULL && (agp->dtat_flags & DTRACE_A_TRUNC)) {
+		/*
+		 * If we're walking on behalf of a truncation, the entries of
+		 * the truncated variable that are to be kept must be visited
+		 * in order and before the others of that variable; the order
+		 * of the remaining entries doesn't matter.  We move the
+		 * entries of the variable to the front and select the ones
+		 * to keep instead of sorting everything.
+		 */
+		for (i = 0; i < nentries; i++) {
+			h = sorted[i];
+
+			if (h->dtahe_data.dtada_desc->dtagd_varid !=
+			    agp->dtat_truncid)
+				continue;
+
+			sorted[i] = sorted[ntrunc];
+			sorted[ntrunc++] = h;
+		}
+
+		dt_aggregate_topk(sorted, ntrunc,
+		    MIN(agp->dtat_trunc, ntrunc), sfunc);
+	} else if (sfunc == NULL) {
 		dt_aggregate_qsort(dtp, sorted, nentries,
 				sizeof (dt_ahashent_t *), NULL);
 	} else {
@@ -2037,9 +2968,23 @@ dtrace_aggregate_walk_joined(dtrace_hdl_t *dtp, dtrace_aggvarid_t *aggvars,
 
 		/*
 		 * We have a bundle boundary.  Everything from start to
-		 * (i - 1) belongs in one bundle.
+		 * (i - 1) belongs in one bundle.  In delta mode, the bundle
+		 * is only visited if one of its entries has changed since its
+		 * variable was last printed; the others come along with it, so
+		 * that every column of the row is present.
 		 */
 		assert(i - start <= naggvars);
+
+		for (j = start; j < i; j++) {
+			if (dt_aggregate_changed(agp, sorted[j]))
+				break;
+		}
+
+		if (j == i) {
+			start = i;
+			continue;
+		}
+
 		bundlesize = (naggvars + 2) * sizeof (dt_ahashent_t *);
 
 		if ((nbundle = dt_zalloc(dtp, bundlesize)) == NULL) {
@@ -2200,35 +3145,13 @@ dt_aggregate_destroy(dtrace_hdl_t *dtp)
 {
 	dt_aggregate_t *agp = &dtp->dt_aggregate;
 	dt_ahash_t *hash = &agp->dtat_hash;
-	dt_ahashent_t *h, *next;
-	dtrace_aggdata_t *aggdata;
-	int i, max_cpus = agp->dtat_maxcpu;
 
-	if (hash->dtah_hash == NULL) {
+	if (hash->dtah_hash == NULL)
 		assert(hash->dtah_all == NULL);
-	} else {
-		free(hash->dtah_hash);
-
-		for (h = hash->dtah_all; h != NULL; h = next) {
-			next = h->dtahe_nextall;
-
-			aggdata = &h->dtahe_data;
-
-			if (aggdata->dtada_percpu != NULL) {
-				for (i = 0; i < max_cpus; i++)
-					free(aggdata->dtada_percpu[i]);
-				free(aggdata->dtada_percpu);
-			}
-
-			free(aggdata->dtada_data);
-			free(h);
-		}
-
-		hash->dtah_hash = NULL;
-		hash->dtah_all = NULL;
-		hash->dtah_size = 0;
-	}
+	else
+		dt_ahash_destroy(hash);
 
 	free(agp->dtat_buf.dtbd_data);
 	free(agp->dtat_cpus);
+	free(agp->dtat_printgen);
 }
@@ -261,6 +261,17 @@ dt_as(dt_pcb_t *pcb)
 		    dtp->dt_linkmode);
 	}
 
+	/*
+	 * Optimize the instruction list before assembling it, keeping count
+	 * of instructions before and after for the difstats option.
+	 */
+	pcb->pcb_asilen += dlp->dl_len;
+
+	if (!dtp->dt_nodifopt)
+		dt_difopt(pcb);
+
+	pcb->pcb_asolen += dlp->dl_len;
+
 	assert(pcb->pcb_difo == NULL);
 	pcb->pcb_difo = dt_zalloc(dtp, sizeof (dtrace_difo_t));
 
@@ -50,10 +50,20 @@ typedef struct dt_irlist {
 	uint_t dl_label;		/* next label number to assign */
 } dt_irlist_t;
 
+#define	DT_DOP_R1	0x01	/* reads the register in the r1 field */
+#define	DT_DOP_R2	0x02	/* reads the register in the r2 field */
+#define	DT_DOP_RS	0x04	/* reads the register in the rd field */
+#define	DT_DOP_RD	0x08	/* writes the register in the rd field */
+#define	DT_DOP_CCR	0x10	/* reads the condition codes */
+#define	DT_DOP_CCW	0x20	/* sets the condition codes */
+#define	DT_DOP_PURE	0x40	/* has no effect other than its result */
+#define	DT_DOP_OPAQUE	0x80	/* unknown to the optimizer */
+
 extern void dt_irlist_create(dt_irlist_t *);
 extern void dt_irlist_destroy(dt_irlist_t *);
 extern void dt_irlist_append(dt_irlist_t *, dt_irnode_t *);
 extern uint_t dt_irlist_label(dt_irlist_t *);
+extern uint_t dt_difopt_flags(const dt_irnode_t *);
 
 #ifdef	__cplusplus
 }
@@ -88,6 +88,7 @@
 
 #include <sys/dtrace.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 
 #include <assert.h>
@@ -100,6 +101,7 @@
 #include <limits.h>
 #include <ctype.h>
 #include <dirent.h>
+#include <fcntl.h>
 #include <dt_module.h>
 #include <dt_program.h>
 #include <dt_provider.h>
@@ -1763,6 +1765,8 @@ dt_compile_one_clause(dtrace_hdl_t *dtp, dt_node_t *cnp, dt_node_t *pnp)
 
 	assert(yypcb->pcb_ecbdesc == NULL);
 	yypcb->pcb_ecbdesc = edp;
+	yypcb->pcb_asilen = 0;
+	yypcb->pcb_asolen = 0;
 
 	if (cnp->dn_pred != NULL) {
 		dt_cg(yypcb, cnp->dn_pred);
@@ -1801,6 +1805,17 @@ dt_compile_one_clause(dtrace_hdl_t *dtp, dt_node_t *cnp, dt_node_t *pnp)
 	}
 
 	assert(yypcb->pcb_ecbdesc == edp);
+
+	if (dtp->dt_difstats) {
+		const dtrace_probedesc_t *pdp = pnp->dn_desc;
+
+		dt_dprintf("%s:%s:%s:%s (line %d): %u DIF instructions, "
+		    "%u before optimization",
+		    pdp->dtpd_provider, pdp->dtpd_mod, pdp->dtpd_func,
+		    pdp->dtpd_name, pnp->dn_line, yypcb->pcb_asolen,
+		    yypcb->pcb_asilen);
+	}
+
 	dt_ecbdesc_release(dtp, edp);
 	dt_endcontext(dtp);
 	yypcb->pcb_ecbdesc = NULL;
@@ -1989,9 +2004,188 @@ dt_reduce(dtrace_hdl_t *dtp, dt_version_t v)
 }
 
 /*
- * Fork and exec the cpp(1) preprocessor to run over the specified input file,
- * and return a FILE handle for the cpp output.  We use the /dev/fd filesystem
- * here to simplify the code by leveraging file descriptor inheritance.
+ * Fork and exec cpp(1) with the specified argument vector, which names its
+ * input and output files, and wait for it to exit.
+ */
+static int
+dt_cpp_exec(dtrace_hdl_t *dtp, char *const argv[])
+{
+	struct sigaction act, oact;
+	sigset_t mask, omask;
+
+	int wstat, estat;
+	pid_t pid;
+
+	/*
+	 * libdtrace must be able to be embedded in other programs that may
+	 * include application-specific signal handlers.  Therefore, if we
+	 * need to fork to run cpp(1), we must avoid generating a SIGCHLD
+	 * that could confuse the containing application.  To do this,
+	 * we block SIGCHLD and reset its disposition to SIG_DFL.
+	 * We restore our signal state once we are done.
+	 */
+	(void) sigemptyset(&mask);
+	(void) sigaddset(&mask, SIGCHLD);
+	(void) sigprocmask(SIG_BLOCK, &mask, &omask);
+
+	bzero(&act, sizeof (act));
+	act.sa_handler = SIG_DFL;
+	(void) sigaction(SIGCHLD, &act, &oact);
+
+	if ((pid = fork()) == -1) {
+		(void) sigaction(SIGCHLD, &oact, NULL);
+		(void) sigprocmask(SIG_SETMASK, &omask, NULL);
+		return (dt_set_errno(dtp, EDT_CPPFORK));
+	}
+
+	if (pid == 0) {
+		(void) execvp(dtp->dt_cpp_path, argv);
+		_exit(errno == ENOENT ? 127 : 126);
+	}
+
+	do {
+		dt_dprintf("waiting for %s (PID %d)", dtp->dt_cpp_path,
+		    (int)pid);
+	} while (waitpid(pid, &wstat, 0) == -1 && errno == EINTR);
+
+	(void) sigaction(SIGCHLD, &oact, NULL);
+	(void) sigprocmask(SIG_SETMASK, &omask, NULL);
+
+	dt_dprintf("%s returned exit status 0x%x", dtp->dt_cpp_path, wstat);
+	estat = WIFEXITED(wstat) ? WEXITSTATUS(wstat) : -1;
+
+	switch (estat) {
+	case 0:
+		return (0);
+	case 126:
+		return (dt_set_errno(dtp, EDT_CPPEXEC));
+	case 127:
+		return (dt_set_errno(dtp, EDT_CPPENT));
+	default:
+		return (dt_set_errno(dtp, EDT_CPPERR));
+	}
+}
+
+/*
+ * Return the in-process preprocessor for the current cpp(1) arguments, or NULL
+ * if we have to run cpp(1) itself, as we always do unless the "cppinproc"
+ * option is set.  The macros that cpp(1) predefines for these arguments are
+ * obtained by running it once with -dM, so that the arguments only cost one
+ * fork and exec for as long as they don't change.  If anything goes wrong, we
+ * remember that until they do.
+ */
+static dt_pp_t *
+dt_preproc_pp(dtrace_hdl_t *dtp)
+{
+	int argc = dtp->dt_cpp_argc, err = dtp->dt_errno, i;
+	char **argv = NULL, *args, *buf = NULL, opath[20];
+	FILE *ofp = NULL;
+	dt_pp_t *pp = NULL;
+	size_t len = 0;
+	long size;
+
+	if (!dtp->dt_cppinproc || dtp->dt_cppexec ||
+	    strcmp(dtp->dt_cpp_path, _dtrace_defcpp) != 0)
+		return (NULL);
+
+	for (i = 1; i < argc; i++)
+		len += strlen(dtp->dt_cpp_argv[i]) + 1;
+
+	if ((args = malloc(len + 1)) == NULL)
+		return (NULL);
+
+	for (args[0] = '\0', i = 1; i < argc; i++) {
+		(void) strcat(args, dtp->dt_cpp_argv[i]);
+		(void) strcat(args, "\n");
+	}
+
+	if (dtp->dt_pp_args != NULL && strcmp(args, dtp->dt_pp_args) == 0) {
+		free(args);
+		return (dtp->dt_pp);
+	}
+
+	dt_pp_destroy(dtp->dt_pp);
+	free(dtp->dt_pp_args);
+	dtp->dt_pp = NULL;
+	dtp->dt_pp_args = args;
+
+	if ((pp = dt_pp_create(dtp, argc, dtp->dt_cpp_argv)) == NULL ||
+	    (argv = malloc(sizeof (char *) * (argc + 5))) == NULL ||
+	    (ofp = tmpfile()) == NULL)
+		goto err;
+
+	(void) snprintf(opath, sizeof (opath), "/dev/fd/%d", fileno(ofp));
+
+	bcopy(dtp->dt_cpp_argv, argv, sizeof (char *) * argc);
+	argv[argc++] = "-dM";
+	argv[argc++] = "-o";
+	argv[argc++] = opath;
+	argv[argc++] = "/dev/null";
+	argv[argc] = NULL;
+
+	if (dt_cpp_exec(dtp, argv) != 0 || fseek(ofp, 0, SEEK_END) == -1 ||
+	    (size = ftell(ofp)) == -1 || fseek(ofp, 0, SEEK_SET) == -1 ||
+	    (buf = malloc(size + 1)) == NULL ||
+	    fread(buf, 1, size, ofp) != (size_t)size ||
+	    dt_pp_predefine(pp, buf, size) != 0)
+		goto err;
+
+	free(buf);
+	free(argv);
+	(void) fclose(ofp);
+
+	dtp->dt_pp = pp;
+	return (pp);
+
+err:
+	dt_dprintf("using %s to preprocess programs", dtp->dt_cpp_path);
+	dtp->dt_errno = err;
+	dt_pp_destroy(pp);
+	free(buf);
+	free(argv);
+	if (ofp != NULL)
+		(void) fclose(ofp);
+	return (NULL);
+}
+
+/*
+ * The output of the in-process preprocessor is returned as a read-only FILE
+ * over its buffer, which is freed when the FILE is closed.
+ */
+typedef struct dt_ppout {
+	char *dpo_buf;		/* preprocessed program */
+	size_t dpo_len;		/* length of dpo_buf */
+	size_t dpo_off;		/* offset of next read */
+} dt_ppout_t;
+
+static int
+dt_ppout_read(void *arg, char *buf, int n)
+{
+	dt_ppout_t *dpo = arg;
+
+	n = MIN((size_t)n, dpo->dpo_len - dpo->dpo_off);
+	bcopy(dpo->dpo_buf + dpo->dpo_off, buf, n);
+	dpo->dpo_off += n;
+
+	return (n);
+}
+
+static int
+dt_ppout_close(void *arg)
+{
+	dt_ppout_t *dpo = arg;
+
+	free(dpo->dpo_buf);
+	free(dpo);
+
+	return (0);
+}
+
+/*
+ * Run the C preprocessor over the specified input file, and return a FILE
+ * handle for its output.  Unless the in-process preprocessor is enabled and
+ * can handle the program, we fork and exec cpp(1), using the /dev/fd
+ * filesystem to simplify the code by leveraging file descriptor inheritance.
  */
 static FILE *
 dt_preproc(dtrace_hdl_t *dtp, FILE *ifp)
@@ -1999,28 +2193,21 @@ dt_preproc(dtrace_hdl_t *dtp, FILE *ifp)
 	int argc = dtp->dt_cpp_argc;
 	// We use clang -E and thus need to pass -o as well
 	// We do not define __STDC__, clang does that for us, so one less arg
-	char **argv = malloc(sizeof (char *) * (argc + 5));
-	FILE *tfp = tmpfile();
-	FILE *ofp = tmpfile();
+	char **argv = NULL;
+	FILE *tfp = NULL;
+	FILE *ofp = NULL;
+	FILE *mfp;
 
 	char ipath[20], opath[20]; /* big enough for /dev/fd/ + INT_MAX + \0 */
 	char verdef[32]; /* big enough for -D__SUNW_D_VERSION=0x%08x + \0 */
-	char* cpyln;
+	char *cpyln, *buf = NULL;
+	dt_ppout_t *dpo;
+	dt_pp_t *pp;
 
-	struct sigaction act, oact;
-	sigset_t mask, omask;
-
-	int wstat, estat;
-	pid_t pid;
-	size_t len;
+	size_t len, size;
 	off64_t off;
 	int c;
 
-	if (argv == NULL || ofp == NULL || tfp == NULL) {
-		(void) dt_set_errno(dtp, errno);
-		goto err;
-	}
-
 	/*
 	 * If the input is a seekable file, see if it is an interpreter file.
 	 * If we see #!, seek past the first line because cpp will choke on it.
@@ -2045,17 +2232,60 @@ dt_preproc(dtrace_hdl_t *dtp, FILE *ifp)
 	 * we can't provide it with a seek pointer. To workaround
 	 * it, we copy the file without the shebang.
 	 */
+	if ((mfp = open_memstream(&buf, &size)) == NULL) {
+		(void) dt_set_errno(dtp, errno);
+		return (NULL);
+	}
+
 	while ((cpyln = fgetln(ifp, &len)) != NULL) {
-		if (fwrite(cpyln, sizeof(char), len, tfp) != len) {
+		if (fwrite(cpyln, sizeof(char), len, mfp) != len) {
 			(void) dt_set_errno(dtp, errno);
+			(void) fclose(mfp);
 			goto err;
 		}
 	}
 
+	if (fclose(mfp) == EOF) {
+		(void) dt_set_errno(dtp, errno);
+		goto err;
+	}
+
+	(void) fseeko(ifp, off, SEEK_SET);
+
+	(void) snprintf(ipath, sizeof (ipath), "/dev/fd/%d", fileno(ifp));
+
+	if ((pp = dt_preproc_pp(dtp)) != NULL &&
+	    (dpo = malloc(sizeof (dt_ppout_t))) != NULL) {
+		bzero(dpo, sizeof (dt_ppout_t));
+
+		if ((mfp = open_memstream(&dpo->dpo_buf,
+		    &dpo->dpo_len)) != NULL) {
+			c = dt_pp_run(pp, ipath, buf, size, dtp->dt_vmax, mfp);
+
+			if (fclose(mfp) == 0 && c == 0 && (ofp = funopen(dpo,
+			    dt_ppout_read, NULL, NULL, dt_ppout_close)) != NULL) {
+				free(buf);
+				return (ofp);
+			}
+		}
+
+		free(dpo->dpo_buf);
+		free(dpo);
+	}
+
+	argv = malloc(sizeof (char *) * (argc + 5));
+	tfp = tmpfile();
+	ofp = tmpfile();
+
+	if (argv == NULL || ofp == NULL || tfp == NULL ||
+	    fwrite(buf, sizeof(char), size, tfp) != size) {
+		(void) dt_set_errno(dtp, errno);
+		goto err;
+	}
+
 	(void) fflush(tfp);
 	(void) clearerr(tfp);
 	(void) fseeko(tfp, 0, SEEK_SET);
-	(void) fseeko(ifp, off, SEEK_SET);
 
 	(void) snprintf(ipath, sizeof (ipath), "/dev/fd/%d", fileno(tfp));
 	(void) snprintf(opath, sizeof (opath), "/dev/fd/%d", fileno(ofp));
@@ -2071,59 +2301,10 @@ dt_preproc(dtrace_hdl_t *dtp, FILE *ifp)
 	argv[argc++] = ipath;
 	argv[argc] = NULL;
 
-	/*
-	 * libdtrace must be able to be embedded in other programs that may
-	 * include application-specific signal handlers.  Therefore, if we
-	 * need to fork to run cpp(1), we must avoid generating a SIGCHLD
-	 * that could confuse the containing application.  To do this,
-	 * we block SIGCHLD and reset its disposition to SIG_DFL.
-	 * We restore our signal state once we are done.
-	 */
-	(void) sigemptyset(&mask);
-	(void) sigaddset(&mask, SIGCHLD);
-	(void) sigprocmask(SIG_BLOCK, &mask, &omask);
-
-	bzero(&act, sizeof (act));
-	act.sa_handler = SIG_DFL;
-	(void) sigaction(SIGCHLD, &act, &oact);
-
-	if ((pid = fork()) == -1) {
-		(void) sigaction(SIGCHLD, &oact, NULL);
-		(void) sigprocmask(SIG_SETMASK, &omask, NULL);
-		(void) dt_set_errno(dtp, EDT_CPPFORK);
-		goto err;
-	}
-
-	if (pid == 0) {
-		(void) execvp(dtp->dt_cpp_path, argv);
-		_exit(errno == ENOENT ? 127 : 126);
-	}
-
-	do {
-		dt_dprintf("waiting for %s (PID %d)", dtp->dt_cpp_path,
-		    (int)pid);
-	} while (waitpid(pid, &wstat, 0) == -1 && errno == EINTR);
-
-	(void) sigaction(SIGCHLD, &oact, NULL);
-	(void) sigprocmask(SIG_SETMASK, &omask, NULL);
-
-	dt_dprintf("%s returned exit status 0x%x", dtp->dt_cpp_path, wstat);
-	estat = WIFEXITED(wstat) ? WEXITSTATUS(wstat) : -1;
-
-	if (estat != 0) {
-		switch (estat) {
-		case 126:
-			(void) dt_set_errno(dtp, EDT_CPPEXEC);
-			break;
-		case 127:
-			(void) dt_set_errno(dtp, EDT_CPPENT);
-			break;
-		default:
-			(void) dt_set_errno(dtp, EDT_CPPERR);
-		}
+	if (dt_cpp_exec(dtp, argv) != 0)
 		goto err;
-	}
 
+	free(buf);
 	free(argv);
 	(void) fclose(tfp);
 	(void) fflush(ofp);
@@ -2131,9 +2312,12 @@ dt_preproc(dtrace_hdl_t *dtp, FILE *ifp)
 	return (ofp);
 
 err:
+	free(buf);
 	free(argv);
-	(void) fclose(tfp);
-	(void) fclose(ofp);
+	if (tfp != NULL)
+		(void) fclose(tfp);
+	if (ofp != NULL)
+		(void) fclose(ofp);
 	return (NULL);
 }
 
@@ -2356,6 +2540,7 @@ dt_lib_depend_free(dtrace_hdl_t *dtp)
 	while ((dld = dt_list_next(&dtp->dt_lib_dep)) != NULL) {
 		while ((dlda = dt_list_next(&dld->dtld_dependencies)) != NULL) {
 			dt_list_delete(&dld->dtld_dependencies, dlda);
+			dt_free(dtp, dlda->dtld_name);
 			dt_free(dtp, dlda->dtld_library);
 			dt_free(dtp, dlda->dtld_libpath);
 			dt_free(dtp, dlda);
@@ -2380,6 +2565,386 @@ dt_lib_depend_free(dtrace_hdl_t *dtp)
 }
 
 
+/*
+ * The library dependencies found by the control line scan of each library in
+ * dt_load_libs_dir() are a function of the contents of that library alone, so
+ * we remember them across invocations in a per-user cache file, keyed on the
+ * identity, size and modification time of the library.  We cache the names
+ * given to #pragma D depends_on rather than the libraries they resolved to,
+ * and resolve them again on every use, so that a cache entry is valid for any
+ * library path.  The file is only trusted if it is owned by our effective
+ * user and cannot be written by anyone else.
+ */
+#define	DT_LIBCACHE_FILE	"com.apple.dtrace.libdeps"
+#define	DT_LIBCACHE_MAGIC	"dtrace-libdeps"
+#define	DT_LIBCACHE_MAXDEPS	1024
+
+typedef struct dt_libcache_ent {
+	dt_list_t dlce_list;		/* linked-list forward/back pointers */
+	char *dlce_library;		/* library pathname */
+	uint64_t dlce_dev;		/* device of library */
+	uint64_t dlce_ino;		/* inode number of library */
+	uint64_t dlce_size;		/* size of library */
+	uint64_t dlce_mtime;		/* modification time of library (ns) */
+	uint_t dlce_ndeps;		/* number of dependencies */
+	char **dlce_deps;		/* names of dependencies */
+	int dlce_used;			/* boolean: entry used by this scan */
+} dt_libcache_ent_t;
+
+typedef struct dt_libcache {
+	dt_list_t dlc_ents;		/* list of cache entries */
+	char dlc_path[PATH_MAX];	/* pathname of cache file, or "" */
+	int dlc_dirty;			/* boolean: cache file needs update */
+} dt_libcache_t;
+
+static uint64_t
+dt_libcache_mtime(const struct stat *st)
+{
+	return ((uint64_t)st->st_mtimespec.tv_sec * NANOSEC +
+	    st->st_mtimespec.tv_nsec);
+}
+
+static void
+dt_libcache_ent_free(dtrace_hdl_t *dtp, dt_libcache_ent_t *dce)
+{
+	uint_t i;
+
+	if (dce->dlce_deps != NULL) {
+		for (i = 0; i < dce->dlce_ndeps; i++)
+			dt_free(dtp, dce->dlce_deps[i]);
+		dt_free(dtp, dce->dlce_deps);
+	}
+
+	dt_free(dtp, dce->dlce_library);
+	dt_free(dtp, dce);
+}
+
+static dt_libcache_ent_t *
+dt_libcache_ent_create(dtrace_hdl_t *dtp, const char *library, uint_t ndeps)
+{
+	dt_libcache_ent_t *dce;
+
+	if ((dce = dt_zalloc(dtp, sizeof (dt_libcache_ent_t))) == NULL)
+		return (NULL);
+
+	dce->dlce_ndeps = ndeps;
+
+	if ((dce->dlce_library = strdup(library)) == NULL ||
+	    (dce->dlce_deps = dt_zalloc(dtp,
+	    (ndeps + 1) * sizeof (char *))) == NULL) {
+		dt_libcache_ent_free(dtp, dce);
+		return (NULL);
+	}
+
+	return (dce);
+}
+
+static dt_libcache_ent_t *
+dt_libcache_lookup(dt_libcache_t *dlc, const char *library)
+{
+	dt_libcache_ent_t *dce;
+
+	for (dce = dt_list_next(&dlc->dlc_ents); dce != NULL;
+	    dce = dt_list_next(dce)) {
+		if (strcmp(dce->dlce_library, library) == 0)
+			return (dce);
+	}
+
+	return (NULL);
+}
+
+/*
+ * Read the cache file, if there is one we can trust.  Any failure simply
+ * leaves us with fewer entries, as every library can still be scanned.
+ */
+static void
+dt_libcache_load(dtrace_hdl_t *dtp, dt_libcache_t *dlc)
+{
+	char buf[PATH_MAX + 128], hdr[128];
+	unsigned long long dev, ino, size, mtime;
+	dt_libcache_ent_t *dce;
+	struct stat st;
+	uint_t i, ndeps;
+	size_t len;
+	FILE *fp;
+	int fd, n;
+
+	bzero(dlc, sizeof (dt_libcache_t));
+
+	if (dtp->dt_nolibcache)
+		return;
+
+	len = confstr(_CS_DARWIN_USER_CACHE_DIR,
+	    dlc->dlc_path, sizeof (dlc->dlc_path));
+
+	if (len == 0 || len > sizeof (dlc->dlc_path) ||
+	    strlcat(dlc->dlc_path, DT_LIBCACHE_FILE,
+	    sizeof (dlc->dlc_path)) >= sizeof (dlc->dlc_path)) {
+		dlc->dlc_path[0] = '\0';
+		return;
+	}
+
+	if ((fd = open(dlc->dlc_path, O_RDONLY | O_NOFOLLOW)) == -1)
+		return;
+
+	if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) ||
+	    st.st_uid != geteuid() || (st.st_mode & (S_IWGRP | S_IWOTH))) {
+		dt_dprintf("ignoring library cache %s", dlc->dlc_path);
+		(void) close(fd);
+		return;
+	}
+
+	if ((fp = fdopen(fd, "r")) == NULL) {
+		(void) close(fd);
+		return;
+	}
+
+	(void) snprintf(hdr, sizeof (hdr), "%s %s\n",
+	    DT_LIBCACHE_MAGIC, _dtrace_version);
+
+	if (fgets(buf, sizeof (buf), fp) == NULL || strcmp(buf, hdr) != 0)
+		goto out;
+
+	while (fgets(buf, sizeof (buf), fp) != NULL) {
+		if ((len = strlen(buf)) == 0 || buf[len - 1] != '\n')
+			break;
+
+		buf[len - 1] = '\0';
+		n = 0;
+
+		if (sscanf(buf, "%llu %llu %llu %llu %u %n", &dev, &ino,
+		    &size, &mtime, &ndeps, &n) != 5 || n == 0 ||
+		    buf[n] != '/' || ndeps > DT_LIBCACHE_MAXDEPS ||
+		    dt_libcache_lookup(dlc, &buf[n]) != NULL)
+			break;
+
+		if ((dce = dt_libcache_ent_create(dtp, &buf[n], ndeps)) == NULL)
+			break;
+
+		dce->dlce_dev = dev;
+		dce->dlce_ino = ino;
+		dce->dlce_size = size;
+		dce->dlce_mtime = mtime;
+
+		for (i = 0; i < ndeps; i++) {
+			if (fgets(buf, sizeof (buf), fp) == NULL ||
+			    (len = strlen(buf)) <= 1 || buf[len - 1] != '\n')
+				break;
+
+			buf[len - 1] = '\0';
+			if ((dce->dlce_deps[i] = strdup(buf)) == NULL)
+				break;
+		}
+
+		if (i < ndeps) {
+			dt_libcache_ent_free(dtp, dce);
+			break;
+		}
+
+		dt_list_append(&dlc->dlc_ents, dce);
+	}
+out:
+	(void) fclose(fp);
+}
+
+/*
+ * Write the cache file back if this scan added to it.  We keep the entries of
+ * libraries in directories that were not part of this scan for as long as
+ * those libraries exist.  The new contents are written to a temporary file
+ * that is then renamed over the old one, so that a concurrent reader always
+ * sees a complete file.
+ */
+static void
+dt_libcache_save(dtrace_hdl_t *dtp, dt_libcache_t *dlc)
+{
+	char tmp[PATH_MAX];
+	dt_libcache_ent_t *dce;
+	struct stat st;
+	uint_t i;
+	FILE *fp;
+	int fd, err;
+
+	if (!dlc->dlc_dirty || dlc->dlc_path[0] == '\0')
+		return;
+
+	if (snprintf(tmp, sizeof (tmp), "%s.%d", dlc->dlc_path,
+	    (int)getpid()) >= sizeof (tmp))
+		return;
+
+	if ((fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW,
+	    S_IRUSR | S_IWUSR)) == -1) {
+		dt_dprintf("failed to create library cache %s: %s",
+		    tmp, strerror(errno));
+		return;
+	}
+
+	if ((fp = fdopen(fd, "w")) == NULL) {
+		(void) close(fd);
+		(void) unlink(tmp);
+		return;
+	}
+
+	(void) fprintf(fp, "%s %s\n", DT_LIBCACHE_MAGIC, _dtrace_version);
+
+	for (dce = dt_list_next(&dlc->dlc_ents); dce != NULL;
+	    dce = dt_list_next(dce)) {
+		if (!dce->dlce_used && stat(dce->dlce_library, &st) != 0)
+			continue;
+
+		(void) fprintf(fp, "%llu %llu %llu %llu %u %s\n",
+		    (unsigned long long)dce->dlce_dev,
+		    (unsigned long long)dce->dlce_ino,
+		    (unsigned long long)dce->dlce_size,
+		    (unsigned long long)dce->dlce_mtime,
+		    dce->dlce_ndeps, dce->dlce_library);
+
+		for (i = 0; i < dce->dlce_ndeps; i++)
+			(void) fprintf(fp, "%s\n", dce->dlce_deps[i]);
+	}
+
+	err = ferror(fp);
+
+	if (fclose(fp) != 0 || err || rename(tmp, dlc->dlc_path) == -1) {
+		dt_dprintf("failed to update library cache %s: %s",
+		    dlc->dlc_path, strerror(errno));
+		(void) unlink(tmp);
+	}
+}
+
+static void
+dt_libcache_free(dtrace_hdl_t *dtp, dt_libcache_t *dlc)
+{
+	dt_libcache_ent_t *dce;
+
+	while ((dce = dt_list_next(&dlc->dlc_ents)) != NULL) {
+		dt_list_delete(&dlc->dlc_ents, dce);
+		dt_libcache_ent_free(dtp, dce);
+	}
+}
+
+/*
+ * Find the library that a dependency name resolves to, the same way as
+ * #pragma D depends_on does.
+ */
+static int
+dt_libcache_resolve(dtrace_hdl_t *dtp, const char *name, char *lib, size_t len)
+{
+	dt_dirpath_t *dirp;
+	struct stat st;
+
+	for (dirp = dt_list_next(&dtp->dt_lib_path); dirp != NULL;
+	    dirp = dt_list_next(dirp)) {
+		(void) snprintf(lib, len, "%s/%s", dirp->dir_path, name);
+
+		if (stat(lib, &st) == 0)
+			return (0);
+	}
+
+	return (-1);
+}
+
+/*
+ * If the cache holds the dependencies of the library of the specified node,
+ * add them to the node and return 0.  Otherwise return -1 to have the library
+ * scanned.
+ */
+static int
+dt_libcache_depends(dtrace_hdl_t *dtp, dt_libcache_t *dlc,
+    dt_lib_depend_t *dld, const struct stat *st)
+{
+	char lib[PATH_MAX];
+	dt_libcache_ent_t *dce;
+	dt_lib_depend_t *dpld;
+	uint_t i;
+
+	if (dlc->dlc_path[0] == '\0' ||
+	    (dce = dt_libcache_lookup(dlc, dld->dtld_library)) == NULL)
+		return (-1);
+
+	if (dce->dlce_dev != (uint64_t)st->st_dev ||
+	    dce->dlce_ino != (uint64_t)st->st_ino ||
+	    dce->dlce_size != (uint64_t)st->st_size ||
+	    dce->dlce_mtime != dt_libcache_mtime(st))
+		return (-1);
+
+	/*
+	 * Any dependency that no longer resolves is left for the scan to
+	 * report, so check them all before adding any of them.
+	 */
+	for (i = 0; i < dce->dlce_ndeps; i++) {
+		if (dt_libcache_resolve(dtp, dce->dlce_deps[i],
+		    lib, sizeof (lib)) != 0)
+			return (-1);
+	}
+
+	for (i = 0; i < dce->dlce_ndeps; i++) {
+		(void) dt_libcache_resolve(dtp, dce->dlce_deps[i],
+		    lib, sizeof (lib));
+
+		if (dt_lib_depend_add(dtp, &dld->dtld_dependencies, lib) != 0)
+			return (-1);
+
+		dpld = dt_list_prev(&dld->dtld_dependencies);
+		if ((dpld->dtld_name = strdup(dce->dlce_deps[i])) == NULL)
+			return (dt_set_errno(dtp, EDT_NOMEM));
+	}
+
+	dce->dlce_used = 1;
+	return (0);
+}
+
+/*
+ * Record the dependencies that a successful scan found for the library of the
+ * specified node, replacing any stale entry for that library.
+ */
+static void
+dt_libcache_enter(dtrace_hdl_t *dtp, dt_libcache_t *dlc,
+    dt_lib_depend_t *dld, const struct stat *st)
+{
+	dt_libcache_ent_t *dce;
+	dt_lib_depend_t *dpld;
+	uint_t i, ndeps = 0;
+
+	if (dlc->dlc_path[0] == '\0' || strchr(dld->dtld_library, '\n'))
+		return;
+
+	for (dpld = dt_list_next(&dld->dtld_dependencies); dpld != NULL;
+	    dpld = dt_list_next(dpld)) {
+		if (dpld->dtld_name == NULL)
+			return;
+		ndeps++;
+	}
+
+	if (ndeps > DT_LIBCACHE_MAXDEPS)
+		return;
+
+	if ((dce = dt_libcache_lookup(dlc, dld->dtld_library)) != NULL) {
+		dt_list_delete(&dlc->dlc_ents, dce);
+		dt_libcache_ent_free(dtp, dce);
+	}
+
+	if ((dce = dt_libcache_ent_create(dtp, dld->dtld_library,
+	    ndeps)) == NULL)
+		return;
+
+	dce->dlce_dev = st->st_dev;
+	dce->dlce_ino = st->st_ino;
+	dce->dlce_size = st->st_size;
+	dce->dlce_mtime = dt_libcache_mtime(st);
+	dce->dlce_used = 1;
+
+	for (i = 0, dpld = dt_list_next(&dld->dtld_dependencies); dpld != NULL;
+	    i++, dpld = dt_list_next(dpld)) {
+		if ((dce->dlce_deps[i] = strdup(dpld->dtld_name)) == NULL) {
+			dt_libcache_ent_free(dtp, dce);
+			return;
+		}
+	}
+
+	dt_list_append(&dlc->dlc_ents, dce);
+	dlc->dlc_dirty = 1;
+}
+
 /*
  * Open all of the .d library files found in the specified directory and
  * compile each one of them. We silently ignore any missing directories and
@@ -2390,10 +2955,11 @@ dt_lib_depend_free(dtrace_hdl_t *dtp)
  * privileges.
  */
 static int
-dt_load_libs_dir(dtrace_hdl_t *dtp, const char *path)
+dt_load_libs_dir(dtrace_hdl_t *dtp, const char *path, dt_libcache_t *dlc)
 {
 	struct dirent *dp;
 	const char *p, *end;
+	struct stat st;
 	DIR *dirp;
 
 	char fname[PATH_MAX];
@@ -2444,6 +3010,20 @@ dt_load_libs_dir(dtrace_hdl_t *dtp, const char *path)
 		if (dt_lib_depend_add(dtp, &dtp->dt_lib_dep, fname) != 0)
 			return (-1); /* preserve dt_errno */
 
+		dld = dt_list_prev(&dtp->dt_lib_dep);
+
+		/*
+		 * The scan only serves to find the dependencies of the
+		 * library, so skip it if they are already cached.  Any other
+		 * directives in the library are processed when it is compiled.
+		 */
+		if (fstat(fileno(fp), &st) == 0 &&
+		    dt_libcache_depends(dtp, dlc, dld, &st) == 0) {
+			(void) fclose(fp);
+			dtp->dt_filetag = NULL;
+			continue;
+		}
+
 		rv = dt_compile(dtp, DT_CTX_DPROG,
 		    DTRACE_PROBESPEC_NAME, NULL,
 		    DTRACE_C_EMPTY | DTRACE_C_CTL, 0, NULL, fp, NULL);
@@ -2456,6 +3036,8 @@ dt_load_libs_dir(dtrace_hdl_t *dtp, const char *path)
 		if (dtp->dt_errno)
 			dt_dprintf("error parsing library %s: %s",
 			    fname, dtrace_errmsg(dtp, dtrace_errno(dtp)));
+		else if (fstat(fileno(fp), &st) == 0)
+			dt_libcache_enter(dtp, dlc, dld, &st);
 
 		(void) fclose(fp);
 		dtp->dt_filetag = NULL;
@@ -2536,11 +3118,14 @@ static int
 dt_load_libs(dtrace_hdl_t *dtp)
 {
 	dt_dirpath_t *dirp;
+	dt_libcache_t dlc;
 
 	if (dtp->dt_cflags & DTRACE_C_NOLIBS)
 		return (0); /* libraries already processed */
 
 	dtp->dt_cflags |= DTRACE_C_NOLIBS;
+	dt_libcache_load(dtp, &dlc);
+
 	/*
 	 * /usr/lib/dtrace is always at the head of the list. The rest of the
 	 * list is specified in the precedence order the user requested. Process
@@ -2550,18 +3135,23 @@ dt_load_libs(dtrace_hdl_t *dtp)
 	 */
 	for (dirp = dt_list_next(dt_list_next(&dtp->dt_lib_path));
 	    dirp != NULL; dirp = dt_list_next(dirp)) {
-		if (dt_load_libs_dir(dtp, dirp->dir_path) != 0) {
+		if (dt_load_libs_dir(dtp, dirp->dir_path, &dlc) != 0) {
+			dt_libcache_free(dtp, &dlc);
 			dtp->dt_cflags &= ~DTRACE_C_NOLIBS;
 			return (-1); /* errno is set for us */
 		}
 	}
 	/* Handle /usr/lib/dtrace */
 	dirp = dt_list_next(&dtp->dt_lib_path);
-	if (dt_load_libs_dir(dtp, dirp->dir_path) != 0) {
+	if (dt_load_libs_dir(dtp, dirp->dir_path, &dlc) != 0) {
+		dt_libcache_free(dtp, &dlc);
 		dtp->dt_cflags &= ~DTRACE_C_NOLIBS;
 		return (-1); /* errno is set for us */
 	}
 
+	dt_libcache_save(dtp, &dlc);
+	dt_libcache_free(dtp, &dlc);
+
 	if (dt_load_libs_sort(dtp) < 0)
 		return (-1);
 
@@ -2208,4 +2208,11 @@ dt_cg(dt_pcb_t *pcb, dt_node_t *dnp)
 
 	dt_regset_free(pcb->pcb_regs, 0);
 	dt_regset_assert_free(pcb->pcb_regs);
+
+	/*
+	 * If an expression needed more registers than the register file
+	 * holds, assign its values to the registers that exist, spilling
+	 * some of them to clause-local variables.
+	 */
+	dt_regset_assign(pcb->pcb_regs, pcb);
 }
@@ -38,6 +38,7 @@
 #include <ctype.h>
 #include <alloca.h>
 #include <dt_impl.h>
+#include <dt_module.h>
 
 #include "dt_printf.h"
 
@@ -1252,12 +1253,10 @@ int
 dt_print_stack(dtrace_hdl_t *dtp, FILE *fp, const char *format,
     caddr_t addr, int depth, int size)
 {
-	dtrace_syminfo_t dts;
-	GElf_Sym sym;
-        char aux_symbol_name[32];
-        int i, indent;
-        char c[PATH_MAX * 2];
-        uint64_t pc;
+	const dt_ksym_t *dks;
+	int i, indent, symbols;
+	char c[PATH_MAX * 2];
+	uint64_t pc;
 
 	if (dt_printf(dtp, fp, "\n") < 0)
 		return (-1);
@@ -1270,6 +1269,8 @@ dt_print_stack(dtrace_hdl_t *dtp, FILE *fp, const char *format,
 	else
 		indent = _dtrace_stkindent;
 
+	symbols = dtp->dt_options[DTRACEOPT_STACKSYMBOLS] != DTRACEOPT_UNSET;
+
 	for (i = 0; i < depth; i++) {
 		switch (size) {
 		case sizeof (uint32_t):
@@ -1294,29 +1295,20 @@ dt_print_stack(dtrace_hdl_t *dtp, FILE *fp, const char *format,
 		if (dt_printf(dtp, fp, "%*s", indent, "") < 0)
 			return (-1);
 
-		if ((dtp->dt_options[DTRACEOPT_STACKSYMBOLS] != DTRACEOPT_UNSET) && dtrace_lookup_by_addr(dtp, pc, aux_symbol_name, sizeof(aux_symbol_name), &sym, &dts) == 0) 
-		{
-			if (pc > sym.st_value) {
-				(void) snprintf(c, sizeof (c), "%s`%s+0x%llx",
-				    dts.dts_object, dts.dts_name,
-				    pc - sym.st_value);
-			} else {
-				(void) snprintf(c, sizeof (c), "%s`%s",
-				    dts.dts_object, dts.dts_name);
-			}
+		dks = symbols ? dt_module_lookup_ksym(dtp, pc) : NULL;
+
+		if (dks == NULL) {
+			(void) snprintf(c, sizeof (c), "0x%llx", pc);
+		} else if (!(dks->dks_flags & DT_KSYM_SYM)) {
+			(void) snprintf(c, sizeof (c), "%s`0x%llx",
+			    dks->dks_object, pc);
+		} else if (pc > dks->dks_sym.st_value) {
+			(void) snprintf(c, sizeof (c), "%s`%s+0x%llx",
+			    dks->dks_object, dks->dks_name,
+			    pc - dks->dks_sym.st_value);
 		} else {
-			/*
-			 * We'll repeat the lookup, but this time we'll specify
-			 * a NULL GElf_Sym -- indicating that we're only
-			 * interested in the containing module.
-			 */
-			if ((dtp->dt_options[DTRACEOPT_STACKSYMBOLS] != DTRACEOPT_UNSET) && dtrace_lookup_by_addr(dtp, pc, NULL, 0, NULL, &dts) == 0) 
-			{
-				(void) snprintf(c, sizeof (c), "%s`0x%llx",
-				    dts.dts_object, pc);
-			} else {
-				(void) snprintf(c, sizeof (c), "0x%llx", pc);
-			}
+			(void) snprintf(c, sizeof (c), "%s`%s",
+			    dks->dks_object, dks->dks_name);
 		}
 
 		if (dt_printf(dtp, fp, format, c) < 0)
@@ -1341,10 +1333,9 @@ dt_print_ustack(dtrace_hdl_t *dtp, FILE *fp, const char *format,
 	const char *str = strsize ? strbase : NULL;
 	int err = 0;
 
-	char name[PATH_MAX], objname[PATH_MAX], c[PATH_MAX * 2];
-	struct ps_prochandle *P;
-	GElf_Sym sym;
-	int i, indent;
+	char c[PATH_MAX * 2];
+	const dt_usym_t *dus;
+	int i, indent, symbols;
 	pid_t pid;
 
 	if (depth == 0)
@@ -1368,36 +1359,37 @@ dt_print_ustack(dtrace_hdl_t *dtp, FILE *fp, const char *format,
 	 * determining <symbol, offset> from <pid, address>.  For now, if
 	 * this is a vector open, we just print the raw address or string.
 	 */
-	if ((dtp->dt_options[DTRACEOPT_STACKSYMBOLS] != DTRACEOPT_UNSET) && dtp->dt_vector == NULL)
-		P = dt_proc_grab(dtp, pid, PGRAB_RDONLY | PGRAB_FORCE, 0);
-	else
-		P = NULL;
-
-	if (P != NULL)
-		dt_proc_lock(dtp, P); /* lock handle while we perform lookups */
+	symbols = (dtp->dt_options[DTRACEOPT_STACKSYMBOLS] != DTRACEOPT_UNSET) &&
+	    dtp->dt_vector == NULL;
 
 	for (i = 0; i < depth && pc[i] != NULL; i++) {
-		prmap_t thread_local_map;
-		const prmap_t *map;
-
 		if ((err = dt_printf(dtp, fp, "%*s", indent, "")) < 0)
 			break;
 
-		if (P != NULL && Plookup_by_addr(P, pc[i],
-		    name, sizeof (name), &sym) == 0) {
-			(void) Pobjname(P, pc[i], objname, sizeof (objname));
+		/*
+		 * Each frame is resolved through the symbolization cache,
+		 * which only grabs the process on a miss.  If the process
+		 * can't be grabbed, don't try again for the remaining frames.
+		 */
+		if ((dus = symbols ?
+		    dt_proc_usym_lookup(dtp, pid, pc[i]) : NULL) == NULL)
+			symbols = 0;
+
+		if (dus != NULL && (dus->dus_flags & DT_USYM_SYM)) {
+			const char *obj = (dus->dus_flags & DT_USYM_OBJ) ?
+			    dt_basename(dus->dus_objname) : "";
 
-			if (pc[i] > sym.st_value) {
+			if (pc[i] > dus->dus_sym.st_value) {
 				(void) snprintf(c, sizeof (c),
-				    "%s`%s+0x%llx", dt_basename(objname), name,
-				    (u_longlong_t)(pc[i] - sym.st_value));
+				    "%s`%s+0x%llx", obj, dus->dus_name,
+				    (u_longlong_t)(pc[i] - dus->dus_sym.st_value));
 			} else {
 				(void) snprintf(c, sizeof (c),
-				    "%s`%s", dt_basename(objname), name);
+				    "%s`%s", obj, dus->dus_name);
 			}
 		} else if (str != NULL && str[0] != '\0' && str[0] != '@' &&
-			   (P != NULL && ((map = Paddr_to_map(P, pc[i], &thread_local_map)) == NULL ||
-					  (map->pr_mflags & MA_WRITE)))) {
+			   (dus != NULL && (!(dus->dus_flags & DT_USYM_MAP) ||
+					    (dus->dus_mflags & MA_WRITE)))) {
 			/*
 			 * If the current string pointer in the string table
 			 * does not point to an empty string _and_ the program
@@ -1413,10 +1405,10 @@ dt_print_ustack(dtrace_hdl_t *dtp, FILE *fp, const char *format,
 			 */
 			(void) snprintf(c, sizeof (c), "%s", str);
 		} else {
-			if (P != NULL && Pobjname(P, pc[i], objname,
-			    sizeof (objname)) != 0) {
+			if (dus != NULL && (dus->dus_flags & DT_USYM_OBJ)) {
 				(void) snprintf(c, sizeof (c), "%s`0x%llx",
-				    dt_basename(objname), (u_longlong_t)pc[i]);
+				    dt_basename(dus->dus_objname),
+				    (u_longlong_t)pc[i]);
 			} else {
 				(void) snprintf(c, sizeof (c), "0x%llx",
 				    (u_longlong_t)pc[i]);
@@ -1455,11 +1447,6 @@ dt_print_ustack(dtrace_hdl_t *dtp, FILE *fp, const char *format,
 		}
 	}
 
-	if (P != NULL) {
-		dt_proc_unlock(dtp, P);
-		dt_proc_release(dtp, P);
-	}
-
 	return (err);
 }
 
@@ -1475,20 +1462,10 @@ dt_print_usym(dtrace_hdl_t *dtp, FILE *fp, caddr_t addr, dtrace_actkind_t act)
 	int n, len = 256;
 
 	if (act == DTRACEACT_USYM && dtp->dt_vector == NULL) {
-		struct ps_prochandle *P;
-
-		if ((P = dt_proc_grab(dtp, pid,
-		    PGRAB_RDONLY | PGRAB_FORCE, 0)) != NULL) {
-			GElf_Sym sym;
+		const dt_usym_t *dus = dt_proc_usym_lookup(dtp, pid, pc);
 
-			dt_proc_lock(dtp, P);
-
-			if (Plookup_by_addr(P, pc, NULL, 0, &sym) == 0)
-				pc = sym.st_value;
-
-			dt_proc_unlock(dtp, P);
-			dt_proc_release(dtp, P);
-		}
+		if (dus != NULL && (dus->dus_flags & DT_USYM_SYM))
+			pc = dus->dus_sym.st_value;
 	}
 
 	do {
@@ -1506,10 +1483,8 @@ dt_print_umod(dtrace_hdl_t *dtp, FILE *fp, const char *format, caddr_t addr)
 	uint64_t pid = ((uint64_t *)addr)[0];
 	/* LINTED - alignment */
 	uint64_t pc = ((uint64_t *)addr)[1];
-	int err = 0;
-
-	char objname[PATH_MAX], c[PATH_MAX * 2];
-	struct ps_prochandle *P;
+	char c[PATH_MAX * 2];
+	const dt_usym_t *dus;
 
 	if (format == NULL)
 		format = "  %-50s";
@@ -1519,27 +1494,18 @@ dt_print_umod(dtrace_hdl_t *dtp, FILE *fp, const char *format, caddr_t addr)
 	 * printing raw addresses in the vectored case.
 	 */
 	if (dtp->dt_vector == NULL)
-		P = dt_proc_grab(dtp, pid, PGRAB_RDONLY | PGRAB_FORCE, 0);
+		dus = dt_proc_usym_lookup(dtp, pid, pc);
 	else
-		P = NULL;
-
-	if (P != NULL)
-		dt_proc_lock(dtp, P); /* lock handle while we perform lookups */
+		dus = NULL;
 
-	if (P != NULL && Pobjname(P, pc, objname, sizeof (objname)) != 0) {
-		(void) snprintf(c, sizeof (c), "%s", dt_basename(objname));
+	if (dus != NULL && (dus->dus_flags & DT_USYM_OBJ)) {
+		(void) snprintf(c, sizeof (c), "%s",
+		    dt_basename(dus->dus_objname));
 	} else {
 		(void) snprintf(c, sizeof (c), "0x%llx", (u_longlong_t)pc);
 	}
 
-	err = dt_printf(dtp, fp, format, c);
-
-	if (P != NULL) {
-		dt_proc_unlock(dtp, P);
-		dt_proc_release(dtp, P);
-	}
-
-	return (err);
+	return (dt_printf(dtp, fp, format, c));
 }
 
 static int
@@ -1547,30 +1513,20 @@ dt_print_sym(dtrace_hdl_t *dtp, FILE *fp, const char *format, caddr_t addr)
 {
 	/* LINTED - alignment */
 	uint64_t pc = *((uint64_t *)addr);
-	dtrace_syminfo_t dts;
-	GElf_Sym sym;
+	const dt_ksym_t *dks;
 	char c[PATH_MAX * 2];
-        char aux_symbol_name[32];
 
 	if (format == NULL)
 		format = "  %-50s";
 
-	if (dtrace_lookup_by_addr(dtp, pc, aux_symbol_name, sizeof(aux_symbol_name), &sym, &dts) == 0) {
+	if ((dks = dt_module_lookup_ksym(dtp, pc)) == NULL) {
+		(void) snprintf(c, sizeof (c), "0x%llx", (u_longlong_t)pc);
+	} else if (dks->dks_flags & DT_KSYM_SYM) {
 		(void) snprintf(c, sizeof (c), "%s`%s",
-		    dts.dts_object, dts.dts_name);
+		    dks->dks_object, dks->dks_name);
 	} else {
-		/*
-		 * We'll repeat the lookup, but this time we'll specify a
-		 * NULL GElf_Sym -- indicating that we're only interested in
-		 * the containing module.
-		 */
-		if (dtrace_lookup_by_addr(dtp, pc, NULL, 0, NULL, &dts) == 0) {
-			(void) snprintf(c, sizeof (c), "%s`0x%llx",
-			    dts.dts_object, (u_longlong_t)pc);
-		} else {
-			(void) snprintf(c, sizeof (c), "0x%llx",
-			    (u_longlong_t)pc);
-		}
+		(void) snprintf(c, sizeof (c), "%s`0x%llx",
+		    dks->dks_object, (u_longlong_t)pc);
 	}
 
 	if (dt_printf(dtp, fp, format, c) < 0)
@@ -1584,14 +1540,14 @@ dt_print_mod(dtrace_hdl_t *dtp, FILE *fp, const char *format, caddr_t addr)
 {
 	/* LINTED - alignment */
 	uint64_t pc = *((uint64_t *)addr);
-	dtrace_syminfo_t dts;
+	const dt_ksym_t *dks;
 	char c[PATH_MAX * 2];
 
 	if (format == NULL)
 		format = "  %-50s";
 
-	if (dtrace_lookup_by_addr(dtp, pc, NULL, 0, NULL, &dts) == 0) {
-		(void) snprintf(c, sizeof (c), "%s", dts.dts_object);
+	if ((dks = dt_module_lookup_ksym(dtp, pc)) != NULL) {
+		(void) snprintf(c, sizeof (c), "%s", dks->dks_object);
 	} else {
 		(void) snprintf(c, sizeof (c), "0x%llx", (u_longlong_t)pc);
 	}
@@ -1734,6 +1690,7 @@ dt_trunc_agg(const dtrace_aggdata_t *aggdata, void *arg)
 static int
 dt_trunc(dtrace_hdl_t *dtp, caddr_t base, dtrace_recdesc_t *rec)
 {
+	dt_aggregate_t *agp = &dtp->dt_aggregate;
 	dt_trunc_t trunc;
 	caddr_t addr;
 	int64_t remaining;
@@ -1791,8 +1748,19 @@ dt_trunc(dtrace_hdl_t *dtp, caddr_t base, dtrace_recdesc_t *rec)
 	assert(remaining >= 0);
 	trunc.dttd_remaining = remaining;
 
+	/*
+	 * Let the sorted walk know that only the first entries of this
+	 * variable need to be visited in order; see
+	 * dt_aggregate_walk_sorted().
+	 */
+	agp->dtat_flags |= DTRACE_A_TRUNC;
+	agp->dtat_truncid = trunc.dttd_id;
+	agp->dtat_trunc = trunc.dttd_remaining;
+
 	(void) func(dtp, dt_trunc_agg, &trunc);
 
+	agp->dtat_flags &= ~DTRACE_A_TRUNC;
+
 	return (0);
 }
 
@@ -2095,18 +2063,46 @@ dt_setopt(dtrace_hdl_t *dtp, const dtrace_probedata_t *data,
 	return (rval);
 }
 
+/* ARGSUSED */
+static uint64_t
+dt_buf_oldest(void *elem, void *arg)
+{
+#pragma unused(arg)
+	dtrace_bufdesc_t *buf = elem;
+	size_t offs = buf->dtbd_oldest;
+
+	while (offs < buf->dtbd_size) {
+		dtrace_rechdr_t *dtrh =
+		    (dtrace_rechdr_t *)(buf->dtbd_data + offs);
+		if (dtrh->dtrh_epid == DTRACE_EPIDNONE) {
+			offs += sizeof (dtrace_epid_t);
+		} else {
+			return (DTRACE_RECORD_LOAD_TIMESTAMP(dtrh));
+		}
+	}
+
+	/* There are no records left; use the time the buffer was retrieved. */
+	return (buf->dtbd_timestamp);
+}
+
 static int
 dt_consume_cpu(dtrace_hdl_t *dtp, FILE *fp, int cpu,
-               dtrace_bufdesc_t *buf, boolean_t just_one, dtrace_probedata_t *datap,
+               dtrace_bufdesc_t *buf, boolean_t just_one, uint64_t limit,
+               dtrace_probedata_t *datap,
                dtrace_consume_probe_f *efunc, dtrace_consume_rec_f *rfunc, void *arg);
 
 
+/*
+ * Consume the run of records at the head of a buffer whose timestamps are no
+ * later than limit, stopping before the end of the time covered by the buffer.
+ * The oldest record is always consumed.
+ */
 static int
-dt_consume_cpu_once(dtrace_hdl_t *dtp, FILE *fp, int cpu,
-					dtrace_bufdesc_t *buf, dtrace_probedata_t *datap,
+dt_consume_cpu_run(dtrace_hdl_t *dtp, FILE *fp, int cpu,
+					dtrace_bufdesc_t *buf, uint64_t limit, dtrace_probedata_t *datap,
 					dtrace_consume_probe_f *efunc, dtrace_consume_rec_f *rfunc, void *arg)
 {
-	return dt_consume_cpu(dtp, fp, cpu, buf, B_TRUE, datap, efunc, rfunc, arg);
+	return dt_consume_cpu(dtp, fp, cpu, buf, B_TRUE, limit, datap, efunc, rfunc, arg);
 }
 
 static int
@@ -2118,13 +2114,14 @@ dt_consume_cpu_many(dtrace_hdl_t *dtp, FILE *fp, int cpu,
 	bzero(&data, sizeof (data));
 	data.dtpda_handle = dtp;
 	data.dtpda_cpu = cpu;
-	return dt_consume_cpu(dtp, fp, cpu, buf, B_FALSE, &data, efunc, rfunc, arg);
+	return dt_consume_cpu(dtp, fp, cpu, buf, B_FALSE, 0, &data, efunc, rfunc, arg);
 }
 
 
 static int
 dt_consume_cpu(dtrace_hdl_t *dtp, FILE *fp, int cpu,
-               dtrace_bufdesc_t *buf, boolean_t just_one, dtrace_probedata_t *datap,
+               dtrace_bufdesc_t *buf, boolean_t just_one, uint64_t limit,
+               dtrace_probedata_t *datap,
                dtrace_consume_probe_f *efunc, dtrace_consume_rec_f *rfunc, void *arg)
 {
 	dtrace_epid_t id;
@@ -2491,6 +2488,8 @@ nofmt:
 					    dtrace_aggregate_walk_sorted(dtp,
 					    dt_print_agg, &pd) < 0)
 						return (-1);
+
+					dt_aggregate_printed(dtp, pd.dtpa_id);
 					goto nextrec;
 				}
 
@@ -2501,6 +2500,11 @@ nofmt:
 					return (-1);
 				}
 
+				while (naggvars > 0) {
+					dt_aggregate_printed(dtp,
+					    aggvars[--naggvars]);
+				}
+
 				dt_free(dtp, aggvars);
 				goto nextrec;
 			}
@@ -2566,8 +2570,17 @@ nextepid:
 		offs += epd->dtepd_size;
 		last = id;
 		if (just_one) {
+			uint64_t timestamp;
+
 			buf->dtbd_oldest = offs;
-			break;
+
+			timestamp = dt_buf_oldest(buf, NULL);
+			if (timestamp > limit ||
+			    timestamp == buf->dtbd_timestamp)
+				break;
+
+			assert(timestamp >= dtp->dt_last_timestamp);
+			dtp->dt_last_timestamp = timestamp;
 		}
 	}
 
@@ -2588,6 +2601,18 @@ nextepid:
 	return (dt_handle_cpudrop(dtp, cpu, DTRACEDROP_PRINCIPAL, drops));
 }
 
+/*
+ * Principal buffers are retrieved into descriptors that are allocated by
+ * dt_get_buf().  Along with each descriptor, we keep the allocated size of its
+ * data, so that a descriptor whose data is still bufsize bytes can be put in
+ * dt_bufpool and reused instead of being allocated anew for every CPU on
+ * every pass.
+ */
+typedef struct dt_bufent {
+	dtrace_bufdesc_t dtbe_desc;	/* buffer descriptor (must be first) */
+	size_t dtbe_size;		/* allocated size of dtbd_data */
+} dt_bufent_t;
+
 /*
  * Reduce memory usage by shrinking the buffer if it's no more than half full.
  * Note, we need to preserve the alignment of the data at dtbd_oldest, which is
@@ -2609,6 +2634,7 @@ dt_realloc_buf(dtrace_hdl_t *dtp, dtrace_bufdesc_t *buf, int cursize)
 		buf->dtbd_oldest = misalign;
 		buf->dtbd_size = used + misalign;
 		buf->dtbd_data = newdata;
+		((dt_bufent_t *)buf)->dtbe_size = buf->dtbd_size;
 	}
 }
 
@@ -2647,6 +2673,7 @@ dt_unring_buf(dtrace_hdl_t *dtp, dtrace_bufdesc_t *buf)
 	buf->dtbd_oldest = 0;
 	buf->dtbd_data = newdata;
 	buf->dtbd_size += misalign;
+	((dt_bufent_t *)buf)->dtbe_size = buf->dtbd_size;
 
 	return (0);
 }
@@ -2654,8 +2681,19 @@ dt_unring_buf(dtrace_hdl_t *dtp, dtrace_bufdesc_t *buf)
 static void
 dt_put_buf(dtrace_hdl_t *dtp, dtrace_bufdesc_t *buf)
 {
+	dt_bufent_t *ent = (dt_bufent_t *)buf;
+	dtrace_optval_t size;
+
+	(void) dtrace_getopt(dtp, "bufsize", &size);
+
+	if (ent->dtbe_size == (size_t)size &&
+	    dtp->dt_nbufpool < DT_BUFPOOL_MAX) {
+		dtp->dt_bufpool[dtp->dt_nbufpool++] = ent;
+		return;
+	}
+
 	dt_free(dtp, buf->dtbd_data);
-	dt_free(dtp, buf);
+	dt_free(dtp, ent);
 }
 
 /*
@@ -2667,18 +2705,32 @@ static int
 dt_get_buf(dtrace_hdl_t *dtp, int cpu, dtrace_bufdesc_t **bufp)
 {
 	dtrace_optval_t size;
-	dtrace_bufdesc_t *buf = dt_zalloc(dtp, sizeof (*buf));
+	dt_bufent_t *ent;
+	dtrace_bufdesc_t *buf;
+	caddr_t data;
 	int error, rval;
 
-	if (buf == NULL)
-		return (-1);
-
 	(void) dtrace_getopt(dtp, "bufsize", &size);
-	buf->dtbd_data = dt_alloc(dtp, size);
-	if (buf->dtbd_data == NULL) {
-		dt_free(dtp, buf);
-		return (-1);
+
+	if (dtp->dt_nbufpool > 0) {
+		ent = dtp->dt_bufpool[--dtp->dt_nbufpool];
+		assert(ent->dtbe_size == (size_t)size);
+		data = ent->dtbe_desc.dtbd_data;
+		bzero(&ent->dtbe_desc, sizeof (dtrace_bufdesc_t));
+		ent->dtbe_desc.dtbd_data = data;
+	} else {
+		if ((ent = dt_zalloc(dtp, sizeof (dt_bufent_t))) == NULL)
+			return (-1);
+
+		ent->dtbe_desc.dtbd_data = dt_alloc(dtp, size);
+		if (ent->dtbe_desc.dtbd_data == NULL) {
+			dt_free(dtp, ent);
+			return (-1);
+		}
+		ent->dtbe_size = size;
 	}
+
+	buf = &ent->dtbe_desc;
 	buf->dtbd_size = size;
 	buf->dtbd_cpu = cpu;
 
@@ -2698,17 +2750,48 @@ dt_get_buf(dtrace_hdl_t *dtp, int cpu, dtrace_bufdesc_t **bufp)
 		return (rval);
 	}
 
-	error = dt_unring_buf(dtp, buf);
-	if (error != 0) {
-		dt_put_buf(dtp, buf);
-		return (error);
+	/*
+	 * When we're not consuming in temporal order, each buffer is consumed
+	 * in full and then released, and dt_consume_cpu() walks a wrapped ring
+	 * in place as two segments.  Otherwise, the buffer may be held in the
+	 * priority queue across passes with its cursor in dtbd_oldest, so we
+	 * rearrange a wrapped ring and shrink the buffer to what it holds.
+	 */
+	if (dtp->dt_options[DTRACEOPT_TEMPORAL] != DTRACEOPT_UNSET) {
+		error = dt_unring_buf(dtp, buf);
+		if (error != 0) {
+			dt_put_buf(dtp, buf);
+			return (error);
+		}
+		dt_realloc_buf(dtp, buf, size);
 	}
-	dt_realloc_buf(dtp, buf, size);
 
 	*bufp = buf;
 	return (0);
 }
 
+void
+dt_consume_destroy(dtrace_hdl_t *dtp)
+{
+	dtrace_bufdesc_t *buf;
+	dt_bufent_t *ent;
+	uint_t cookie = 0;
+
+	if (dtp->dt_bufq != NULL) {
+		while ((buf = dt_pq_walk(dtp->dt_bufq, &cookie)) != NULL)
+			dt_put_buf(dtp, buf);
+
+		dt_pq_fini(dtp->dt_bufq);
+		dtp->dt_bufq = NULL;
+	}
+
+	while (dtp->dt_nbufpool > 0) {
+		ent = dtp->dt_bufpool[--dtp->dt_nbufpool];
+		dt_free(dtp, ent->dtbe_desc.dtbd_data);
+		dt_free(dtp, ent);
+	}
+}
+
 typedef struct dt_begin {
 	dtrace_consume_probe_f *dtbgn_probefunc;
 	dtrace_consume_rec_f *dtbgn_recfunc;
@@ -2894,28 +2977,6 @@ dt_consume_begin(dtrace_hdl_t *dtp, FILE *fp,
 	return (rval);
 }
 
-/* ARGSUSED */
-static uint64_t
-dt_buf_oldest(void *elem, void *arg)
-{
-#pragma unused(arg)
-	dtrace_bufdesc_t *buf = elem;
-	size_t offs = buf->dtbd_oldest;
-
-	while (offs < buf->dtbd_size) {
-		dtrace_rechdr_t *dtrh =
-		    (dtrace_rechdr_t *)(buf->dtbd_data + offs);
-		if (dtrh->dtrh_epid == DTRACE_EPIDNONE) {
-			offs += sizeof (dtrace_epid_t);
-		} else {
-			return (DTRACE_RECORD_LOAD_TIMESTAMP(dtrh));
-		}
-	}
-
-	/* There are no records left; use the time the buffer was retrieved. */
-	return (buf->dtbd_timestamp);
-}
-
 int
 dtrace_consume(dtrace_hdl_t *dtp, FILE *fp,
     dtrace_consume_probe_f *pf, dtrace_consume_rec_f *rf, void *arg)
@@ -3005,8 +3066,10 @@ dtrace_consume(dtrace_hdl_t *dtp, FILE *fp,
 		 * based on the first entry in the buffer.  This is sufficient
 		 * because entries within a buffer are already sorted.
 		 *
-		 * We then consume records one at a time, always consuming the
-		 * oldest record, as determined by the priority queue.  When
+		 * We then consume records in runs, always consuming the oldest
+		 * record, as determined by the priority queue, along with any
+		 * records that follow it in its buffer and are no later than the
+		 * oldest record of every other buffer.  When
 		 * we reach the end of the time covered by these buffers,
 		 * we need to stop and retrieve more records on the next pass.
 		 * The kernel tells us the time covered by each buffer, in
@@ -3058,12 +3121,12 @@ dtrace_consume(dtrace_hdl_t *dtp, FILE *fp,
 
 		/* Consume records. */
 		for (;;) {
-			uint64_t timestamp;
+			uint64_t timestamp, limit;
 
-			if ((buf = dt_pq_pop(dtp->dt_bufq)) == NULL)
+			if ((buf = dt_pq_peek(dtp->dt_bufq, &timestamp)) == NULL)
 				break;
 
-			timestamp = dt_buf_oldest(buf, dtp);
+			(void) dt_pq_pop(dtp->dt_bufq);
 			assert(timestamp >= dtp->dt_last_timestamp);
 			dtp->dt_last_timestamp = timestamp;
 
@@ -3081,8 +3144,18 @@ dtrace_consume(dtrace_hdl_t *dtp, FILE *fp,
 				continue;
 			}
 
-			if ((rval = dt_consume_cpu_once(dtp, fp,
-			    buf->dtbd_cpu, buf, &data[buf->dtbd_cpu], pf, rf, arg)) != 0)
+			/*
+			 * Records within a buffer are already sorted, so we
+			 * can consume every record that is no later than the
+			 * oldest record of the runner-up before we need to
+			 * consult the priority queue again.
+			 */
+			if (dt_pq_peek(dtp->dt_bufq, &limit) == NULL)
+				limit = UINT64_MAX;
+
+			if ((rval = dt_consume_cpu_run(dtp, fp,
+			    buf->dtbd_cpu, buf, limit, &data[buf->dtbd_cpu],
+			    pf, rf, arg)) != 0)
 				return (rval);
 			dt_pq_insert(dtp->dt_bufq, buf);
 		}
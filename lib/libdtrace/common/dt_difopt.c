@@ -0,0 +1,1270 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * DIF optimizer
+ *
+ * dt_cg() generates the code for each node of the parse tree on its own, so
+ * the instruction list that it leaves in pcb_ir moves values into registers
+ * that already hold them, loads the same constant or variable more than once
+ * and branches to other branches.  Every instruction of a DIFO is executed in
+ * probe context each time its probe fires, so dt_as() first hands the list to
+ * dt_difopt(), which repeats the following passes until none of them finds
+ * anything left to improve:
+ *
+ * - Branch threading retargets a branch whose destination is a 'ba' (or the
+ *   same conditional branch) to the final destination, turns a 'ba' to a
+ *   'ret' into that 'ret', removes branches to the next instruction and
+ *   inverts a conditional branch around a 'ba'.
+ *
+ * - Instructions that follow a 'ba' or a 'ret' and are not the destination
+ *   of any branch are removed.
+ *
+ * - Within each basic block, the value held by each register is numbered.
+ *   Operations on constants are folded, each read of a register is replaced
+ *   by a read of the first register that came to hold the same value, and an
+ *   instruction that computes a value that a register already holds -- the
+ *   same constant, the same operation on the same values or another load of
+ *   the same variable -- becomes a 'mov' or disappears.  A comparison of
+ *   constants decides the branches that depend on it.
+ *
+ * - Instructions that have no effect other than their result are removed if
+ *   that result is never used.  DIF only branches forward, so one backward
+ *   pass over the list computes exact register liveness.
+ *
+ * The passes never introduce a backward branch, never write %r0 and keep the
+ * final 'ret', and any code that the optimizer does not understand is left
+ * alone.  Only loads of user-defined variables are numbered, as some built-in
+ * variables such as vtimestamp change while the probe is firing.  A store to
+ * a variable or a subroutine call ends the reuse of earlier loads, and a store
+ * is never forwarded to a later load, as the load of a variable passed by
+ * reference yields its storage rather than the value stored.
+ */
+
+#include <sys/types.h>
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <strings.h>
+
+#include <dt_impl.h>
+#include <dt_as.h>
+
+#define	DT_DOP_CC	DIF_DIR_NREGS	/* liveness bit for condition codes */
+#define	DT_DOP_NONE	(-1u)		/* no register holds a value */
+#define	DT_DOP_MAXPASS	16		/* bound on passes over the list */
+
+#define	DT_DOP_ISLABEL(dip) \
+	((dip)->di_label != DT_LBL_NONE && (dip)->di_instr == DIF_INSTR_NOP)
+
+#define	DT_DOP_ISBRANCH(op)	((op) >= DIF_OP_BA && (op) <= DIF_OP_BLEU)
+
+typedef struct dt_dopval {
+	uint_t dov_op;		/* opcode computing the value (or NOP) */
+	uint_t dov_valid;	/* value may be found by dt_difopt_lookup() */
+	uint64_t dov_a;		/* constant, variable id or operand value */
+	uint64_t dov_b;		/* operand value or immediate */
+} dt_dopval_t;
+
+typedef struct dt_difopt {
+	dt_pcb_t *dop_pcb;	/* pcb whose pcb_ir is being optimized */
+	dt_irnode_t **dop_ir;	/* instructions and label declarations */
+	uint_t dop_len;		/* number of entries in dop_ir[] */
+	uint_t dop_nlabels;	/* number of labels (dl_label) */
+	uint_t *dop_lblpos;	/* index in dop_ir[] of each label */
+	uint_t *dop_lblrefs;	/* number of branches to each label */
+	uint_t *dop_live;	/* registers live before each dop_ir[] */
+	uint64_t *dop_ints;	/* integer table, then folded constants */
+	uint_t dop_nints;	/* number of entries of pcb_inttab */
+	uint_t dop_nfold;	/* number of folded constants after those */
+	uint_t dop_maxfold;	/* capacity for folded constants */
+	dt_dopval_t *dop_vals;	/* values of the current basic block */
+	uint_t dop_nvals;	/* number of values in dop_vals[] */
+	uint_t dop_vn[DIF_DIR_NREGS];	/* value held by each register */
+	uint_t dop_age[DIF_DIR_NREGS];	/* when each register got its value */
+	uint_t dop_clock;	/* source of dop_age[] */
+	uint_t dop_ccvalid;	/* condition codes have a known source */
+	uint_t dop_ccop;	/* opcode that set the condition codes */
+	uint_t dop_cca;		/* value of the first operand */
+	uint_t dop_ccb;		/* value of the second operand (or NONE) */
+} dt_difopt_t;
+
+/*
+ * Return the DT_DOP_* flags describing the operands and effects of an
+ * instruction.  dt_regset_assign() uses them to find the registers that an
+ * instruction reads and writes.
+ */
+uint_t
+dt_difopt_flags(const dt_irnode_t *dip)
+{
+	dif_instr_t instr = dip->di_instr;
+
+	switch (DIF_INSTR_OP(instr)) {
+	case DIF_OP_OR:
+	case DIF_OP_XOR:
+	case DIF_OP_AND:
+	case DIF_OP_SLL:
+	case DIF_OP_SRL:
+	case DIF_OP_SRA:
+	case DIF_OP_SUB:
+	case DIF_OP_ADD:
+	case DIF_OP_MUL:
+		return (DT_DOP_R1 | DT_DOP_R2 | DT_DOP_RD | DT_DOP_PURE);
+	case DIF_OP_SDIV:
+	case DIF_OP_UDIV:
+	case DIF_OP_SREM:
+	case DIF_OP_UREM:
+		return (DT_DOP_R1 | DT_DOP_R2 | DT_DOP_RD);
+	case DIF_OP_NOT:
+	case DIF_OP_MOV:
+		return (DT_DOP_R1 | DT_DOP_RD | DT_DOP_PURE);
+	case DIF_OP_CMP:
+		return (DT_DOP_R1 | DT_DOP_R2 | DT_DOP_CCW | DT_DOP_PURE);
+	case DIF_OP_SCMP:
+		return (DT_DOP_R1 | DT_DOP_R2 | DT_DOP_CCW);
+	case DIF_OP_TST:
+		return (DT_DOP_R1 | DT_DOP_CCW | DT_DOP_PURE);
+	case DIF_OP_BA:
+		return (0);
+	case DIF_OP_BE:
+	case DIF_OP_BNE:
+	case DIF_OP_BG:
+	case DIF_OP_BGU:
+	case DIF_OP_BGE:
+	case DIF_OP_BGEU:
+	case DIF_OP_BL:
+	case DIF_OP_BLU:
+	case DIF_OP_BLE:
+	case DIF_OP_BLEU:
+		return (DT_DOP_CCR);
+	case DIF_OP_LDSB:
+	case DIF_OP_LDSH:
+	case DIF_OP_LDSW:
+	case DIF_OP_LDUB:
+	case DIF_OP_LDUH:
+	case DIF_OP_LDUW:
+	case DIF_OP_LDX:
+	case DIF_OP_ULDSB:
+	case DIF_OP_ULDSH:
+	case DIF_OP_ULDSW:
+	case DIF_OP_ULDUB:
+	case DIF_OP_ULDUH:
+	case DIF_OP_ULDUW:
+	case DIF_OP_ULDX:
+	case DIF_OP_RLDSB:
+	case DIF_OP_RLDSH:
+	case DIF_OP_RLDSW:
+	case DIF_OP_RLDUB:
+	case DIF_OP_RLDUH:
+	case DIF_OP_RLDUW:
+	case DIF_OP_RLDX:
+	case DIF_OP_ALLOCS:
+		return (DT_DOP_R1 | DT_DOP_RD);
+	case DIF_OP_RET:
+		return (DT_DOP_RS);
+	case DIF_OP_NOP:
+		return (DT_DOP_PURE);
+	case DIF_OP_SETX:
+		if (dip->di_extern != NULL)
+			return (DT_DOP_RD); /* value is relocated later */
+		return (DT_DOP_RD | DT_DOP_PURE);
+	case DIF_OP_SETS:
+		return (DT_DOP_RD | DT_DOP_PURE);
+	case DIF_OP_LDGS:
+	case DIF_OP_LDTS:
+	case DIF_OP_LDLS:
+		if (DIF_INSTR_VAR(instr) < DIF_VAR_OTHER_UBASE)
+			return (DT_DOP_RD); /* built-in variable */
+		return (DT_DOP_RD | DT_DOP_PURE);
+	case DIF_OP_LDGA:
+	case DIF_OP_LDTA:
+		return (DT_DOP_R2 | DT_DOP_RD);
+	case DIF_OP_LDGAA:
+	case DIF_OP_LDTAA:
+	case DIF_OP_CALL:
+	case DIF_OP_XLATE:
+	case DIF_OP_XLARG:
+		return (DT_DOP_RD);
+	case DIF_OP_STGS:
+	case DIF_OP_STTS:
+	case DIF_OP_STLS:
+	case DIF_OP_STGAA:
+	case DIF_OP_STTAA:
+		return (DT_DOP_RS);
+	case DIF_OP_PUSHTR:
+	case DIF_OP_PUSHTV:
+		return (DT_DOP_R2 | DT_DOP_RS);
+	case DIF_OP_POPTS:
+	case DIF_OP_FLUSHTS:
+		return (0);
+	case DIF_OP_COPYS:
+		return (DT_DOP_R1 | DT_DOP_R2 | DT_DOP_RS);
+	case DIF_OP_STB:
+	case DIF_OP_STH:
+	case DIF_OP_STW:
+	case DIF_OP_STX:
+		return (DT_DOP_R1 | DT_DOP_RS);
+#if defined(DIF_OP_STRIP)
+	case DIF_OP_STRIP:
+		return (DT_DOP_R1 | DT_DOP_RD | DT_DOP_PURE);
+#endif /* defined(DIF_OP_STRIP) */
+	default:
+		return (DT_DOP_OPAQUE);
+	}
+}
+
+/*
+ * Return the registers read (or written) by an instruction as a bitmap, with
+ * bit DT_DOP_CC standing for the condition codes.  %r0 is always zero, so it
+ * is left out of both.
+ */
+static uint_t
+dt_difopt_uses(dif_instr_t instr, uint_t flags)
+{
+	uint_t m = 0;
+
+	if (flags & DT_DOP_R1)
+		m |= 1u << DIF_INSTR_R1(instr);
+	if (flags & DT_DOP_R2)
+		m |= 1u << DIF_INSTR_R2(instr);
+	if (flags & DT_DOP_RS)
+		m |= 1u << DIF_INSTR_RD(instr);
+	if (flags & DT_DOP_CCR)
+		m |= 1u << DT_DOP_CC;
+
+	return (m & ~1u);
+}
+
+static uint_t
+dt_difopt_defs(dif_instr_t instr, uint_t flags)
+{
+	uint_t m = 0;
+
+	if (flags & DT_DOP_RD)
+		m |= 1u << DIF_INSTR_RD(instr);
+	if (flags & DT_DOP_CCW)
+		m |= 1u << DT_DOP_CC;
+
+	return (m & ~1u);
+}
+
+/*
+ * Remove the instruction at dop_ir[i].  If it is the destination of a label,
+ * it turns into a declaration of that label, just like those that dt_cg()
+ * appends for labels that precede the code they apply to.
+ */
+static void
+dt_difopt_delete(dt_difopt_t *dop, uint_t i)
+{
+	dt_irnode_t *dip = dop->dop_ir[i];
+
+	if (dip->di_label != DT_LBL_NONE) {
+		dip->di_instr = DIF_INSTR_NOP;
+		dip->di_extern = NULL;
+	} else {
+		free(dip);
+		dop->dop_ir[i] = NULL;
+	}
+}
+
+/*
+ * Return the index of the first instruction at or after dop_ir[i], skipping
+ * label declarations, or dop_len if there is none.
+ */
+static uint_t
+dt_difopt_next(const dt_difopt_t *dop, uint_t i)
+{
+	for (; i < dop->dop_len; i++) {
+		const dt_irnode_t *dip = dop->dop_ir[i];
+
+		if (dip != NULL && !DT_DOP_ISLABEL(dip))
+			break;
+	}
+
+	return (i);
+}
+
+static uint_t
+dt_difopt_target(const dt_difopt_t *dop, uint_t label)
+{
+	return (dt_difopt_next(dop, dop->dop_lblpos[label]));
+}
+
+static int
+dt_difopt_isblock(const dt_difopt_t *dop, const dt_irnode_t *dip)
+{
+	return (dip->di_label != DT_LBL_NONE &&
+	    dop->dop_lblrefs[dip->di_label] != 0);
+}
+
+static void
+dt_difopt_labels(dt_difopt_t *dop)
+{
+	uint_t i;
+
+	bzero(dop->dop_lblrefs, sizeof (uint_t) * dop->dop_nlabels);
+
+	for (i = 0; i < dop->dop_len; i++) {
+		dt_irnode_t *dip = dop->dop_ir[i];
+
+		if (dip == NULL)
+			continue;
+
+		if (dip->di_label != DT_LBL_NONE)
+			dop->dop_lblpos[dip->di_label] = i;
+
+		if (DT_DOP_ISBRANCH(DIF_INSTR_OP(dip->di_instr)))
+			dop->dop_lblrefs[DIF_INSTR_LABEL(dip->di_instr)]++;
+	}
+}
+
+static uint_t
+dt_difopt_invert(uint_t op)
+{
+	switch (op) {
+	case DIF_OP_BE:
+		return (DIF_OP_BNE);
+	case DIF_OP_BNE:
+		return (DIF_OP_BE);
+	case DIF_OP_BG:
+		return (DIF_OP_BLE);
+	case DIF_OP_BLE:
+		return (DIF_OP_BG);
+	case DIF_OP_BGU:
+		return (DIF_OP_BLEU);
+	case DIF_OP_BLEU:
+		return (DIF_OP_BGU);
+	case DIF_OP_BGE:
+		return (DIF_OP_BL);
+	case DIF_OP_BL:
+		return (DIF_OP_BGE);
+	case DIF_OP_BGEU:
+		return (DIF_OP_BLU);
+	default:
+		assert(op == DIF_OP_BLU);
+		return (DIF_OP_BGEU);
+	}
+}
+
+static int
+dt_difopt_branches(dt_difopt_t *dop)
+{
+	int changed = 0;
+	uint_t i;
+
+	dt_difopt_labels(dop);
+
+	for (i = 0; i < dop->dop_len; i++) {
+		dt_irnode_t *dip = dop->dop_ir[i];
+		uint_t op, lbl, t, n;
+
+		if (dip == NULL || DT_DOP_ISLABEL(dip))
+			continue;
+
+		if (!DT_DOP_ISBRANCH(op = DIF_INSTR_OP(dip->di_instr)))
+			continue;
+
+		/*
+		 * Follow the branch for as long as it lands on a branch that
+		 * is certain to be taken as well.  Branches do not change the
+		 * condition codes, so that includes a copy of the same
+		 * conditional branch.
+		 */
+		lbl = DIF_INSTR_LABEL(dip->di_instr);
+		t = dt_difopt_target(dop, lbl);
+
+		while (t < dop->dop_len) {
+			dif_instr_t instr = dop->dop_ir[t]->di_instr;
+
+			if (DIF_INSTR_OP(instr) != DIF_OP_BA &&
+			    (op == DIF_OP_BA || DIF_INSTR_OP(instr) != op))
+				break;
+
+			lbl = DIF_INSTR_LABEL(instr);
+			t = dt_difopt_target(dop, lbl);
+		}
+
+		if (lbl != DIF_INSTR_LABEL(dip->di_instr)) {
+			dip->di_instr = DIF_INSTR_BRANCH(op, lbl);
+			changed = 1;
+		}
+
+		n = dt_difopt_next(dop, i + 1);
+
+		if (t == n) {
+			dt_difopt_delete(dop, i);
+			changed = 1;
+			continue;
+		}
+
+		if (op == DIF_OP_BA) {
+			if (t < dop->dop_len && DIF_INSTR_OP(
+			    dop->dop_ir[t]->di_instr) == DIF_OP_RET) {
+				dip->di_instr = dop->dop_ir[t]->di_instr;
+				changed = 1;
+			}
+			continue;
+		}
+
+		/*
+		 * Turn "bCC 1f; ba 2f; 1:" into "b!CC 2f" unless the 'ba' is
+		 * itself the destination of another branch.
+		 */
+		if (n < dop->dop_len &&
+		    DIF_INSTR_OP(dop->dop_ir[n]->di_instr) == DIF_OP_BA &&
+		    !dt_difopt_isblock(dop, dop->dop_ir[n]) &&
+		    t == dt_difopt_next(dop, n + 1)) {
+			dip->di_instr = DIF_INSTR_BRANCH(dt_difopt_invert(op),
+			    DIF_INSTR_LABEL(dop->dop_ir[n]->di_instr));
+			dt_difopt_delete(dop, n);
+			changed = 1;
+		}
+	}
+
+	return (changed);
+}
+
+static int
+dt_difopt_reach(dt_difopt_t *dop)
+{
+	uint_t i, last = 0;
+	int changed = 0, reached = 1;
+
+	dt_difopt_labels(dop);
+
+	for (i = 0; i < dop->dop_len; i++) {
+		if (dop->dop_ir[i] != NULL && !DT_DOP_ISLABEL(dop->dop_ir[i]))
+			last = i;
+	}
+
+	for (i = 0; i < dop->dop_len; i++) {
+		dt_irnode_t *dip = dop->dop_ir[i];
+		uint_t op;
+
+		if (dip == NULL)
+			continue;
+
+		if (dt_difopt_isblock(dop, dip))
+			reached = 1;
+
+		if (DT_DOP_ISLABEL(dip))
+			continue;
+
+		if (!reached && i != last) {
+			dt_difopt_delete(dop, i);
+			changed = 1;
+			continue;
+		}
+
+		if ((op = DIF_INSTR_OP(dip->di_instr)) == DIF_OP_BA ||
+		    op == DIF_OP_RET)
+			reached = 0;
+	}
+
+	return (changed);
+}
+
+/*
+ * Value numbering.  Value number 0 is the constant zero held by %r0, and the
+ * other entries of dop_vals[] describe how their values were computed so that
+ * dt_difopt_lookup() can find a value that is computed again.
+ */
+static uint_t
+dt_difopt_value(dt_difopt_t *dop, uint_t op, uint64_t a, uint64_t b, int find)
+{
+	dt_dopval_t *dvp;
+	uint_t v;
+
+	if (find) {
+		for (v = 0; v < dop->dop_nvals; v++) {
+			dvp = &dop->dop_vals[v];
+
+			if (dvp->dov_valid && dvp->dov_op == op &&
+			    dvp->dov_a == a && dvp->dov_b == b)
+				return (v);
+		}
+	}
+
+	dvp = &dop->dop_vals[v = dop->dop_nvals++];
+	dvp->dov_op = op;
+	dvp->dov_valid = find;
+	dvp->dov_a = a;
+	dvp->dov_b = b;
+
+	return (v);
+}
+
+static uint_t
+dt_difopt_lookup(dt_difopt_t *dop, uint_t op, uint64_t a, uint64_t b)
+{
+	return (dt_difopt_value(dop, op, a, b, 1));
+}
+
+static uint_t
+dt_difopt_fresh(dt_difopt_t *dop)
+{
+	return (dt_difopt_value(dop, DIF_OP_NOP, 0, 0, 0));
+}
+
+/*
+ * Forget the loads of variable var by opcode op, or of every variable if op
+ * is DIF_OP_NOP, so that the next load of the variable is performed again.
+ * None of the subroutines reached by 'call' stores to a D variable today, but
+ * we do not rely on that: the loads on either side of a call are never
+ * merged.
+ */
+static void
+dt_difopt_forget(dt_difopt_t *dop, uint_t op, uint64_t var)
+{
+	uint_t v;
+
+	for (v = 0; v < dop->dop_nvals; v++) {
+		dt_dopval_t *dvp = &dop->dop_vals[v];
+
+		if (dvp->dov_op != DIF_OP_LDGS && dvp->dov_op != DIF_OP_LDTS &&
+		    dvp->dov_op != DIF_OP_LDLS)
+			continue;
+
+		if (op == DIF_OP_NOP || (dvp->dov_op == op && dvp->dov_a == var))
+			dvp->dov_valid = 0;
+	}
+}
+
+static int
+dt_difopt_isconst(const dt_difopt_t *dop, uint_t v, uint64_t *xp)
+{
+	if (dop->dop_vals[v].dov_op != DIF_OP_SETX)
+		return (0);
+
+	*xp = dop->dop_vals[v].dov_a;
+	return (1);
+}
+
+static void
+dt_difopt_set(dt_difopt_t *dop, uint_t r, uint_t v)
+{
+	dop->dop_vn[r] = v;
+	dop->dop_age[r] = ++dop->dop_clock;
+}
+
+static void
+dt_difopt_reset(dt_difopt_t *dop)
+{
+	uint_t r;
+
+	dop->dop_nvals = 0;
+	dop->dop_clock = 0;
+	dop->dop_ccvalid = 0;
+
+	(void) dt_difopt_lookup(dop, DIF_OP_SETX, 0, 0);
+	dop->dop_vn[0] = 0;
+	dop->dop_age[0] = 0;
+
+	for (r = 1; r < DIF_DIR_NREGS; r++)
+		dt_difopt_set(dop, r, dt_difopt_fresh(dop));
+}
+
+/*
+ * Return the register that has held value v for the longest time, so that
+ * reads converge on it and the moves to other registers become unused.
+ */
+static uint_t
+dt_difopt_holder(const dt_difopt_t *dop, uint_t v)
+{
+	uint_t r, h = DT_DOP_NONE;
+
+	for (r = 0; r < DIF_DIR_NREGS; r++) {
+		if (dop->dop_vn[r] == v &&
+		    (h == DT_DOP_NONE || dop->dop_age[r] < dop->dop_age[h]))
+			h = r;
+	}
+
+	return (h);
+}
+
+static int
+dt_difopt_fold(uint_t op, uint64_t a, uint64_t b, uint64_t *xp)
+{
+	switch (op) {
+	case DIF_OP_OR:
+		*xp = a | b;
+		break;
+	case DIF_OP_XOR:
+		*xp = a ^ b;
+		break;
+	case DIF_OP_AND:
+		*xp = a & b;
+		break;
+	case DIF_OP_SUB:
+		*xp = a - b;
+		break;
+	case DIF_OP_ADD:
+		*xp = a + b;
+		break;
+	case DIF_OP_MUL:
+		*xp = a * b;
+		break;
+	case DIF_OP_NOT:
+		*xp = ~a;
+		break;
+	case DIF_OP_SLL:
+	case DIF_OP_SRL:
+	case DIF_OP_SRA:
+		/*
+		 * The result of shifting by 64 or more depends on the machine
+		 * that executes the DIFO, so such shifts are left to it.
+		 */
+		if (b >= 64)
+			return (0);
+		if (op == DIF_OP_SLL)
+			*xp = a << b;
+		else if (op == DIF_OP_SRL)
+			*xp = a >> b;
+		else
+			*xp = (uint64_t)((int64_t)a >> b);
+		break;
+	case DIF_OP_SDIV:
+	case DIF_OP_SREM:
+		if (b == 0 || ((int64_t)a == INT64_MIN && (int64_t)b == -1))
+			return (0);
+		if (op == DIF_OP_SDIV)
+			*xp = (uint64_t)((int64_t)a / (int64_t)b);
+		else
+			*xp = (uint64_t)((int64_t)a % (int64_t)b);
+		break;
+	case DIF_OP_UDIV:
+	case DIF_OP_UREM:
+		if (b == 0)
+			return (0);
+		*xp = op == DIF_OP_UDIV ? a / b : a % b;
+		break;
+	default:
+		return (0);
+	}
+
+	return (1);
+}
+
+/*
+ * Simplify an operation with one constant operand, returning the value of
+ * the result if it is the other operand or zero, and DT_DOP_NONE otherwise.
+ */
+static uint_t
+dt_difopt_identity(const dt_difopt_t *dop, uint_t op, uint_t v1, uint_t v2)
+{
+	uint64_t x;
+
+	if (dt_difopt_isconst(dop, v2, &x)) {
+		switch (op) {
+		case DIF_OP_OR:
+		case DIF_OP_XOR:
+		case DIF_OP_SUB:
+		case DIF_OP_ADD:
+		case DIF_OP_SLL:
+		case DIF_OP_SRL:
+		case DIF_OP_SRA:
+			if (x == 0)
+				return (v1);
+			break;
+		case DIF_OP_AND:
+		case DIF_OP_MUL:
+			if (x == 0)
+				return (0);
+			if (x == 1 && op == DIF_OP_MUL)
+				return (v1);
+			break;
+		case DIF_OP_SDIV:
+		case DIF_OP_UDIV:
+			if (x == 1)
+				return (v1);
+			break;
+		}
+	}
+
+	if (dt_difopt_isconst(dop, v1, &x)) {
+		switch (op) {
+		case DIF_OP_OR:
+		case DIF_OP_XOR:
+		case DIF_OP_ADD:
+			if (x == 0)
+				return (v2);
+			break;
+		case DIF_OP_AND:
+		case DIF_OP_SLL:
+		case DIF_OP_SRL:
+		case DIF_OP_SRA:
+			if (x == 0)
+				return (0);
+			break;
+		case DIF_OP_MUL:
+			if (x == 0)
+				return (0);
+			if (x == 1)
+				return (v2);
+			break;
+		}
+	}
+
+	return (DT_DOP_NONE);
+}
+
+/*
+ * Return the index of integer x among the constants that we have folded,
+ * adding it if needed.  These are only entered into pcb_inttab by
+ * dt_difopt_finish() if a 'setx' still refers to them, so that intermediate
+ * results do not take up room in the DIFO.
+ */
+static int
+dt_difopt_int(dt_difopt_t *dop, uint64_t x)
+{
+	uint_t i;
+
+	for (i = dop->dop_nints; i < dop->dop_nints + dop->dop_nfold; i++) {
+		if (dop->dop_ints[i] == x)
+			return (i);
+	}
+
+	if (dop->dop_nfold == dop->dop_maxfold || i > DIF_INTOFF_MAX)
+		return (-1);
+
+	dop->dop_ints[i] = x;
+	dop->dop_nfold++;
+
+	return (i);
+}
+
+/*
+ * Evaluate a conditional branch on condition codes set by comparing a and b,
+ * as done by 'cmp' and (with b = 0) 'tst' in the DIF emulator.
+ */
+static int
+dt_difopt_taken(uint_t op, uint_t ccop, uint64_t a, uint64_t b)
+{
+	int64_t r = (int64_t)(a - b);
+	int n = 0, z, v = 0, c = 0;
+
+	if (ccop == DIF_OP_TST) {
+		z = a == 0;
+	} else {
+		n = r < 0;
+		z = r == 0;
+		c = a < b;
+	}
+
+	switch (op) {
+	case DIF_OP_BE:
+		return (z);
+	case DIF_OP_BNE:
+		return (!z);
+	case DIF_OP_BG:
+		return (!(z | (n ^ v)));
+	case DIF_OP_BGU:
+		return (!(c | z));
+	case DIF_OP_BGE:
+		return (!(n ^ v));
+	case DIF_OP_BGEU:
+		return (!c);
+	case DIF_OP_BL:
+		return (n ^ v);
+	case DIF_OP_BLU:
+		return (c);
+	case DIF_OP_BLE:
+		return (z | (n ^ v));
+	default:
+		assert(op == DIF_OP_BLEU);
+		return (c | z);
+	}
+}
+
+/*
+ * Number the value computed by the instruction at dop_ir[i], rewriting or
+ * removing the instruction if the value is known or already at hand.  Returns
+ * non-zero if the instruction list was changed.
+ */
+static int
+dt_difopt_number(dt_difopt_t *dop, uint_t i)
+{
+	dt_irnode_t *dip = dop->dop_ir[i];
+	dif_instr_t instr = dip->di_instr;
+	uint_t op = DIF_INSTR_OP(instr);
+	uint_t flags = dt_difopt_flags(dip);
+	uint_t r1 = DIF_INSTR_R1(instr);
+	uint_t r2 = DIF_INSTR_R2(instr);
+	uint_t rd = DIF_INSTR_RD(instr);
+	uint_t v1 = DT_DOP_NONE, v2 = DT_DOP_NONE, v = DT_DOP_NONE, h;
+	uint64_t x1 = 0, x2 = 0, x;
+	int changed = 0, c1 = 0, c2 = 0;
+	int idx;
+
+	/*
+	 * Read each operand from the register that has held its value for the
+	 * longest time.
+	 */
+	if (flags & DT_DOP_R1)
+		r1 = dt_difopt_holder(dop, dop->dop_vn[r1]);
+	if (flags & DT_DOP_R2)
+		r2 = dt_difopt_holder(dop, dop->dop_vn[r2]);
+	if (flags & DT_DOP_RS)
+		rd = dt_difopt_holder(dop, dop->dop_vn[rd]);
+
+	if (DIF_INSTR_FMT(op, r1, r2, rd) != instr) {
+		dip->di_instr = instr = DIF_INSTR_FMT(op, r1, r2, rd);
+		changed = 1;
+	}
+
+	if (flags & DT_DOP_R1) {
+		v1 = dop->dop_vn[r1];
+		c1 = dt_difopt_isconst(dop, v1, &x1);
+	}
+
+	if (flags & DT_DOP_R2) {
+		v2 = dop->dop_vn[r2];
+		c2 = dt_difopt_isconst(dop, v2, &x2);
+	}
+
+	switch (op) {
+	case DIF_OP_OR:
+	case DIF_OP_XOR:
+	case DIF_OP_AND:
+	case DIF_OP_SLL:
+	case DIF_OP_SRL:
+	case DIF_OP_SRA:
+	case DIF_OP_SUB:
+	case DIF_OP_ADD:
+	case DIF_OP_MUL:
+	case DIF_OP_SDIV:
+	case DIF_OP_UDIV:
+	case DIF_OP_SREM:
+	case DIF_OP_UREM:
+		if (c1 && c2 && dt_difopt_fold(op, x1, x2, &x))
+			v = dt_difopt_lookup(dop, DIF_OP_SETX, x, 0);
+		else if ((v = dt_difopt_identity(dop, op, v1, v2)) ==
+		    DT_DOP_NONE)
+			v = dt_difopt_lookup(dop, op, v1, v2);
+		break;
+	case DIF_OP_NOT:
+		if (c1 && dt_difopt_fold(op, x1, 0, &x))
+			v = dt_difopt_lookup(dop, DIF_OP_SETX, x, 0);
+		else
+			v = dt_difopt_lookup(dop, op, v1, 0);
+		break;
+	case DIF_OP_MOV:
+		v = v1;
+		break;
+	case DIF_OP_SETX:
+		if (dip->di_extern == NULL) {
+			v = dt_difopt_lookup(dop, DIF_OP_SETX,
+			    dop->dop_ints[DIF_INSTR_INTEGER(instr)], 0);
+		}
+		break;
+	case DIF_OP_SETS:
+		v = dt_difopt_lookup(dop, op, DIF_INSTR_STRING(instr), 0);
+		break;
+	case DIF_OP_LDGS:
+	case DIF_OP_LDTS:
+	case DIF_OP_LDLS:
+		if (flags & DT_DOP_PURE)
+			v = dt_difopt_lookup(dop, op, DIF_INSTR_VAR(instr), 0);
+		break;
+#if defined(DIF_OP_STRIP)
+	case DIF_OP_STRIP:
+		v = dt_difopt_lookup(dop, op, v1, DIF_INSTR_IMM2(instr));
+		break;
+#endif /* defined(DIF_OP_STRIP) */
+
+	case DIF_OP_STGS:
+	case DIF_OP_STTS:
+	case DIF_OP_STLS:
+		dt_difopt_forget(dop, op == DIF_OP_STGS ? DIF_OP_LDGS :
+		    op == DIF_OP_STTS ? DIF_OP_LDTS : DIF_OP_LDLS,
+		    DIF_INSTR_VAR(instr));
+		return (changed);
+
+	case DIF_OP_CALL:
+		dt_difopt_forget(dop, DIF_OP_NOP, 0);
+		break;
+
+	case DIF_OP_CMP:
+	case DIF_OP_TST:
+		if (op == DIF_OP_TST)
+			v2 = DT_DOP_NONE;
+
+		if (dop->dop_ccvalid && dop->dop_ccop == op &&
+		    dop->dop_cca == v1 && dop->dop_ccb == v2) {
+			dt_difopt_delete(dop, i);
+			return (1);
+		}
+
+		dop->dop_ccvalid = 1;
+		dop->dop_ccop = op;
+		dop->dop_cca = v1;
+		dop->dop_ccb = v2;
+		return (changed);
+
+	case DIF_OP_SCMP:
+		dop->dop_ccvalid = 0;
+		return (changed);
+
+	case DIF_OP_BE:
+	case DIF_OP_BNE:
+	case DIF_OP_BG:
+	case DIF_OP_BGU:
+	case DIF_OP_BGE:
+	case DIF_OP_BGEU:
+	case DIF_OP_BL:
+	case DIF_OP_BLU:
+	case DIF_OP_BLE:
+	case DIF_OP_BLEU:
+		if (!dop->dop_ccvalid ||
+		    !dt_difopt_isconst(dop, dop->dop_cca, &x1) ||
+		    (dop->dop_ccop == DIF_OP_CMP &&
+		    !dt_difopt_isconst(dop, dop->dop_ccb, &x2)))
+			return (changed);
+
+		if (dop->dop_ccop == DIF_OP_TST)
+			x2 = 0;
+
+		if (dt_difopt_taken(op, dop->dop_ccop, x1, x2)) {
+			dip->di_instr = DIF_INSTR_BRANCH(DIF_OP_BA,
+			    DIF_INSTR_LABEL(instr));
+		} else
+			dt_difopt_delete(dop, i);
+		return (1);
+	}
+
+	if (!(flags & DT_DOP_RD))
+		return (changed);
+
+	if (v == DT_DOP_NONE) {
+		dt_difopt_set(dop, rd, dt_difopt_fresh(dop));
+		return (changed);
+	}
+
+	/*
+	 * The value is known.  If the destination already holds it, the
+	 * instruction does nothing.  Otherwise, copy the value from another
+	 * register if one holds it, or load a folded constant.  Only division
+	 * and remainder have an effect besides their result, which is to
+	 * abort on a zero divisor, and an earlier instruction that computed
+	 * the same quotient has already checked that.
+	 */
+	if (dop->dop_vn[rd] == v) {
+		dt_difopt_delete(dop, i);
+		return (1);
+	}
+
+	if ((h = dt_difopt_holder(dop, v)) != DT_DOP_NONE) {
+		if (instr != DIF_INSTR_MOV(h, rd)) {
+			dip->di_instr = DIF_INSTR_MOV(h, rd);
+			changed = 1;
+		}
+	} else if (dt_difopt_isconst(dop, v, &x) && op != DIF_OP_SETX &&
+	    (idx = dt_difopt_int(dop, x)) != -1) {
+		dip->di_instr = DIF_INSTR_SETX((uint_t)idx, rd);
+		changed = 1;
+	}
+
+	dt_difopt_set(dop, rd, v);
+	return (changed);
+}
+
+static int
+dt_difopt_local(dt_difopt_t *dop)
+{
+	int changed = 0;
+	uint_t i, op;
+
+	dt_difopt_labels(dop);
+	dt_difopt_reset(dop);
+
+	for (i = 0; i < dop->dop_len; i++) {
+		dt_irnode_t *dip = dop->dop_ir[i];
+
+		if (dip == NULL)
+			continue;
+
+		if (dt_difopt_isblock(dop, dip))
+			dt_difopt_reset(dop);
+
+		if (DT_DOP_ISLABEL(dip))
+			continue;
+
+		if (dt_difopt_number(dop, i))
+			changed = 1;
+
+		if ((dip = dop->dop_ir[i]) == NULL || DT_DOP_ISLABEL(dip))
+			continue;
+
+		if ((op = DIF_INSTR_OP(dip->di_instr)) == DIF_OP_BA ||
+		    op == DIF_OP_RET)
+			dt_difopt_reset(dop);
+	}
+
+	return (changed);
+}
+
+static int
+dt_difopt_dead(dt_difopt_t *dop)
+{
+	uint_t i, live = 0, last = dop->dop_len;
+	int changed = 0;
+
+	dt_difopt_labels(dop);
+
+	for (i = dop->dop_len; i-- != 0; ) {
+		dt_irnode_t *dip = dop->dop_ir[i];
+		uint_t op, flags, out, defs;
+
+		if (dip == NULL)
+			continue;
+
+		if (DT_DOP_ISLABEL(dip)) {
+			dop->dop_live[i] = live;
+			continue;
+		}
+
+		op = DIF_INSTR_OP(dip->di_instr);
+		flags = dt_difopt_flags(dip);
+
+		if (op == DIF_OP_RET) {
+			out = 0;
+		} else if (DT_DOP_ISBRANCH(op)) {
+			out = dop->dop_live[dop->dop_lblpos[
+			    DIF_INSTR_LABEL(dip->di_instr)]];
+			if (op != DIF_OP_BA)
+				out |= live;
+		} else
+			out = live;
+
+		defs = dt_difopt_defs(dip->di_instr, flags);
+
+		if ((flags & DT_DOP_PURE) && (defs & out) == 0 &&
+		    last != dop->dop_len) {
+			dt_difopt_delete(dop, i);
+			dop->dop_live[i] = live = out;
+			changed = 1;
+			continue;
+		}
+
+		last = i;
+		live = (out & ~defs) | dt_difopt_uses(dip->di_instr, flags);
+		dop->dop_live[i] = live;
+	}
+
+	return (changed);
+}
+
+/*
+ * Check that we understand every instruction and that every branch goes
+ * forward to a label that is declared, as dt_cg() always does.
+ */
+static int
+dt_difopt_check(dt_difopt_t *dop)
+{
+	uint_t i, r, flags, op;
+
+	for (i = 0; i < dop->dop_nlabels; i++)
+		dop->dop_lblpos[i] = DT_DOP_NONE;
+
+	for (i = 0; i < dop->dop_len; i++) {
+		dt_irnode_t *dip = dop->dop_ir[i];
+
+		if (dip->di_label >= dop->dop_nlabels ||
+		    (dip->di_label != DT_LBL_NONE &&
+		    dop->dop_lblpos[dip->di_label] != DT_DOP_NONE))
+			return (-1);
+
+		if (dip->di_label != DT_LBL_NONE)
+			dop->dop_lblpos[dip->di_label] = i;
+	}
+
+	for (i = 0; i < dop->dop_len; i++) {
+		dt_irnode_t *dip = dop->dop_ir[i];
+
+		if (DT_DOP_ISLABEL(dip))
+			continue;
+
+		if ((flags = dt_difopt_flags(dip)) & DT_DOP_OPAQUE)
+			return (-1);
+
+		if (((flags & DT_DOP_R1) &&
+		    DIF_INSTR_R1(dip->di_instr) >= DIF_DIR_NREGS) ||
+		    ((flags & DT_DOP_R2) &&
+		    DIF_INSTR_R2(dip->di_instr) >= DIF_DIR_NREGS) ||
+		    ((flags & (DT_DOP_RS | DT_DOP_RD)) &&
+		    DIF_INSTR_RD(dip->di_instr) >= DIF_DIR_NREGS))
+			return (-1);
+
+		if ((flags & DT_DOP_RD) && DIF_INSTR_RD(dip->di_instr) == 0)
+			return (-1);
+
+		if (DT_DOP_ISBRANCH(op = DIF_INSTR_OP(dip->di_instr))) {
+			r = DIF_INSTR_LABEL(dip->di_instr);
+
+			if (r == DT_LBL_NONE || r >= dop->dop_nlabels ||
+			    dop->dop_lblpos[r] == DT_DOP_NONE ||
+			    dop->dop_lblpos[r] <= i ||
+			    dt_difopt_target(dop, r) == dop->dop_len)
+				return (-1);
+		}
+	}
+
+	return (0);
+}
+
+/*
+ * Link the remaining nodes back into the instruction list, dropping the
+ * labels that are no longer referenced and entering the folded constants
+ * that are still in use into the integer table.
+ */
+static int
+dt_difopt_finish(dt_difopt_t *dop)
+{
+	dt_irlist_t *dlp = &dop->dop_pcb->pcb_ir;
+	dt_irnode_t *dip, **pp = &dlp->dl_list;
+	uint_t i, idx;
+	int rv = 0, off;
+
+	dt_difopt_labels(dop);
+
+	dlp->dl_last = NULL;
+	dlp->dl_len = 0;
+
+	for (i = 0; i < dop->dop_len; i++) {
+		if ((dip = dop->dop_ir[i]) == NULL)
+			continue;
+
+		if (dip->di_label != DT_LBL_NONE &&
+		    dop->dop_lblrefs[dip->di_label] == 0) {
+			if (DT_DOP_ISLABEL(dip)) {
+				free(dip);
+				continue;
+			}
+			dip->di_label = DT_LBL_NONE;
+		}
+
+		if (DIF_INSTR_OP(dip->di_instr) == DIF_OP_SETX &&
+		    (idx = DIF_INSTR_INTEGER(dip->di_instr)) >= dop->dop_nints) {
+			off = dt_inttab_insert(dop->dop_pcb->pcb_inttab,
+			    dop->dop_ints[idx], DT_INT_SHARED);
+
+			if (off == -1 || off > DIF_INTOFF_MAX)
+				rv = off == -1 ? EDT_NOMEM : EDT_INT2BIG;
+			else {
+				dip->di_instr = DIF_INSTR_SETX((uint_t)off,
+				    DIF_INSTR_RD(dip->di_instr));
+			}
+		}
+
+		if (!DT_DOP_ISLABEL(dip))
+			dlp->dl_len++;
+
+		*pp = dlp->dl_last = dip;
+		pp = &dip->di_next;
+	}
+
+	*pp = NULL;
+	return (rv);
+}
+
+void
+dt_difopt(dt_pcb_t *pcb)
+{
+	dtrace_hdl_t *dtp = pcb->pcb_hdl;
+	dt_irlist_t *dlp = &pcb->pcb_ir;
+	dt_difopt_t dop;
+	dt_irnode_t *dip;
+	uint_t i, n = 0;
+	int err, pass;
+
+	for (dip = dlp->dl_list; dip != NULL; dip = dip->di_next)
+		n++;
+
+	if (n == 0)
+		return;
+
+	bzero(&dop, sizeof (dop));
+	dop.dop_pcb = pcb;
+	dop.dop_len = n;
+	dop.dop_nlabels = dlp->dl_label;
+	dop.dop_nints = dt_inttab_size(pcb->pcb_inttab);
+	dop.dop_maxfold = n;
+
+	dop.dop_ir = dt_alloc(dtp, sizeof (dt_irnode_t *) * n);
+	dop.dop_lblpos = dt_alloc(dtp, sizeof (uint_t) * dop.dop_nlabels);
+	dop.dop_lblrefs = dt_alloc(dtp, sizeof (uint_t) * dop.dop_nlabels);
+	dop.dop_live = dt_alloc(dtp, sizeof (uint_t) * n);
+	dop.dop_ints = dt_alloc(dtp, sizeof (uint64_t) * (dop.dop_nints + n));
+	dop.dop_vals = dt_alloc(dtp,
+	    sizeof (dt_dopval_t) * (n + DIF_DIR_NREGS + 1));
+
+	/*
+	 * The optimizer is only an improvement: if we can't get the memory
+	 * that it needs, the list is assembled as it is.
+	 */
+	if (dop.dop_ir == NULL || dop.dop_lblpos == NULL ||
+	    dop.dop_lblrefs == NULL || dop.dop_live == NULL ||
+	    dop.dop_ints == NULL || dop.dop_vals == NULL)
+		goto out;
+
+	for (i = 0, dip = dlp->dl_list; dip != NULL; dip = dip->di_next)
+		dop.dop_ir[i++] = dip;
+
+	if (dt_difopt_check(&dop) != 0) {
+		dt_dprintf("DIF optimizer skipped unexpected code\n");
+		goto out;
+	}
+
+	dt_inttab_write(pcb->pcb_inttab, dop.dop_ints);
+
+	for (pass = 0; pass < DT_DOP_MAXPASS; pass++) {
+		int changed = 0;
+
+		changed |= dt_difopt_branches(&dop);
+		changed |= dt_difopt_reach(&dop);
+		changed |= dt_difopt_local(&dop);
+		changed |= dt_difopt_dead(&dop);
+
+		if (!changed)
+			break;
+	}
+
+	err = dt_difopt_finish(&dop);
+
+	dt_free(dtp, dop.dop_ir);
+	dt_free(dtp, dop.dop_lblpos);
+	dt_free(dtp, dop.dop_lblrefs);
+	dt_free(dtp, dop.dop_live);
+	dt_free(dtp, dop.dop_ints);
+	dt_free(dtp, dop.dop_vals);
+
+	if (err != 0)
+		longjmp(pcb->pcb_jmpbuf, err);
+	return;
+out:
+	dt_free(dtp, dop.dop_ir);
+	dt_free(dtp, dop.dop_lblpos);
+	dt_free(dtp, dop.dop_lblrefs);
+	dt_free(dtp, dop.dop_live);
+	dt_free(dtp, dop.dop_ints);
+	dt_free(dtp, dop.dop_vals);
+}
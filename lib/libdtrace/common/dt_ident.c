@@ -636,17 +636,20 @@ dt_idhash_create(const char *name, const dt_ident_t *tmpl,
     uint_t min, uint_t max)
 {
 	dt_idhash_t *dhp;
-	size_t size;
 
 	assert(min <= max);
 
-	size = sizeof (dt_idhash_t) +
-	    sizeof (dt_ident_t *) * (_dtrace_strbuckets - 1);
+	if ((dhp = malloc(sizeof (dt_idhash_t))) == NULL)
+		return (NULL);
+
+	bzero(dhp, sizeof (dt_idhash_t));
 
-	if ((dhp = malloc(size)) == NULL)
+	if ((dhp->dh_hash = calloc(_dtrace_strbuckets,
+	    sizeof (dt_ident_t *))) == NULL) {
+		free(dhp);
 		return (NULL);
+	}
 
-	bzero(dhp, size);
 	dhp->dh_name = name;
 	dhp->dh_tmpl = tmpl;
 	dhp->dh_nextid = min;
@@ -687,6 +690,7 @@ dt_idhash_destroy(dt_idhash_t *dhp)
 		}
 	}
 
+	free(dhp->dh_hash);
 	free(dhp);
 }
 
@@ -753,6 +757,36 @@ dt_idhash_name(const dt_idhash_t *dhp)
 	return (dhp->dh_name);
 }
 
+/*
+ * Double the number of buckets once the hash chains average DT_IDHASH_LOAD
+ * identifiers, so that hashes holding many identifiers (such as the probes of
+ * a pid provider instrumenting a large binary) keep their chains short.  If
+ * the larger bucket array can't be allocated, we carry on with the old one.
+ */
+static void
+dt_idhash_grow(dt_idhash_t *dhp)
+{
+	ulong_t i, h, hashsz = dhp->dh_hashsz * 2 + 1;
+	dt_ident_t **hash, *idp, *next;
+
+	if (dhp->dh_nelems < dhp->dh_hashsz * DT_IDHASH_LOAD ||
+	    (hash = calloc(hashsz, sizeof (dt_ident_t *))) == NULL)
+		return;
+
+	for (i = 0; i < dhp->dh_hashsz; i++) {
+		for (idp = dhp->dh_hash[i]; idp != NULL; idp = next) {
+			next = idp->di_next;
+			h = dt_strtab_hash(idp->di_name, NULL) % hashsz;
+			idp->di_next = hash[h];
+			hash[h] = idp;
+		}
+	}
+
+	free(dhp->dh_hash);
+	dhp->dh_hash = hash;
+	dhp->dh_hashsz = hashsz;
+}
+
 dt_ident_t *
 dt_idhash_insert(dt_idhash_t *dhp, const char *name, ushort_t kind,
     ushort_t flags, uint_t id, dtrace_attribute_t attr, uint_t vers,
@@ -770,6 +804,8 @@ dt_idhash_insert(dt_idhash_t *dhp, const char *name, ushort_t kind,
 	if (idp == NULL)
 		return (NULL);
 
+	dt_idhash_grow(dhp);
+
 	h = dt_strtab_hash(name, NULL) % dhp->dh_hashsz;
 	idp->di_next = dhp->dh_hash[h];
 
@@ -790,6 +826,8 @@ dt_idhash_xinsert(dt_idhash_t *dhp, dt_ident_t *idp)
 	if (dhp->dh_tmpl != NULL)
 		dt_idhash_populate(dhp); /* fill hash w/ initial population */
 
+	dt_idhash_grow(dhp);
+
 	h = dt_strtab_hash(idp->di_name, NULL) % dhp->dh_hashsz;
 	idp->di_next = dhp->dh_hash[h];
 	idp->di_flags &= ~DT_IDFLG_ORPHAN;
@@ -120,10 +120,12 @@ typedef struct dt_idhash {
 	uint_t dh_minid;	/* min id to be returned by idhash_nextid() */
 	uint_t dh_maxid;	/* max id to be returned by idhash_nextid() */
 	ulong_t dh_nelems;	/* number of identifiers in hash table */
-	ulong_t dh_hashsz;	/* number of entries in dh_buckets array */
-	dt_ident_t *dh_hash[1];	/* array of hash table bucket pointers */
+	ulong_t dh_hashsz;	/* number of entries in dh_hash array */
+	dt_ident_t **dh_hash;	/* array of hash table bucket pointers */
 } dt_idhash_t;
 
+#define	DT_IDHASH_LOAD	2	/* mean chain length at which dh_hash grows */
+
 typedef struct dt_idstack {
 	dt_list_t dids_list;	/* list meta-data for dt_idhash_t stack */
 } dt_idstack_t;
@@ -100,6 +100,7 @@ extern "C" {
 #include <dt_dof.h>
 #include <dt_pcb.h>
 #include <dt_pq.h>
+#include <dt_pp.h>
 
 struct dt_module;		/* see below */
 struct dt_pfdict;		/* see <dt_printf.h> */
@@ -183,26 +184,91 @@ typedef struct dt_module {
 #define	DT_DM_KERNEL	0x2	/* module is associated with a kernel object */
 #define	DT_DM_PRIMARY	0x4	/* module is a krtld primary kernel object */
 
+/*
+ * A kernel address range whose symbol (or, failing that, containing module)
+ * has been resolved.  The ranges are kept sorted by address in dt_ksyms so
+ * that subsequent addresses within them are resolved by a binary search.
+ */
+typedef struct dt_ksym {
+	GElf_Addr dks_addr;	/* base address of range */
+	GElf_Xword dks_size;	/* size in bytes of range */
+	uint_t dks_flags;	/* range flags (see below) */
+	GElf_Sym dks_sym;	/* symbol containing range */
+	char *dks_name;		/* name of symbol */
+	char *dks_object;	/* name of module containing range */
+} dt_ksym_t;
+
+#define	DT_KSYM_SYM	0x1	/* dks_sym and dks_name are valid */
+
 typedef struct dt_provmod {
 	char *dp_name;				/* name of provider module */
 	struct dt_provmod *dp_next;		/* next module */
 } dt_provmod_t;
 
+/*
+ * An aggregation hash entry.  The aggregation data (key and value records)
+ * is allocated along with the entry and immediately follows it in memory;
+ * dtahe_data.dtada_data points there.  If per-CPU data is kept, the array of
+ * per-CPU pointers and the values they point to are a single allocation.
+ */
 typedef struct dt_ahashent {
-	struct dt_ahashent *dtahe_prev;		/* prev on hash chain */
-	struct dt_ahashent *dtahe_next;		/* next on hash chain */
 	struct dt_ahashent *dtahe_prevall;	/* prev on list of all */
 	struct dt_ahashent *dtahe_nextall;	/* next on list of all */
 	uint64_t dtahe_hashval;			/* hash value */
+	uint64_t dtahe_gen;			/* generation of last change */
 	size_t dtahe_size;			/* size of data */
 	dtrace_aggdata_t dtahe_data;		/* data */
 	void (*dtahe_aggregate)(int64_t *, int64_t *, size_t); /* function */
 } dt_ahashent_t;
 
+/*
+ * The aggregation hash is an open-addressed, linearly probed table.  Each
+ * slot caches the hash value of its entry so that probing only touches the
+ * slot array until a candidate with a matching hash value is found.
+ */
+typedef struct dt_ahashslot {
+	uint64_t	dtahs_hashval;		/* hash value of entry */
+	dt_ahashent_t	*dtahs_ent;		/* entry (NULL if slot is free) */
+} dt_ahashslot_t;
+
+/*
+ * Aggregation hash entries and their per-CPU data are allocated from an arena
+ * that belongs to the hash.  Small blocks are carved out of chunks that each
+ * hold blocks of a single size class, and are recycled through a free list
+ * kept by their chunk; large blocks get a chunk of their own.  Each chunk
+ * counts its blocks in use and is released as soon as the last of them is
+ * freed, so that removing entries (e.g. with trunc()) gives memory back as it
+ * goes.  An empty chunk is only kept if it is the last one of its size class
+ * with room, so that a hash that shrinks and grows again doesn't thrash.
+ */
+#define	DT_AGGARENA_QUANTUM	16		/* size class granularity */
+#define	DT_AGGARENA_NCLASS	256		/* number of size classes */
+#define	DT_AGGARENA_CHUNKSIZE	(64 * 1024)	/* shared chunk size/alignment */
+
+typedef struct dt_aggchunk {
+	struct dt_aggchunk *dtac_prev;		/* prev chunk on list */
+	struct dt_aggchunk *dtac_next;		/* next chunk on list */
+	size_t dtac_size;			/* usable size of chunk */
+	size_t dtac_used;			/* bytes carved from chunk */
+	void *dtac_free;			/* free blocks of chunk */
+	uint_t dtac_class;			/* size class (0 if large) */
+	uint_t dtac_nalloc;			/* number of blocks in use */
+} dt_aggchunk_t;
+
+typedef struct dt_aggarena {
+	dt_aggchunk_t *dtaa_avail[DT_AGGARENA_NCLASS]; /* chunks with room */
+	dt_aggchunk_t *dtaa_full;		/* shared chunks without room */
+	dt_aggchunk_t *dtaa_large;		/* chunks of large blocks */
+	size_t dtaa_nalloc;			/* number of blocks in use */
+	size_t dtaa_size;			/* bytes of chunks held */
+} dt_aggarena_t;
+
 typedef struct dt_ahash {
-	dt_ahashent_t	**dtah_hash;		/* hash table */
+	dt_ahashslot_t	*dtah_hash;		/* hash table */
 	dt_ahashent_t	*dtah_all;		/* list of all elements */
-	size_t		dtah_size;		/* size of hash table */
+	size_t		dtah_size;		/* size of hash table (power of 2) */
+	size_t		dtah_nelems;		/* number of elements in table */
+	dt_aggarena_t	dtah_arena;		/* storage for entries */
 } dt_ahash_t;
 
 typedef struct dt_aggregate {
@@ -213,6 +279,11 @@ typedef struct dt_aggregate {
 	processorid_t dtat_ncpu;	/* size of dtat_cpus array */
 	processorid_t dtat_maxcpu;	/* maximum number of CPUs */
 	dt_ahash_t dtat_hash;		/* aggregate hash table */
+	dtrace_aggvarid_t dtat_truncid;	/* variable being truncated */
+	uint64_t dtat_trunc;		/* entries kept by truncation */
+	uint64_t dtat_gen;		/* generation of last snapshot */
+	uint64_t *dtat_printgen;	/* per-variable generation printed */
+	dtrace_aggvarid_t dtat_nprintgen; /* size of dtat_printgen array */
 } dt_aggregate_t;
 
 typedef struct dt_print_aggdata {
@@ -234,6 +305,7 @@ typedef struct dt_lib_depend {
 	dt_list_t dtld_deplist;		/* linked-list forward/back pointers */
 	char *dtld_library;		/* library name */
 	char *dtld_libpath;		/* library pathname */
+	char *dtld_name;		/* name given to #pragma depends_on */
 	uint_t dtld_finish;		/* completion time in tsort for lib */
 	uint_t dtld_start;		/* starting time in tsort for lib */
 	uint_t dtld_loaded;		/* boolean: is this library loaded */
@@ -243,6 +315,9 @@ typedef struct dt_lib_depend {
 
 typedef uint32_t dt_version_t;		/* encoded version (see below) */
 
+#define	DT_BUFPOOL_MAX	4	/* max principal buffers kept for reuse */
+#define	DT_BUFFERED_MINSIZE	4096	/* initial size of buffered output */
+
 struct dtrace_hdl {
 	const dtrace_vector_t *dt_vector; /* library vector, if vectored open */
 	void *dt_varg;	/* vector argument, if vectored open */
@@ -264,6 +339,11 @@ struct dtrace_hdl {
 	dt_module_t **dt_mods;	/* hash table of dt_module_t's */
 	uint_t dt_modbuckets;	/* number of module hash buckets */
 	uint_t dt_nmods;	/* number of modules in hash and list */
+	dt_module_t **dt_modtext; /* modules with text sorted by address */
+	uint_t dt_nmodtext;	/* number of modules in dt_modtext */
+	dt_ksym_t **dt_ksyms;	/* resolved kernel ranges sorted by address */
+	uint_t dt_nksyms;	/* number of ranges in dt_ksyms */
+	uint_t dt_ksymsz;	/* size of dt_ksyms array */
 	dt_provmod_t *dt_provmod; /* linked list of provider modules */
 	dt_module_t *dt_exec;	/* pointer to executable module */
 	dt_module_t *dt_rtld;	/* pointer to run-time linker module */
@@ -294,6 +374,8 @@ struct dtrace_hdl {
 	char **dt_strdata;	/* pointer to strdata array */
 	dt_aggregate_t dt_aggregate; /* aggregate */
 	dt_pq_t *dt_bufq;	/* CPU-specific data queue */
+	struct dt_bufent *dt_bufpool[DT_BUFPOOL_MAX]; /* reusable buffers */
+	int dt_nbufpool;	/* number of buffers in dt_bufpool */
 	struct dt_pfdict *dt_pfdict; /* dictionary of printf conversions */
 	dt_version_t dt_vmax;	/* optional ceiling on program API binding */
 	dtrace_attribute_t dt_amin; /* optional floor on program attributes */
@@ -301,11 +383,21 @@ struct dtrace_hdl {
 	char **dt_cpp_argv;	/* argument vector for exec'ing cpp(1) */
 	int dt_cpp_argc;	/* count of initialized cpp(1) arguments */
 	int dt_cpp_args;	/* size of dt_cpp_argv[] array */
+	dt_pp_t *dt_pp;		/* in-process preprocessor for dt_pp_args */
+	char *dt_pp_args;	/* cpp(1) arguments dt_pp was created for */
+	uint_t dt_cppinproc;	/* boolean: preprocess in process */
+	uint_t dt_cppexec;	/* boolean: always exec cpp(1) */
 	char *dt_ld_path;	/* pathname of ld(1) to invoke if needed */
 	dt_list_t dt_lib_path;	/* linked-list forming library search path */
 	uint_t dt_nojtanalysis;	/* boolean:  set via -xnojtanalysis */
+	uint_t dt_nodifopt;	/* boolean:  set via -xnodifopt */
+	uint_t dt_nolibcache;	/* boolean:  set via -xnolibcache */
+	uint_t dt_ctfcache;	/* boolean:  set via -xctfcache */
+	uint_t dt_difstats;	/* boolean:  set via -xdifstats */
 	uint_t dt_lazyload;	/* boolean:  set via -xlazyload */
 	uint_t dt_droptags;	/* boolean:  set via -xdroptags */
+	uint_t dt_aggsnapthreads; /* threads for aggregation snapshots */
+	uint_t dt_pidthreads;	/* threads for pid probe site decoding */
 	uint_t dt_active;	/* boolean:  set once tracing is active */
 	uint_t dt_stopped;	/* boolean:  set once tracing is stopped */
 	processorid_t dt_beganon; /* CPU that executed BEGIN probe (if any) */
@@ -346,6 +438,7 @@ struct dtrace_hdl {
 	hrtime_t dt_lastagg;	/* last snapshot of aggregation data */
 	char *dt_sprintf_buf;	/* buffer for dtrace_sprintf() */
 	int dt_sprintf_buflen;	/* length of dtrace_sprintf() buffer */
+	int dt_sprintf_bufoffs;	/* length of string in dtrace_sprintf() buffer */
 	const char *dt_filetag;	/* default filetag for dt_set_errmsg() */
 	char *dt_buffered_buf;	/* buffer for buffered output */
 	size_t dt_buffered_offs; /* current offset into buffered buffer */
@@ -634,6 +727,10 @@ extern int dt_status(dtrace_hdl_t *, processorid_t);
 extern long dt_sysconf(dtrace_hdl_t *, int);
 extern ssize_t dt_write(dtrace_hdl_t *, int, const void *, size_t);
 extern int dt_printf(dtrace_hdl_t *, FILE *, const char *, ...);
+extern int dt_printf_str(dtrace_hdl_t *, FILE *, const char *, size_t);
+
+#define	DT_FORMAT_INTLEN	24	/* max length of dt_format_int() output */
+extern int dt_format_int(char *, const char *, uint64_t);
 
 extern void *dt_zalloc(dtrace_hdl_t *, size_t);
 extern void *dt_alloc(dtrace_hdl_t *, size_t);
@@ -645,12 +742,14 @@ extern char *dt_basename(char *);
 
 extern ulong_t dt_popc(ulong_t);
 extern ulong_t dt_popcb(const ulong_t *, ulong_t);
+extern uint64_t dt_hash64(const void *, size_t, uint64_t);
 
 extern int dt_buffered_enable(dtrace_hdl_t *);
 extern int dt_buffered_flush(dtrace_hdl_t *, dtrace_probedata_t *,
     const dtrace_recdesc_t *, const dtrace_aggdata_t *, uint32_t flags);
 extern void dt_buffered_disable(dtrace_hdl_t *);
 extern void dt_buffered_destroy(dtrace_hdl_t *);
+extern void dt_consume_destroy(dtrace_hdl_t *);
 
 extern int dt_rw_read_held(pthread_rwlock_t *);
 extern int dt_rw_write_held(pthread_rwlock_t *);
@@ -691,17 +790,20 @@ extern void dt_pragma(dt_node_t *);
 extern int dt_reduce(dtrace_hdl_t *, dt_version_t);
 extern void dt_cg(dt_pcb_t *, dt_node_t *);
 extern dtrace_difo_t *dt_as(dt_pcb_t *);
+extern void dt_difopt(dt_pcb_t *);
 extern void dt_dis(const dtrace_difo_t *, FILE *);
 
 extern int dt_aggregate_go(dtrace_hdl_t *);
 extern int dt_aggregate_init(dtrace_hdl_t *);
 extern void dt_aggregate_destroy(dtrace_hdl_t *);
+extern void dt_aggregate_printed(dtrace_hdl_t *, dtrace_aggvarid_t);
 
 extern int dt_epid_lookup(dtrace_hdl_t *, dtrace_epid_t,
     dtrace_eprobedesc_t **, dtrace_probedesc_t **);
 extern void dt_epid_destroy(dtrace_hdl_t *);
 extern int dt_aggid_lookup(dtrace_hdl_t *, dtrace_aggid_t, dtrace_aggdesc_t **);
 extern void dt_aggid_destroy(dtrace_hdl_t *);
+extern void dt_map_prefetch(dtrace_hdl_t *);
 
 extern void *dt_format_lookup(dtrace_hdl_t *, int);
 extern void dt_format_destroy(dtrace_hdl_t *);
@@ -751,6 +853,7 @@ extern const dtrace_pattr_t _dtrace_prvdesc;	 /* provider attribute bundle */
 
 extern const dt_version_t _dtrace_versions[];	 /* array of valid versions */
 extern const char *const _dtrace_version;	 /* current version string */
+extern const char *_dtrace_defcpp;		 /* default cpp(1) to invoke */
 
 extern int _dtrace_strbuckets;		/* number of hash buckets for strings */
 extern int _dtrace_intbuckets;		/* number of hash buckets for ints */
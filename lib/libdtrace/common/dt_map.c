@@ -38,6 +38,8 @@
 #include <dt_impl.h>
 #include <dt_printf.h>
 
+#define	DT_MAP_NRECS	8	/* records described by the first ioctl */
+
 static int
 dt_strdata_add(dtrace_hdl_t *dtp, dtrace_recdesc_t *rec, void ***data, int *max)
 {
@@ -115,8 +117,9 @@ dt_epid_add(dtrace_hdl_t *dtp, dtrace_epid_t id)
 {
 	dtrace_id_t max;
 	int rval, i;
-	dtrace_eprobedesc_t *enabled, *nenabled;
-	dtrace_probedesc_t *probe;
+	size_t psize, size;
+	dtrace_eprobedesc_t *enabled;
+	dtrace_probedesc_t *probe, *nprobe;
 
 	while (id >= (max = dtp->dt_maxprobe) || dtp->dt_pdesc == NULL) {
 		dtrace_id_t new_max = max ? (max << 1) : 1;
@@ -151,47 +154,52 @@ dt_epid_add(dtrace_hdl_t *dtp, dtrace_epid_t id)
 	if (dtp->dt_pdesc[id] != NULL)
 		return (0);
 
-	if ((enabled = malloc(sizeof (dtrace_eprobedesc_t))) == NULL)
+	/*
+	 * The probe description and the enabled probe description are kept
+	 * in a single allocation, with the latter following the former.  We
+	 * start out with room for DT_MAP_NRECS records, which is enough for
+	 * most enablings to be described by a single ioctl.
+	 */
+	psize = P2ROUNDUP(sizeof (dtrace_probedesc_t), sizeof (uint64_t));
+	size = psize + sizeof (dtrace_eprobedesc_t) +
+	    (DT_MAP_NRECS - 1) * sizeof (dtrace_recdesc_t);
+
+	if ((probe = malloc(size)) == NULL)
 		return (dt_set_errno(dtp, EDT_NOMEM));
 
+	enabled = (dtrace_eprobedesc_t *)((uintptr_t)probe + psize);
 	bzero(enabled, sizeof (dtrace_eprobedesc_t));
 	enabled->dtepd_epid = id;
-	enabled->dtepd_nrecs = 1;
+	enabled->dtepd_nrecs = DT_MAP_NRECS;
 
 	if (dt_ioctl(dtp, DTRACEIOC_EPROBE, enabled) == -1) {
 		rval = dt_set_errno(dtp, errno);
-		free(enabled);
+		free(probe);
 		return (rval);
 	}
 
-	if (DTRACE_SIZEOF_EPROBEDESC(enabled) != sizeof (*enabled)) {
+	if (enabled->dtepd_nrecs > DT_MAP_NRECS) {
 		/*
-		 * There must be more than one action.  Allocate the
+		 * There are more actions than we made room for.  Allocate the
 		 * appropriate amount of space and try again.
 		 */
-		if ((nenabled =
-		    malloc(DTRACE_SIZEOF_EPROBEDESC(enabled))) != NULL)
-			bcopy(enabled, nenabled, sizeof (*enabled));
+		size = psize + DTRACE_SIZEOF_EPROBEDESC(enabled);
 
-		free(enabled);
-
-		if ((enabled = nenabled) == NULL)
+		if ((nprobe = realloc(probe, size)) == NULL) {
+			free(probe);
 			return (dt_set_errno(dtp, EDT_NOMEM));
+		}
 
-		rval = dt_ioctl(dtp, DTRACEIOC_EPROBE, enabled);
+		probe = nprobe;
+		enabled = (dtrace_eprobedesc_t *)((uintptr_t)probe + psize);
 
-		if (rval == -1) {
+		if (dt_ioctl(dtp, DTRACEIOC_EPROBE, enabled) == -1) {
 			rval = dt_set_errno(dtp, errno);
-			free(enabled);
+			free(probe);
 			return (rval);
 		}
 	}
 
-	if ((probe = malloc(sizeof (dtrace_probedesc_t))) == NULL) {
-		free(enabled);
-		return (dt_set_errno(dtp, EDT_NOMEM));
-	}
-
 	probe->dtpd_id = enabled->dtepd_probeid;
 
 	if (dt_ioctl(dtp, DTRACEIOC_PROBES, probe) == -1) {
@@ -230,7 +238,6 @@ err:
 	 * we have already allocated.  This is okay; these formats are
 	 * hanging off of dt_formats and will therefore not be leaked.
 	 */
-	free(enabled);
 	free(probe);
 	return (rval);
 }
@@ -274,7 +281,6 @@ dt_epid_destroy(dtrace_hdl_t *dtp)
 		}
 
 		assert(dtp->dt_pdesc[i] != NULL);
-		free(dtp->dt_edesc[i]);
 		free(dtp->dt_pdesc[i]);
 	}
 
@@ -367,12 +373,15 @@ dt_aggid_add(dtrace_hdl_t *dtp, dtrace_aggid_t id)
 	if (dtp->dt_aggdesc[id] == NULL) {
 		dtrace_aggdesc_t *agg, *nagg;
 
-		if ((agg = malloc(sizeof (dtrace_aggdesc_t))) == NULL)
+		size_t size = sizeof (dtrace_aggdesc_t) +
+		    (DT_MAP_NRECS - 1) * sizeof (dtrace_recdesc_t);
+
+		if ((agg = malloc(size)) == NULL)
 			return (dt_set_errno(dtp, EDT_NOMEM));
 
 		bzero(agg, sizeof (dtrace_aggdesc_t));
 		agg->dtagd_id = id;
-		agg->dtagd_nrecs = 1;
+		agg->dtagd_nrecs = DT_MAP_NRECS;
 
 		if (dt_ioctl(dtp, DTRACEIOC_AGGDESC, agg) == -1) {
 			rval = dt_set_errno(dtp, errno);
@@ -380,18 +389,19 @@ dt_aggid_add(dtrace_hdl_t *dtp, dtrace_aggid_t id)
 			return (rval);
 		}
 
-		if (DTRACE_SIZEOF_AGGDESC(agg) != sizeof (*agg)) {
+		if (agg->dtagd_nrecs > DT_MAP_NRECS) {
 			/*
-			 * There must be more than one action.  Allocate the
-			 * appropriate amount of space and try again.
+			 * There are more actions than we made room for.
+			 * Allocate the appropriate amount of space and try
+			 * again.
 			 */
-			if ((nagg = malloc(DTRACE_SIZEOF_AGGDESC(agg))) != NULL)
-				bcopy(agg, nagg, sizeof (*agg));
-
-			free(agg);
-
-			if ((agg = nagg) == NULL)
+			if ((nagg = realloc(agg,
+			    DTRACE_SIZEOF_AGGDESC(agg))) == NULL) {
+				free(agg);
 				return (dt_set_errno(dtp, EDT_NOMEM));
+			}
+
+			agg = nagg;
 
 			rval = dt_ioctl(dtp, DTRACEIOC_AGGDESC, agg);
 
@@ -477,3 +487,34 @@ dt_aggid_destroy(dtrace_hdl_t *dtp)
 	dtp->dt_maxagg = 0;
 }
 
+
+/*
+ * Enabled probe IDs and aggregation IDs are allocated densely, starting at 1,
+ * as the enablings are created.  Rather than describing each of them the
+ * first time that its data is consumed -- which, with many enablings, stalls
+ * the consumer right after tracing has started and makes drops likely -- we
+ * describe all of them once tracing starts.  We stop at the first ID that the
+ * kernel doesn't know about:  any ID beyond it, or any ID created later on,
+ * will still be described by dt_epid_lookup() and dt_aggid_lookup() as its
+ * data is consumed.  Failure here is therefore not an error.
+ */
+void
+dt_map_prefetch(dtrace_hdl_t *dtp)
+{
+	int err = dtp->dt_errno;
+	dtrace_eprobedesc_t *epd;
+	dtrace_probedesc_t *pd;
+	dtrace_aggdesc_t *agg;
+	dtrace_epid_t epid;
+	dtrace_aggid_t aggid;
+
+	for (epid = DTRACE_EPIDNONE + 1;
+	    dt_epid_lookup(dtp, epid, &epd, &pd) == 0; epid++)
+		continue;
+
+	for (aggid = DTRACE_AGGIDNONE + 1;
+	    dt_aggid_lookup(dtp, aggid, &agg) == 0; aggid++)
+		continue;
+
+	dtp->dt_errno = err;
+}
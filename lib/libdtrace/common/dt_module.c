@@ -877,6 +877,32 @@ static const dt_modops_t dt_modops_macho_64 = {
 	dt_module_symaddr_macho_64
 };
 
+/*
+ * Double the number of module hash buckets once the chains average
+ * DT_IDHASH_LOAD modules, as with identifier hashes.
+ */
+static void
+dt_module_grow(dtrace_hdl_t *dtp)
+{
+	uint_t h, nbuckets = dtp->dt_modbuckets * 2 + 1;
+	dt_module_t **mods, *dmp;
+
+	if (dtp->dt_nmods < dtp->dt_modbuckets * DT_IDHASH_LOAD ||
+	    (mods = calloc(nbuckets, sizeof (dt_module_t *))) == NULL)
+		return;
+
+	for (dmp = dt_list_next(&dtp->dt_modlist); dmp != NULL;
+	    dmp = dt_list_next(dmp)) {
+		h = dt_strtab_hash(dmp->dm_name, NULL) % nbuckets;
+		dmp->dm_next = mods[h];
+		mods[h] = dmp;
+	}
+
+	free(dtp->dt_mods);
+	dtp->dt_mods = mods;
+	dtp->dt_modbuckets = nbuckets;
+}
+
 dt_module_t *
 dt_module_create(dtrace_hdl_t *dtp, const char *name)
 {
@@ -891,6 +917,9 @@ dt_module_create(dtrace_hdl_t *dtp, const char *name)
 	if ((dmp = malloc(sizeof (dt_module_t))) == NULL)
 		return (NULL); /* caller must handle allocation failure */
 
+	dt_module_grow(dtp);
+	h = dt_strtab_hash(name, NULL) % dtp->dt_modbuckets;
+
 	bzero(dmp, sizeof (dt_module_t));
 	(void) strlcpy(dmp->dm_name, name, sizeof (dmp->dm_name));
 	dt_list_append(&dtp->dt_modlist, dmp);
@@ -898,6 +927,9 @@ dt_module_create(dtrace_hdl_t *dtp, const char *name)
 	dtp->dt_mods[h] = dmp;
 	dtp->dt_nmods++;
 
+	free(dtp->dt_modtext); /* rebuilt by dt_module_lookup_by_text() */
+	dtp->dt_modtext = NULL;
+
 	if (dtp->dt_conf.dtc_ctfmodel == CTF_MODEL_LP64)
 		dmp->dm_ops = &dt_modops_macho_64;
 	else
@@ -928,6 +960,192 @@ dt_module_lookup_by_ctf(dtrace_hdl_t *dtp, ctf_file_t *ctfp)
 	return (ctfp ? ctf_getspecific(ctfp) : NULL);
 }
 
+static int
+dt_module_textcmp(const void *lp, const void *rp)
+{
+	const dt_module_t *lhs = *((const dt_module_t **)lp);
+	const dt_module_t *rhs = *((const dt_module_t **)rp);
+
+	if (lhs->dm_text_va < rhs->dm_text_va)
+		return (-1);
+
+	if (lhs->dm_text_va > rhs->dm_text_va)
+		return (1);
+
+	return (0);
+}
+
+/*
+ * Find the module whose text section contains the specified address.  The
+ * modules are indexed by text address the first time this is called after the
+ * module list or the modules' address ranges change (e.g. by dtrace_update()),
+ * so that a lookup is a binary search rather than a walk of the module list.
+ */
+dt_module_t *
+dt_module_lookup_by_text(dtrace_hdl_t *dtp, GElf_Addr addr)
+{
+	dt_module_t *dmp;
+	uint_t lo, hi, mid;
+
+	if (dtp->dt_modtext == NULL && (dtp->dt_modtext =
+	    malloc(sizeof (dt_module_t *) * (dtp->dt_nmods + 1))) != NULL) {
+		dtp->dt_nmodtext = 0;
+
+		for (dmp = dt_list_next(&dtp->dt_modlist); dmp != NULL;
+		    dmp = dt_list_next(dmp)) {
+			if (dmp->dm_text_size != 0)
+				dtp->dt_modtext[dtp->dt_nmodtext++] = dmp;
+		}
+
+		qsort(dtp->dt_modtext, dtp->dt_nmodtext,
+		    sizeof (dt_module_t *), dt_module_textcmp);
+	}
+
+	if (dtp->dt_modtext == NULL) {
+		for (dmp = dt_list_next(&dtp->dt_modlist); dmp != NULL;
+		    dmp = dt_list_next(dmp)) {
+			if (addr - dmp->dm_text_va < dmp->dm_text_size)
+				return (dmp);
+		}
+
+		return (NULL);
+	}
+
+	for (lo = 0, hi = dtp->dt_nmodtext; lo < hi; ) {
+		mid = (lo + hi) / 2;
+
+		if (dtp->dt_modtext[mid]->dm_text_va <= addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (lo == 0)
+		return (NULL);
+
+	dmp = dtp->dt_modtext[lo - 1];
+	return (addr - dmp->dm_text_va < dmp->dm_text_size ? dmp : NULL);
+}
+
+/*
+ * Return the index of the first resolved kernel range that starts above the
+ * specified address.
+ */
+static uint_t
+dt_module_ksym_search(dtrace_hdl_t *dtp, GElf_Addr addr)
+{
+	uint_t lo = 0, hi = dtp->dt_nksyms, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+
+		if (dtp->dt_ksyms[mid]->dks_addr <= addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return (lo);
+}
+
+/*
+ * Resolve a kernel address to its symbol and containing module.  Each range
+ * that dtrace_lookup_by_addr() resolves is remembered, so that the many stack
+ * frames and aggregation keys that fall within the same function are resolved
+ * with a binary search.  The resolved ranges are discarded by dtrace_update().
+ * NULL is returned if the address isn't within any known module.
+ */
+const dt_ksym_t *
+dt_module_lookup_ksym(dtrace_hdl_t *dtp, GElf_Addr addr)
+{
+	char aux_symbol_name[32];
+	dtrace_syminfo_t dts;
+	dt_ksym_t *dks, **ksyms;
+	GElf_Sym sym;
+	uint_t i, size;
+
+	if ((i = dt_module_ksym_search(dtp, addr)) != 0) {
+		dks = dtp->dt_ksyms[i - 1];
+
+		if (addr - dks->dks_addr < dks->dks_size)
+			return (dks);
+	}
+
+	if ((dks = dt_zalloc(dtp, sizeof (dt_ksym_t))) == NULL)
+		return (NULL);
+
+	if (dtrace_lookup_by_addr(dtp, addr, aux_symbol_name,
+	    sizeof (aux_symbol_name), &sym, &dts) == 0) {
+		dks->dks_sym = sym;
+		dks->dks_addr = MIN(sym.st_value, addr);
+		dks->dks_size = MAX(sym.st_value + sym.st_size, addr + 1) -
+		    dks->dks_addr;
+		dks->dks_name = strdup(dts.dts_name != NULL ? dts.dts_name : "");
+		dks->dks_flags |= DT_KSYM_SYM;
+	} else if (dtrace_lookup_by_addr(dtp, addr, NULL, 0, NULL, &dts) == 0) {
+		/*
+		 * There is no symbol for this address, so all we know is its
+		 * containing module:  remember that for this address alone.
+		 */
+		dks->dks_addr = addr;
+		dks->dks_size = 1;
+	} else {
+		dt_free(dtp, dks);
+		return (NULL);
+	}
+
+	dks->dks_object = strdup(dts.dts_object != NULL ? dts.dts_object : "");
+
+	if (dks->dks_object == NULL ||
+	    ((dks->dks_flags & DT_KSYM_SYM) && dks->dks_name == NULL))
+		goto err;
+
+	if (dtp->dt_nksyms == dtp->dt_ksymsz) {
+		size = dtp->dt_ksymsz ? dtp->dt_ksymsz * 2 : 64;
+
+		if ((ksyms = realloc(dtp->dt_ksyms,
+		    sizeof (dt_ksym_t *) * size)) == NULL)
+			goto err;
+
+		dtp->dt_ksyms = ksyms;
+		dtp->dt_ksymsz = size;
+	}
+
+	i = dt_module_ksym_search(dtp, dks->dks_addr);
+	memmove(&dtp->dt_ksyms[i + 1], &dtp->dt_ksyms[i],
+	    sizeof (dt_ksym_t *) * (dtp->dt_nksyms - i));
+	dtp->dt_ksyms[i] = dks;
+	dtp->dt_nksyms++;
+
+	return (dks);
+
+err:
+	dt_free(dtp, dks->dks_name);
+	dt_free(dtp, dks->dks_object);
+	dt_free(dtp, dks);
+	(void) dt_set_errno(dtp, EDT_NOMEM);
+	return (NULL);
+}
+
+void
+dt_module_ksym_flush(dtrace_hdl_t *dtp)
+{
+	dt_ksym_t *dks;
+	uint_t i;
+
+	for (i = 0; i < dtp->dt_nksyms; i++) {
+		dks = dtp->dt_ksyms[i];
+		dt_free(dtp, dks->dks_name);
+		dt_free(dtp, dks->dks_object);
+		dt_free(dtp, dks);
+	}
+
+	free(dtp->dt_ksyms);
+	dtp->dt_ksyms = NULL;
+	dtp->dt_nksyms = 0;
+	dtp->dt_ksymsz = 0;
+}
+
 static int
 dt_module_load_sect(dtrace_hdl_t *dtp, dt_module_t *dmp, ctf_sect_t *ctsp)
 {
@@ -1016,13 +1234,16 @@ dt_module_load(dtrace_hdl_t *dtp, dt_module_t *dmp)
 	/*
 	 * Allocate the hash chains and hash buckets for symbol name lookup.
 	 * This is relatively simple since the symbol table is of fixed size
-	 * and is known in advance.  We allocate one extra element since we
-	 * use element indices instead of pointers and zero is our sentinel.
+	 * and is known in advance, so we size the buckets to keep the chains
+	 * no longer than DT_IDHASH_LOAD on average.  We allocate one extra
+	 * element since we use element indices instead of pointers and zero is
+	 * our sentinel.
 	 */
 	dmp->dm_nsymelems =
 	    dmp->dm_symtab.cts_size / dmp->dm_symtab.cts_entsize;
 
-	dmp->dm_nsymbuckets = _dtrace_strbuckets;
+	dmp->dm_nsymbuckets = MAX(_dtrace_strbuckets,
+	    (dmp->dm_nsymelems / DT_IDHASH_LOAD) | 1);
 	dmp->dm_symfree = 1;		/* first free element is index 1 */
 
 	dmp->dm_symbuckets = malloc(sizeof (uint_t) * dmp->dm_nsymbuckets);
@@ -1060,6 +1281,35 @@ dt_module_load(dtrace_hdl_t *dtp, dt_module_t *dmp)
 	return (0);
 }
 
+#define	DT_CTFCACHE_FILE	"com.apple.dtrace.ctf."
+
+/*
+ * Open the CTF container for a module.  If -xctfcache is set, go through the
+ * per-user cache of CTF images (see ctf_cache_open()) so that the CTF data is
+ * decompressed and indexed once and simply mapped by later dtrace_open()s.
+ */
+static ctf_file_t *
+dt_module_ctfopen(dtrace_hdl_t *dtp, dt_module_t *dmp)
+{
+	char path[PATH_MAX];
+	size_t len;
+
+	if (dtp->dt_ctfcache && strchr(dmp->dm_name, '/') == NULL) {
+		len = confstr(_CS_DARWIN_USER_CACHE_DIR, path, sizeof (path));
+
+		if (len != 0 && len <= sizeof (path) &&
+		    strlcat(path, DT_CTFCACHE_FILE, sizeof (path)) <
+		    sizeof (path) && strlcat(path, dmp->dm_name,
+		    sizeof (path)) < sizeof (path)) {
+			return (ctf_cache_open(path, &dmp->dm_ctdata,
+			    &dmp->dm_symtab, &dmp->dm_strtab, &dtp->dt_ctferr));
+		}
+	}
+
+	return (ctf_bufopen(&dmp->dm_ctdata,
+	    &dmp->dm_symtab, &dmp->dm_strtab, &dtp->dt_ctferr));
+}
+
 ctf_file_t *
 dt_module_getctf(dtrace_hdl_t *dtp, dt_module_t *dmp)
 {
@@ -1086,10 +1336,7 @@ dt_module_getctf(dtrace_hdl_t *dtp, dt_module_t *dmp)
 		return (NULL);
 	}
 
-	dmp->dm_ctfp = ctf_bufopen(&dmp->dm_ctdata,
-	    &dmp->dm_symtab, &dmp->dm_strtab, &dtp->dt_ctferr);
-
-	if (dmp->dm_ctfp == NULL) {
+	if ((dmp->dm_ctfp = dt_module_ctfopen(dtp, dmp)) == NULL) {
 		(void) dt_set_errno(dtp, EDT_CTF);
 		return (NULL);
 	}
@@ -1127,7 +1374,6 @@ err:
 void
 dt_module_unload(dtrace_hdl_t *dtp, dt_module_t *dmp)
 {
-#pragma unused(dtp)
 	ctf_close(dmp->dm_ctfp);
 	dmp->dm_ctfp = NULL;
 
@@ -1163,6 +1409,9 @@ dt_module_unload(dtrace_hdl_t *dtp, dt_module_t *dmp)
 	dmp->dm_bss_va = (GElf_Addr)0;
 	dmp->dm_bss_size = 0;
 
+	free(dtp->dt_modtext); /* rebuilt by dt_module_lookup_by_text() */
+	dtp->dt_modtext = NULL;
+
 	if (dmp->dm_extern != NULL) {
 		dt_idhash_destroy(dmp->dm_extern);
 		dmp->dm_extern = NULL;
@@ -1369,6 +1618,8 @@ dtrace_update(dtrace_hdl_t *dtp)
 	    dmp != NULL; dmp = dt_list_next(dmp))
 		dt_module_unload(dtp, dmp);
 
+	dt_module_ksym_flush(dtp);
+
 	if (!(dtp->dt_oflags & DTRACE_O_NOSYS)) {
 		dt_module_update(dtp, "mach_kernel");
 	}
@@ -40,6 +40,9 @@ extern void dt_module_destroy(dtrace_hdl_t *, dt_module_t *);
 
 extern dt_module_t *dt_module_lookup_by_name(dtrace_hdl_t *, const char *);
 extern dt_module_t *dt_module_lookup_by_ctf(dtrace_hdl_t *, ctf_file_t *);
+extern dt_module_t *dt_module_lookup_by_text(dtrace_hdl_t *, GElf_Addr);
+extern const dt_ksym_t *dt_module_lookup_ksym(dtrace_hdl_t *, GElf_Addr);
+extern void dt_module_ksym_flush(dtrace_hdl_t *);
 
 extern ctf_file_t *dt_module_getctf(dtrace_hdl_t *, dt_module_t *);
 extern dt_ident_t *dt_module_extern(dtrace_hdl_t *, dt_module_t *,
@@ -1454,6 +1454,8 @@ dtrace_close(dtrace_hdl_t *dtp)
 	while ((dmp = dt_list_next(&dtp->dt_modlist)) != NULL)
 		dt_module_destroy(dtp, dmp);
 
+	dt_module_ksym_flush(dtp);
+
 	while ((pvp = dt_list_next(&dtp->dt_provlist)) != NULL)
 		dt_provider_destroy(dtp, pvp);
 
@@ -1473,6 +1475,7 @@ dtrace_close(dtrace_hdl_t *dtp)
 	dt_format_destroy(dtp);
 	dt_strdata_destroy(dtp);
 	dt_buffered_destroy(dtp);
+	dt_consume_destroy(dtp);
 	dt_aggregate_destroy(dtp);
 	dt_pfdict_destroy(dtp);
 	dt_provmod_destroy(&dtp->dt_provmod);
@@ -1487,6 +1490,8 @@ dtrace_close(dtrace_hdl_t *dtp)
 		free(dirp);
 	}
 
+	dt_pp_destroy(dtp->dt_pp);
+	free(dtp->dt_pp_args);
 	free(dtp->dt_cpp_argv);
 	free(dtp->dt_cpp_path);
 	free(dtp->dt_ld_path);
@@ -57,6 +57,19 @@ dt_opt_agg(dtrace_hdl_t *dtp, const char *arg, uintptr_t option)
 	return (0);
 }
 
+static int
+dt_opt_aggsnapthreads(dtrace_hdl_t *dtp, const char *arg, uintptr_t option)
+{
+#pragma unused(option)
+	int n;
+
+	if (arg == NULL || (n = atoi(arg)) < 0)
+		return (dt_set_errno(dtp, EDT_BADOPTVAL));
+
+	dtp->dt_aggsnapthreads = n;
+	return (0);
+}
+
 /*ARGSUSED*/
 static int
 dt_opt_amin(dtrace_hdl_t *dtp, const char *arg, uintptr_t option)
@@ -153,6 +166,72 @@ dt_opt_cpp_hdrs(dtrace_hdl_t *dtp, const char *arg, uintptr_t option)
 	return (0);
 }
 
+/*ARGSUSED*/
+static int
+dt_opt_cpp_exec(dtrace_hdl_t *dtp, const char *arg, uintptr_t option)
+{
+#pragma unused(option)
+	if (arg != NULL)
+		return (dt_set_errno(dtp, EDT_BADOPTVAL));
+
+	if (dtp->dt_pcb != NULL)
+		return (dt_set_errno(dtp, EDT_BADOPTCTX));
+
+	dtp->dt_cppexec = 1;
+	return (0);
+}
+
+/*ARGSUSED*/
+static int
+dt_opt_cpp_inproc(dtrace_hdl_t *dtp, const char *arg, uintptr_t option)
+{
+#pragma unused(option)
+	if (arg != NULL)
+		return (dt_set_errno(dtp, EDT_BADOPTVAL));
+
+	if (dtp->dt_pcb != NULL)
+		return (dt_set_errno(dtp, EDT_BADOPTCTX));
+
+	dtp->dt_cppinproc = 1;
+	return (0);
+}
+
+/*ARGSUSED*/
+static int
+dt_opt_difstats(dtrace_hdl_t *dtp, const char *arg, uintptr_t option)
+{
+#pragma unused(option)
+	if (arg != NULL)
+		return (dt_set_errno(dtp, EDT_BADOPTVAL));
+
+	dtp->dt_difstats = 1;
+	return (0);
+}
+
+/*ARGSUSED*/
+static int
+dt_opt_nodifopt(dtrace_hdl_t *dtp, const char *arg, uintptr_t option)
+{
+#pragma unused(option)
+	if (arg != NULL)
+		return (dt_set_errno(dtp, EDT_BADOPTVAL));
+
+	dtp->dt_nodifopt = 1;
+	return (0);
+}
+
+/*ARGSUSED*/
+static int
+dt_opt_nolibcache(dtrace_hdl_t *dtp, const char *arg, uintptr_t option)
+{
+#pragma unused(option)
+	if (arg != NULL)
+		return (dt_set_errno(dtp, EDT_BADOPTVAL));
+
+	dtp->dt_nolibcache = 1;
+	return (0);
+}
+
 /*ARGSUSED*/
 static int
 dt_opt_cpp_path(dtrace_hdl_t *dtp, const char *arg, uintptr_t option)
@@ -202,6 +281,18 @@ dt_opt_cpp_opts(dtrace_hdl_t *dtp, const char *arg, uintptr_t option)
 	return (0);
 }
 
+/*ARGSUSED*/
+static int
+dt_opt_ctfcache(dtrace_hdl_t *dtp, const char *arg, uintptr_t option)
+{
+#pragma unused(option)
+	if (arg != NULL)
+		return (dt_set_errno(dtp, EDT_BADOPTVAL));
+
+	dtp->dt_ctfcache = 1;
+	return (0);
+}
+
 /*ARGSUSED*/
 static int
 dt_opt_ctypes(dtrace_hdl_t *dtp, const char *arg, uintptr_t option)
@@ -485,6 +576,19 @@ dt_opt_pgmax(dtrace_hdl_t *dtp, const char *arg, uintptr_t option)
 	return (0);
 }
 
+static int
+dt_opt_pidthreads(dtrace_hdl_t *dtp, const char *arg, uintptr_t option)
+{
+#pragma unused(option)
+	int n;
+
+	if (arg == NULL || (n = atoi(arg)) < 0)
+		return (dt_set_errno(dtp, EDT_BADOPTVAL));
+
+	dtp->dt_pidthreads = n;
+	return (0);
+}
+
 static int
 dt_opt_setenv(dtrace_hdl_t *dtp, const char *arg, uintptr_t option)
 {
@@ -1097,19 +1201,25 @@ typedef struct dt_option {
  * Compile-time options.
  */
 static const dt_option_t _dtrace_ctoptions[] = {
+	{ "aggdelta", dt_opt_agg, DTRACE_A_DELTA },
 	{ "aggpercpu", dt_opt_agg, DTRACE_A_PERCPU },
+	{ "aggsnapthreads", dt_opt_aggsnapthreads },
 	{ "amin", dt_opt_amin },
 	{ "arch", dt_opt_arch },
 	{ "archlibdir", dt_opt_libdir },
 	{ "argref", dt_opt_cflags, DTRACE_C_ARGREF },
 	{ "core", dt_opt_core },
 	{ "cpp", dt_opt_cflags, DTRACE_C_CPP },
+	{ "cppexec", dt_opt_cpp_exec },
+	{ "cppinproc", dt_opt_cpp_inproc },
 	{ "cpphdrs", dt_opt_cpp_hdrs },
 	{ "cpppath", dt_opt_cpp_path },
+	{ "ctfcache", dt_opt_ctfcache },
 	{ "ctypes", dt_opt_ctypes },
 	{ "defaultargs", dt_opt_cflags, DTRACE_C_DEFARG },
 	{ "dtypes", dt_opt_dtypes },
 	{ "debug", dt_opt_debug },
+	{ "difstats", dt_opt_difstats },
 	{ "define", dt_opt_cpp_opts, (uintptr_t)"-D" },
 	{ "disallow_dsym", dt_opt_disallow_dsym },
 	{ "droptags", dt_opt_droptags },
@@ -1128,10 +1238,13 @@ static const dt_option_t _dtrace_ctoptions[] = {
 	{ "linkmode", dt_opt_linkmode },
 	{ "linktype", dt_opt_linktype },
 	{ "mangled", dt_opt_mangled },
+	{ "nolibcache", dt_opt_nolibcache },
 	{ "nolibs", dt_opt_cflags, DTRACE_C_NOLIBS },
 	{ "nojtanalysis", dt_opt_nojtanalysis },
+	{ "nodifopt", dt_opt_nodifopt },
 	{ "noerror", dt_opt_noerror},
 	{ "pgmax", dt_opt_pgmax },
+	{ "pidthreads", dt_opt_pidthreads },
 	{ "preallocate", dt_opt_preallocate },
 	{ "pspec", dt_opt_cflags, DTRACE_C_PSPEC },
 	{ "setenv", dt_opt_setenv, 1 },
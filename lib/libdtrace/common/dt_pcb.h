@@ -69,6 +69,8 @@ typedef struct dt_pcb {
 	uint_t pcb_asvidx;	/* assembler vartab index (see dt_as.c) */
 	ulong_t **pcb_asxrefs;	/* assembler imported xlators (see dt_as.c) */
 	uint_t pcb_asxreflen;	/* assembler xlator map length (see dt_as.c) */
+	uint_t pcb_asilen;	/* assembler input instructions (see dt_as.c) */
+	uint_t pcb_asolen;	/* assembler output instructions (see dt_as.c) */
 	const dtrace_probedesc_t *pcb_pdesc; /* probedesc for current context */
 	struct dt_probe *pcb_probe; /* probe associated with current context */
 	dtrace_probeinfo_t pcb_pinfo; /* info associated with current context */
@@ -98,6 +98,456 @@ dt_pid_error(dtrace_hdl_t *dtp, dt_pcb_t *pcb, dt_proc_t *dpr,
 	return (1);
 }
 
+/*
+ * Functions are visited in address order, so rather than reading the text of
+ * each one separately, we read an aligned window of the process's text and
+ * serve the functions it covers from that.  The window is discarded by
+ * dt_pid_text_flush() once the probes of a description have been created, so
+ * that later descriptions see the text as it is then.  A window that runs
+ * past either end of a mapping cannot be read in one piece; we then shrink it
+ * down to the pages holding the request, which costs a few extra reads once
+ * per mapping boundary rather than once per function.
+ */
+#define	DT_PID_TEXTWIN	(256 * 1024)
+#define	DT_PID_TEXTMIN	4096
+
+ssize_t
+dt_pid_read(struct ps_prochandle *P, dtrace_hdl_t *dtp, void *buf,
+    size_t nbyte, uint64_t addr)
+{
+	dt_proc_t *dpr = dt_proc_lookup(dtp, P, B_FALSE);
+	uint64_t base, end, lo, hi;
+
+	assert(DT_MUTEX_HELD(&dpr->dpr_lock));
+
+	if (dpr->dpr_textsize != 0 && addr >= dpr->dpr_textaddr &&
+	    addr + nbyte <= dpr->dpr_textaddr + dpr->dpr_textsize) {
+		bcopy(dpr->dpr_text + (addr - dpr->dpr_textaddr), buf, nbyte);
+		return (nbyte);
+	}
+
+	if (nbyte > DT_PID_TEXTWIN)
+		return (Pread(P, buf, nbyte, addr));
+
+	if (dpr->dpr_text == NULL &&
+	    (dpr->dpr_text = dt_alloc(dtp, 2 * DT_PID_TEXTWIN)) == NULL)
+		return (Pread(P, buf, nbyte, addr));
+
+	dpr->dpr_textsize = 0;
+
+	base = addr & ~(uint64_t)(DT_PID_TEXTWIN - 1);
+	end = P2ROUNDUP(addr + nbyte, DT_PID_TEXTWIN);
+	lo = addr & ~(uint64_t)(DT_PID_TEXTMIN - 1);
+	hi = P2ROUNDUP(addr + nbyte, DT_PID_TEXTMIN);
+
+	while (Pread(P, dpr->dpr_text, end - base, base) != end - base) {
+		if (base == lo && end == hi)
+			return (0);
+
+		base = lo;
+		if (end - hi <= DT_PID_TEXTMIN)
+			end = hi;
+		else
+			end = hi + P2ROUNDUP((end - hi) / 2, DT_PID_TEXTMIN);
+	}
+
+	dpr->dpr_textaddr = base;
+	dpr->dpr_textsize = end - base;
+	bcopy(dpr->dpr_text + (addr - base), buf, nbyte);
+
+	return (nbyte);
+}
+
+static void
+dt_pid_text_flush(dtrace_hdl_t *dtp, dt_proc_t *dpr)
+{
+	dt_free(dtp, dpr->dpr_text);
+	dpr->dpr_text = NULL;
+	dpr->dpr_textsize = 0;
+}
+
+int
+dt_pid_makeprobe(dtrace_hdl_t *dtp, fasttrap_probe_spec_t *ftp)
+{
+	if (ioctl(dtp->dt_ftfd, FASTTRAPIOC_MAKEPROBE, ftp) != 0) {
+		dt_dprintf("fasttrap probe creation ioctl failed: %s",
+		    strerror(errno));
+		return (dt_set_errno(dtp, errno));
+	}
+
+	return (0);
+}
+
+#if !defined(__arm__) && !defined(__arm64__)
+/*
+ * Return and offset probes require the text of each function to be decoded,
+ * which dominates the cost of creating them.  The offsets that decoding finds
+ * are kept in the site cache (see dt_pidsite_t), so that a function is decoded
+ * once per handle regardless of how many descriptions match it or how many
+ * processes map its image.  Results that depend on the state of a process --
+ * those of functions that couldn't be completely decoded -- aren't cached.
+ */
+typedef struct dt_pid_sitekey {
+	uuid_t dpk_uuid;		/* UUID of containing image */
+	uint64_t dpk_off;		/* offset of function in image */
+	uint64_t dpk_size;		/* size of function */
+	int dpk_type;			/* DTFTP_RETURN or DTFTP_OFFSETS */
+} dt_pid_sitekey_t;
+
+static uint_t
+dt_pid_site_hash(const dt_pid_sitekey_t *key)
+{
+	uint64_t h;
+
+	bcopy(key->dpk_uuid, &h, sizeof (h));
+	h ^= key->dpk_off * 0x9e3779b97f4a7c15ULL;
+
+	return ((uint_t)(h ^ (h >> 32)) & (DT_PIDSITE_HASHSIZE - 1));
+}
+
+static int
+dt_pid_site_match(const dt_pidsite_t *dps, const dt_pid_sitekey_t *key)
+{
+	return (dps->dps_off == key->dpk_off &&
+	    dps->dps_size == key->dpk_size &&
+	    dps->dps_type == key->dpk_type &&
+	    uuid_compare(dps->dps_uuid, key->dpk_uuid) == 0);
+}
+
+static int
+dt_pid_site_lookup(dtrace_hdl_t *dtp, const dt_pid_sitekey_t *key,
+    fasttrap_probe_spec_t *ftp)
+{
+	dt_proc_hash_t *dph = dtp->dt_procs;
+	dt_pidsite_t *dps = NULL;
+	uint_t i;
+
+	(void) pthread_mutex_lock(&dph->dph_sitelock);
+
+	if (dph->dph_sites != NULL)
+		dps = dph->dph_sites[dt_pid_site_hash(key)];
+
+	for (; dps != NULL; dps = dps->dps_next) {
+		if (dt_pid_site_match(dps, key))
+			break;
+	}
+
+	if (dps != NULL && ftp != NULL) {
+		for (i = 0; i < dps->dps_noffs; i++)
+			ftp->ftps_offs[i] = dps->dps_offs[i];
+		ftp->ftps_noffs = dps->dps_noffs;
+	}
+
+	(void) pthread_mutex_unlock(&dph->dph_sitelock);
+
+	return (dps != NULL ? 0 : -1);
+}
+
+/*
+ * This is called by the decoding threads as well, so we use malloc() directly
+ * rather than dt_alloc(), which sets the handle's errno on failure.
+ */
+static void
+dt_pid_site_insert(dtrace_hdl_t *dtp, const dt_pid_sitekey_t *key,
+    const fasttrap_probe_spec_t *ftp)
+{
+	dt_proc_hash_t *dph = dtp->dt_procs;
+	dt_pidsite_t *dps;
+	size_t size = offsetof(dt_pidsite_t, dps_offs) +
+	    MAX(ftp->ftps_noffs, 1) * sizeof (uint32_t);
+	uint_t h = dt_pid_site_hash(key), i;
+
+	(void) pthread_mutex_lock(&dph->dph_sitelock);
+
+	if (dph->dph_sitemem + size > DT_PIDSITE_MAXMEM)
+		goto out;
+
+	if (dph->dph_sites == NULL && (dph->dph_sites =
+	    calloc(DT_PIDSITE_HASHSIZE, sizeof (dt_pidsite_t *))) == NULL)
+		goto out;
+
+	for (dps = dph->dph_sites[h]; dps != NULL; dps = dps->dps_next) {
+		if (dt_pid_site_match(dps, key))
+			goto out;
+	}
+
+	if ((dps = malloc(size)) == NULL)
+		goto out;
+
+	uuid_copy(dps->dps_uuid, key->dpk_uuid);
+	dps->dps_off = key->dpk_off;
+	dps->dps_size = key->dpk_size;
+	dps->dps_type = key->dpk_type;
+	dps->dps_noffs = ftp->ftps_noffs;
+	for (i = 0; i < ftp->ftps_noffs; i++)
+		dps->dps_offs[i] = (uint32_t)ftp->ftps_offs[i];
+
+	dps->dps_next = dph->dph_sites[h];
+	dph->dph_sites[h] = dps;
+	dph->dph_sitemem += size;
+out:
+	(void) pthread_mutex_unlock(&dph->dph_sitelock);
+}
+
+/*
+ * Store in ftp the return sites (DTFTP_RETURN) or instruction offsets
+ * (DTFTP_OFFSETS) of the function symp, decoding its text unless they are in
+ * the site cache.
+ */
+int
+dt_pid_find_sites(struct ps_prochandle *P, dtrace_hdl_t *dtp,
+    fasttrap_probe_spec_t *ftp, const GElf_Sym *symp, int type)
+{
+	const pstatus_t *psp = Pstatus(P);
+	dt_pid_sitekey_t key;
+	mach_vm_address_t base;
+	uint8_t *text;
+	int cache;
+
+	cache = (Pobjuuid(P, symp->st_value, key.dpk_uuid, &base) == 0);
+
+	if (cache) {
+		key.dpk_off = symp->st_value - base;
+		key.dpk_size = symp->st_size;
+		key.dpk_type = type;
+
+		if (dt_pid_site_lookup(dtp, &key, ftp) == 0)
+			return (0);
+	}
+
+	/*
+	 * We allocate a few extra bytes at the end so we don't have to check
+	 * for overrunning the buffer.
+	 */
+	if ((text = calloc(1, symp->st_size + 4)) == NULL) {
+		dt_dprintf("mr sparkle: malloc() failed");
+		return (-1);
+	}
+
+	if (dt_pid_read(P, dtp, text, symp->st_size, symp->st_value) !=
+	    symp->st_size) {
+		dt_dprintf("mr sparkle: Pread() failed");
+		free(text);
+		return (-1);
+	}
+
+	if (dt_pid_decode_sites(dtp, psp->pr_pid, psp->pr_dmodel, text, symp,
+	    type, ftp) >= 0 && cache)
+		dt_pid_site_insert(dtp, &key, ftp);
+
+	free(text);
+
+	return (0);
+}
+
+/*
+ * When the "pidthreads" option is set, the functions of a module that match a
+ * description are decoded by a pool of threads before any of their probes are
+ * created.  Each thread repeatedly claims the next DT_PID_DECODE_CHUNK
+ * functions, reads and decodes their text and adds their sites to the site
+ * cache; the probes are then created one function at a time as usual, but
+ * without decoding.
+ */
+#define	DT_PID_DECODE_CHUNK	32
+
+typedef struct dt_pid_decode {
+	dtrace_hdl_t *dpd_dtp;		/* pointer to libdtrace handle */
+	struct ps_prochandle *dpd_pr;	/* process whose text is decoded */
+	pid_t dpd_pid;			/* pid of process */
+	char dpd_dmodel;		/* data model of process */
+	uuid_t dpd_uuid;		/* UUID of module */
+	uint64_t dpd_base;		/* base address of module */
+	const char *dpd_func;		/* function name pattern */
+	int dpd_return;			/* boolean: find return sites */
+	int dpd_offsets;		/* boolean: find instruction offsets */
+	GElf_Sym *dpd_syms;		/* functions to decode */
+	uint_t dpd_nsyms;		/* number of functions to decode */
+	uint_t dpd_maxsyms;		/* size of dpd_syms */
+	pthread_mutex_t dpd_lock;	/* lock for dpd_next */
+	uint_t dpd_next;		/* index of next function to claim */
+} dt_pid_decode_t;
+
+static int
+dt_pid_decode_collect(void *arg, const GElf_Sym *symp, const char *func)
+{
+	dt_pid_decode_t *dpd = arg;
+	dtrace_hdl_t *dtp = dpd->dpd_dtp;
+	GElf_Sym *syms;
+	uint_t max;
+
+	if (symp->st_shndx == SHN_UNDEF || symp->st_size == 0 ||
+	    !gmatch(func, dpd->dpd_func))
+		return (0);
+
+	if (dpd->dpd_nsyms != 0 &&
+	    dpd->dpd_syms[dpd->dpd_nsyms - 1].st_value == symp->st_value)
+		return (0);
+
+	if (dpd->dpd_nsyms == dpd->dpd_maxsyms) {
+		max = MAX(dpd->dpd_maxsyms * 2, 256);
+
+		if ((syms = dt_alloc(dtp, max * sizeof (GElf_Sym))) == NULL)
+			return (1);
+
+		if (dpd->dpd_syms != NULL) {
+			bcopy(dpd->dpd_syms, syms,
+			    dpd->dpd_nsyms * sizeof (GElf_Sym));
+			dt_free(dtp, dpd->dpd_syms);
+		}
+
+		dpd->dpd_syms = syms;
+		dpd->dpd_maxsyms = max;
+	}
+
+	dpd->dpd_syms[dpd->dpd_nsyms++] = *symp;
+
+	return (0);
+}
+
+static void
+dt_pid_decode_one(dt_pid_decode_t *dpd, const GElf_Sym *symp, int type,
+    uint8_t *text, fasttrap_probe_spec_t *ftp)
+{
+	dt_pid_sitekey_t key;
+
+	uuid_copy(key.dpk_uuid, dpd->dpd_uuid);
+	key.dpk_off = symp->st_value - dpd->dpd_base;
+	key.dpk_size = symp->st_size;
+	key.dpk_type = type;
+
+	if (dt_pid_site_lookup(dpd->dpd_dtp, &key, NULL) == 0)
+		return;
+
+	if (dt_pid_decode_sites(dpd->dpd_dtp, dpd->dpd_pid, dpd->dpd_dmodel,
+	    text, symp, type, ftp) >= 0)
+		dt_pid_site_insert(dpd->dpd_dtp, &key, ftp);
+}
+
+static void *
+dt_pid_decode_worker(void *arg)
+{
+	dt_pid_decode_t *dpd = arg;
+	fasttrap_probe_spec_t *ftp = NULL;
+	uint8_t *text = NULL;
+	uint64_t size, maxsize = 0;
+	uint_t i, end;
+
+	for (;;) {
+		(void) pthread_mutex_lock(&dpd->dpd_lock);
+		i = dpd->dpd_next;
+		end = dpd->dpd_next = MIN(i + DT_PID_DECODE_CHUNK,
+		    dpd->dpd_nsyms);
+		(void) pthread_mutex_unlock(&dpd->dpd_lock);
+
+		if (i == end)
+			break;
+
+		for (; i < end; i++) {
+			const GElf_Sym *symp = &dpd->dpd_syms[i];
+
+			if ((size = symp->st_size) > maxsize) {
+				free(text);
+				free(ftp);
+
+				text = malloc(size + 4);
+				ftp = malloc(sizeof (fasttrap_probe_spec_t) +
+				    (size - 1) * sizeof (ftp->ftps_offs[0]));
+
+				if (text == NULL || ftp == NULL) {
+					maxsize = 0;
+					continue;
+				}
+
+				maxsize = size;
+			}
+
+			bzero(text, size + 4);
+			if (Pread(dpd->dpd_pr, text, size, symp->st_value) !=
+			    size)
+				continue;
+
+			if (dpd->dpd_return)
+				dt_pid_decode_one(dpd, symp, DTFTP_RETURN,
+				    text, ftp);
+
+			if (dpd->dpd_offsets)
+				dt_pid_decode_one(dpd, symp, DTFTP_OFFSETS,
+				    text, ftp);
+		}
+	}
+
+	free(text);
+	free(ftp);
+
+	return (NULL);
+}
+
+static void
+dt_pid_decode_module(dt_pid_probe_t *pp, const prmap_t *pmp, const char *obj,
+    dt_pr_t reason)
+{
+	dtrace_hdl_t *dtp = pp->dpp_dtp;
+	const pstatus_t *psp = Pstatus(pp->dpp_pr);
+	dt_pid_decode_t dpd;
+	mach_vm_address_t base;
+	pthread_t *tids;
+	int i, nthreads, nstarted;
+
+	bzero(&dpd, sizeof (dpd));
+	dpd.dpd_dtp = dtp;
+	dpd.dpd_pr = pp->dpp_pr;
+	dpd.dpd_pid = psp->pr_pid;
+	dpd.dpd_dmodel = psp->pr_dmodel;
+	dpd.dpd_func = pp->dpp_func;
+	dpd.dpd_return = gmatch("return", pp->dpp_name);
+	dpd.dpd_offsets = strisglob(pp->dpp_name);
+
+	if (!dpd.dpd_return && !dpd.dpd_offsets)
+		return;
+
+	/*
+	 * Sites can only be cached for images with a UUID.
+	 */
+	if (Pobjuuid(pp->dpp_pr, pmp->pr_vaddr, dpd.dpd_uuid, &base) != 0)
+		return;
+
+	dpd.dpd_base = base;
+
+	if (dt_libproc_funcs[reason].symbol_iter_by_addr(pp->dpp_pr, obj,
+	    PR_SYMTAB, BIND_ANY | TYPE_FUNC, dt_pid_decode_collect,
+	    &dpd) == 0 && dpd.dpd_nsyms == 0) {
+		(void) dt_libproc_funcs[reason].symbol_iter_by_addr(
+		    pp->dpp_pr, obj, PR_DYNSYM, BIND_ANY | TYPE_FUNC,
+		    dt_pid_decode_collect, &dpd);
+	}
+
+	nthreads = MIN(dtp->dt_pidthreads,
+	    dpd.dpd_nsyms / DT_PID_DECODE_CHUNK);
+
+	if (nthreads > 1 && (tids = dt_alloc(dtp,
+	    nthreads * sizeof (pthread_t))) != NULL) {
+		(void) pthread_mutex_init(&dpd.dpd_lock, NULL);
+
+		for (nstarted = 0; nstarted < nthreads; nstarted++) {
+			if (pthread_create(&tids[nstarted], NULL,
+			    dt_pid_decode_worker, &dpd) != 0)
+				break;
+		}
+
+		for (i = 0; i < nstarted; i++)
+			(void) pthread_join(tids[i], NULL);
+
+		dt_dprintf("decoded %u functions of %s with %d threads",
+		    dpd.dpd_nsyms, obj, nstarted);
+
+		(void) pthread_mutex_destroy(&dpd.dpd_lock);
+		dt_free(dtp, tids);
+	}
+
+	dt_free(dtp, dpd.dpd_syms);
+}
+#endif /* !defined(__arm__) && !defined(__arm64__) */
+
 static char*
 dt_pid_provider(fasttrap_provider_type_t type)
 {
@@ -384,6 +834,11 @@ dt_pid_per_mod(void *arg, const prmap_t *pmp, const char *obj,
 	} else {
 		uint_t nmatches = pp->dpp_nmatches;
 
+#if !defined(__arm__) && !defined(__arm64__)
+		if (dtp->dt_pidthreads > 1)
+			dt_pid_decode_module(pp, pmp, obj, reason);
+#endif
+
 		if (dt_libproc_funcs[reason].symbol_iter_by_addr(pp->dpp_pr, 
 		    obj, PR_SYMTAB, BIND_ANY | TYPE_FUNC, dt_pid_sym_filt, pp)) {
 			return (1);
@@ -778,6 +1233,8 @@ dt_pid_create_probes(dtrace_probedesc_t *pdp, dtrace_hdl_t *dtp, dt_pcb_t *pcb,
 			        err = -1; 
 		}
 		
+		dt_pid_text_flush(dtp, dpr);
+
 		if (err == 0) {
 			/*
 			 * Alert other retained enablings which may match
@@ -851,6 +1308,8 @@ dt_pid_create_probes_module(dtrace_hdl_t *dtp, dt_proc_t *dpr)
 		}
 	}
 	
+	dt_pid_text_flush(dtp, dpr);
+
 	if (found) {
 		/*
 		 * Give DTrace a shot to the ribs to get it to check
@@ -97,6 +97,14 @@ extern int dt_pid_create_objc_probes(dtrace_probedesc_t *, dtrace_hdl_t *,
 
 extern int dt_pid_per_sym(dt_pid_probe_t *, const GElf_Sym *, const char *);
 
+extern ssize_t dt_pid_read(struct ps_prochandle *, dtrace_hdl_t *, void *,
+    size_t, uint64_t);
+extern int dt_pid_makeprobe(dtrace_hdl_t *, fasttrap_probe_spec_t *);
+extern int dt_pid_find_sites(struct ps_prochandle *, dtrace_hdl_t *,
+    fasttrap_probe_spec_t *, const GElf_Sym *, int);
+extern int dt_pid_decode_sites(dtrace_hdl_t *, pid_t, char, uint8_t *,
+    const GElf_Sym *, int, fasttrap_probe_spec_t *);
+
 extern int dt_pid_error(dtrace_hdl_t *, dt_pcb_t *, dt_proc_t *,
     fasttrap_probe_spec_t *, dt_errtag_t, const char *, ...);
 
@@ -0,0 +1,2431 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * In-process C preprocessor
+ *
+ * Running cpp(1) over a D program costs a fork and exec of clang(1) along
+ * with a round trip through temporary files.  This file implements the part
+ * of the C preprocessor that D programs actually use -- #define and #undef,
+ * conditionals, #include of headers found through -I or next to the including
+ * file, #line and #pragma D -- so that most programs can be preprocessed
+ * without leaving the process.
+ *
+ * The macros predefined by clang(1) and by our own -D, -U and -include
+ * arguments are obtained by running the preprocessor once with -dM, and are
+ * then shared by every program compiled by the handle.  The output mimics
+ * that of clang -E: the same line markers on entering and leaving headers,
+ * blank lines or markers to keep tokens on their original lines, and a space
+ * wherever clang would insert one to keep adjacent tokens apart, which
+ * matters to the probe description syntax of D.  The output is not byte for
+ * byte that of clang -E, though: white space within a line, and the choice
+ * between blank lines and a line marker, can differ.  Neither changes the
+ * tokens the D compiler sees nor the lines it reports them on.
+ *
+ * Anything outside of that subset, including every condition that cpp(1)
+ * would report as an error or a warning, makes dt_pp_run() give up so that
+ * the caller can fall back to cpp(1), which then behaves exactly as before.
+ * The in-process preprocessor is only used if the "cppinproc" option is set;
+ * the tests in test/tst/common/preprocessor are run with and without it.  It
+ * stays off by default because clang(1) remains the definition of what a D
+ * program preprocesses to: a difference in macro expansion would silently
+ * change which probes a script enables, while all it saves is one fork and
+ * exec per program, which dtrace(1M) pays once per invocation next to the far
+ * larger cost of loading the D libraries.  The option is meant for consumers
+ * that compile many preprocessed programs on one handle, such as tools that
+ * generate a program per request, for which that fork and exec dominates the
+ * compile time (see perf.cpp).
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <assert.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include <dt_impl.h>
+#include <dt_pp.h>
+
+#define	DT_PP_HASHSIZE		1024	/* buckets for predefined macros */
+#define	DT_PP_RUNHASHSIZE	128	/* buckets for macros of a program */
+#define	DT_PP_MAXDEPTH		200	/* maximum #include nesting */
+#define	DT_PP_MAXPARAMS		128	/* maximum macro parameters */
+#define	DT_PP_MAXBLANK		8	/* blank lines before using a marker */
+#define	DT_PP_CHUNKSIZE		(64 * 1024)
+
+#define	DT_PP_TOK_EOF		0	/* end of input */
+#define	DT_PP_TOK_IDENT		1	/* identifier */
+#define	DT_PP_TOK_NUMBER	2	/* preprocessing number */
+#define	DT_PP_TOK_CHAR		3	/* character constant */
+#define	DT_PP_TOK_STRING	4	/* string literal */
+#define	DT_PP_TOK_PUNCT		5	/* punctuator */
+#define	DT_PP_TOK_OTHER		6	/* any other character */
+#define	DT_PP_TOK_PASTE		7	/* ## operator of a replacement list */
+#define	DT_PP_TOK_PLACE		8	/* placemarker for an empty argument */
+
+#define	DT_PP_TF_SPACE		0x01	/* preceded by white space */
+#define	DT_PP_TF_BOL		0x02	/* first token of a line */
+#define	DT_PP_TF_DIRECTIVE	0x04	/* # that introduces a directive */
+
+#define	DT_PP_MF_FUNC		0x01	/* function-like macro */
+#define	DT_PP_MF_VARIADIC	0x02	/* last parameter takes the rest */
+#define	DT_PP_MF_UNDEF		0x04	/* predefined macro was #undef'd */
+
+#define	DT_PP_B_NONE		0	/* ordinary macro */
+#define	DT_PP_B_FILE		1	/* __FILE__ */
+#define	DT_PP_B_LINE		2	/* __LINE__ */
+#define	DT_PP_B_COUNTER		3	/* __COUNTER__ */
+#define	DT_PP_B_LEVEL		4	/* __INCLUDE_LEVEL__ */
+#define	DT_PP_B_BASEFILE	5	/* __BASE_FILE__ */
+#define	DT_PP_B_UNSUP		6	/* builtin we leave to cpp(1) */
+
+#define	DT_PP_C_ACTIVE		0	/* group is being processed */
+#define	DT_PP_C_SEEK		1	/* no group of the #if taken yet */
+#define	DT_PP_C_DONE		2	/* a group of the #if was taken */
+#define	DT_PP_C_OUTER		3	/* an enclosing group is skipped */
+
+typedef struct dt_pp_macro dt_pp_macro_t;
+
+typedef struct dt_pp_hide {
+	struct dt_pp_hide *pph_next;	/* next macro in hide set */
+	const dt_pp_macro_t *pph_macro;	/* macro that may not be expanded */
+} dt_pp_hide_t;
+
+typedef struct dt_pp_tok {
+	struct dt_pp_tok *ppt_next;	/* next token in list */
+	const char *ppt_text;		/* spelling (not NUL-terminated) */
+	uint_t ppt_len;			/* length of spelling */
+	uchar_t ppt_kind;		/* kind of token (DT_PP_TOK_*) */
+	uchar_t ppt_flags;		/* flags (DT_PP_TF_*) */
+	ushort_t ppt_param;		/* parameter number + 1, or 0 */
+	uint_t ppt_line;		/* line of token or of its expansion */
+	uint_t ppt_col;			/* column of token or its expansion */
+	dt_pp_hide_t *ppt_hide;		/* hide set */
+} dt_pp_tok_t;
+
+struct dt_pp_macro {
+	dt_pp_macro_t *ppm_next;	/* next macro on hash chain */
+	const char *ppm_name;		/* name (not NUL-terminated) */
+	uint_t ppm_namelen;		/* length of name */
+	uint_t ppm_flags;		/* flags (DT_PP_MF_*) */
+	uint_t ppm_builtin;		/* builtin macro (DT_PP_B_*) */
+	uint_t ppm_nparams;		/* number of parameters */
+	dt_pp_tok_t *ppm_body;		/* replacement list */
+};
+
+typedef struct dt_pp_chunk {
+	struct dt_pp_chunk *ppk_next;	/* next chunk */
+	size_t ppk_size;		/* usable size of chunk */
+	size_t ppk_used;		/* bytes allocated from chunk */
+} dt_pp_chunk_t;
+
+typedef struct dt_pp_cond {
+	struct dt_pp_cond *ppc_prev;	/* enclosing conditional */
+	int ppc_state;			/* state of the #if (DT_PP_C_*) */
+	int ppc_else;			/* boolean: #else seen */
+} dt_pp_cond_t;
+
+typedef struct dt_pp_file {
+	struct dt_pp_file *ppf_prev;	/* including file */
+	const char *ppf_path;		/* path that the file was opened as */
+	const char *ppf_name;		/* presumed name (see #line) */
+	const char *ppf_buf;		/* contents of file */
+	size_t ppf_len;			/* length of contents */
+	size_t ppf_off;			/* offset of lexer */
+	size_t ppf_bol;			/* offset of start of current line */
+	uint_t ppf_line;		/* line of lexer */
+	int ppf_lineadj;		/* presumed line less actual line */
+	uint_t ppf_flags;		/* flags for the next token */
+	dt_pp_cond_t *ppf_cond;		/* innermost open conditional */
+} dt_pp_file_t;
+
+typedef struct dt_pp_once {
+	struct dt_pp_once *ppo_next;	/* next file */
+	dev_t ppo_dev;			/* device of file */
+	ino_t ppo_ino;			/* inode of file */
+} dt_pp_once_t;
+
+typedef struct dt_pp_in {
+	dt_pp_tok_t *ppi_toks;		/* tokens to rescan first */
+	int ppi_file;			/* boolean: then read current file */
+	uint_t ppi_flags;		/* flags left by an empty expansion */
+} dt_pp_in_t;
+
+struct dt_pp {
+	dtrace_hdl_t *dpp_hdl;		/* dtrace handle */
+	dt_pp_chunk_t *dpp_chunks;	/* memory for predefined macros */
+	dt_pp_macro_t *dpp_hash[DT_PP_HASHSIZE]; /* predefined macros */
+	char **dpp_incdirs;		/* -I directories in search order */
+	int dpp_nincdirs;		/* number of -I directories */
+};
+
+typedef struct dt_pp_run {
+	dt_pp_t *ppr_pp;		/* preprocessor */
+	jmp_buf ppr_jmp;		/* where to go if we must give up */
+	dt_pp_chunk_t **ppr_chunks;	/* where to allocate memory from */
+	dt_pp_macro_t **ppr_hash;	/* macros defined by this run */
+	uint_t ppr_hashsize;		/* buckets in ppr_hash */
+	dt_pp_file_t *ppr_file;		/* file being read */
+	const char *ppr_base;		/* name of the main file */
+	int ppr_depth;			/* #include depth */
+	int ppr_counter;		/* value of __COUNTER__ */
+	dt_pp_once_t *ppr_once;		/* files with #pragma once */
+	dt_pp_in_t ppr_in;		/* input of the main loop */
+	dt_pp_tok_t ppr_eof;		/* end of a token list */
+	FILE *ppr_out;			/* output, if any */
+	uint_t ppr_outline;		/* presumed line of output */
+	int ppr_outbol;			/* boolean: at beginning of line */
+	dt_pp_tok_t ppr_prev;		/* last token written */
+	dt_pp_tok_t ppr_prevprev;	/* token written before that */
+} dt_pp_run_t;
+
+static const char *const dt_pp_unsup[] = {
+	"_Pragma", "__DATE__", "__TIME__", "__TIMESTAMP__", "__FILE_NAME__",
+	"__MODULE__", "__building_module", "__has_attribute", "__has_builtin",
+	"__has_c_attribute", "__has_cpp_attribute", "__has_declspec_attribute",
+	"__has_extension", "__has_feature", "__has_include",
+	"__has_include_next", "__has_warning", "__is_identifier",
+	"__is_target_arch", "__is_target_environment", "__is_target_os",
+	"__is_target_variant_environment", "__is_target_variant_os",
+	"__is_target_vendor", "__VA_OPT__", NULL
+};
+
+/*
+ * Punctuators of more than one character, longest first.  The digraphs come
+ * last so that we can tell them apart.
+ */
+static const char *const dt_pp_puncts[] = {
+	"...", "<<=", ">>=", "->", "++", "--", "<<", ">>", "<=", ">=", "==",
+	"!=", "&&", "||", "*=", "/=", "%=", "+=", "-=", "&=", "^=", "|=", "##",
+	"<:", ":>", "<%", "%>", "%:", NULL
+};
+
+#define	DT_PP_DIGRAPHS	23	/* index of the first digraph */
+
+static void
+dt_pp_fail(dt_pp_run_t *run, const char *why)
+{
+	dt_pp_file_t *f = run->ppr_file;
+
+	if (f != NULL) {
+		dt_dprintf("deferring to cpp: %s:%u: %s", f->ppf_name,
+		    f->ppf_line, why);
+	} else
+		dt_dprintf("deferring to cpp: %s", why);
+
+	longjmp(run->ppr_jmp, 1);
+}
+
+static void *
+dt_pp_alloc(dt_pp_run_t *run, size_t size)
+{
+	dt_pp_chunk_t *ck = *run->ppr_chunks;
+	void *p;
+
+	size = P2ROUNDUP(size, sizeof (uint64_t));
+
+	if (ck == NULL || ck->ppk_used + size > ck->ppk_size) {
+		size_t csize = MAX(size, DT_PP_CHUNKSIZE);
+
+		if ((ck = malloc(sizeof (dt_pp_chunk_t) + csize)) == NULL)
+			dt_pp_fail(run, "out of memory");
+
+		ck->ppk_next = *run->ppr_chunks;
+		ck->ppk_size = csize;
+		ck->ppk_used = 0;
+		*run->ppr_chunks = ck;
+	}
+
+	p = (char *)(ck + 1) + ck->ppk_used;
+	ck->ppk_used += size;
+	return (p);
+}
+
+static void
+dt_pp_free_chunks(dt_pp_chunk_t *ck)
+{
+	dt_pp_chunk_t *next;
+
+	for (; ck != NULL; ck = next) {
+		next = ck->ppk_next;
+		free(ck);
+	}
+}
+
+static char *
+dt_pp_strndup(dt_pp_run_t *run, const char *s, size_t len)
+{
+	char *p = dt_pp_alloc(run, len + 1);
+
+	bcopy(s, p, len);
+	p[len] = '\0';
+	return (p);
+}
+
+static int
+dt_pp_is(const dt_pp_tok_t *t, const char *s)
+{
+	size_t len = strlen(s);
+
+	return (t != NULL && t->ppt_len == len &&
+	    bcmp(t->ppt_text, s, len) == 0);
+}
+
+static int
+dt_pp_ispunct(const dt_pp_tok_t *t, const char *s)
+{
+	return (t != NULL && t->ppt_kind == DT_PP_TOK_PUNCT && dt_pp_is(t, s));
+}
+
+static dt_pp_tok_t *
+dt_pp_tok(dt_pp_run_t *run, int kind, const char *text, size_t len)
+{
+	dt_pp_tok_t *t = dt_pp_alloc(run, sizeof (dt_pp_tok_t));
+
+	bzero(t, sizeof (dt_pp_tok_t));
+	t->ppt_kind = kind;
+	t->ppt_text = text;
+	t->ppt_len = len;
+	return (t);
+}
+
+static dt_pp_tok_t *
+dt_pp_dup(dt_pp_run_t *run, const dt_pp_tok_t *tok)
+{
+	dt_pp_tok_t *t = dt_pp_alloc(run, sizeof (dt_pp_tok_t));
+
+	bcopy(tok, t, sizeof (dt_pp_tok_t));
+	t->ppt_next = NULL;
+	return (t);
+}
+
+static dt_pp_tok_t *
+dt_pp_copy(dt_pp_run_t *run, const dt_pp_tok_t *list)
+{
+	dt_pp_tok_t *head = NULL, **tailp = &head;
+
+	for (; list != NULL; list = list->ppt_next) {
+		*tailp = dt_pp_dup(run, list);
+		tailp = &(*tailp)->ppt_next;
+	}
+
+	return (head);
+}
+
+/*
+ * Hide sets record the macros whose expansion produced a token, and which
+ * therefore may not be expanded again when the token is rescanned.
+ */
+static int
+dt_pp_hidden(const dt_pp_hide_t *hs, const dt_pp_macro_t *m)
+{
+	for (; hs != NULL; hs = hs->pph_next) {
+		if (hs->pph_macro == m)
+			return (1);
+	}
+
+	return (0);
+}
+
+static dt_pp_hide_t *
+dt_pp_hide_add(dt_pp_run_t *run, dt_pp_hide_t *hs, const dt_pp_macro_t *m)
+{
+	dt_pp_hide_t *h;
+
+	if (dt_pp_hidden(hs, m))
+		return (hs);
+
+	h = dt_pp_alloc(run, sizeof (dt_pp_hide_t));
+	h->pph_next = hs;
+	h->pph_macro = m;
+	return (h);
+}
+
+static dt_pp_hide_t *
+dt_pp_hide_union(dt_pp_run_t *run, const dt_pp_hide_t *a, dt_pp_hide_t *b)
+{
+	for (; a != NULL; a = a->pph_next)
+		b = dt_pp_hide_add(run, b, a->pph_macro);
+
+	return (b);
+}
+
+static dt_pp_hide_t *
+dt_pp_hide_inter(dt_pp_run_t *run, const dt_pp_hide_t *a,
+    const dt_pp_hide_t *b)
+{
+	dt_pp_hide_t *hs = NULL;
+
+	for (; a != NULL; a = a->pph_next) {
+		if (dt_pp_hidden(b, a->pph_macro))
+			hs = dt_pp_hide_add(run, hs, a->pph_macro);
+	}
+
+	return (hs);
+}
+
+static uint_t
+dt_pp_hashname(const char *s, size_t len)
+{
+	uint_t h = 0;
+
+	while (len-- != 0)
+		h = h * 31 + (uchar_t)*s++;
+
+	return (h);
+}
+
+static dt_pp_macro_t *
+dt_pp_chain_lookup(dt_pp_macro_t *m, const char *name, size_t len)
+{
+	for (; m != NULL; m = m->ppm_next) {
+		if (m->ppm_namelen == len && bcmp(m->ppm_name, name, len) == 0)
+			return (m);
+	}
+
+	return (NULL);
+}
+
+/*
+ * Look up a macro, first among those defined or undefined by this run and
+ * then among the predefined macros.
+ */
+static dt_pp_macro_t *
+dt_pp_lookup(dt_pp_run_t *run, const dt_pp_tok_t *t)
+{
+	uint_t h = dt_pp_hashname(t->ppt_text, t->ppt_len);
+	dt_pp_macro_t *m;
+
+	m = dt_pp_chain_lookup(run->ppr_hash[h % run->ppr_hashsize],
+	    t->ppt_text, t->ppt_len);
+
+	if (m == NULL && run->ppr_hash != run->ppr_pp->dpp_hash) {
+		m = dt_pp_chain_lookup(
+		    run->ppr_pp->dpp_hash[h % DT_PP_HASHSIZE],
+		    t->ppt_text, t->ppt_len);
+	}
+
+	return (m != NULL && (m->ppm_flags & DT_PP_MF_UNDEF) ? NULL : m);
+}
+
+static void
+dt_pp_insert(dt_pp_run_t *run, dt_pp_macro_t *m)
+{
+	dt_pp_macro_t **mp = &run->ppr_hash[dt_pp_hashname(m->ppm_name,
+	    m->ppm_namelen) % run->ppr_hashsize];
+	dt_pp_macro_t *o;
+
+	for (; (o = *mp) != NULL; mp = &o->ppm_next) {
+		if (o->ppm_namelen == m->ppm_namelen &&
+		    bcmp(o->ppm_name, m->ppm_name, m->ppm_namelen) == 0) {
+			*mp = o->ppm_next;
+			break;
+		}
+	}
+
+	m->ppm_next = *mp;
+	*mp = m;
+}
+
+/*
+ * The lexer works directly on the contents of each file.  Backslash-newline
+ * sequences are skipped wherever they appear, and a token that contains one
+ * is given a copy of its spelling without them.
+ */
+static size_t
+dt_pp_skip(const dt_pp_file_t *f, size_t off)
+{
+	while (off + 1 < f->ppf_len && f->ppf_buf[off] == '\\') {
+		if (f->ppf_buf[off + 1] == '\n')
+			off += 2;
+		else if (f->ppf_buf[off + 1] == '\r' && off + 2 < f->ppf_len &&
+		    f->ppf_buf[off + 2] == '\n')
+			off += 3;
+		else
+			break;
+	}
+
+	return (off);
+}
+
+static int
+dt_pp_peek(const dt_pp_file_t *f, size_t off)
+{
+	return (off < f->ppf_len ? (uchar_t)f->ppf_buf[off] : EOF);
+}
+
+static size_t
+dt_pp_next(const dt_pp_file_t *f, size_t off)
+{
+	return (dt_pp_skip(f, off + 1));
+}
+
+static void
+dt_pp_consume(dt_pp_file_t *f, size_t off)
+{
+	const char *p;
+
+	for (p = f->ppf_buf + f->ppf_off; p < f->ppf_buf + off; p++) {
+		if (*p == '\n') {
+			f->ppf_line++;
+			f->ppf_bol = p - f->ppf_buf + 1;
+		}
+	}
+
+	f->ppf_off = off;
+}
+
+static int
+dt_pp_isident(int c)
+{
+	return (isalnum(c) || c == '_' || c == '$');
+}
+
+/*
+ * Skip white space and comments, recording in ppf_flags whether any were seen
+ * and whether we crossed the end of a line.  Within a directive, we stop at
+ * the newline that ends it.
+ */
+static void
+dt_pp_skipws(dt_pp_run_t *run, dt_pp_file_t *f, int directive)
+{
+	size_t off = dt_pp_skip(f, f->ppf_off);
+	int c;
+
+	for (;;) {
+		c = dt_pp_peek(f, off);
+
+		if (c == '\n' && directive) {
+			break;
+		} else if (c == '\n') {
+			f->ppf_flags |= DT_PP_TF_BOL;
+			off = dt_pp_next(f, off);
+		} else if (c == ' ' || c == '\t' || c == '\f' || c == '\v' ||
+		    c == '\r') {
+			f->ppf_flags |= DT_PP_TF_SPACE;
+			off = dt_pp_next(f, off);
+		} else if (c == '/' &&
+		    dt_pp_peek(f, dt_pp_next(f, off)) == '*') {
+			off = dt_pp_next(f, dt_pp_next(f, off));
+
+			for (;;) {
+				if ((c = dt_pp_peek(f, off)) == EOF) {
+					dt_pp_consume(f, off);
+					dt_pp_fail(run, "unterminated comment");
+				}
+
+				off = dt_pp_next(f, off);
+
+				if (c == '*' && dt_pp_peek(f, off) == '/') {
+					off = dt_pp_next(f, off);
+					break;
+				}
+			}
+
+			f->ppf_flags |= DT_PP_TF_SPACE;
+		} else if (c == '/' &&
+		    dt_pp_peek(f, dt_pp_next(f, off)) == '/') {
+			while ((c = dt_pp_peek(f, off)) != EOF && c != '\n')
+				off = dt_pp_next(f, off);
+
+			f->ppf_flags |= DT_PP_TF_SPACE;
+		} else
+			break;
+	}
+
+	dt_pp_consume(f, off);
+}
+
+static size_t
+dt_pp_lexquote(dt_pp_run_t *run, dt_pp_file_t *f, size_t off, int skipping)
+{
+	int q = dt_pp_peek(f, off), c;
+
+	for (off = dt_pp_next(f, off); (c = dt_pp_peek(f, off)) != q;
+	    off = dt_pp_next(f, off)) {
+		if (c == '\\') {
+			off = dt_pp_next(f, off);
+			c = dt_pp_peek(f, off);
+		}
+
+		if (c == '\n' || c == EOF) {
+			if (skipping)
+				return (0);
+			dt_pp_fail(run, "unterminated literal");
+		}
+	}
+
+	return (dt_pp_next(f, off));
+}
+
+/*
+ * Lex the next token from the file.  When skipping a group we don't report
+ * unterminated literals, just as cpp(1) doesn't.
+ */
+static dt_pp_tok_t *
+dt_pp_lex(dt_pp_run_t *run, dt_pp_file_t *f, int skipping)
+{
+	size_t start, off, i, n;
+	const char *const *pp;
+	dt_pp_tok_t *t;
+	char *s;
+	int c, c2;
+
+	dt_pp_skipws(run, f, 0);
+
+	start = off = f->ppf_off;
+	t = dt_pp_tok(run, DT_PP_TOK_EOF, f->ppf_buf + start, 0);
+	t->ppt_flags = f->ppf_flags;
+	t->ppt_line = f->ppf_line;
+	t->ppt_col = start - f->ppf_bol + 1;
+
+	if ((c = dt_pp_peek(f, off)) == EOF)
+		return (t);
+
+	f->ppf_flags = 0;
+
+	if (isalpha(c) || c == '_' || c == '$') {
+		while (dt_pp_isident(dt_pp_peek(f, off)))
+			off = dt_pp_next(f, off);
+
+		t->ppt_kind = DT_PP_TOK_IDENT;
+
+		/*
+		 * An encoding prefix makes a single token of the identifier
+		 * and the literal that follows it.
+		 */
+		if ((c2 = dt_pp_peek(f, off)) == '"' || c2 == '\'') {
+			n = off - start;
+
+			if ((n == 1 && (c == 'L' || c == 'u' || c == 'U')) ||
+			    (n == 2 && c == 'u' && c2 == '"' &&
+			    f->ppf_buf[start + 1] == '8')) {
+				if ((i = dt_pp_lexquote(run, f, off,
+				    skipping)) != 0) {
+					off = i;
+					t->ppt_kind = c2 == '"' ?
+					    DT_PP_TOK_STRING : DT_PP_TOK_CHAR;
+				}
+			}
+		}
+	} else if (isdigit(c) ||
+	    (c == '.' && isdigit(dt_pp_peek(f, dt_pp_next(f, off))))) {
+		for (;;) {
+			c2 = c;
+			off = dt_pp_next(f, off);
+			c = dt_pp_peek(f, off);
+
+			if ((c == '+' || c == '-') &&
+			    strchr("eEpP", c2) != NULL)
+				continue;
+
+			if (!isalnum(c) && c != '_' && c != '.')
+				break;
+		}
+
+		t->ppt_kind = DT_PP_TOK_NUMBER;
+	} else if (c == '"' || c == '\'') {
+		if ((off = dt_pp_lexquote(run, f, start, skipping)) == 0) {
+			off = dt_pp_next(f, start);
+			t->ppt_kind = DT_PP_TOK_OTHER;
+		} else {
+			t->ppt_kind = c == '"' ?
+			    DT_PP_TOK_STRING : DT_PP_TOK_CHAR;
+		}
+	} else {
+		t->ppt_kind = DT_PP_TOK_PUNCT;
+
+		for (pp = dt_pp_puncts; *pp != NULL; pp++) {
+			for (i = 0, off = start; (*pp)[i] != '\0' &&
+			    dt_pp_peek(f, off) == (uchar_t)(*pp)[i]; i++)
+				off = dt_pp_next(f, off);
+
+			if ((*pp)[i] == '\0')
+				break;
+		}
+
+		if (*pp == NULL) {
+			off = dt_pp_next(f, start);
+
+			if (strchr("[](){}.&*+-~!/%<>^|?:;=,#", c) == NULL)
+				t->ppt_kind = DT_PP_TOK_OTHER;
+
+			if (c > SCHAR_MAX && !skipping)
+				dt_pp_fail(run, "non-ASCII character");
+		} else if (pp >= &dt_pp_puncts[DT_PP_DIGRAPHS] && !skipping) {
+			dt_pp_fail(run, "digraph");
+		}
+
+		if (c == '#' && off == dt_pp_next(f, start) &&
+		    (t->ppt_flags & DT_PP_TF_BOL))
+			t->ppt_flags |= DT_PP_TF_DIRECTIVE;
+	}
+
+	t->ppt_len = off - start;
+
+	if (memchr(t->ppt_text, '\\', t->ppt_len) != NULL) {
+		s = dt_pp_alloc(run, t->ppt_len + 1);
+
+		for (n = 0, i = start; i < off; i = dt_pp_next(f, i))
+			s[n++] = f->ppf_buf[i];
+
+		t->ppt_text = s;
+		t->ppt_len = n;
+	}
+
+	dt_pp_consume(f, off);
+	return (t);
+}
+
+/*
+ * Read the rest of a directive line, leaving the lexer at the beginning of
+ * the next line.
+ */
+static dt_pp_tok_t *
+dt_pp_readline(dt_pp_run_t *run, int skipping)
+{
+	dt_pp_file_t *f = run->ppr_file;
+	dt_pp_tok_t *head = NULL, **tailp = &head, *t;
+	int c;
+
+	for (;;) {
+		dt_pp_skipws(run, f, 1);
+
+		if ((c = dt_pp_peek(f, f->ppf_off)) == '\n' || c == EOF) {
+			if (c == '\n')
+				dt_pp_consume(f, dt_pp_next(f, f->ppf_off));
+			f->ppf_flags = DT_PP_TF_BOL;
+			break;
+		}
+
+		t = dt_pp_lex(run, f, skipping);
+		t->ppt_flags &= ~DT_PP_TF_DIRECTIVE;
+		*tailp = t;
+		tailp = &t->ppt_next;
+	}
+
+	return (head);
+}
+
+/*
+ * Get the next token to scan.  A macro that expands to nothing passes on its
+ * white space and its place at the start of a line to the token after it.
+ */
+static dt_pp_tok_t *
+dt_pp_get(dt_pp_run_t *run, dt_pp_in_t *in, int skipping)
+{
+	dt_pp_tok_t *t;
+
+	if ((t = in->ppi_toks) != NULL) {
+		in->ppi_toks = t->ppt_next;
+		t->ppt_next = NULL;
+	} else if (in->ppi_file) {
+		t = dt_pp_lex(run, run->ppr_file, skipping);
+	} else {
+		run->ppr_eof.ppt_next = NULL;
+		return (&run->ppr_eof);
+	}
+
+	t->ppt_flags |= in->ppi_flags;
+	in->ppi_flags = 0;
+	return (t);
+}
+
+static void
+dt_pp_unget(dt_pp_in_t *in, dt_pp_tok_t *t)
+{
+	t->ppt_next = in->ppi_toks;
+	in->ppi_toks = t;
+}
+
+static void
+dt_pp_push(dt_pp_in_t *in, dt_pp_tok_t *list)
+{
+	dt_pp_tok_t *t;
+
+	if (list == NULL)
+		return;
+
+	for (t = list; t->ppt_next != NULL; t = t->ppt_next)
+		continue;
+
+	t->ppt_next = in->ppi_toks;
+	in->ppi_toks = list;
+}
+
+static dt_pp_tok_t *
+dt_pp_string(dt_pp_run_t *run, const char *s)
+{
+	size_t len = strlen(s), n = 0;
+	char *p = dt_pp_alloc(run, 2 * len + 2);
+
+	p[n++] = '"';
+	for (; *s != '\0'; s++) {
+		if (*s == '"' || *s == '\\')
+			p[n++] = '\\';
+		p[n++] = *s;
+	}
+	p[n++] = '"';
+
+	return (dt_pp_tok(run, DT_PP_TOK_STRING, p, n));
+}
+
+static dt_pp_tok_t *
+dt_pp_number(dt_pp_run_t *run, uint64_t val)
+{
+	char buf[32];
+	size_t len = snprintf(buf, sizeof (buf), "%llu",
+	    (unsigned long long)val);
+
+	return (dt_pp_tok(run, DT_PP_TOK_NUMBER,
+	    dt_pp_strndup(run, buf, len), len));
+}
+
+/*
+ * Implement the # operator: spell the tokens of an argument, with a single
+ * space wherever there was white space, and make a string literal of them.
+ */
+static dt_pp_tok_t *
+dt_pp_stringify(dt_pp_run_t *run, const dt_pp_tok_t *arg)
+{
+	const dt_pp_tok_t *t;
+	size_t len = 2, n = 0, i;
+	char *p;
+
+	for (t = arg; t != NULL; t = t->ppt_next)
+		len += 2 * t->ppt_len + 1;
+
+	p = dt_pp_alloc(run, len);
+	p[n++] = '"';
+
+	for (t = arg; t != NULL; t = t->ppt_next) {
+		if (t != arg &&
+		    (t->ppt_flags & (DT_PP_TF_SPACE | DT_PP_TF_BOL)))
+			p[n++] = ' ';
+
+		for (i = 0; i < t->ppt_len; i++) {
+			if ((t->ppt_kind == DT_PP_TOK_STRING ||
+			    t->ppt_kind == DT_PP_TOK_CHAR) &&
+			    (t->ppt_text[i] == '"' || t->ppt_text[i] == '\\'))
+				p[n++] = '\\';
+			p[n++] = t->ppt_text[i];
+		}
+	}
+
+	p[n++] = '"';
+	return (dt_pp_tok(run, DT_PP_TOK_STRING, p, n));
+}
+
+/*
+ * Implement the ## operator: the spellings of both tokens must form exactly
+ * one token.
+ */
+static dt_pp_tok_t *
+dt_pp_glue(dt_pp_run_t *run, dt_pp_tok_t *l, dt_pp_tok_t *r)
+{
+	dt_pp_file_t f;
+	dt_pp_tok_t *t;
+	char *s;
+
+	if (l->ppt_kind == DT_PP_TOK_PLACE) {
+		r->ppt_flags = l->ppt_flags;
+		return (r);
+	}
+
+	if (r->ppt_kind == DT_PP_TOK_PLACE)
+		return (l);
+
+	s = dt_pp_alloc(run, l->ppt_len + r->ppt_len + 1);
+	bcopy(l->ppt_text, s, l->ppt_len);
+	bcopy(r->ppt_text, s + l->ppt_len, r->ppt_len);
+
+	bzero(&f, sizeof (f));
+	f.ppf_buf = s;
+	f.ppf_len = l->ppt_len + r->ppt_len;
+	f.ppf_name = run->ppr_file->ppf_name;
+	f.ppf_line = run->ppr_file->ppf_line;
+
+	t = dt_pp_lex(run, &f, 0);
+
+	if (t->ppt_kind == DT_PP_TOK_EOF || f.ppf_flags != 0 ||
+	    f.ppf_off != f.ppf_len)
+		dt_pp_fail(run, "pasting does not form a valid token");
+
+	t->ppt_flags = l->ppt_flags;
+	t->ppt_hide = dt_pp_hide_inter(run, l->ppt_hide, r->ppt_hide);
+	return (t);
+}
+
+static dt_pp_tok_t *dt_pp_expand_list(dt_pp_run_t *, dt_pp_tok_t *, int);
+
+/*
+ * Substitute the arguments of a macro invocation into its replacement list,
+ * apply the # and ## operators, and give each resulting token the hide set of
+ * the invocation and the position of the macro name.
+ */
+static dt_pp_tok_t *
+dt_pp_subst(dt_pp_run_t *run, const dt_pp_macro_t *m, dt_pp_tok_t **args,
+    dt_pp_hide_t *hs, const dt_pp_tok_t *name)
+{
+	dt_pp_tok_t *head = NULL, **tailp = &head, **exp = NULL;
+	dt_pp_tok_t **prevp = NULL, **prevprevp = NULL;
+	dt_pp_tok_t *b, *t, *x, *prevb = NULL, *prevprevb = NULL;
+	dt_pp_tok_t *out = NULL, **otailp = &out, **lastp = NULL;
+	int first = 1;
+	uint_t i;
+
+	if (m->ppm_nparams != 0) {
+		exp = dt_pp_alloc(run, m->ppm_nparams * sizeof (dt_pp_tok_t *));
+		bzero(exp, m->ppm_nparams * sizeof (dt_pp_tok_t *));
+	}
+
+	for (b = m->ppm_body; b != NULL; b = b->ppt_next) {
+		i = b->ppt_param - 1;
+
+		if ((m->ppm_flags & DT_PP_MF_FUNC) && dt_pp_ispunct(b, "#")) {
+			t = dt_pp_stringify(run,
+			    args[b->ppt_next->ppt_param - 1]);
+			t->ppt_flags = b->ppt_flags & DT_PP_TF_SPACE;
+			b = b->ppt_next;
+		} else if (b->ppt_param == 0) {
+			t = dt_pp_dup(run, b);
+		} else if ((m->ppm_flags & DT_PP_MF_VARIADIC) &&
+		    i == m->ppm_nparams - 1 && prevb != NULL &&
+		    prevb->ppt_kind == DT_PP_TOK_PASTE &&
+		    dt_pp_ispunct(prevprevb, ",")) {
+			/*
+			 * As an extension, ", ## __VA_ARGS__" drops the comma
+			 * if there are no variable arguments, and otherwise
+			 * just drops the ##.
+			 */
+			if (b->ppt_next != NULL &&
+			    b->ppt_next->ppt_kind == DT_PP_TOK_PASTE)
+				dt_pp_fail(run, "unsupported use of ##");
+
+			tailp = args[i] == NULL ? prevprevp : prevp;
+			*tailp = NULL;
+			t = dt_pp_copy(run, args[i]);
+		} else if ((prevb != NULL &&
+		    prevb->ppt_kind == DT_PP_TOK_PASTE) ||
+		    (b->ppt_next != NULL &&
+		    b->ppt_next->ppt_kind == DT_PP_TOK_PASTE)) {
+			if ((t = dt_pp_copy(run, args[i])) == NULL)
+				t = dt_pp_tok(run, DT_PP_TOK_PLACE, "", 0);
+		} else {
+			if (exp[i] == NULL && args[i] != NULL) {
+				exp[i] = dt_pp_expand_list(run,
+				    dt_pp_copy(run, args[i]), 0);
+			}
+			t = dt_pp_copy(run, exp[i]);
+		}
+
+		if (b->ppt_param != 0 && t != NULL) {
+			t->ppt_flags = (t->ppt_flags & ~(DT_PP_TF_SPACE |
+			    DT_PP_TF_BOL)) | (b->ppt_flags & DT_PP_TF_SPACE);
+		}
+
+		prevprevb = prevb;
+		prevb = b;
+		prevprevp = prevp;
+		prevp = tailp;
+
+		for (*tailp = t; *tailp != NULL; tailp = &(*tailp)->ppt_next)
+			continue;
+	}
+
+	/*
+	 * Apply the ## operators from left to right, and then drop any
+	 * remaining placemarkers.
+	 */
+	for (t = head; t != NULL; t = x) {
+		x = t->ppt_next;
+		t->ppt_next = NULL;
+
+		if (t->ppt_kind == DT_PP_TOK_PASTE) {
+			assert(lastp != NULL && x != NULL);
+			t = x;
+			x = t->ppt_next;
+			t->ppt_next = NULL;
+			t = dt_pp_glue(run, *lastp, t);
+			otailp = lastp;
+		}
+
+		*otailp = t;
+		lastp = otailp;
+		otailp = &t->ppt_next;
+	}
+
+	for (tailp = &out; (t = *tailp) != NULL; ) {
+		if (t->ppt_kind == DT_PP_TOK_PLACE) {
+			*tailp = t->ppt_next;
+			continue;
+		}
+
+		t->ppt_hide = dt_pp_hide_union(run, t->ppt_hide, hs);
+		t->ppt_line = name->ppt_line;
+		t->ppt_col = name->ppt_col;
+		t->ppt_flags &= ~(DT_PP_TF_BOL | DT_PP_TF_DIRECTIVE);
+
+		if (first) {
+			t->ppt_flags = (t->ppt_flags & ~DT_PP_TF_SPACE) |
+			    (name->ppt_flags & (DT_PP_TF_SPACE | DT_PP_TF_BOL));
+			first = 0;
+		}
+
+		tailp = &t->ppt_next;
+	}
+
+	return (out);
+}
+
+/*
+ * Collect the arguments of a function-like macro invocation, up to and
+ * including the closing parenthesis.
+ */
+static dt_pp_tok_t *
+dt_pp_args(dt_pp_run_t *run, dt_pp_in_t *in, const dt_pp_macro_t *m,
+    dt_pp_tok_t **args)
+{
+	uint_t nslots = MAX(m->ppm_nparams, 1), n = 0, depth = 0;
+	dt_pp_tok_t **tailp = &args[0], *t;
+
+	bzero(args, nslots * sizeof (dt_pp_tok_t *));
+
+	for (;;) {
+		t = dt_pp_get(run, in, 0);
+
+		if (t->ppt_kind == DT_PP_TOK_EOF)
+			dt_pp_fail(run, "unterminated macro invocation");
+
+		if (t->ppt_flags & DT_PP_TF_DIRECTIVE)
+			dt_pp_fail(run, "directive in macro arguments");
+
+		if (dt_pp_ispunct(t, "(")) {
+			depth++;
+		} else if (dt_pp_ispunct(t, ")")) {
+			if (depth == 0)
+				break;
+			depth--;
+		} else if (dt_pp_ispunct(t, ",") && depth == 0 &&
+		    !((m->ppm_flags & DT_PP_MF_VARIADIC) &&
+		    n == m->ppm_nparams - 1)) {
+			if (++n >= nslots)
+				dt_pp_fail(run, "too many macro arguments");
+			tailp = &args[n];
+			continue;
+		}
+
+		if (t->ppt_flags & DT_PP_TF_BOL) {
+			t->ppt_flags &= ~DT_PP_TF_BOL;
+			t->ppt_flags |= DT_PP_TF_SPACE;
+		}
+
+		*tailp = t;
+		tailp = &t->ppt_next;
+	}
+
+	if (n + 1 < m->ppm_nparams && !((m->ppm_flags & DT_PP_MF_VARIADIC) &&
+	    n + 2 == m->ppm_nparams))
+		dt_pp_fail(run, "too few macro arguments");
+
+	if (m->ppm_nparams == 0 && args[0] != NULL)
+		dt_pp_fail(run, "too many macro arguments");
+
+	return (t);
+}
+
+static dt_pp_tok_t *
+dt_pp_builtin(dt_pp_run_t *run, const dt_pp_macro_t *m, const dt_pp_tok_t *t)
+{
+	dt_pp_file_t *f = run->ppr_file;
+
+	switch (m->ppm_builtin) {
+	case DT_PP_B_FILE:
+		return (dt_pp_string(run, f->ppf_name));
+	case DT_PP_B_LINE:
+		return (dt_pp_number(run, t->ppt_line + f->ppf_lineadj));
+	case DT_PP_B_COUNTER:
+		return (dt_pp_number(run, run->ppr_counter++));
+	case DT_PP_B_LEVEL:
+		return (dt_pp_number(run, run->ppr_depth));
+	case DT_PP_B_BASEFILE:
+		return (dt_pp_string(run, run->ppr_base));
+	default:
+		dt_pp_fail(run, "unsupported builtin macro");
+	}
+
+	return (NULL);
+}
+
+/*
+ * Expand the macro named by token t, reading any arguments from the input,
+ * and push the result back onto the input to be rescanned.  Returns 0 if t
+ * names a function-like macro but isn't followed by an argument list.
+ */
+static int
+dt_pp_expand(dt_pp_run_t *run, dt_pp_in_t *in, dt_pp_tok_t *t,
+    const dt_pp_macro_t *m)
+{
+	dt_pp_tok_t *p, *rparen, **args, *body;
+
+	if (m->ppm_builtin != DT_PP_B_NONE) {
+		body = dt_pp_builtin(run, m, t);
+		body->ppt_flags =
+		    t->ppt_flags & (DT_PP_TF_SPACE | DT_PP_TF_BOL);
+		body->ppt_line = t->ppt_line;
+		body->ppt_col = t->ppt_col;
+		dt_pp_unget(in, body);
+		return (1);
+	}
+
+	if (!(m->ppm_flags & DT_PP_MF_FUNC)) {
+		body = dt_pp_subst(run, m, NULL,
+		    dt_pp_hide_add(run, t->ppt_hide, m), t);
+	} else {
+		p = dt_pp_get(run, in, 0);
+
+		if (!dt_pp_ispunct(p, "(") ||
+		    (p->ppt_flags & DT_PP_TF_DIRECTIVE)) {
+			dt_pp_unget(in, p);
+			return (0);
+		}
+
+		args = dt_pp_alloc(run,
+		    MAX(m->ppm_nparams, 1) * sizeof (dt_pp_tok_t *));
+		rparen = dt_pp_args(run, in, m, args);
+
+		body = dt_pp_subst(run, m, args, dt_pp_hide_add(run,
+		    dt_pp_hide_inter(run, t->ppt_hide, rparen->ppt_hide), m),
+		    t);
+	}
+
+	if (body == NULL)
+		in->ppi_flags |= t->ppt_flags & (DT_PP_TF_SPACE | DT_PP_TF_BOL);
+
+	dt_pp_push(in, body);
+	return (1);
+}
+
+/*
+ * Replace "defined X" and "defined(X)" in a #if expression.
+ */
+static dt_pp_tok_t *
+dt_pp_defined(dt_pp_run_t *run, dt_pp_in_t *in)
+{
+	dt_pp_tok_t *t = dt_pp_get(run, in, 0);
+	const dt_pp_macro_t *m;
+	int paren = 0;
+
+	if (dt_pp_ispunct(t, "(")) {
+		paren = 1;
+		t = dt_pp_get(run, in, 0);
+	}
+
+	if (t->ppt_kind != DT_PP_TOK_IDENT)
+		dt_pp_fail(run, "defined without an identifier");
+
+	if (paren && !dt_pp_ispunct(dt_pp_get(run, in, 0), ")"))
+		dt_pp_fail(run, "defined without a closing parenthesis");
+
+	if ((m = dt_pp_lookup(run, t)) != NULL &&
+	    m->ppm_builtin == DT_PP_B_UNSUP)
+		dt_pp_fail(run, "unsupported builtin macro");
+
+	return (dt_pp_number(run, m != NULL));
+}
+
+/*
+ * Fully macro-expand a list of tokens in isolation, as is done for macro
+ * arguments and for the operands of #if, #include and #line.
+ */
+static dt_pp_tok_t *
+dt_pp_expand_list(dt_pp_run_t *run, dt_pp_tok_t *list, int ifexpr)
+{
+	dt_pp_tok_t *head = NULL, **tailp = &head, *t;
+	const dt_pp_macro_t *m;
+	dt_pp_in_t in;
+
+	in.ppi_toks = list;
+	in.ppi_file = 0;
+	in.ppi_flags = 0;
+
+	while ((t = dt_pp_get(run, &in, 0))->ppt_kind != DT_PP_TOK_EOF) {
+		if (t->ppt_kind == DT_PP_TOK_IDENT) {
+			if (ifexpr && dt_pp_is(t, "defined")) {
+				t = dt_pp_defined(run, &in);
+			} else if ((m = dt_pp_lookup(run, t)) != NULL &&
+			    !dt_pp_hidden(t->ppt_hide, m) &&
+			    dt_pp_expand(run, &in, t, m)) {
+				continue;
+			}
+		}
+
+		*tailp = t;
+		tailp = &t->ppt_next;
+	}
+
+	return (head);
+}
+
+/*
+ * Evaluate the controlling expression of #if and #elif.  Values are 64-bit,
+ * signed unless the usual arithmetic conversions make them unsigned.  The
+ * evaluation of operands that are skipped by &&, || and ?: doesn't report
+ * division by zero.
+ */
+typedef struct dt_pp_val {
+	uint64_t ppv_val;		/* value */
+	int ppv_uns;			/* boolean: value is unsigned */
+} dt_pp_val_t;
+
+typedef struct dt_pp_expr {
+	dt_pp_run_t *ppe_run;		/* preprocessor run */
+	dt_pp_tok_t *ppe_tok;		/* next token of expression */
+} dt_pp_expr_t;
+
+static dt_pp_val_t dt_pp_eval_cond(dt_pp_expr_t *, int);
+
+static int
+dt_pp_eval_op(dt_pp_expr_t *e, const char *op)
+{
+	if (dt_pp_ispunct(e->ppe_tok, op)) {
+		e->ppe_tok = e->ppe_tok->ppt_next;
+		return (1);
+	}
+
+	return (0);
+}
+
+static dt_pp_val_t
+dt_pp_eval_number(dt_pp_expr_t *e, const dt_pp_tok_t *t)
+{
+	const char *p = t->ppt_text, *end = p + t->ppt_len;
+	dt_pp_val_t v = { 0, 0 };
+	uint64_t base = 10, d;
+	int nl = 0;
+
+	if (end - p > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
+		base = 16;
+		p += 2;
+	} else if (end - p > 2 && p[0] == '0' && (p[1] == 'b' || p[1] == 'B')) {
+		base = 2;
+		p += 2;
+	} else if (p[0] == '0') {
+		base = 8;
+	}
+
+	for (; p < end && isxdigit((uchar_t)*p); p++) {
+		d = isdigit((uchar_t)*p) ? *p - '0' :
+		    tolower((uchar_t)*p) - 'a' + 10;
+
+		if (d >= base)
+			break;
+
+		if (v.ppv_val > (UINT64_MAX - d) / base)
+			dt_pp_fail(e->ppe_run, "integer constant is too large");
+
+		v.ppv_val = v.ppv_val * base + d;
+	}
+
+	for (; p < end; p++) {
+		if ((*p == 'u' || *p == 'U') && !v.ppv_uns)
+			v.ppv_uns = 1;
+		else if ((*p == 'l' || *p == 'L') && nl < 2 &&
+		    (nl == 0 || p[-1] == *p))
+			nl++;
+		else
+			dt_pp_fail(e->ppe_run, "invalid integer constant");
+	}
+
+	if (v.ppv_val > INT64_MAX)
+		v.ppv_uns = 1;
+
+	return (v);
+}
+
+static dt_pp_val_t
+dt_pp_eval_char(dt_pp_expr_t *e, const dt_pp_tok_t *t)
+{
+	const char *p = t->ppt_text + 1, *end = t->ppt_text + t->ppt_len - 1;
+	dt_pp_val_t v = { 0, 0 };
+	int c, n;
+
+	if (t->ppt_text[0] != '\'' || p >= end)
+		dt_pp_fail(e->ppe_run, "unsupported character constant");
+
+	if ((c = (uchar_t)*p++) == '\\') {
+		switch (c = (uchar_t)*p++) {
+		case 'n': c = '\n'; break;
+		case 't': c = '\t'; break;
+		case 'r': c = '\r'; break;
+		case 'a': c = '\a'; break;
+		case 'b': c = '\b'; break;
+		case 'f': c = '\f'; break;
+		case 'v': c = '\v'; break;
+		case '\\': case '\'': case '"': case '?': break;
+		case 'x':
+			for (c = 0, n = 0; p < end && isxdigit((uchar_t)*p);
+			    p++, n++) {
+				c = c * 16 + (isdigit((uchar_t)*p) ? *p - '0' :
+				    tolower((uchar_t)*p) - 'a' + 10);
+			}
+			if (n == 0 || n > 2)
+				dt_pp_fail(e->ppe_run, "invalid escape");
+			break;
+		default:
+			if (c < '0' || c > '7')
+				dt_pp_fail(e->ppe_run, "invalid escape");
+			for (c -= '0', n = 1; p < end && n < 3 &&
+			    *p >= '0' && *p <= '7'; p++, n++)
+				c = c * 8 + *p - '0';
+			if (c > UCHAR_MAX)
+				dt_pp_fail(e->ppe_run, "invalid escape");
+		}
+	}
+
+	if (p != end)
+		dt_pp_fail(e->ppe_run, "multi-character constant");
+
+	v.ppv_val = (int64_t)(char)c;
+	return (v);
+}
+
+static dt_pp_val_t
+dt_pp_eval_unary(dt_pp_expr_t *e, int ev)
+{
+	dt_pp_tok_t *t = e->ppe_tok;
+	dt_pp_val_t v = { 0, 0 };
+
+	if (t == NULL)
+		dt_pp_fail(e->ppe_run, "missing expression");
+
+	if (dt_pp_eval_op(e, "(")) {
+		v = dt_pp_eval_cond(e, ev);
+		if (!dt_pp_eval_op(e, ")"))
+			dt_pp_fail(e->ppe_run, "missing ')' in expression");
+		return (v);
+	}
+
+	if (dt_pp_eval_op(e, "+"))
+		return (dt_pp_eval_unary(e, ev));
+
+	if (dt_pp_eval_op(e, "-")) {
+		v = dt_pp_eval_unary(e, ev);
+		if (ev && !v.ppv_uns && (int64_t)v.ppv_val == INT64_MIN)
+			dt_pp_fail(e->ppe_run, "integer overflow");
+		v.ppv_val = -v.ppv_val;
+		return (v);
+	}
+
+	if (dt_pp_eval_op(e, "~")) {
+		v = dt_pp_eval_unary(e, ev);
+		v.ppv_val = ~v.ppv_val;
+		return (v);
+	}
+
+	if (dt_pp_eval_op(e, "!")) {
+		v = dt_pp_eval_unary(e, ev);
+		v.ppv_val = v.ppv_val == 0;
+		v.ppv_uns = 0;
+		return (v);
+	}
+
+	e->ppe_tok = t->ppt_next;
+
+	switch (t->ppt_kind) {
+	case DT_PP_TOK_NUMBER:
+		return (dt_pp_eval_number(e, t));
+	case DT_PP_TOK_CHAR:
+		return (dt_pp_eval_char(e, t));
+	case DT_PP_TOK_IDENT:
+		return (v);
+	default:
+		dt_pp_fail(e->ppe_run, "invalid token in expression");
+	}
+
+	return (v);
+}
+
+static int
+dt_pp_eval_prec(const dt_pp_tok_t *t)
+{
+	static const struct {
+		const char *op;
+		int prec;
+	} ops[] = {
+		{ "*", 10 }, { "/", 10 }, { "%", 10 }, { "+", 9 }, { "-", 9 },
+		{ "<<", 8 }, { ">>", 8 }, { "<", 7 }, { ">", 7 }, { "<=", 7 },
+		{ ">=", 7 }, { "==", 6 }, { "!=", 6 }, { "&", 5 }, { "^", 4 },
+		{ "|", 3 }, { "&&", 2 }, { "||", 1 }, { NULL, 0 }
+	};
+	int i;
+
+	for (i = 0; t != NULL && ops[i].op != NULL; i++) {
+		if (dt_pp_ispunct(t, ops[i].op))
+			return (ops[i].prec);
+	}
+
+	return (0);
+}
+
+static dt_pp_val_t
+dt_pp_eval_binary(dt_pp_expr_t *e, int minprec, int ev)
+{
+	dt_pp_val_t l = dt_pp_eval_unary(e, ev), r;
+	dt_pp_tok_t *op;
+	int64_t res;
+	int prec, uns, ovf;
+
+	while ((prec = dt_pp_eval_prec(e->ppe_tok)) >= minprec && prec != 0) {
+		op = e->ppe_tok;
+		e->ppe_tok = op->ppt_next;
+
+		if (dt_pp_is(op, "&&") || dt_pp_is(op, "||")) {
+			int lv = l.ppv_val != 0, and = dt_pp_is(op, "&&");
+
+			r = dt_pp_eval_binary(e, prec + 1,
+			    ev && (and ? lv : !lv));
+			l.ppv_val = and ? (lv && r.ppv_val != 0) :
+			    (lv || r.ppv_val != 0);
+			l.ppv_uns = 0;
+			continue;
+		}
+
+		r = dt_pp_eval_binary(e, prec + 1, ev);
+
+		if (dt_pp_is(op, "<<") || dt_pp_is(op, ">>")) {
+			if (r.ppv_val >= 64) {
+				if (ev)
+					dt_pp_fail(e->ppe_run, "invalid shift");
+				r.ppv_val = 0;
+			}
+
+			if (dt_pp_is(op, "<<")) {
+				if (ev && !l.ppv_uns &&
+				    ((int64_t)(l.ppv_val << r.ppv_val) >>
+				    r.ppv_val) != (int64_t)l.ppv_val) {
+					dt_pp_fail(e->ppe_run,
+					    "integer overflow");
+				}
+				l.ppv_val <<= r.ppv_val;
+			} else if (l.ppv_uns)
+				l.ppv_val >>= r.ppv_val;
+			else
+				l.ppv_val = (int64_t)l.ppv_val >> r.ppv_val;
+			continue;
+		}
+
+		uns = l.ppv_uns || r.ppv_uns;
+
+		/*
+		 * cpp(1) warns about signed overflow and about negative values
+		 * that are converted to unsigned, so we leave those to it.
+		 */
+		if (ev && uns && ((!l.ppv_uns && (int64_t)l.ppv_val < 0) ||
+		    (!r.ppv_uns && (int64_t)r.ppv_val < 0)))
+			dt_pp_fail(e->ppe_run, "negative value made unsigned");
+
+		switch (op->ppt_text[0]) {
+		case '*':
+			ovf = __builtin_mul_overflow((int64_t)l.ppv_val,
+			    (int64_t)r.ppv_val, &res);
+			if (ev && !uns && ovf)
+				dt_pp_fail(e->ppe_run, "integer overflow");
+			l.ppv_val *= r.ppv_val;
+			break;
+		case '/':
+		case '%':
+			if (r.ppv_val == 0) {
+				if (ev) {
+					dt_pp_fail(e->ppe_run,
+					    "division by zero");
+				}
+				l.ppv_val = 0;
+			} else if (uns) {
+				l.ppv_val = op->ppt_text[0] == '/' ?
+				    l.ppv_val / r.ppv_val :
+				    l.ppv_val % r.ppv_val;
+			} else if ((int64_t)r.ppv_val == -1) {
+				if (ev && (int64_t)l.ppv_val == INT64_MIN) {
+					dt_pp_fail(e->ppe_run,
+					    "integer overflow");
+				}
+				l.ppv_val = op->ppt_text[0] == '/' ?
+				    -l.ppv_val : 0;
+			} else {
+				l.ppv_val = op->ppt_text[0] == '/' ?
+				    (int64_t)l.ppv_val / (int64_t)r.ppv_val :
+				    (int64_t)l.ppv_val % (int64_t)r.ppv_val;
+			}
+			break;
+		case '+':
+			ovf = __builtin_add_overflow((int64_t)l.ppv_val,
+			    (int64_t)r.ppv_val, &res);
+			if (ev && !uns && ovf)
+				dt_pp_fail(e->ppe_run, "integer overflow");
+			l.ppv_val += r.ppv_val;
+			break;
+		case '-':
+			ovf = __builtin_sub_overflow((int64_t)l.ppv_val,
+			    (int64_t)r.ppv_val, &res);
+			if (ev && !uns && ovf)
+				dt_pp_fail(e->ppe_run, "integer overflow");
+			l.ppv_val -= r.ppv_val;
+			break;
+		case '<':
+		case '>':
+			if (op->ppt_len == 1 && op->ppt_text[0] == '<') {
+				l.ppv_val = uns ? l.ppv_val < r.ppv_val :
+				    (int64_t)l.ppv_val < (int64_t)r.ppv_val;
+			} else if (op->ppt_len == 1) {
+				l.ppv_val = uns ? l.ppv_val > r.ppv_val :
+				    (int64_t)l.ppv_val > (int64_t)r.ppv_val;
+			} else if (op->ppt_text[0] == '<') {
+				l.ppv_val = uns ? l.ppv_val <= r.ppv_val :
+				    (int64_t)l.ppv_val <= (int64_t)r.ppv_val;
+			} else {
+				l.ppv_val = uns ? l.ppv_val >= r.ppv_val :
+				    (int64_t)l.ppv_val >= (int64_t)r.ppv_val;
+			}
+			uns = 0;
+			break;
+		case '=':
+			l.ppv_val = l.ppv_val == r.ppv_val;
+			uns = 0;
+			break;
+		case '!':
+			l.ppv_val = l.ppv_val != r.ppv_val;
+			uns = 0;
+			break;
+		case '&':
+			l.ppv_val &= r.ppv_val;
+			break;
+		case '^':
+			l.ppv_val ^= r.ppv_val;
+			break;
+		case '|':
+			l.ppv_val |= r.ppv_val;
+			break;
+		}
+
+		l.ppv_uns = uns;
+	}
+
+	return (l);
+}
+
+static dt_pp_val_t
+dt_pp_eval_cond(dt_pp_expr_t *e, int ev)
+{
+	dt_pp_val_t c = dt_pp_eval_binary(e, 1, ev), l, r;
+
+	if (!dt_pp_eval_op(e, "?"))
+		return (c);
+
+	l = dt_pp_eval_cond(e, ev && c.ppv_val != 0);
+
+	if (!dt_pp_eval_op(e, ":"))
+		dt_pp_fail(e->ppe_run, "missing ':' in expression");
+
+	r = dt_pp_eval_cond(e, ev && c.ppv_val == 0);
+
+	if (c.ppv_val == 0)
+		l.ppv_val = r.ppv_val;
+	l.ppv_uns = l.ppv_uns || r.ppv_uns;
+	return (l);
+}
+
+static int
+dt_pp_eval(dt_pp_run_t *run, dt_pp_tok_t *line)
+{
+	dt_pp_expr_t e;
+	dt_pp_val_t v;
+
+	e.ppe_run = run;
+	e.ppe_tok = dt_pp_expand_list(run, line, 1);
+
+	v = dt_pp_eval_cond(&e, 1);
+
+	if (e.ppe_tok != NULL)
+		dt_pp_fail(run, "garbage at end of expression");
+
+	return (v.ppv_val != 0);
+}
+
+/*
+ * Output.  Tokens are written on the presumed line they came from, using
+ * newlines to get there if it's close and a line marker otherwise.  A space
+ * separates tokens that were separated in the input, and any two tokens that
+ * would otherwise run together in a way that clang -E also avoids.
+ */
+static void
+dt_pp_putname(FILE *fp, const char *s)
+{
+	for (; *s != '\0'; s++) {
+		if (*s == '"' || *s == '\\')
+			(void) fputc('\\', fp);
+		(void) fputc(*s, fp);
+	}
+}
+
+static void
+dt_pp_marker(dt_pp_run_t *run, uint_t line, const char *name,
+    const char *flags)
+{
+	if (run->ppr_out == NULL)
+		return;
+
+	if (!run->ppr_outbol)
+		(void) fputc('\n', run->ppr_out);
+
+	(void) fprintf(run->ppr_out, "# %u \"", line);
+	dt_pp_putname(run->ppr_out, name);
+	(void) fprintf(run->ppr_out, "\"%s\n", flags);
+
+	run->ppr_outline = line;
+	run->ppr_outbol = 1;
+}
+
+static void
+dt_pp_sync(dt_pp_run_t *run, uint_t line)
+{
+	if (line == run->ppr_outline)
+		return;
+
+	if (line > run->ppr_outline &&
+	    line - run->ppr_outline <= DT_PP_MAXBLANK) {
+		while (run->ppr_outline < line) {
+			(void) fputc('\n', run->ppr_out);
+			run->ppr_outline++;
+		}
+		run->ppr_outbol = 1;
+	} else
+		dt_pp_marker(run, line, run->ppr_file->ppf_name, "");
+}
+
+static int
+dt_pp_avoid(const dt_pp_tok_t *pp, const dt_pp_tok_t *p, const dt_pp_tok_t *t)
+{
+	int c = (uchar_t)t->ppt_text[0];
+
+	/*
+	 * Tokens that were adjacent in their spelling can stay that way, as
+	 * they would have been lexed differently otherwise.
+	 */
+	if (p->ppt_text + p->ppt_len == t->ppt_text)
+		return (0);
+
+	if ((dt_pp_ispunct(t, "=") || dt_pp_ispunct(t, "==")) &&
+	    p->ppt_kind == DT_PP_TOK_PUNCT && (p->ppt_len == 1 ?
+	    strchr("!%+-*/^&|<>=", p->ppt_text[0]) != NULL :
+	    dt_pp_is(p, "<<") || dt_pp_is(p, ">>")))
+		return (1);
+
+	switch (p->ppt_kind) {
+	case DT_PP_TOK_IDENT:
+		if (t->ppt_kind == DT_PP_TOK_NUMBER)
+			return (c != '.');
+		if (t->ppt_kind == DT_PP_TOK_IDENT)
+			return (1);
+		if (t->ppt_kind == DT_PP_TOK_STRING ||
+		    t->ppt_kind == DT_PP_TOK_CHAR) {
+			return (c != '"' && c != '\'' ? 1 : dt_pp_is(p, "L") ||
+			    dt_pp_is(p, "u") || dt_pp_is(p, "U") ||
+			    dt_pp_is(p, "u8"));
+		}
+		return (0);
+	case DT_PP_TOK_NUMBER:
+		return (dt_pp_isident(c) || c == '.' || c == '+' || c == '-');
+	case DT_PP_TOK_PUNCT:
+		if (p->ppt_len != 1)
+			return (0);
+
+		switch (p->ppt_text[0]) {
+		case '.':
+			return ((c == '.' && dt_pp_ispunct(pp, ".")) ||
+			    isdigit(c));
+		case '&':
+			return (c == '&');
+		case '+':
+			return (c == '+');
+		case '-':
+			return (c == '-' || c == '>');
+		case '/':
+			return (c == '*' || c == '/');
+		case '<':
+			return (c == '<' || c == ':' || c == '%');
+		case '>':
+			return (c == '>');
+		case '|':
+			return (c == '|');
+		case '%':
+			return (c == '>' || c == ':');
+		case ':':
+			return (c == '>');
+		case '#':
+			return (c == '#' || c == '@' || c == '%');
+		}
+		return (0);
+	default:
+		return (0);
+	}
+}
+
+static void
+dt_pp_emit(dt_pp_run_t *run, dt_pp_tok_t *t)
+{
+	FILE *fp = run->ppr_out;
+
+	if (fp == NULL)
+		return;
+
+	/*
+	 * Like clang -E, we only move to the line of a token if it was the
+	 * first on its line, so the rest of a line joined by backslash-newline
+	 * or a macro invocation that spans lines stay where they are.
+	 */
+	if (t->ppt_flags & DT_PP_TF_BOL)
+		dt_pp_sync(run, t->ppt_line + run->ppr_file->ppf_lineadj);
+
+	/*
+	 * A # at the start of a line would look like a directive to the D
+	 * lexer, so it is indented like clang -E does.
+	 */
+	if (run->ppr_outbol) {
+		if (t->ppt_col > 1)
+			(void) fprintf(fp, "%*s", (int)t->ppt_col - 1, "");
+		else if (dt_pp_ispunct(t, "#"))
+			(void) fputc(' ', fp);
+	} else if ((t->ppt_flags & (DT_PP_TF_SPACE | DT_PP_TF_BOL)) ||
+	    dt_pp_avoid(&run->ppr_prevprev, &run->ppr_prev, t)) {
+		(void) fputc(' ', fp);
+	}
+
+	(void) fwrite(t->ppt_text, 1, t->ppt_len, fp);
+
+	run->ppr_prevprev = run->ppr_prev;
+	run->ppr_prev = *t;
+	run->ppr_outbol = 0;
+}
+
+/*
+ * Directives.
+ */
+static int
+dt_pp_skipping(const dt_pp_run_t *run)
+{
+	const dt_pp_cond_t *c = run->ppr_file->ppf_cond;
+
+	return (c != NULL && c->ppc_state != DT_PP_C_ACTIVE);
+}
+
+static int
+dt_pp_param(dt_pp_tok_t *const *params, uint_t n, const dt_pp_tok_t *t)
+{
+	uint_t i;
+
+	for (i = 0; i < n; i++) {
+		if (params[i] == NULL ? dt_pp_is(t, "__VA_ARGS__") :
+		    params[i]->ppt_len == t->ppt_len &&
+		    bcmp(params[i]->ppt_text, t->ppt_text, t->ppt_len) == 0)
+			return (i + 1);
+	}
+
+	return (0);
+}
+
+/*
+ * Two definitions of a macro are the same if they have the same parameters
+ * and the same replacement list, including where there is white space.
+ */
+static int
+dt_pp_macro_same(const dt_pp_macro_t *a, const dt_pp_macro_t *b)
+{
+	const dt_pp_tok_t *s, *t;
+
+	if (a->ppm_flags != b->ppm_flags || a->ppm_builtin != DT_PP_B_NONE ||
+	    b->ppm_builtin != DT_PP_B_NONE || a->ppm_nparams != b->ppm_nparams)
+		return (0);
+
+	for (s = a->ppm_body, t = b->ppm_body; s != NULL && t != NULL;
+	    s = s->ppt_next, t = t->ppt_next) {
+		if (s->ppt_len != t->ppt_len || s->ppt_param != t->ppt_param ||
+		    bcmp(s->ppt_text, t->ppt_text, s->ppt_len) != 0 ||
+		    (s->ppt_flags & DT_PP_TF_SPACE) !=
+		    (t->ppt_flags & DT_PP_TF_SPACE))
+			return (0);
+	}
+
+	return (s == t);
+}
+
+static void
+dt_pp_define(dt_pp_run_t *run, dt_pp_tok_t *t)
+{
+	dt_pp_tok_t *params[DT_PP_MAXPARAMS], *b, *prev = NULL;
+	const dt_pp_macro_t *o;
+	dt_pp_macro_t *m;
+	uint_t n = 0;
+
+	if (t == NULL || t->ppt_kind != DT_PP_TOK_IDENT ||
+	    dt_pp_is(t, "defined") || dt_pp_is(t, "__VA_ARGS__"))
+		dt_pp_fail(run, "invalid macro name");
+
+	m = dt_pp_alloc(run, sizeof (dt_pp_macro_t));
+	bzero(m, sizeof (dt_pp_macro_t));
+	m->ppm_name = t->ppt_text;
+	m->ppm_namelen = t->ppt_len;
+
+	b = t->ppt_next;
+
+	if (dt_pp_ispunct(b, "(") && !(b->ppt_flags & DT_PP_TF_SPACE)) {
+		m->ppm_flags |= DT_PP_MF_FUNC;
+
+		for (b = b->ppt_next; !dt_pp_ispunct(b, ")"); ) {
+			if (n == DT_PP_MAXPARAMS)
+				dt_pp_fail(run, "too many macro parameters");
+
+			if (dt_pp_ispunct(b, "...")) {
+				params[n++] = NULL;
+				m->ppm_flags |= DT_PP_MF_VARIADIC;
+				b = b->ppt_next;
+				break;
+			}
+
+			if (b == NULL || b->ppt_kind != DT_PP_TOK_IDENT ||
+			    dt_pp_is(b, "__VA_ARGS__") ||
+			    dt_pp_param(params, n, b) != 0)
+				dt_pp_fail(run, "invalid macro parameters");
+
+			params[n++] = b;
+			b = b->ppt_next;
+
+			if (dt_pp_ispunct(b, "...")) {
+				m->ppm_flags |= DT_PP_MF_VARIADIC;
+				b = b->ppt_next;
+				break;
+			}
+
+			if (dt_pp_ispunct(b, ","))
+				b = b->ppt_next;
+			else if (!dt_pp_ispunct(b, ")"))
+				dt_pp_fail(run, "invalid macro parameters");
+		}
+
+		if (!dt_pp_ispunct(b, ")"))
+			dt_pp_fail(run, "invalid macro parameters");
+
+		b = b->ppt_next;
+	} else if (b != NULL && !(b->ppt_flags & DT_PP_TF_SPACE)) {
+		dt_pp_fail(run, "no white space after macro name");
+	}
+
+	m->ppm_nparams = n;
+	m->ppm_body = b;
+
+	if (b != NULL)
+		b->ppt_flags &= ~DT_PP_TF_SPACE;
+
+	for (; b != NULL; prev = b, b = b->ppt_next) {
+		if (b->ppt_kind == DT_PP_TOK_IDENT) {
+			b->ppt_param = dt_pp_param(params, n, b);
+
+			if (b->ppt_param == 0 && (dt_pp_is(b, "__VA_ARGS__") ||
+			    dt_pp_is(b, "__VA_OPT__")))
+				dt_pp_fail(run, "invalid use of __VA_ARGS__");
+		} else if (dt_pp_ispunct(b, "##")) {
+			if (prev == NULL || b->ppt_next == NULL) {
+				dt_pp_fail(run,
+				    "## at edge of replacement list");
+			}
+			b->ppt_kind = DT_PP_TOK_PASTE;
+		}
+	}
+
+	for (b = m->ppm_body; b != NULL; b = b->ppt_next) {
+		if ((m->ppm_flags & DT_PP_MF_FUNC) && dt_pp_ispunct(b, "#") &&
+		    (b->ppt_next == NULL || b->ppt_next->ppt_param == 0))
+			dt_pp_fail(run, "# is not followed by a parameter");
+	}
+
+	if ((o = dt_pp_lookup(run, t)) != NULL && !dt_pp_macro_same(o, m))
+		dt_pp_fail(run, "macro redefined");
+
+	dt_pp_insert(run, m);
+}
+
+static void
+dt_pp_undef(dt_pp_run_t *run, dt_pp_tok_t *t)
+{
+	dt_pp_macro_t *m;
+
+	if (t == NULL || t->ppt_kind != DT_PP_TOK_IDENT ||
+	    t->ppt_next != NULL || dt_pp_is(t, "defined"))
+		dt_pp_fail(run, "invalid #undef");
+
+	m = dt_pp_alloc(run, sizeof (dt_pp_macro_t));
+	bzero(m, sizeof (dt_pp_macro_t));
+	m->ppm_name = t->ppt_text;
+	m->ppm_namelen = t->ppt_len;
+	m->ppm_flags = DT_PP_MF_UNDEF;
+	dt_pp_insert(run, m);
+}
+
+static void
+dt_pp_cond_push(dt_pp_run_t *run, int state)
+{
+	dt_pp_cond_t *c = dt_pp_alloc(run, sizeof (dt_pp_cond_t));
+
+	c->ppc_prev = run->ppr_file->ppf_cond;
+	c->ppc_state = state;
+	c->ppc_else = 0;
+	run->ppr_file->ppf_cond = c;
+}
+
+static int
+dt_pp_ifdef(dt_pp_run_t *run, dt_pp_tok_t *t)
+{
+	const dt_pp_macro_t *m;
+
+	if (t == NULL || t->ppt_kind != DT_PP_TOK_IDENT || t->ppt_next != NULL)
+		dt_pp_fail(run, "invalid #ifdef");
+
+	if ((m = dt_pp_lookup(run, t)) != NULL &&
+	    m->ppm_builtin == DT_PP_B_UNSUP)
+		dt_pp_fail(run, "unsupported builtin macro");
+
+	return (m != NULL);
+}
+
+static const char *
+dt_pp_open(dt_pp_run_t *run, const char *dir, const char *name, int *fdp)
+{
+	size_t len = strlen(dir);
+	char *path;
+
+	path = dt_pp_alloc(run, len + strlen(name) + 2);
+	(void) strcpy(path, dir);
+
+	if (len != 0 && path[len - 1] != '/')
+		(void) strcat(path, "/");
+	(void) strcat(path, name);
+
+	if ((*fdp = open(path, O_RDONLY)) == -1)
+		return (NULL);
+
+	return (path);
+}
+
+static void
+dt_pp_push_file(dt_pp_run_t *run, const char *path, const char *buf,
+    size_t len)
+{
+	dt_pp_file_t *f = dt_pp_alloc(run, sizeof (dt_pp_file_t));
+
+	bzero(f, sizeof (dt_pp_file_t));
+	f->ppf_prev = run->ppr_file;
+	f->ppf_path = path;
+	f->ppf_name = path;
+	f->ppf_buf = buf;
+	f->ppf_len = len;
+	f->ppf_line = 1;
+	f->ppf_flags = DT_PP_TF_BOL;
+
+	run->ppr_file = f;
+}
+
+static void
+dt_pp_include(dt_pp_run_t *run, dt_pp_tok_t *t)
+{
+	dt_pp_file_t *f = run->ppr_file;
+	const char *path = NULL, *p, *end;
+	dt_pp_tok_t *rest;
+	dt_pp_once_t *o;
+	char *name, *dir, *buf;
+	struct stat st;
+	size_t len;
+	ssize_t n;
+	int fd = -1, quoted, i;
+
+	if (t != NULL && t->ppt_kind == DT_PP_TOK_STRING &&
+	    t->ppt_text[0] == '"') {
+		name = dt_pp_strndup(run, t->ppt_text + 1, t->ppt_len - 2);
+		quoted = 1;
+		rest = t->ppt_next;
+	} else if (dt_pp_ispunct(t, "<") && t->ppt_text > f->ppf_buf &&
+	    t->ppt_text < f->ppf_buf + f->ppf_len) {
+		end = f->ppf_buf + f->ppf_len;
+
+		for (p = t->ppt_text + 1; p < end && *p != '>'; p++) {
+			if (*p == '\n' || *p == '\\')
+				dt_pp_fail(run, "unsupported #include");
+		}
+
+		if (p == end)
+			dt_pp_fail(run, "unsupported #include");
+
+		name = dt_pp_strndup(run, t->ppt_text + 1,
+		    p - t->ppt_text - 1);
+		quoted = 0;
+
+		for (rest = t; rest != NULL && rest->ppt_text <= p;
+		    rest = rest->ppt_next)
+			continue;
+	} else {
+		dt_pp_fail(run, "unsupported #include");
+	}
+
+	if (rest != NULL || name[0] == '\0')
+		dt_pp_fail(run, "unsupported #include");
+
+	if (run->ppr_depth >= DT_PP_MAXDEPTH)
+		dt_pp_fail(run, "#include nested too deeply");
+
+	if (name[0] == '/') {
+		if ((fd = open(name, O_RDONLY)) != -1)
+			path = name;
+	} else {
+		if (quoted && (p = strrchr(f->ppf_path, '/')) != NULL) {
+			dir = dt_pp_strndup(run, f->ppf_path,
+			    p - f->ppf_path);
+			path = dt_pp_open(run, dir, name, &fd);
+		}
+
+		for (i = 0; path == NULL &&
+		    i < run->ppr_pp->dpp_nincdirs; i++) {
+			path = dt_pp_open(run, run->ppr_pp->dpp_incdirs[i],
+			    name, &fd);
+		}
+	}
+
+	if (path == NULL)
+		dt_pp_fail(run, "header not found in -I directories");
+
+	if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+		(void) close(fd);
+		dt_pp_fail(run, "header is not a regular file");
+	}
+
+	for (o = run->ppr_once; o != NULL; o = o->ppo_next) {
+		if (o->ppo_dev == st.st_dev && o->ppo_ino == st.st_ino) {
+			(void) close(fd);
+			return;
+		}
+	}
+
+	buf = dt_pp_alloc(run, st.st_size);
+
+	for (len = 0; len < (size_t)st.st_size; len += n) {
+		if ((n = read(fd, buf + len, st.st_size - len)) <= 0) {
+			(void) close(fd);
+			dt_pp_fail(run, "failed to read header");
+		}
+	}
+
+	(void) close(fd);
+
+	dt_pp_push_file(run, path, buf, len);
+	run->ppr_depth++;
+	dt_pp_marker(run, 1, path, " 1");
+}
+
+static void
+dt_pp_line(dt_pp_run_t *run, dt_pp_tok_t *t)
+{
+	dt_pp_file_t *f = run->ppr_file;
+	const char *p, *end;
+	uint64_t line = 0;
+	char *name;
+	size_t n;
+
+	t = dt_pp_expand_list(run, t, 0);
+
+	if (t == NULL || t->ppt_kind != DT_PP_TOK_NUMBER ||
+	    (t->ppt_text[0] == '0' && t->ppt_len > 1))
+		dt_pp_fail(run, "invalid #line");
+
+	for (p = t->ppt_text, end = p + t->ppt_len; p < end; p++) {
+		if (!isdigit((uchar_t)*p) || (line = line * 10 + *p - '0') >
+		    INT_MAX)
+			dt_pp_fail(run, "invalid #line");
+	}
+
+	if ((t = t->ppt_next) != NULL) {
+		if (t->ppt_kind != DT_PP_TOK_STRING || t->ppt_text[0] != '"' ||
+		    t->ppt_next != NULL ||
+		    memchr(t->ppt_text, '\\', t->ppt_len) != NULL)
+			dt_pp_fail(run, "invalid #line");
+
+		n = t->ppt_len - 2;
+		name = dt_pp_strndup(run, t->ppt_text + 1, n);
+		f->ppf_name = name;
+	}
+
+	f->ppf_lineadj = (int)line - (int)f->ppf_line;
+	dt_pp_marker(run, line, f->ppf_name, "");
+}
+
+static void
+dt_pp_pragma(dt_pp_run_t *run, dt_pp_tok_t *hash, dt_pp_tok_t *t)
+{
+	dt_pp_file_t *f = run->ppr_file;
+	dt_pp_once_t *o;
+	struct stat st;
+
+	if (dt_pp_is(t, "once") && t->ppt_next == NULL) {
+		if (stat(f->ppf_path, &st) == 0) {
+			o = dt_pp_alloc(run, sizeof (dt_pp_once_t));
+			o->ppo_dev = st.st_dev;
+			o->ppo_ino = st.st_ino;
+			o->ppo_next = run->ppr_once;
+			run->ppr_once = o;
+		}
+		return;
+	}
+
+	if (!dt_pp_is(t, "D") && !dt_pp_is(t, "ident"))
+		dt_pp_fail(run, "unsupported #pragma");
+
+	if (run->ppr_out == NULL)
+		return;
+
+	dt_pp_sync(run, hash->ppt_line + f->ppf_lineadj);
+
+	if (!run->ppr_outbol)
+		dt_pp_fail(run, "#pragma after tokens on the same line");
+
+	(void) fputs("#pragma", run->ppr_out);
+
+	for (; t != NULL; t = t->ppt_next) {
+		if (t->ppt_flags & (DT_PP_TF_SPACE | DT_PP_TF_BOL))
+			(void) fputc(' ', run->ppr_out);
+		(void) fwrite(t->ppt_text, 1, t->ppt_len, run->ppr_out);
+	}
+
+	(void) fputc('\n', run->ppr_out);
+	run->ppr_outline++;
+}
+
+static void
+dt_pp_directive(dt_pp_run_t *run, dt_pp_tok_t *hash)
+{
+	int skipping = dt_pp_skipping(run);
+	dt_pp_tok_t *line = dt_pp_readline(run, skipping), *t;
+	dt_pp_cond_t *c = run->ppr_file->ppf_cond;
+
+	if (line == NULL)
+		return; /* null directive */
+
+	t = line->ppt_next;
+
+	if (line->ppt_kind != DT_PP_TOK_IDENT) {
+		if (skipping)
+			return;
+		dt_pp_fail(run, "invalid directive");
+	}
+
+	if (dt_pp_is(line, "if") || dt_pp_is(line, "ifdef") ||
+	    dt_pp_is(line, "ifndef")) {
+		if (skipping)
+			dt_pp_cond_push(run, DT_PP_C_OUTER);
+		else if (dt_pp_is(line, "if"))
+			dt_pp_cond_push(run, dt_pp_eval(run, t) ?
+			    DT_PP_C_ACTIVE : DT_PP_C_SEEK);
+		else
+			dt_pp_cond_push(run, dt_pp_ifdef(run, t) ==
+			    dt_pp_is(line, "ifdef") ?
+			    DT_PP_C_ACTIVE : DT_PP_C_SEEK);
+		return;
+	}
+
+	if (dt_pp_is(line, "elif") || dt_pp_is(line, "else") ||
+	    dt_pp_is(line, "endif")) {
+		if (c == NULL || (c->ppc_else && !dt_pp_is(line, "endif")))
+			dt_pp_fail(run, "unbalanced conditional");
+
+		if (t != NULL && !dt_pp_is(line, "elif"))
+			dt_pp_fail(run, "extra tokens after directive");
+
+		if (dt_pp_is(line, "endif")) {
+			run->ppr_file->ppf_cond = c->ppc_prev;
+		} else if (dt_pp_is(line, "else")) {
+			c->ppc_else = 1;
+			if (c->ppc_state == DT_PP_C_ACTIVE)
+				c->ppc_state = DT_PP_C_DONE;
+			else if (c->ppc_state == DT_PP_C_SEEK)
+				c->ppc_state = DT_PP_C_ACTIVE;
+		} else if (c->ppc_state == DT_PP_C_ACTIVE) {
+			c->ppc_state = DT_PP_C_DONE;
+		} else if (c->ppc_state == DT_PP_C_SEEK && dt_pp_eval(run, t)) {
+			c->ppc_state = DT_PP_C_ACTIVE;
+		}
+		return;
+	}
+
+	if (dt_pp_is(line, "elifdef") || dt_pp_is(line, "elifndef"))
+		dt_pp_fail(run, "unsupported directive");
+
+	if (skipping)
+		return;
+
+	if (dt_pp_is(line, "define"))
+		dt_pp_define(run, t);
+	else if (dt_pp_is(line, "undef"))
+		dt_pp_undef(run, t);
+	else if (dt_pp_is(line, "include"))
+		dt_pp_include(run, t);
+	else if (dt_pp_is(line, "line"))
+		dt_pp_line(run, t);
+	else if (dt_pp_is(line, "pragma"))
+		dt_pp_pragma(run, hash, t);
+	else
+		dt_pp_fail(run, "unsupported directive");
+}
+
+/*
+ * Preprocess the file on top of the stack, along with anything it includes.
+ */
+static void
+dt_pp_process(dt_pp_run_t *run)
+{
+	dt_pp_file_t *base = run->ppr_file, *f;
+	dt_pp_in_t *in = &run->ppr_in;
+	const dt_pp_macro_t *m;
+	dt_pp_tok_t *t;
+
+	in->ppi_toks = NULL;
+	in->ppi_file = 1;
+	in->ppi_flags = 0;
+
+	for (;;) {
+		t = dt_pp_get(run, in, dt_pp_skipping(run));
+
+		if (t->ppt_kind == DT_PP_TOK_EOF) {
+			if ((f = run->ppr_file)->ppf_cond != NULL)
+				dt_pp_fail(run, "unterminated conditional");
+
+			if (f == base)
+				break;
+
+			run->ppr_file = f->ppf_prev;
+			run->ppr_depth--;
+			dt_pp_marker(run, run->ppr_file->ppf_line +
+			    run->ppr_file->ppf_lineadj,
+			    run->ppr_file->ppf_name, " 2");
+			continue;
+		}
+
+		if (t->ppt_flags & DT_PP_TF_DIRECTIVE) {
+			dt_pp_directive(run, t);
+			continue;
+		}
+
+		if (dt_pp_skipping(run))
+			continue;
+
+		if (t->ppt_kind == DT_PP_TOK_IDENT &&
+		    (m = dt_pp_lookup(run, t)) != NULL &&
+		    !dt_pp_hidden(t->ppt_hide, m) &&
+		    dt_pp_expand(run, in, t, m))
+			continue;
+
+		dt_pp_emit(run, t);
+	}
+}
+
+static void
+dt_pp_run_init(dt_pp_run_t *run, dt_pp_t *pp)
+{
+	bzero(run, sizeof (dt_pp_run_t));
+	run->ppr_pp = pp;
+	run->ppr_eof.ppt_kind = DT_PP_TOK_EOF;
+	run->ppr_eof.ppt_text = "";
+}
+
+/*
+ * Create a preprocessor for the specified cpp(1) argument vector, or return
+ * NULL if it has arguments that we don't implement.  The -D, -U and -include
+ * arguments only affect the predefined macros, which the caller supplies with
+ * dt_pp_predefine().
+ */
+dt_pp_t *
+dt_pp_create(dtrace_hdl_t *dtp, int argc, char *const argv[])
+{
+	dt_pp_t *pp;
+	int i;
+
+	if ((pp = dt_zalloc(dtp, sizeof (dt_pp_t))) == NULL)
+		return (NULL);
+
+	pp->dpp_hdl = dtp;
+
+	if ((pp->dpp_incdirs = dt_zalloc(dtp, sizeof (char *) * argc)) == NULL)
+		goto err;
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-E") == 0 || strcmp(argv[i], "-xc") == 0 ||
+		    (argv[i][0] == '-' && (argv[i][1] == 'D' ||
+		    argv[i][1] == 'U') && argv[i][2] != '\0'))
+			continue;
+
+		if (strcmp(argv[i], "-include") == 0 && i + 1 < argc) {
+			i++;
+			continue;
+		}
+
+		if (strncmp(argv[i], "-I", 2) == 0 && argv[i][2] != '\0') {
+			if ((pp->dpp_incdirs[pp->dpp_nincdirs++] =
+			    strdup(argv[i] + 2)) == NULL)
+				goto err;
+			continue;
+		}
+
+		dt_dprintf("cpp argument %s requires cpp", argv[i]);
+		goto err;
+	}
+
+	return (pp);
+
+err:
+	dt_pp_destroy(pp);
+	return (NULL);
+}
+
+static void
+dt_pp_builtin_define(dt_pp_run_t *run, const char *name, uint_t builtin)
+{
+	dt_pp_macro_t *m = dt_pp_alloc(run, sizeof (dt_pp_macro_t));
+
+	bzero(m, sizeof (dt_pp_macro_t));
+	m->ppm_name = name;
+	m->ppm_namelen = strlen(name);
+	m->ppm_builtin = builtin;
+	dt_pp_insert(run, m);
+}
+
+/*
+ * Define the predefined macros from the output of cpp -dM.
+ */
+int
+dt_pp_predefine(dt_pp_t *pp, const char *text, size_t len)
+{
+	const char *const *p;
+	dt_pp_run_t run;
+	char *buf;
+
+	dt_pp_run_init(&run, pp);
+	run.ppr_chunks = &pp->dpp_chunks;
+	run.ppr_hash = pp->dpp_hash;
+	run.ppr_hashsize = DT_PP_HASHSIZE;
+	run.ppr_base = "<built-in>";
+
+	if (setjmp(run.ppr_jmp) != 0)
+		return (-1);
+
+	dt_pp_builtin_define(&run, "__FILE__", DT_PP_B_FILE);
+	dt_pp_builtin_define(&run, "__LINE__", DT_PP_B_LINE);
+	dt_pp_builtin_define(&run, "__COUNTER__", DT_PP_B_COUNTER);
+	dt_pp_builtin_define(&run, "__INCLUDE_LEVEL__", DT_PP_B_LEVEL);
+	dt_pp_builtin_define(&run, "__BASE_FILE__", DT_PP_B_BASEFILE);
+
+	for (p = dt_pp_unsup; *p != NULL; p++)
+		dt_pp_builtin_define(&run, *p, DT_PP_B_UNSUP);
+
+	buf = dt_pp_alloc(&run, len);
+	bcopy(text, buf, len);
+
+	dt_pp_push_file(&run, run.ppr_base, buf, len);
+	dt_pp_process(&run);
+	return (0);
+}
+
+/*
+ * Preprocess the program in buf, whose file name is name, and write the
+ * result to ofp.  If we return -1, the program needs cpp(1).
+ */
+int
+dt_pp_run(dt_pp_t *pp, const char *name, const char *buf, size_t len,
+    uint_t vers, FILE *ofp)
+{
+	dt_pp_macro_t *hash[DT_PP_RUNHASHSIZE];
+	dt_pp_chunk_t *chunks = NULL;
+	dt_pp_run_t run;
+	char def[64];
+
+	bzero(hash, sizeof (hash));
+	dt_pp_run_init(&run, pp);
+	run.ppr_chunks = &chunks;
+	run.ppr_hash = hash;
+	run.ppr_hashsize = DT_PP_RUNHASHSIZE;
+	run.ppr_base = name;
+
+	if (setjmp(run.ppr_jmp) != 0) {
+		dt_pp_free_chunks(chunks);
+		return (-1);
+	}
+
+	(void) snprintf(def, sizeof (def),
+	    "#define __SUNW_D_VERSION 0x%08x\n", vers);
+	dt_pp_push_file(&run, "<command line>", def, strlen(def));
+	dt_pp_process(&run);
+
+	run.ppr_file = NULL;
+	run.ppr_out = ofp;
+	run.ppr_outbol = 1;
+	run.ppr_outline = 1;
+
+	dt_pp_push_file(&run, name, buf, len);
+	dt_pp_marker(&run, 1, name, "");
+	dt_pp_process(&run);
+
+	if (!run.ppr_outbol)
+		(void) fputc('\n', ofp);
+
+	dt_pp_free_chunks(chunks);
+	return (0);
+}
+
+void
+dt_pp_destroy(dt_pp_t *pp)
+{
+	int i;
+
+	if (pp == NULL)
+		return;
+
+	if (pp->dpp_incdirs != NULL) {
+		for (i = 0; i < pp->dpp_nincdirs; i++)
+			free(pp->dpp_incdirs[i]);
+		dt_free(pp->dpp_hdl, pp->dpp_incdirs);
+	}
+
+	dt_pp_free_chunks(pp->dpp_chunks);
+	dt_free(pp->dpp_hdl, pp);
+}
@@ -0,0 +1,44 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef	_DT_PP_H
+#define	_DT_PP_H
+
+#include <stdio.h>
+#include <dtrace.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+typedef struct dt_pp dt_pp_t;
+
+extern dt_pp_t *dt_pp_create(dtrace_hdl_t *, int, char *const []);
+extern int dt_pp_predefine(dt_pp_t *, const char *, size_t);
+extern int dt_pp_run(dt_pp_t *, const char *, const char *, size_t,
+    uint_t, FILE *);
+extern void dt_pp_destroy(dt_pp_t *);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _DT_PP_H */
@@ -22,6 +22,45 @@
 #include <dt_pq.h>
 #include <assert.h>
 
+/*
+ * The priority queue is a tournament tree:  each item occupies a leaf, and
+ * each internal node records the leaf that won the match between its two
+ * children.  The value of each item is obtained from the callback only once,
+ * when the item is inserted, and cached in its leaf; replaying the matches on
+ * the path from a leaf to the root then costs a single comparison per level.
+ * Unoccupied leaves have a value of UINT64_MAX and never win a match against
+ * an occupied leaf.
+ */
+
+static uint_t
+dt_pq_winner(dt_pq_t *p, uint_t node)
+{
+	return (node >= p->dtpq_nleaves ?
+	    node - p->dtpq_nleaves : p->dtpq_tree[node]);
+}
+
+static void
+dt_pq_match(dt_pq_t *p, uint_t node)
+{
+	uint_t l = dt_pq_winner(p, node * 2);
+	uint_t r = dt_pq_winner(p, node * 2 + 1);
+
+	if (p->dtpq_vals[r] < p->dtpq_vals[l] ||
+	    (p->dtpq_items[l] == NULL && p->dtpq_items[r] != NULL))
+		l = r;
+
+	p->dtpq_tree[node] = l;
+}
+
+static void
+dt_pq_replay(dt_pq_t *p, uint_t leaf)
+{
+	uint_t node;
+
+	for (node = (leaf + p->dtpq_nleaves) / 2; node > 0; node /= 2)
+		dt_pq_match(p, node);
+}
+
 /*
  * Create a new priority queue.
  *
@@ -32,27 +71,43 @@ dt_pq_t *
 dt_pq_init(dtrace_hdl_t *dtp, uint_t size, dt_pq_value_f value_cb, void *cb_arg)
 {
 	dt_pq_t *p;
+	uint_t i, n;
 	assert(size > 1);
 
-	/* We don't use the first element of the array so we can index from 1.  It
-	 * makes the math easier. */
-	size++;
+	for (n = 2; n < size; n *= 2)
+		continue;
 
 	if ((p = dt_zalloc(dtp, sizeof (dt_pq_t))) == NULL)
 		return (NULL);
 
-	p->dtpq_items = dt_zalloc(dtp, size * sizeof (p->dtpq_items[0]));
-	if (p->dtpq_items == NULL) {
-		dt_free(dtp, p);
+	p->dtpq_hdl = dtp;
+	p->dtpq_items = dt_zalloc(dtp, n * sizeof (p->dtpq_items[0]));
+	p->dtpq_vals = dt_alloc(dtp, n * sizeof (p->dtpq_vals[0]));
+	p->dtpq_tree = dt_zalloc(dtp, n * sizeof (p->dtpq_tree[0]));
+	p->dtpq_free = dt_alloc(dtp, n * sizeof (p->dtpq_free[0]));
+
+	if (p->dtpq_items == NULL || p->dtpq_vals == NULL ||
+	    p->dtpq_tree == NULL || p->dtpq_free == NULL) {
+		dt_pq_fini(p);
 		return (NULL);
 	}
 
-	p->dtpq_hdl = dtp;
-	p->dtpq_size = size;
-	p->dtpq_last = 1;
+	p->dtpq_nleaves = n;
 	p->dtpq_value = value_cb;
 	p->dtpq_arg = cb_arg;
 
+	/*
+	 * Hand out the leaves in ascending order, so that a queue that never
+	 * holds more than a few items only ever touches one corner of the tree.
+	 */
+	for (i = 0; i < n; i++) {
+		p->dtpq_vals[i] = UINT64_MAX;
+		p->dtpq_free[p->dtpq_nfree++] = n - 1 - i;
+	}
+
+	for (i = n - 1; i > 0; i--)
+		dt_pq_match(p, i);
+
 	return (p);
 }
 
@@ -62,32 +117,23 @@ dt_pq_fini(dt_pq_t *p)
 	dtrace_hdl_t *dtp = p->dtpq_hdl;
 
 	dt_free(dtp, p->dtpq_items);
+	dt_free(dtp, p->dtpq_vals);
+	dt_free(dtp, p->dtpq_tree);
+	dt_free(dtp, p->dtpq_free);
 	dt_free(dtp, p);
 }
 
-static uint64_t
-dt_pq_getvalue(dt_pq_t *p, uint_t index)
-{
-	void *item = p->dtpq_items[index];
-	return (p->dtpq_value(item, p->dtpq_arg));
-}
-
 void
 dt_pq_insert(dt_pq_t *p, void *item)
 {
-	uint_t i;
-
-	assert(p->dtpq_last < p->dtpq_size);
+	uint_t leaf;
 
-	i = p->dtpq_last++;
-	p->dtpq_items[i] = item;
+	assert(p->dtpq_nfree > 0);
 
-	while (i > 1 && dt_pq_getvalue(p, i) < dt_pq_getvalue(p, i / 2)) {
-		void *tmp = p->dtpq_items[i];
-		p->dtpq_items[i] = p->dtpq_items[i / 2];
-		p->dtpq_items[i / 2] = tmp;
-		i /= 2;
-	}
+	leaf = p->dtpq_free[--p->dtpq_nfree];
+	p->dtpq_items[leaf] = item;
+	p->dtpq_vals[leaf] = p->dtpq_value(item, p->dtpq_arg);
+	dt_pq_replay(p, leaf);
 }
 
 /*
@@ -97,65 +143,44 @@ dt_pq_insert(dt_pq_t *p, void *item)
 void *
 dt_pq_walk(dt_pq_t *p, uint_t *cookie)
 {
-	(*cookie)++;
-	if (*cookie >= p->dtpq_last)
-		return (NULL);
+	while (*cookie < p->dtpq_nleaves) {
+		void *item = p->dtpq_items[(*cookie)++];
 
-	return (p->dtpq_items[*cookie]);
+		if (item != NULL)
+			return (item);
+	}
+
+	return (NULL);
 }
 
+/*
+ * Return the element with the lowest value without removing it, and that
+ * value in *valp.  Returns NULL if the priority queue is empty.
+ */
 void *
-dt_pq_pop(dt_pq_t *p)
+dt_pq_peek(dt_pq_t *p, uint64_t *valp)
 {
-	uint_t i = 1;
-	void *ret;
+	uint_t leaf = p->dtpq_tree[1];
 
-	assert(p->dtpq_last > 0);
+	if (valp != NULL)
+		*valp = p->dtpq_vals[leaf];
 
-	if (p->dtpq_last == 1)
+	return (p->dtpq_items[leaf]);
+}
+
+void *
+dt_pq_pop(dt_pq_t *p)
+{
+	uint_t leaf = p->dtpq_tree[1];
+	void *ret = p->dtpq_items[leaf];
+
+	if (ret == NULL)
 		return (NULL);
 
-	ret = p->dtpq_items[1];
-
-	p->dtpq_last--;
-	p->dtpq_items[1] = p->dtpq_items[p->dtpq_last];
-	p->dtpq_items[p->dtpq_last] = NULL;
-
-	for (;;) {
-		uint_t lc = i * 2;
-		uint_t rc = i * 2 + 1;
-		uint_t c;
-		uint64_t v;
-		void *tmp;
-
-		if (lc >= p->dtpq_last)
-			break;
-
-		if (rc >= p->dtpq_last) {
-			c = lc;
-			v = dt_pq_getvalue(p, lc);
-		} else {
-			uint64_t lv = dt_pq_getvalue(p, lc);
-			uint64_t rv = dt_pq_getvalue(p, rc);
-
-			if (lv < rv) {
-				c = lc;
-				v = lv;
-			} else {
-				c = rc;
-				v = rv;
-			}
-		}
-
-		if (v >= dt_pq_getvalue(p, i))
-			break;
-
-		tmp = p->dtpq_items[i];
-		p->dtpq_items[i] = p->dtpq_items[c];
-		p->dtpq_items[c] = tmp;
-
-		i = c;
-	}
+	p->dtpq_items[leaf] = NULL;
+	p->dtpq_vals[leaf] = UINT64_MAX;
+	p->dtpq_free[p->dtpq_nfree++] = leaf;
+	dt_pq_replay(p, leaf);
 
 	return (ret);
 }
@@ -30,9 +30,12 @@ typedef uint64_t (*dt_pq_value_f)(void *, void *);
 
 typedef struct dt_pq {
 	dtrace_hdl_t *dtpq_hdl;		/* dtrace handle */
-	void **dtpq_items;		/* array of elements */
-	uint_t dtpq_size;		/* count of allocated elements */
-	uint_t dtpq_last;		/* next free slot */
+	void **dtpq_items;		/* array of elements, one per leaf */
+	uint64_t *dtpq_vals;		/* cached value of each leaf */
+	uint_t *dtpq_tree;		/* winning leaf of each match */
+	uint_t *dtpq_free;		/* stack of unoccupied leaves */
+	uint_t dtpq_nleaves;		/* number of leaves (power of two) */
+	uint_t dtpq_nfree;		/* count of unoccupied leaves */
 	dt_pq_value_f dtpq_value;	/* callback to get the value */
 	void *dtpq_arg;			/* callback argument */
 } dt_pq_t;
@@ -42,6 +45,7 @@ extern void dt_pq_fini(dt_pq_t *);
 
 extern void dt_pq_insert(dt_pq_t *, void *);
 extern void *dt_pq_pop(dt_pq_t *);
+extern void *dt_pq_peek(dt_pq_t *, uint64_t *);
 extern void *dt_pq_walk(dt_pq_t *, uint_t *);
 
 #ifdef	__cplusplus
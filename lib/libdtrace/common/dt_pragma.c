@@ -272,6 +272,15 @@ dt_pragma_depends(const char *prname, dt_node_t *cnp)
 				    "failed to add dependency %s:%s\n", lib,
 				    dtrace_errmsg(dtp, dtrace_errno(dtp)));
 			}
+
+			/*
+			 * Remember the name the dependency was given as well as
+			 * the library it resolved to, so that the dependency
+			 * can be cached independently of the library path.
+			 */
+			dld = dt_list_prev(&dld->dtld_dependencies);
+			if ((dld->dtld_name = strdup(nnp->dn_string)) == NULL)
+				longjmp(yypcb->pcb_jmpbuf, EDT_NOMEM);
 		} else {
 			/*
 			 * By this point we have already performed a topological
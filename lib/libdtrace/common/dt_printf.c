@@ -246,6 +246,20 @@ pfcheck_type(dt_pfargv_t *pfv, dt_pfargd_t *pfd, dt_node_t *dnp)
 	    dnp->dn_type), pfd->pfd_conv->pfc_dctfp, pfd->pfd_conv->pfc_dtype));
 }
 
+/*
+ * Print the string s of length len.  The format is most often a bare "%s", in
+ * which case the string is appended to the output as is.
+ */
+static int
+pfprint_string(dtrace_hdl_t *dtp, FILE *fp, const char *format,
+    const char *s, size_t len)
+{
+	if (format[0] == '%' && format[1] == 's' && format[2] == '\0')
+		return (dt_printf_str(dtp, fp, s, len));
+
+	return (dt_printf(dtp, fp, format, s));
+}
+
 /*ARGSUSED*/
 static int
 pfprint_sint(dtrace_hdl_t *dtp, FILE *fp, const char *format,
@@ -254,23 +268,34 @@ pfprint_sint(dtrace_hdl_t *dtp, FILE *fp, const char *format,
 #pragma unused(pfd)
 	int64_t normal = (int64_t)unormal;
 	int32_t n = (int32_t)normal;
+	char buf[DT_FORMAT_INTLEN];
+	int64_t val;
+	int len;
 
 	switch (size) {
 	case sizeof (int8_t):
-		return (dt_printf(dtp, fp, format,
-		    (int32_t)*((int8_t *)addr) / n));
+		val = (int32_t)*((int8_t *)addr) / n;
+		break;
 	case sizeof (int16_t):
-		return (dt_printf(dtp, fp, format,
-		    (int32_t)*((int16_t *)addr) / n));
+		val = (int32_t)*((int16_t *)addr) / n;
+		break;
 	case sizeof (int32_t):
-		return (dt_printf(dtp, fp, format,
-		    *((int32_t *)addr) / n));
+		val = *((int32_t *)addr) / n;
+		break;
 	case sizeof (int64_t):
-		return (dt_printf(dtp, fp, format,
-		    *((int64_t *)addr) / normal));
+		val = *((int64_t *)addr) / normal;
+		break;
 	default:
 		return (dt_set_errno(dtp, EDT_DMISMATCH));
 	}
+
+	if ((len = dt_format_int(buf, format, (uint64_t)val)) >= 0)
+		return (dt_printf_str(dtp, fp, buf, len));
+
+	if (size == sizeof (int64_t))
+		return (dt_printf(dtp, fp, format, val));
+
+	return (dt_printf(dtp, fp, format, (int32_t)val));
 }
 
 /*ARGSUSED*/
@@ -280,23 +305,34 @@ pfprint_uint(dtrace_hdl_t *dtp, FILE *fp, const char *format,
 {
 #pragma unused(pfd)
 	uint32_t n = (uint32_t)normal;
+	char buf[DT_FORMAT_INTLEN];
+	uint64_t val;
+	int len;
 
 	switch (size) {
 	case sizeof (uint8_t):
-		return (dt_printf(dtp, fp, format,
-		    (uint32_t)*((uint8_t *)addr) / n));
+		val = (uint32_t)*((uint8_t *)addr) / n;
+		break;
 	case sizeof (uint16_t):
-		return (dt_printf(dtp, fp, format,
-		    (uint32_t)*((uint16_t *)addr) / n));
+		val = (uint32_t)*((uint16_t *)addr) / n;
+		break;
 	case sizeof (uint32_t):
-		return (dt_printf(dtp, fp, format,
-		    *((uint32_t *)addr) / n));
+		val = *((uint32_t *)addr) / n;
+		break;
 	case sizeof (uint64_t):
-		return (dt_printf(dtp, fp, format,
-		    *((uint64_t *)addr) / normal));
+		val = *((uint64_t *)addr) / normal;
+		break;
 	default:
 		return (dt_set_errno(dtp, EDT_DMISMATCH));
 	}
+
+	if ((len = dt_format_int(buf, format, val)) >= 0)
+		return (dt_printf_str(dtp, fp, buf, len));
+
+	if (size == sizeof (uint64_t))
+		return (dt_printf(dtp, fp, format, val));
+
+	return (dt_printf(dtp, fp, format, (uint32_t)val));
 }
 
 static int
@@ -361,7 +397,7 @@ pfprint_addr(dtrace_hdl_t *dtp, FILE *fp, const char *format,
 		s = alloca(n);
 	} while ((len = dtrace_addr2str(dtp, val, s, n)) > n);
 
-	return (dt_printf(dtp, fp, format, s));
+	return (pfprint_string(dtp, fp, format, s, strlen(s)));
 }
 
 /*ARGSUSED*/
@@ -417,7 +453,7 @@ pfprint_uaddr(dtrace_hdl_t *dtp, FILE *fp, const char *format,
 		s = alloca(n);
 	} while ((len = dtrace_uaddr2str(dtp, pid, val, s, n)) > n);
 
-	return (dt_printf(dtp, fp, format, s));
+	return (pfprint_string(dtp, fp, format, s, strlen(s)));
 }
 
 /*ARGSUSED*/
@@ -503,7 +539,7 @@ pfprint_time(dtrace_hdl_t *dtp, FILE *fp, const char *format,
 		*dst++ = src[i];
 
 	*dst = '\0';
-	return (dt_printf(dtp, fp, format, buf));
+	return (pfprint_string(dtp, fp, format, buf, dst - buf));
 }
 
 /*
@@ -537,7 +573,7 @@ pfprint_cstr(dtrace_hdl_t *dtp, FILE *fp, const char *format,
 
 	bcopy(addr, s, size);
 	s[size] = '\0';
-	return (dt_printf(dtp, fp, format, s));
+	return (pfprint_string(dtp, fp, format, s, strlen(s)));
 }
 
 /*ARGSUSED*/
@@ -1573,6 +1609,7 @@ dtrace_sprintf(dtrace_hdl_t *dtp, FILE *fp, void *fmtdata,
 
 	bzero(dtp->dt_sprintf_buf, size);
 	dtp->dt_sprintf_buflen = size;
+	dtp->dt_sprintf_bufoffs = 0;
 	rval = dt_printf_format(dtp, fp, fmtdata, recp, nrecs, buf, len,
 	    NULL, 0);
 	dtp->dt_sprintf_buflen = 0;
@@ -1955,10 +1992,15 @@ dtrace_fprinta(dtrace_hdl_t *dtp, FILE *fp, void *fmtdata,
 		if (dtrace_aggregate_walk_sorted(dtp,
 		    dt_fprinta, &pfw) == -1 || pfw.pfw_err != 0)
 			return (-1); /* errno is set for us */
+
+		dt_aggregate_printed(dtp, pfw.pfw_aid);
 	} else {
 		if (dtrace_aggregate_walk_joined(dtp, aggvars, naggvars,
 		    dt_fprintas, &pfw) == -1 || pfw.pfw_err != 0)
 			return (-1); /* errno is set for us */
+
+		while (naggvars > 0)
+			dt_aggregate_printed(dtp, aggvars[--naggvars]);
 	}
 
 	return (i);
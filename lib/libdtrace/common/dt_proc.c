@@ -242,6 +242,7 @@ dt_proc_rdevent(dtrace_hdl_t *dtp, dt_proc_t *dpr, const char *evname)
 			break;
 
 		Pupdate_syms(dpr->dpr_proc);
+		dpr->dpr_symgen++;
 		if (dt_pid_create_probes_module(dtp, dpr) != 0)
 			dt_proc_notify(dtp, dtp->dt_procs, dpr,
 			    dpr->dpr_errmsg);
@@ -256,10 +257,12 @@ dt_proc_rdevent(dtrace_hdl_t *dtp, dt_proc_t *dpr, const char *evname)
 		break;
 	case RD_PREINIT:
 		Pupdate_syms(dpr->dpr_proc);
+		dpr->dpr_symgen++;
 		dt_proc_stop(dpr, DT_PROC_STOP_PREINIT);
 		break;
 	case RD_POSTINIT:
 		Pupdate_syms(dpr->dpr_proc);
+		dpr->dpr_symgen++;
 		dt_proc_stop(dpr, DT_PROC_STOP_POSTINIT);
 		break;
 	default:;
@@ -335,6 +338,47 @@ dt_proc_lookup(dtrace_hdl_t *dtp, struct ps_prochandle *P, int remove)
 	return (dpr);
 }
 
+static void
+dt_proc_usym_flush(dtrace_hdl_t *dtp, dt_usymtab_t *dut)
+{
+	dt_usym_t *dus, *nus;
+	int i;
+
+	if (dut->dut_nsyms != 0)
+		dtp->dt_procs->dph_usymflushes++;
+
+	for (i = 0; i < DT_USYM_HASHSIZE; i++) {
+		for (dus = dut->dut_hash[i]; dus != NULL; dus = nus) {
+			nus = dus->dus_next;
+			dt_free(dtp, dus->dus_name);
+			dt_free(dtp, dus->dus_objname);
+			dt_free(dtp, dus);
+		}
+		dut->dut_hash[i] = NULL;
+	}
+
+	dut->dut_nsyms = 0;
+}
+
+/*
+ * Discard the symbolization cache of a process handle that is going away.
+ */
+static void
+dt_proc_usym_purge(dtrace_hdl_t *dtp, dt_proc_t *dpr)
+{
+	dt_usymtab_t *dut, **dutp = &dtp->dt_procs->dph_usyms;
+
+	while ((dut = *dutp) != NULL) {
+		if (dut->dut_dpr == dpr) {
+			*dutp = dut->dut_next;
+			dt_proc_usym_flush(dtp, dut);
+			dt_free(dtp, dut);
+		} else {
+			dutp = &dut->dut_next;
+		}
+	}
+}
+
 static void
 dt_proc_destroy(dtrace_hdl_t *dtp, struct ps_prochandle *P)
 {
@@ -423,6 +467,8 @@ dt_proc_destroy(dtrace_hdl_t *dtp, struct ps_prochandle *P)
 	}
 
 	dt_list_delete(&dph->dph_lrulist, dpr);
+	dt_proc_usym_purge(dtp, dpr);
+	dt_free(dtp, dpr->dpr_text);
 	Prelease(dpr->dpr_proc, rflag);
 	dt_free(dtp, dpr);
 }
@@ -677,6 +723,146 @@ dt_proc_unlock(dtrace_hdl_t *dtp, struct ps_prochandle *P)
 	assert(err == 0); /* check for unheld lock */
 }
 
+#define	DT_USYM_HASH(pc)	\
+	((uint_t)((pc) ^ ((pc) >> 16)) & (DT_USYM_HASHSIZE - 1))
+
+/*
+ * The control thread bumps dpr_symgen when it sees the process's dyld
+ * activity, but a handle grabbed read-only has no control thread and would
+ * never see it.  libproc counts every image load and unload for all handles,
+ * so we add that count in.  The caller must hold the process lock.
+ */
+static uint_t
+dt_proc_symgen(dt_proc_t *dpr)
+{
+	return (dpr->dpr_symgen + Pmapgen(dpr->dpr_proc));
+}
+
+/*
+ * Resolve a user address in the specified process to the symbol, object and
+ * mapping that contain it.  Results are cached per process handle, so that
+ * the many stack frames and aggregation keys that share the same addresses
+ * don't each grab the process and search its symbol tables.  The cache is
+ * flushed whenever the process's mappings change underneath it, whether or
+ * not the handle has a control thread (see dt_proc_symgen()).  The
+ * returned entry is only valid until the next call; NULL is returned if the
+ * process can't be grabbed.  The caller must not hold the process lock.
+ */
+const dt_usym_t *
+dt_proc_usym_lookup(dtrace_hdl_t *dtp, pid_t pid, uint64_t pc)
+{
+	dt_proc_hash_t *dph = dtp->dt_procs;
+	uint_t h = DT_USYM_HASH(pc);
+	char name[PATH_MAX];
+	prmap_t thread_local_map;
+	const prmap_t *map;
+	struct ps_prochandle *P;
+	dt_usymtab_t *dut;
+	dt_usym_t *dus;
+	dt_proc_t *dpr;
+	uint_t gen;
+
+	dph->dph_usymlookups++;
+
+	for (dut = dph->dph_usyms; dut != NULL; dut = dut->dut_next) {
+		if (dut->dut_dpr->dpr_pid == pid && !dut->dut_dpr->dpr_stale)
+			break;
+	}
+
+	if (dut != NULL) {
+		dpr = dut->dut_dpr;
+
+		(void) pthread_mutex_lock(&dpr->dpr_lock);
+		gen = dt_proc_symgen(dpr);
+		(void) pthread_mutex_unlock(&dpr->dpr_lock);
+
+		if (dut->dut_gen == gen) {
+			for (dus = dut->dut_hash[h]; dus != NULL;
+			    dus = dus->dus_next) {
+				if (dus->dus_pc != pc)
+					continue;
+
+				dt_list_delete(&dph->dph_lrulist, dpr);
+				dt_list_prepend(&dph->dph_lrulist, dpr);
+				dph->dph_usymhits++;
+				return (dus);
+			}
+		}
+	}
+
+	if ((P = dt_proc_grab(dtp, pid, PGRAB_RDONLY | PGRAB_FORCE, 0)) == NULL)
+		return (NULL);
+
+	dpr = dt_proc_lookup(dtp, P, B_FALSE);
+
+	/*
+	 * Only cache the result if the handle outlives the dt_proc_release()
+	 * below; otherwise, return it in the handle-wide scratch entry.
+	 */
+	if (dpr->dpr_refs > 1 ||
+	    (dpr->dpr_cacheable && dph->dph_lrucnt <= dph->dph_lrulim)) {
+		for (dut = dph->dph_usyms; dut != NULL; dut = dut->dut_next) {
+			if (dut->dut_dpr == dpr)
+				break;
+		}
+
+		if (dut == NULL &&
+		    (dut = dt_zalloc(dtp, sizeof (dt_usymtab_t))) != NULL) {
+			dut->dut_dpr = dpr;
+			dut->dut_next = dph->dph_usyms;
+			dph->dph_usyms = dut;
+		}
+	} else {
+		dut = NULL;
+	}
+
+	if (dut == NULL || (dus = dt_zalloc(dtp, sizeof (dt_usym_t))) == NULL) {
+		dus = &dph->dph_usymtmp;
+		dt_free(dtp, dus->dus_name);
+		dt_free(dtp, dus->dus_objname);
+		bzero(dus, sizeof (dt_usym_t));
+		dut = NULL;
+	}
+
+	dt_proc_lock(dtp, P);
+
+	gen = dt_proc_symgen(dpr);
+
+	if (dut != NULL && (dut->dut_gen != gen ||
+	    dut->dut_nsyms >= DT_USYM_MAX)) {
+		dt_proc_usym_flush(dtp, dut);
+		dut->dut_gen = gen;
+	}
+
+	dus->dus_pc = pc;
+
+	if (Plookup_by_addr(P, pc, name, sizeof (name), &dus->dus_sym) == 0 &&
+	    (dus->dus_name = strdup(name)) != NULL)
+		dus->dus_flags |= DT_USYM_SYM;
+
+	if (Pobjname(P, pc, name, sizeof (name)) != NULL &&
+	    (dus->dus_objname = strdup(name)) != NULL)
+		dus->dus_flags |= DT_USYM_OBJ;
+
+	if ((map = Paddr_to_map(P, pc, &thread_local_map)) != NULL) {
+		dus->dus_vaddr = map->pr_vaddr;
+		dus->dus_mflags = map->pr_mflags;
+		dus->dus_flags |= DT_USYM_MAP;
+	}
+
+	dt_proc_unlock(dtp, P);
+
+	if (dut != NULL) {
+		dus->dus_next = dut->dut_hash[h];
+		dut->dut_hash[h] = dus;
+		dut->dut_nsyms++;
+	}
+
+	dt_proc_release(dtp, P);
+
+	return (dus);
+}
+
 void
 dt_proc_init(dtrace_hdl_t *dtp)
 {
@@ -688,6 +874,7 @@ dt_proc_init(dtrace_hdl_t *dtp)
 		return;
 
 	(void) pthread_mutex_init(&dtp->dt_procs->dph_lock, NULL);
+	(void) pthread_mutex_init(&dtp->dt_procs->dph_sitelock, NULL);
 
 	dtp->dt_procs->dph_hashlen = _dtrace_pidbuckets;
 	dtp->dt_procs->dph_lrulim = _dtrace_pidlrulim;
@@ -735,6 +922,26 @@ dt_proc_fini(dtrace_hdl_t *dtp)
 	while ((dpr = dt_list_next(&dph->dph_lrulist)) != NULL)
 		dt_proc_destroy(dtp, dpr->dpr_proc);
 
+	assert(dph->dph_usyms == NULL);
+	dt_free(dtp, dph->dph_usymtmp.dus_name);
+	dt_free(dtp, dph->dph_usymtmp.dus_objname);
+
+	if (dph->dph_sites != NULL) {
+		dt_pidsite_t *dps, *nps;
+		int i;
+
+		for (i = 0; i < DT_PIDSITE_HASHSIZE; i++) {
+			for (dps = dph->dph_sites[i]; dps != NULL; dps = nps) {
+				nps = dps->dps_next;
+				dt_free(dtp, dps);
+			}
+		}
+
+		dt_free(dtp, dph->dph_sites);
+	}
+
+	(void) pthread_mutex_destroy(&dph->dph_sitelock);
+
 	dtp->dt_procs = NULL;
 	dt_free(dtp, dph);
 
@@ -829,6 +1036,24 @@ dtrace_proc_continue(dtrace_hdl_t *dtp, struct ps_prochandle *P)
 	dt_proc_continue(dtp, P);
 }
 
+int
+dtrace_proc_symstat(dtrace_hdl_t *dtp, dtrace_symstat_t *stat)
+{
+	dt_proc_hash_t *dph = dtp->dt_procs;
+	dt_usymtab_t *dut;
+
+	bzero(stat, sizeof (dtrace_symstat_t));
+
+	stat->dtss_lookups = dph->dph_usymlookups;
+	stat->dtss_hits = dph->dph_usymhits;
+	stat->dtss_flushes = dph->dph_usymflushes;
+
+	for (dut = dph->dph_usyms; dut != NULL; dut = dut->dut_next)
+		stat->dtss_entries += dut->dut_nsyms;
+
+	return (0);
+}
+
 int
 dtrace_proc_state(dtrace_hdl_t *dtp, struct ps_prochandle *P)
 {
@@ -58,8 +58,65 @@ typedef struct dt_proc {
 	uint8_t dpr_rdonly;		/* proc flag: opened read-only */
 	pthread_t dpr_tid;		/* control thread (or zero if none) */
 	dt_list_t dpr_bps;		/* list of dt_bkpt_t structures */
+	uint_t dpr_symgen;		/* bumped when mappings change */
+	uint8_t *dpr_text;		/* text window read by dt_pid_read() */
+	uint64_t dpr_textaddr;		/* address of dpr_text in process */
+	size_t dpr_textsize;		/* valid bytes in dpr_text */
 } dt_proc_t;
 
+/*
+ * The user symbolization cache remembers, for each address resolved in a
+ * grabbed process, the symbol, object and mapping that contain it.  There is
+ * one table of addresses per process handle; it is discarded when the handle
+ * is destroyed and flushed when the handle's dpr_symgen, or libproc's count
+ * of the process's image loads and unloads, changes.
+ */
+typedef struct dt_usym {
+	struct dt_usym *dus_next;	/* next entry on hash chain */
+	uint64_t dus_pc;		/* user address */
+	uint_t dus_flags;		/* valid fields (see below) */
+	int dus_mflags;			/* pr_mflags of containing mapping */
+	uint64_t dus_vaddr;		/* base of containing mapping */
+	GElf_Sym dus_sym;		/* symbol containing address */
+	char *dus_name;			/* name of dus_sym */
+	char *dus_objname;		/* name of containing object */
+} dt_usym_t;
+
+#define	DT_USYM_SYM	0x1	/* dus_sym and dus_name are valid */
+#define	DT_USYM_OBJ	0x2	/* dus_objname is valid */
+#define	DT_USYM_MAP	0x4	/* dus_vaddr and dus_mflags are valid */
+
+#define	DT_USYM_HASHSIZE	1024	/* hash chains per process */
+#define	DT_USYM_MAX		65536	/* max addresses cached per process */
+
+typedef struct dt_usymtab {
+	struct dt_usymtab *dut_next;	/* next table (for another process) */
+	dt_proc_t *dut_dpr;		/* process handle of cached addresses */
+	uint_t dut_gen;			/* dt_proc_symgen() of cached addresses */
+	uint_t dut_nsyms;		/* number of cached addresses */
+	dt_usym_t *dut_hash[DT_USYM_HASHSIZE]; /* hash chains */
+} dt_usymtab_t;
+
+/*
+ * The pid provider's site cache remembers, for each function it has decoded,
+ * the offsets of the function's return sites or instruction boundaries.  The
+ * offsets only depend on the function's text, so entries are keyed by the UUID
+ * of the containing image and the function's offset within it, and are shared
+ * by every process of the handle that maps the same image.
+ */
+typedef struct dt_pidsite {
+	struct dt_pidsite *dps_next;	/* next entry on hash chain */
+	uuid_t dps_uuid;		/* UUID of containing image */
+	uint64_t dps_off;		/* offset of function in image */
+	uint64_t dps_size;		/* size of function */
+	int dps_type;			/* DTFTP_RETURN or DTFTP_OFFSETS */
+	uint_t dps_noffs;		/* number of offsets */
+	uint32_t dps_offs[1];		/* offsets of sites in function */
+} dt_pidsite_t;
+
+#define	DT_PIDSITE_HASHSIZE	4096		/* hash chains per handle */
+#define	DT_PIDSITE_MAXMEM	(64 << 20)	/* max bytes of cached sites */
+
 typedef struct dt_proc_notify {
 	dt_proc_t *dprn_dpr;		/* process associated with the event */
 	char dprn_errmsg[BUFSIZ];	/* error message */
@@ -91,6 +148,14 @@ typedef struct dt_proc_hash {
 	dt_list_t dph_lrulist;		/* list of dt_proc_t's in lru order */
 	uint_t dph_lrulim;		/* limit on number of procs to hold */
 	uint_t dph_lrucnt;		/* count of cached process handles */
+	dt_usymtab_t *dph_usyms;	/* symbolization cache tables */
+	dt_usym_t dph_usymtmp;		/* lookup result that isn't cached */
+	uint64_t dph_usymlookups;	/* count of symbolization lookups */
+	uint64_t dph_usymhits;		/* count of lookups found in cache */
+	uint64_t dph_usymflushes;	/* count of tables flushed */
+	pthread_mutex_t dph_sitelock;	/* lock protecting dph_sites */
+	dt_pidsite_t **dph_sites;	/* pid provider site cache chains */
+	size_t dph_sitemem;		/* bytes of cached sites */
 	uint_t dph_hashlen;		/* size of hash chains array */
 	dt_proc_t *dph_hash[1];		/* hash chains array */
 } dt_proc_hash_t;
@@ -104,6 +169,7 @@ extern void dt_proc_continue(dtrace_hdl_t *, struct ps_prochandle *);
 extern void dt_proc_lock(dtrace_hdl_t *, struct ps_prochandle *);
 extern void dt_proc_unlock(dtrace_hdl_t *, struct ps_prochandle *);
 extern dt_proc_t *dt_proc_lookup(dtrace_hdl_t *, struct ps_prochandle *, int);
+extern const dt_usym_t *dt_proc_usym_lookup(dtrace_hdl_t *, pid_t, uint64_t);
 
 extern void dt_proc_init(dtrace_hdl_t *);
 extern void dt_proc_fini(dtrace_hdl_t *);
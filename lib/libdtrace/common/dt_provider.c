@@ -38,11 +38,42 @@
 #include <dt_string.h>
 #include <dt_list.h>
 
+/*
+ * Double the number of provider hash buckets once the chains average
+ * DT_IDHASH_LOAD providers, as with identifier hashes.  Each pid provider is
+ * a separate provider, so tracing many processes results in many providers.
+ */
+static void
+dt_provider_grow(dtrace_hdl_t *dtp)
+{
+	uint_t h, nbuckets = dtp->dt_provbuckets * 2 + 1;
+	dt_provider_t **provs, *pvp;
+
+	if (dtp->dt_nprovs < dtp->dt_provbuckets * DT_IDHASH_LOAD ||
+	    (provs = calloc(nbuckets, sizeof (dt_provider_t *))) == NULL)
+		return;
+
+	for (pvp = dt_list_next(&dtp->dt_provlist); pvp != NULL;
+	    pvp = dt_list_next(pvp)) {
+		h = dt_strtab_hash(pvp->pv_desc.dtvd_name, NULL) % nbuckets;
+		pvp->pv_next = provs[h];
+		provs[h] = pvp;
+	}
+
+	free(dtp->dt_provs);
+	dtp->dt_provs = provs;
+	dtp->dt_provbuckets = nbuckets;
+}
+
 static dt_provider_t *
-dt_provider_insert(dtrace_hdl_t *dtp, dt_provider_t *pvp, uint_t h)
+dt_provider_insert(dtrace_hdl_t *dtp, dt_provider_t *pvp)
 {
+	uint_t h;
+
+	dt_provider_grow(dtp);
 	dt_list_append(&dtp->dt_provlist, pvp);
 
+	h = dt_strtab_hash(pvp->pv_desc.dtvd_name, NULL) % dtp->dt_provbuckets;
 	pvp->pv_next = dtp->dt_provs[h];
 	dtp->dt_provs[h] = pvp;
 	dtp->dt_nprovs++;
@@ -108,8 +139,7 @@ dt_provider_create(dtrace_hdl_t *dtp, const char *name)
 	pvp->pv_desc.dtvd_attr.dtpa_name = _dtrace_prvattr;
 	pvp->pv_desc.dtvd_attr.dtpa_args = _dtrace_prvattr;
 
-	return (dt_provider_insert(dtp, pvp,
-	    dt_strtab_hash(name, NULL) % dtp->dt_provbuckets));
+	return (dt_provider_insert(dtp, pvp));
 }
 
 void
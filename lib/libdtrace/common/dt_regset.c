@@ -35,14 +35,22 @@
 #include <assert.h>
 #include <strings.h>
 #include <stdlib.h>
+#include <stdio.h>
 
 #include <dt_regset.h>
 #include <dt_impl.h>
 
+/*
+ * The register set hands out DT_REGSET_NVREGS registers, which is as many as
+ * an instruction can name, in first-fit order.  Code that fits into the
+ * dr_size registers of the DIF register file therefore uses those registers
+ * directly, and dt_regset_assign() maps the registers of any code that
+ * doesn't onto the register file once it has been generated.
+ */
 dt_regset_t *
 dt_regset_create(ulong_t nregs)
 {
-	ulong_t n = BT_BITOUL(nregs);
+	ulong_t n = BT_BITOUL(DT_REGSET_NVREGS);
 	dt_regset_t *drp = malloc(sizeof (dt_regset_t));
 
 	if (drp == NULL)
@@ -56,6 +64,7 @@ dt_regset_create(ulong_t nregs)
 	}
 
 	drp->dr_size = nregs;
+	drp->dr_maxreg = 0;
 
 	return (drp);
 }
@@ -70,7 +79,8 @@ dt_regset_destroy(dt_regset_t *drp)
 void
 dt_regset_reset(dt_regset_t *drp)
 {
-	bzero(drp->dr_bitmap, sizeof (ulong_t) * BT_BITOUL(drp->dr_size));
+	bzero(drp->dr_bitmap, sizeof (ulong_t) * BT_BITOUL(DT_REGSET_NVREGS));
+	drp->dr_maxreg = 0;
 }
 
 void
@@ -78,7 +88,7 @@ dt_regset_assert_free(dt_regset_t *drp)
 {
 	int reg;
 	boolean_t fail = B_FALSE;
-	for (reg = 0; reg < drp->dr_size; reg++) {
+	for (reg = 0; reg < DT_REGSET_NVREGS; reg++) {
 		if (BT_TEST(drp->dr_bitmap, reg) != 0)  {
 			dt_dprintf("%%r%d was left allocated", reg);
 			fail = B_TRUE;
@@ -95,7 +105,7 @@ dt_regset_assert_free(dt_regset_t *drp)
 int
 dt_regset_alloc(dt_regset_t *drp)
 {
-	ulong_t nbits = drp->dr_size - 1;
+	ulong_t nbits = DT_REGSET_NVREGS - 1;
 	ulong_t maxw = nbits >> BT_ULSHIFT;
 	ulong_t wx;
 
@@ -114,6 +124,8 @@ dt_regset_alloc(dt_regset_t *drp)
 			if ((word & bit) == 0) {
 				reg = (int)((wx << BT_ULSHIFT) | bx);
 				BT_SET(drp->dr_bitmap, reg);
+				if (reg > drp->dr_maxreg)
+					drp->dr_maxreg = reg;
 				return (reg);
 			}
 		}
@@ -127,7 +139,917 @@ dt_regset_alloc(dt_regset_t *drp)
 void
 dt_regset_free(dt_regset_t *drp, int reg)
 {
-	assert(reg >= 0 && reg < drp->dr_size);
+	assert(reg >= 0 && reg < DT_REGSET_NVREGS);
 	assert(BT_TEST(drp->dr_bitmap, reg) != 0);
 	BT_CLEAR(drp->dr_bitmap, reg);
 }
+
+/*
+ * Register assignment
+ *
+ * When an expression needs more registers than the DIF register file holds,
+ * dt_cg() leaves code that names registers beyond dr_size, and
+ * dt_regset_assign() assigns the values that those registers hold to the
+ * registers of the register file:
+ *
+ * - The definitions and uses of each register are grouped into webs, the
+ *   sets of definitions that reach a common use.  dt_cg() reuses a register
+ *   as soon as it is freed, so one register usually holds many unrelated
+ *   values over the course of a DIFO.
+ *
+ * - A backward pass over the list computes the webs that are live before
+ *   each instruction (DIF only branches forward), and each web interferes
+ *   with the webs that are live where it is defined.
+ *
+ * - The interference graph is colored with the registers other than %r0.
+ *   A web that can't be colored is spilled to a clause-local variable: it is
+ *   stored after each of its definitions and reloaded before each of its
+ *   uses into a web that lives for a single instruction, and the graph is
+ *   colored again.  Webs that don't interfere share a variable.
+ *
+ * A web that is live where the DIFO starts, such as the input of a
+ * translator member, keeps the register it was given.
+ */
+
+#define	DT_RA_R1	0		/* r1 field of an instruction */
+#define	DT_RA_R2	1		/* r2 field of an instruction */
+#define	DT_RA_RD	2		/* rd (or rs) field of an instruction */
+#define	DT_RA_NFIELDS	3
+
+#define	DT_RA_USE(f)	(1u << (f))	/* field names a register read */
+#define	DT_RA_DEF	0x8		/* rd field names a register written */
+
+#define	DT_RA_PRE	0x1		/* web is live on entry */
+#define	DT_RA_TEMP	0x2		/* web reloads or stores a spilled web */
+#define	DT_RA_SPILL	0x4		/* web is spilled in this round */
+#define	DT_RA_DEAD	0x8		/* web was spilled in an earlier round */
+
+#define	DT_RA_NONE	(-1u)		/* no web or no register */
+#define	DT_RA_MAXROUND	8		/* bound on rounds of spilling */
+
+#define	DT_RA_ISLABEL(dip) \
+	((dip)->di_label != DT_LBL_NONE && (dip)->di_instr == DIF_INSTR_NOP)
+
+#define	DT_RA_ISBRANCH(op)	((op) >= DIF_OP_BA && (op) <= DIF_OP_BLEU)
+
+typedef struct dt_regalloc {
+	dt_regset_t *dra_regs;		/* register set of the code generator */
+	dt_pcb_t *dra_pcb;		/* pcb whose pcb_ir is being assigned */
+	dt_irnode_t **dra_ir;		/* instructions and label declarations */
+	uint_t *dra_fld;		/* web named by each field of dra_ir[] */
+	uint_t dra_len;			/* number of entries in dra_ir[] */
+	uint_t dra_nlabels;		/* number of labels (dl_label) */
+	uint_t dra_nwebs;		/* number of webs */
+	uint_t *dra_reg;		/* register named by each web */
+	uint_t *dra_flags;		/* DT_RA_* flags of each web */
+	uint_t *dra_color;		/* register assigned to each web */
+	uint_t *dra_cost;		/* references to each web */
+	uint_t *dra_slot;		/* variable that a spilled web lives in */
+	ulong_t *dra_adj;		/* interference matrix of the webs */
+	ulong_t dra_adjw;		/* words in each row of dra_adj[] */
+	uint_t dra_nslots;		/* spill variables used so far */
+} dt_regalloc_t;
+
+static void
+dt_regset_fini(dt_regalloc_t *dra)
+{
+	dtrace_hdl_t *dtp = dra->dra_pcb->pcb_hdl;
+
+	dt_free(dtp, dra->dra_ir);
+	dt_free(dtp, dra->dra_fld);
+	dt_free(dtp, dra->dra_reg);
+	dt_free(dtp, dra->dra_flags);
+	dt_free(dtp, dra->dra_color);
+	dt_free(dtp, dra->dra_cost);
+	dt_free(dtp, dra->dra_slot);
+	dt_free(dtp, dra->dra_adj);
+}
+
+static void
+dt_regset_fail(dt_regalloc_t *dra, int err)
+{
+	dt_regset_fini(dra);
+
+	if (err == EDT_NOREG)
+		xyerror(D_NOREG, "Insufficient registers to generate code");
+
+	longjmp(dra->dra_pcb->pcb_jmpbuf, err);
+}
+
+static void *
+dt_regset_zalloc(dt_regalloc_t *dra, size_t size)
+{
+	void *p = dt_zalloc(dra->dra_pcb->pcb_hdl, size);
+
+	if (p == NULL)
+		dt_regset_fail(dra, EDT_NOMEM);
+
+	return (p);
+}
+
+/*
+ * Return the fields of an instruction that name registers as a combination
+ * of DT_RA_USE() and DT_RA_DEF.  %r0 always holds zero, so a field that
+ * names it is left alone.
+ */
+static uint_t
+dt_regset_operands(const dt_irnode_t *dip)
+{
+	uint_t flags = dt_difopt_flags(dip), m = 0;
+
+	if (flags & DT_DOP_R1)
+		m |= DT_RA_USE(DT_RA_R1);
+	if (flags & DT_DOP_R2)
+		m |= DT_RA_USE(DT_RA_R2);
+	if (flags & DT_DOP_RS)
+		m |= DT_RA_USE(DT_RA_RD);
+	if (flags & DT_DOP_RD)
+		m |= DT_RA_DEF;
+
+	return (m);
+}
+
+static uint_t
+dt_regset_field(dif_instr_t instr, uint_t f)
+{
+	switch (f) {
+	case DT_RA_R1:
+		return (DIF_INSTR_R1(instr));
+	case DT_RA_R2:
+		return (DIF_INSTR_R2(instr));
+	default:
+		return (DIF_INSTR_RD(instr));
+	}
+}
+
+static dif_instr_t
+dt_regset_setfield(dif_instr_t instr, uint_t f, uint_t reg)
+{
+	uint_t shift = f == DT_RA_R1 ? 16 : f == DT_RA_R2 ? 8 : 0;
+
+	return ((instr & ~(0xffu << shift)) | (reg << shift));
+}
+
+static uint_t
+dt_regset_find(uint_t *parent, uint_t w)
+{
+	while (parent[w] != w)
+		w = parent[w] = parent[parent[w]];
+
+	return (w);
+}
+
+/*
+ * Merge the webs reaching a label along one path (src) into those reaching
+ * it along the others (dst): a use after the label reads a value from any of
+ * them, so they must all end up in the same register.
+ */
+static void
+dt_regset_merge(uint_t *parent, uint_t *flags, uint_t *dst, const uint_t *src)
+{
+	uint_t r, a, b;
+
+	for (r = 1; r < DT_REGSET_NVREGS; r++) {
+		if (src[r] == DT_RA_NONE)
+			continue;
+
+		if (dst[r] == DT_RA_NONE) {
+			dst[r] = src[r];
+			continue;
+		}
+
+		a = dt_regset_find(parent, dst[r]);
+		b = dt_regset_find(parent, src[r]);
+
+		if (a != b) {
+			parent[b] = a;
+			flags[a] |= flags[b];
+		}
+	}
+}
+
+/*
+ * Build the webs in one forward pass over the list, tracking the web that
+ * each register holds and the webs that each branch carries to its label.
+ */
+static void
+dt_regset_webs(dt_regalloc_t *dra)
+{
+	uint_t cur[DT_REGSET_NVREGS];
+	uint_t **maps, *parent, *flags, *regs;
+	uint_t i, f, r, w, ops, op, label, nwebs = 0;
+	uint_t max = dra->dra_len * DT_RA_NFIELDS + 1;
+	int reach = 1;
+
+	maps = dt_regset_zalloc(dra, sizeof (uint_t *) * dra->dra_nlabels);
+	parent = dt_zalloc(dra->dra_pcb->pcb_hdl, sizeof (uint_t) * max);
+	flags = dt_zalloc(dra->dra_pcb->pcb_hdl, sizeof (uint_t) * max);
+	regs = dt_zalloc(dra->dra_pcb->pcb_hdl, sizeof (uint_t) * max);
+
+	if (parent == NULL || flags == NULL || regs == NULL)
+		goto nomem;
+
+	for (r = 0; r < DT_REGSET_NVREGS; r++)
+		cur[r] = DT_RA_NONE;
+
+	for (i = 0; i < dra->dra_len; i++) {
+		dt_irnode_t *dip = dra->dra_ir[i];
+		uint_t *fld = &dra->dra_fld[i * DT_RA_NFIELDS];
+
+		for (f = 0; f < DT_RA_NFIELDS; f++)
+			fld[f] = DT_RA_NONE;
+
+		if ((label = dip->di_label) != DT_LBL_NONE &&
+		    maps[label] != NULL) {
+			if (reach)
+				dt_regset_merge(parent, flags, cur, maps[label]);
+			else
+				bcopy(maps[label], cur, sizeof (cur));
+			reach = 1;
+		}
+
+		if (DT_RA_ISLABEL(dip))
+			continue;
+
+		ops = dt_regset_operands(dip);
+
+		for (f = 0; f < DT_RA_NFIELDS; f++) {
+			if (!(ops & DT_RA_USE(f)) ||
+			    (r = dt_regset_field(dip->di_instr, f)) == 0)
+				continue;
+
+			/*
+			 * A register that is read before it is written on a
+			 * path from the entry must be set by our caller.  In
+			 * code that can't be reached, any register will do.
+			 */
+			if (cur[r] == DT_RA_NONE) {
+				parent[nwebs] = nwebs;
+				flags[nwebs] = reach ? DT_RA_PRE : 0;
+				regs[nwebs] = r;
+				cur[r] = nwebs++;
+			}
+
+			fld[f] = cur[r];
+		}
+
+		if ((ops & DT_RA_DEF) &&
+		    (r = DIF_INSTR_RD(dip->di_instr)) != 0) {
+			parent[nwebs] = nwebs;
+			flags[nwebs] = 0;
+			regs[nwebs] = r;
+			fld[DT_RA_RD] = cur[r] = nwebs++;
+		}
+
+		op = DIF_INSTR_OP(dip->di_instr);
+
+		if (DT_RA_ISBRANCH(op)) {
+			label = DIF_INSTR_LABEL(dip->di_instr);
+			assert(label < dra->dra_nlabels);
+
+			if (maps[label] == NULL) {
+				if ((maps[label] = dt_alloc(dra->dra_pcb->pcb_hdl,
+				    sizeof (cur))) == NULL)
+					goto nomem;
+				bcopy(cur, maps[label], sizeof (cur));
+			} else
+				dt_regset_merge(parent, flags, maps[label], cur);
+		}
+
+		if (op == DIF_OP_BA || op == DIF_OP_RET) {
+			for (r = 0; r < DT_REGSET_NVREGS; r++)
+				cur[r] = DT_RA_NONE;
+			reach = 0;
+		}
+	}
+
+	/*
+	 * Number the webs that remain after merging, using the parent array to
+	 * map each representative to its number.
+	 */
+	dra->dra_reg = dt_zalloc(dra->dra_pcb->pcb_hdl, sizeof (uint_t) * max);
+	dra->dra_flags = dt_zalloc(dra->dra_pcb->pcb_hdl,
+	    sizeof (uint_t) * max);
+
+	if (dra->dra_reg == NULL || dra->dra_flags == NULL)
+		goto nomem;
+
+	for (w = 0; w < nwebs; w++) {
+		if (dt_regset_find(parent, w) != w)
+			continue;
+
+		dra->dra_reg[dra->dra_nwebs] = regs[w];
+		dra->dra_flags[dra->dra_nwebs] = flags[w];
+		regs[w] = dra->dra_nwebs++;
+	}
+
+	for (i = 0; i < dra->dra_len * DT_RA_NFIELDS; i++) {
+		if (dra->dra_fld[i] != DT_RA_NONE) {
+			dra->dra_fld[i] =
+			    regs[dt_regset_find(parent, dra->dra_fld[i])];
+		}
+	}
+
+	for (i = 0; i < dra->dra_nlabels; i++)
+		dt_free(dra->dra_pcb->pcb_hdl, maps[i]);
+
+	dt_free(dra->dra_pcb->pcb_hdl, maps);
+	dt_free(dra->dra_pcb->pcb_hdl, parent);
+	dt_free(dra->dra_pcb->pcb_hdl, flags);
+	dt_free(dra->dra_pcb->pcb_hdl, regs);
+	return;
+
+nomem:
+	for (i = 0; i < dra->dra_nlabels; i++)
+		dt_free(dra->dra_pcb->pcb_hdl, maps[i]);
+
+	dt_free(dra->dra_pcb->pcb_hdl, maps);
+	dt_free(dra->dra_pcb->pcb_hdl, parent);
+	dt_free(dra->dra_pcb->pcb_hdl, flags);
+	dt_free(dra->dra_pcb->pcb_hdl, regs);
+	dt_regset_fail(dra, EDT_NOMEM);
+}
+
+static void
+dt_regset_interfere(dt_regalloc_t *dra)
+{
+	ulong_t words = BT_BITOUL(dra->dra_nwebs);
+	ulong_t *live, *lbl, *row, k, bits;
+	uint_t i, f, w, x, ops, op;
+
+	dt_free(dra->dra_pcb->pcb_hdl, dra->dra_adj);
+	dt_free(dra->dra_pcb->pcb_hdl, dra->dra_cost);
+	dra->dra_adj = NULL;
+	dra->dra_cost = NULL;
+
+	dra->dra_adjw = words;
+	dra->dra_adj = dt_regset_zalloc(dra,
+	    sizeof (ulong_t) * words * dra->dra_nwebs);
+	dra->dra_cost = dt_regset_zalloc(dra,
+	    sizeof (uint_t) * dra->dra_nwebs);
+
+	live = dt_zalloc(dra->dra_pcb->pcb_hdl, sizeof (ulong_t) * words);
+	lbl = dt_zalloc(dra->dra_pcb->pcb_hdl,
+	    sizeof (ulong_t) * words * dra->dra_nlabels);
+
+	if (live == NULL || lbl == NULL) {
+		dt_free(dra->dra_pcb->pcb_hdl, live);
+		dt_free(dra->dra_pcb->pcb_hdl, lbl);
+		dt_regset_fail(dra, EDT_NOMEM);
+	}
+
+	for (i = dra->dra_len; i-- != 0; ) {
+		dt_irnode_t *dip = dra->dra_ir[i];
+		uint_t *fld = &dra->dra_fld[i * DT_RA_NFIELDS];
+
+		if (DT_RA_ISLABEL(dip)) {
+			bcopy(live, &lbl[dip->di_label * words],
+			    sizeof (ulong_t) * words);
+			continue;
+		}
+
+		op = DIF_INSTR_OP(dip->di_instr);
+
+		if (op == DIF_OP_RET) {
+			bzero(live, sizeof (ulong_t) * words);
+		} else if (op == DIF_OP_BA) {
+			bcopy(&lbl[DIF_INSTR_LABEL(dip->di_instr) * words],
+			    live, sizeof (ulong_t) * words);
+		} else if (DT_RA_ISBRANCH(op)) {
+			row = &lbl[DIF_INSTR_LABEL(dip->di_instr) * words];
+			for (k = 0; k < words; k++)
+				live[k] |= row[k];
+		}
+
+		ops = dt_regset_operands(dip);
+
+		/*
+		 * The web written by an instruction interferes with every web
+		 * that is live after it, other than itself.
+		 */
+		if ((ops & DT_RA_DEF) && (w = fld[DT_RA_RD]) != DT_RA_NONE) {
+			row = &dra->dra_adj[w * words];
+
+			for (k = 0; k < words; k++) {
+				row[k] |= live[k];
+
+				for (bits = live[k], x = k << BT_ULSHIFT;
+				    bits != 0; bits >>= 1, x++) {
+					if (bits & 1)
+						BT_SET(&dra->dra_adj[x * words], w);
+				}
+			}
+
+			BT_CLEAR(row, w);
+			BT_CLEAR(live, w);
+			dra->dra_cost[w]++;
+		}
+
+		for (f = 0; f < DT_RA_NFIELDS; f++) {
+			if ((ops & DT_RA_USE(f)) &&
+			    (w = fld[f]) != DT_RA_NONE) {
+				BT_SET(live, w);
+				dra->dra_cost[w]++;
+			}
+		}
+
+		if (dip->di_label != DT_LBL_NONE) {
+			bcopy(live, &lbl[dip->di_label * words],
+			    sizeof (ulong_t) * words);
+		}
+	}
+
+	dt_free(dra->dra_pcb->pcb_hdl, live);
+	dt_free(dra->dra_pcb->pcb_hdl, lbl);
+}
+
+/*
+ * Return whether web a is cheaper to spill than web b.  Reloads and stores of
+ * webs that are already spilled are only spilled when nothing else is left.
+ */
+static int
+dt_regset_cheaper(const dt_regalloc_t *dra, const uint_t *deg, uint_t a,
+    uint_t b)
+{
+	uint_t ta = dra->dra_flags[a] & DT_RA_TEMP;
+	uint_t tb = dra->dra_flags[b] & DT_RA_TEMP;
+
+	if (ta != tb)
+		return (tb != 0);
+
+	return ((uint64_t)dra->dra_cost[a] * deg[b] <
+	    (uint64_t)dra->dra_cost[b] * deg[a]);
+}
+
+/*
+ * Color the interference graph by repeatedly removing a web that has fewer
+ * neighbors than there are registers, or failing that the web that is
+ * cheapest to spill per neighbor, and then assigning registers to the webs
+ * in the reverse order.  A web that still finds every register taken by its
+ * neighbors is marked for spilling.  Return the number of such webs.
+ */
+static uint_t
+dt_regset_color(dt_regalloc_t *dra)
+{
+	uchar_t used[DT_REGSET_NVREGS];
+	uint_t nregs = dra->dra_regs->dr_size;
+	uint_t *deg, *stack, *removed;
+	uint_t w, x, best, left = 0, sp = 0, nspill = 0;
+	ulong_t k, bits, *row;
+
+	deg = dt_zalloc(dra->dra_pcb->pcb_hdl, sizeof (uint_t) * dra->dra_nwebs);
+	stack = dt_zalloc(dra->dra_pcb->pcb_hdl,
+	    sizeof (uint_t) * dra->dra_nwebs);
+	removed = dt_zalloc(dra->dra_pcb->pcb_hdl,
+	    sizeof (uint_t) * dra->dra_nwebs);
+
+	dt_free(dra->dra_pcb->pcb_hdl, dra->dra_color);
+	dra->dra_color = dt_zalloc(dra->dra_pcb->pcb_hdl,
+	    sizeof (uint_t) * dra->dra_nwebs);
+
+	if (deg == NULL || stack == NULL || removed == NULL ||
+	    dra->dra_color == NULL) {
+		dt_free(dra->dra_pcb->pcb_hdl, deg);
+		dt_free(dra->dra_pcb->pcb_hdl, stack);
+		dt_free(dra->dra_pcb->pcb_hdl, removed);
+		dt_regset_fail(dra, EDT_NOMEM);
+	}
+
+	for (w = 0; w < dra->dra_nwebs; w++) {
+		row = &dra->dra_adj[w * dra->dra_adjw];
+
+		for (k = 0; k < dra->dra_adjw; k++) {
+			for (bits = row[k]; bits != 0; bits >>= 1)
+				deg[w] += bits & 1;
+		}
+
+		if (dra->dra_flags[w] & DT_RA_PRE) {
+			dra->dra_color[w] = dra->dra_reg[w];
+			removed[w] = 1;
+		} else if (dra->dra_flags[w] & DT_RA_DEAD) {
+			dra->dra_color[w] = DT_RA_NONE;
+			removed[w] = 1;
+		} else {
+			dra->dra_color[w] = DT_RA_NONE;
+			left++;
+		}
+	}
+
+	while (left != 0) {
+		best = DT_RA_NONE;
+
+		for (w = 0; w < dra->dra_nwebs; w++) {
+			if (!removed[w] && deg[w] < nregs - 1) {
+				best = w;
+				break;
+			}
+		}
+
+		/*
+		 * Every web left has too many neighbors: pick the one with the
+		 * fewest references per neighbor, and hope that it finds a
+		 * register anyway.
+		 */
+		if (best == DT_RA_NONE) {
+			for (w = 0; w < dra->dra_nwebs; w++) {
+				if (!removed[w] && (best == DT_RA_NONE ||
+				    dt_regset_cheaper(dra, deg, w, best)))
+					best = w;
+			}
+		}
+
+		removed[best] = 1;
+		stack[sp++] = best;
+		left--;
+
+		row = &dra->dra_adj[best * dra->dra_adjw];
+
+		for (k = 0; k < dra->dra_adjw; k++) {
+			for (bits = row[k], x = k << BT_ULSHIFT;
+			    bits != 0; bits >>= 1, x++) {
+				if (bits & 1)
+					deg[x]--;
+			}
+		}
+	}
+
+	while (sp != 0) {
+		w = stack[--sp];
+		row = &dra->dra_adj[w * dra->dra_adjw];
+		bzero(used, sizeof (used));
+
+		for (k = 0; k < dra->dra_adjw; k++) {
+			for (bits = row[k], x = k << BT_ULSHIFT;
+			    bits != 0; bits >>= 1, x++) {
+				if ((bits & 1) && dra->dra_color[x] != DT_RA_NONE)
+					used[dra->dra_color[x]] = 1;
+			}
+		}
+
+		for (x = 1; x < nregs && used[x]; x++)
+			continue;
+
+		if (x < nregs) {
+			dra->dra_color[w] = x;
+		} else if (dra->dra_flags[w] & DT_RA_TEMP) {
+			nspill = DT_RA_NONE;
+			break;
+		} else {
+			dra->dra_flags[w] |= DT_RA_SPILL;
+			nspill++;
+		}
+	}
+
+	dt_free(dra->dra_pcb->pcb_hdl, deg);
+	dt_free(dra->dra_pcb->pcb_hdl, stack);
+	dt_free(dra->dra_pcb->pcb_hdl, removed);
+
+	if (nspill == DT_RA_NONE)
+		dt_regset_fail(dra, EDT_NOREG);
+
+	return (nspill);
+}
+
+/*
+ * Return the clause-local variable that holds the spilled webs given slot n.
+ * Its name can't be written in D.  The variable is shared by every DIFO of
+ * the program, each of which stores a spilled web before reloading it.
+ */
+static dt_ident_t *
+dt_regset_slot(dt_regalloc_t *dra, uint_t n)
+{
+	dt_pcb_t *pcb = dra->dra_pcb;
+	dtrace_hdl_t *dtp = pcb->pcb_hdl;
+	dtrace_typeinfo_t dtt;
+	char name[32];
+	dt_ident_t *idp;
+	uint_t id;
+
+	(void) snprintf(name, sizeof (name), "%%spill%u", n);
+
+	if ((idp = dt_idhash_lookup(pcb->pcb_locals, name)) == NULL) {
+		if (dt_idhash_nextid(pcb->pcb_locals, &id) == -1)
+			dt_regset_fail(dra, EDT_NOREG);
+
+		if (dt_type_lookup("uint64_t", &dtt) == -1)
+			dt_regset_fail(dra, dtrace_errno(dtp));
+
+		idp = dt_idhash_insert(pcb->pcb_locals, name, DT_IDENT_SCALAR,
+		    DT_IDFLG_LOCAL | DT_IDFLG_WRITE, id, _dtrace_defattr, 0,
+		    &dt_idops_thaw, NULL, dtp->dt_gen);
+
+		if (idp == NULL)
+			dt_regset_fail(dra, EDT_NOMEM);
+
+		dt_ident_type_assign(idp, dtt.dtt_ctfp, dtt.dtt_type);
+	}
+
+	idp->di_flags |= DT_IDFLG_DIFR | DT_IDFLG_DIFW;
+	return (idp);
+}
+
+/*
+ * Give each web marked for spilling a slot that no interfering web spilled in
+ * this round has, and rewrite the list so that the web lives in the variable
+ * of its slot: each use reads a reload of the variable into a new web, and
+ * each definition writes a new web that is then stored to the variable.  The
+ * new instructions are linked into pcb_ir as soon as they are created.
+ */
+static void
+dt_regset_spill(dt_regalloc_t *dra)
+{
+	dt_pcb_t *pcb = dra->dra_pcb;
+	dtrace_hdl_t *dtp = pcb->pcb_hdl;
+	dt_irlist_t *dlp = &pcb->pcb_ir;
+	uint_t i, j, f, g, w, x, ops, len, nwebs, nslots = 0;
+	uint_t tmp[DT_RA_NFIELDS];
+	uint_t *fld, *nfld, *reg, *flags, *slot;
+	dt_irnode_t **ir, *dip, *node, *prev = NULL;
+	ulong_t k, bits, *row;
+	uchar_t *used;
+
+	if ((used = dt_alloc(dtp, dra->dra_nwebs + 1)) == NULL)
+		dt_regset_fail(dra, EDT_NOMEM);
+
+	for (w = 0; w < dra->dra_nwebs; w++) {
+		if (!(dra->dra_flags[w] & DT_RA_SPILL))
+			continue;
+
+		bzero(used, dra->dra_nwebs + 1);
+		row = &dra->dra_adj[w * dra->dra_adjw];
+
+		for (k = 0; k < dra->dra_adjw; k++) {
+			for (bits = row[k], x = k << BT_ULSHIFT;
+			    bits != 0; bits >>= 1, x++) {
+				if ((bits & 1) && x < w &&
+				    (dra->dra_flags[x] & DT_RA_SPILL))
+					used[dra->dra_slot[x] - dra->dra_nslots] = 1;
+			}
+		}
+
+		for (x = 0; used[x]; x++)
+			continue;
+
+		dra->dra_slot[w] = dra->dra_nslots + x;
+		nslots = MAX(nslots, x + 1);
+	}
+
+	dt_free(dtp, used);
+
+	for (x = 0; x < nslots; x++)
+		(void) dt_regset_slot(dra, dra->dra_nslots + x);
+
+	dra->dra_nslots += nslots;
+
+	for (i = 0, len = dra->dra_len; i < dra->dra_len; i++) {
+		fld = &dra->dra_fld[i * DT_RA_NFIELDS];
+
+		for (f = 0; f < DT_RA_NFIELDS; f++) {
+			if (fld[f] != DT_RA_NONE &&
+			    (dra->dra_flags[fld[f]] & DT_RA_SPILL))
+				len++;
+		}
+	}
+
+	nwebs = dra->dra_nwebs + len - dra->dra_len;
+
+	ir = dt_zalloc(dtp, sizeof (dt_irnode_t *) * len);
+	nfld = dt_zalloc(dtp, sizeof (uint_t) * len * DT_RA_NFIELDS);
+	reg = dt_zalloc(dtp, sizeof (uint_t) * nwebs);
+	flags = dt_zalloc(dtp, sizeof (uint_t) * nwebs);
+	slot = dt_zalloc(dtp, sizeof (uint_t) * nwebs);
+
+	if (ir == NULL || nfld == NULL || reg == NULL || flags == NULL ||
+	    slot == NULL)
+		goto nomem;
+
+	bcopy(dra->dra_reg, reg, sizeof (uint_t) * dra->dra_nwebs);
+	bcopy(dra->dra_flags, flags, sizeof (uint_t) * dra->dra_nwebs);
+	bcopy(dra->dra_slot, slot, sizeof (uint_t) * dra->dra_nwebs);
+	nwebs = dra->dra_nwebs;
+
+	for (i = j = 0; i < dra->dra_len; i++) {
+		dip = dra->dra_ir[i];
+		fld = &dra->dra_fld[i * DT_RA_NFIELDS];
+		ops = DT_RA_ISLABEL(dip) ? 0 : dt_regset_operands(dip);
+
+		/*
+		 * Reload each spilled web that the instruction reads, taking
+		 * over the instruction's label so that branches to it execute
+		 * the reloads too.
+		 */
+		for (f = 0; f < DT_RA_NFIELDS; f++) {
+			tmp[f] = fld[f];
+
+			if (!(ops & DT_RA_USE(f)) || (w = fld[f]) == DT_RA_NONE ||
+			    !(flags[w] & DT_RA_SPILL))
+				continue;
+
+			for (g = 0; g < f; g++) {
+				if ((ops & DT_RA_USE(g)) && fld[g] == w)
+					break;
+			}
+
+			if (g < f) {
+				tmp[f] = tmp[g];
+				continue;
+			}
+
+			if ((node = malloc(sizeof (dt_irnode_t))) == NULL)
+				goto nomem;
+
+			node->di_label = dip->di_label;
+			node->di_instr = DIF_INSTR_LDV(DIF_OP_LDLS,
+			    dt_regset_slot(dra, slot[w])->di_id, 0);
+			node->di_extern = NULL;
+			node->di_next = dip;
+			dip->di_label = DT_LBL_NONE;
+
+			if (prev == NULL)
+				dlp->dl_list = node;
+			else
+				prev->di_next = node;
+
+			flags[nwebs] = DT_RA_TEMP;
+			reg[nwebs] = slot[nwebs] = DT_RA_NONE;
+			tmp[f] = nwebs;
+
+			ir[j] = prev = node;
+			nfld[j * DT_RA_NFIELDS + DT_RA_R1] = DT_RA_NONE;
+			nfld[j * DT_RA_NFIELDS + DT_RA_R2] = DT_RA_NONE;
+			nfld[j * DT_RA_NFIELDS + DT_RA_RD] = nwebs++;
+			j++;
+		}
+
+		if ((ops & DT_RA_DEF) && (w = fld[DT_RA_RD]) != DT_RA_NONE &&
+		    (flags[w] & DT_RA_SPILL)) {
+			flags[nwebs] = DT_RA_TEMP;
+			reg[nwebs] = slot[nwebs] = DT_RA_NONE;
+			tmp[DT_RA_RD] = nwebs++;
+		} else
+			w = DT_RA_NONE;
+
+		ir[j] = prev = dip;
+		bcopy(tmp, &nfld[j * DT_RA_NFIELDS], sizeof (tmp));
+		j++;
+
+		if (w == DT_RA_NONE)
+			continue;
+
+		/*
+		 * Store the web that the instruction writes to the variable.
+		 */
+		if ((node = malloc(sizeof (dt_irnode_t))) == NULL)
+			goto nomem;
+
+		node->di_label = DT_LBL_NONE;
+		node->di_instr = DIF_INSTR_STV(DIF_OP_STLS,
+		    dt_regset_slot(dra, slot[w])->di_id, 0);
+		node->di_extern = NULL;
+		node->di_next = dip->di_next;
+		dip->di_next = node;
+
+		if (dlp->dl_last == dip)
+			dlp->dl_last = node;
+
+		ir[j] = prev = node;
+		nfld[j * DT_RA_NFIELDS + DT_RA_R1] = DT_RA_NONE;
+		nfld[j * DT_RA_NFIELDS + DT_RA_R2] = DT_RA_NONE;
+		nfld[j * DT_RA_NFIELDS + DT_RA_RD] = tmp[DT_RA_RD];
+		j++;
+	}
+
+	assert(j <= len);
+
+	for (w = 0; w < dra->dra_nwebs; w++) {
+		if (flags[w] & DT_RA_SPILL)
+			flags[w] = (flags[w] & ~DT_RA_SPILL) | DT_RA_DEAD;
+	}
+
+	dt_free(dtp, dra->dra_ir);
+	dt_free(dtp, dra->dra_fld);
+	dt_free(dtp, dra->dra_reg);
+	dt_free(dtp, dra->dra_flags);
+	dt_free(dtp, dra->dra_slot);
+
+	dra->dra_ir = ir;
+	dra->dra_fld = nfld;
+	dra->dra_len = j;
+	dra->dra_reg = reg;
+	dra->dra_flags = flags;
+	dra->dra_slot = slot;
+	dra->dra_nwebs = nwebs;
+	return;
+
+nomem:
+	dt_free(dtp, ir);
+	dt_free(dtp, nfld);
+	dt_free(dtp, reg);
+	dt_free(dtp, flags);
+	dt_free(dtp, slot);
+	dt_regset_fail(dra, EDT_NOMEM);
+}
+
+/*
+ * Write the register assigned to each web into the fields that name it and
+ * link the list back together.
+ */
+static void
+dt_regset_rewrite(dt_regalloc_t *dra)
+{
+	dt_irlist_t *dlp = &dra->dra_pcb->pcb_ir;
+	dt_irnode_t *dip, **pp = &dlp->dl_list;
+	uint_t i, f, w, ops;
+
+	dlp->dl_last = NULL;
+	dlp->dl_len = 0;
+
+	for (i = 0; i < dra->dra_len; i++) {
+		dip = dra->dra_ir[i];
+
+		if (!DT_RA_ISLABEL(dip)) {
+			ops = dt_regset_operands(dip);
+
+			if (ops & DT_RA_DEF)
+				ops |= DT_RA_USE(DT_RA_RD);
+
+			for (f = 0; f < DT_RA_NFIELDS; f++) {
+				w = dra->dra_fld[i * DT_RA_NFIELDS + f];
+
+				if ((ops & DT_RA_USE(f)) && w != DT_RA_NONE) {
+					dip->di_instr = dt_regset_setfield(
+					    dip->di_instr, f, dra->dra_color[w]);
+				}
+			}
+
+			dlp->dl_len++;
+		}
+
+		*pp = dlp->dl_last = dip;
+		pp = &dip->di_next;
+	}
+
+	*pp = NULL;
+}
+
+void
+dt_regset_assign(dt_regset_t *drp, dt_pcb_t *pcb)
+{
+	dt_irlist_t *dlp = &pcb->pcb_ir;
+	dt_regalloc_t dra;
+	dt_irnode_t *dip;
+	uint_t i, w, round;
+
+	if (drp->dr_maxreg < drp->dr_size)
+		return; /* the code only names registers that exist */
+
+	bzero(&dra, sizeof (dra));
+	dra.dra_regs = drp;
+	dra.dra_pcb = pcb;
+	dra.dra_nlabels = dlp->dl_label;
+
+	for (dip = dlp->dl_list; dip != NULL; dip = dip->di_next)
+		dra.dra_len++;
+
+	dra.dra_ir = dt_regset_zalloc(&dra,
+	    sizeof (dt_irnode_t *) * dra.dra_len);
+	dra.dra_fld = dt_regset_zalloc(&dra,
+	    sizeof (uint_t) * dra.dra_len * DT_RA_NFIELDS);
+
+	for (i = 0, dip = dlp->dl_list; dip != NULL; dip = dip->di_next) {
+		if (!DT_RA_ISLABEL(dip) &&
+		    (dt_difopt_flags(dip) & DT_DOP_OPAQUE))
+			dt_regset_fail(&dra, EDT_NOREG);
+
+		dra.dra_ir[i++] = dip;
+	}
+
+	dt_regset_webs(&dra);
+
+	for (w = 0; w < dra.dra_nwebs; w++) {
+		if ((dra.dra_flags[w] & DT_RA_PRE) &&
+		    dra.dra_reg[w] >= drp->dr_size)
+			dt_regset_fail(&dra, EDT_NOREG);
+	}
+
+	dra.dra_slot = dt_regset_zalloc(&dra, sizeof (uint_t) * dra.dra_nwebs);
+
+	for (round = 0; ; round++) {
+		dt_regset_interfere(&dra);
+
+		if (dt_regset_color(&dra) == 0)
+			break;
+
+		if (round == DT_RA_MAXROUND)
+			dt_regset_fail(&dra, EDT_NOREG);
+
+		dt_regset_spill(&dra);
+	}
+
+	dt_regset_rewrite(&dra);
+
+	dt_dprintf("assigned %u webs to %lu registers using %u spill "
+	    "variables\n", dra.dra_nwebs, drp->dr_size, dra.dra_nslots);
+
+	dt_regset_fini(&dra);
+}
@@ -34,17 +34,23 @@
 extern "C" {
 #endif
 
+#define	DT_REGSET_NVREGS	256	/* registers an instruction can name */
+
 typedef struct dt_regset {
 	ulong_t dr_size;		/* number of registers in set */
 	ulong_t *dr_bitmap;		/* bitmap of active registers */
+	ulong_t dr_maxreg;		/* highest register used since reset */
 } dt_regset_t;
 
+struct dt_pcb;
+
 extern dt_regset_t *dt_regset_create(ulong_t);
 extern void dt_regset_destroy(dt_regset_t *);
 extern void dt_regset_reset(dt_regset_t *);
 extern int dt_regset_alloc(dt_regset_t *);
 extern void dt_regset_free(dt_regset_t *, int);
 extern void dt_regset_assert_free(dt_regset_t *);
+extern void dt_regset_assign(dt_regset_t *, struct dt_pcb *);
 
 #ifdef	__cplusplus
 }
@@ -39,6 +39,7 @@
 #include <sys/sysctl.h>
 
 #include <dt_impl.h>
+#include <dt_module.h>
 
 static const struct {
 	size_t dtps_offset;
@@ -548,6 +549,41 @@ dt_write(dtrace_hdl_t *dtp, int fd, const void *buf, size_t n)
 	return (n - resid);
 }
 
+/*
+ * Make room for len more bytes (plus a terminating NUL) of buffered output.
+ * The buffer is kept across flushes, so it grows to accommodate the largest
+ * output between two flushes and is then reused as is.
+ */
+static int
+dt_buffered_reserve(dtrace_hdl_t *dtp, size_t len)
+{
+	size_t size = dtp->dt_buffered_size;
+	char *newbuf;
+
+	if (dtp->dt_buffered_buf != NULL &&
+	    len < size - dtp->dt_buffered_offs)
+		return (0);
+
+	if (size == 0)
+		size = DT_BUFFERED_MINSIZE;
+
+	while (len >= size - dtp->dt_buffered_offs)
+		size <<= 1;
+
+	if ((newbuf = realloc(dtp->dt_buffered_buf, size)) == NULL)
+		return (dt_set_errno(dtp, EDT_NOMEM));
+
+	if (dtp->dt_buffered_buf == NULL) {
+		dtp->dt_buffered_offs = 0;
+		newbuf[0] = '\0';
+	}
+
+	dtp->dt_buffered_buf = newbuf;
+	dtp->dt_buffered_size = size;
+
+	return (0);
+}
+
 /*
  * This function handles all output from libdtrace, as well as the
  * dtrace_sprintf() case.  If we're here due to dtrace_sprintf(), then
@@ -582,12 +618,14 @@ dt_printf(dtrace_hdl_t *dtp, FILE *fp, const char *format, ...)
 
 		assert(dtp->dt_sprintf_buf != NULL);
 
-		buf = &dtp->dt_sprintf_buf[len = strlen(dtp->dt_sprintf_buf)];
-		len = dtp->dt_sprintf_buflen - len;
-		assert(len >= 0);
+		buf = &dtp->dt_sprintf_buf[dtp->dt_sprintf_bufoffs];
+		len = dtp->dt_sprintf_buflen - dtp->dt_sprintf_bufoffs;
+		assert(len > 0);
 
 		if ((n = vsnprintf(buf, len, format, ap)) < 0)
 			n = dt_set_errno(dtp, errno);
+		else
+			dtp->dt_sprintf_bufoffs += MIN(n, len - 1);
 
 		va_end(ap);
 
@@ -595,6 +633,7 @@ dt_printf(dtrace_hdl_t *dtp, FILE *fp, const char *format, ...)
 	}
 
 	if (fp == NULL) {
+		va_list aq;
 		int needed, rval;
 		size_t avail;
 
@@ -607,57 +646,43 @@ dt_printf(dtrace_hdl_t *dtp, FILE *fp, const char *format, ...)
 			return (dt_set_errno(dtp, EDT_NOBUFFERED));
 		}
 
-		if (dtp->dt_buffered_buf == NULL) {
-			assert(dtp->dt_buffered_size == 0);
-			dtp->dt_buffered_size = 1;
-			dtp->dt_buffered_buf = malloc(dtp->dt_buffered_size);
-
-			if (dtp->dt_buffered_buf == NULL) {
-				va_end(ap);
-				return (dt_set_errno(dtp, EDT_NOMEM));
-			}
-
-			dtp->dt_buffered_offs = 0;
-			dtp->dt_buffered_buf[0] = '\0';
-		}
-
-		if ((needed = vsnprintf(NULL, 0, format, ap)) < 0) {
-			rval = dt_set_errno(dtp, errno);
+		if (dt_buffered_reserve(dtp, 0) != 0) {
 			va_end(ap);
-			return (rval);
+			return (-1); /* errno is set for us */
 		}
 
-		if (needed == 0) {
-			va_end(ap);
-			return (0);
-		}
-
-		for (;;) {
-			char *newbuf;
-
-			assert(dtp->dt_buffered_offs < dtp->dt_buffered_size);
-			avail = dtp->dt_buffered_size - dtp->dt_buffered_offs;
-
-			if (needed + 1 < avail)
-				break;
-
-			if ((newbuf = realloc(dtp->dt_buffered_buf,
-			    dtp->dt_buffered_size << 1)) == NULL) {
+		/*
+		 * Format directly into the space that remains in the buffer;
+		 * only if the output doesn't fit do we need to grow the buffer
+		 * and format it a second time.
+		 */
+		avail = dtp->dt_buffered_size - dtp->dt_buffered_offs;
+		va_copy(aq, ap);
+		needed = vsnprintf(&dtp->dt_buffered_buf[dtp->dt_buffered_offs],
+		    avail, format, aq);
+		va_end(aq);
+
+		if (needed >= 0 && (size_t)needed >= avail) {
+			if (dt_buffered_reserve(dtp, needed) != 0) {
 				va_end(ap);
-				return (dt_set_errno(dtp, EDT_NOMEM));
+				return (-1); /* errno is set for us */
 			}
 
-			dtp->dt_buffered_buf = newbuf;
-			dtp->dt_buffered_size <<= 1;
+			needed = vsnprintf(
+			    &dtp->dt_buffered_buf[dtp->dt_buffered_offs],
+			    dtp->dt_buffered_size - dtp->dt_buffered_offs,
+			    format, ap);
 		}
 
-		if (vsnprintf(&dtp->dt_buffered_buf[dtp->dt_buffered_offs],
-		    avail, format, ap) < 0) {
+		if (needed < 0) {
 			rval = dt_set_errno(dtp, errno);
+			dtp->dt_buffered_buf[dtp->dt_buffered_offs] = '\0';
 			va_end(ap);
 			return (rval);
 		}
 
+		va_end(ap);
+
 		dtp->dt_buffered_offs += needed;
 		assert(dtp->dt_buffered_buf[dtp->dt_buffered_offs] == '\0');
 		return (0);
@@ -674,6 +699,131 @@ dt_printf(dtrace_hdl_t *dtp, FILE *fp, const char *format, ...)
 	return (n);
 }
 
+/*
+ * Output the len bytes at s verbatim, with the same return values and
+ * destinations as dt_printf().  This allows the common conversions to be
+ * formatted by the caller and appended without another pass through printf.
+ */
+int
+dt_printf_str(dtrace_hdl_t *dtp, FILE *fp, const char *s, size_t len)
+{
+	if (dtp->dt_sprintf_buflen != 0) {
+		size_t avail;
+		char *buf;
+
+		assert(dtp->dt_sprintf_buf != NULL);
+
+		buf = &dtp->dt_sprintf_buf[dtp->dt_sprintf_bufoffs];
+		avail = dtp->dt_sprintf_buflen - dtp->dt_sprintf_bufoffs - 1;
+
+		bcopy(s, buf, MIN(len, avail));
+		buf[MIN(len, avail)] = '\0';
+		dtp->dt_sprintf_bufoffs += MIN(len, avail);
+
+		return ((int)len);
+	}
+
+	if (fp == NULL) {
+		if (dtp->dt_bufhdlr == NULL)
+			return (dt_set_errno(dtp, EDT_NOBUFFERED));
+
+		if (dt_buffered_reserve(dtp, len) != 0)
+			return (-1); /* errno is set for us */
+
+		bcopy(s, &dtp->dt_buffered_buf[dtp->dt_buffered_offs], len);
+		dtp->dt_buffered_offs += len;
+		dtp->dt_buffered_buf[dtp->dt_buffered_offs] = '\0';
+		return (0);
+	}
+
+	if (len != 0 && fwrite(s, len, 1, fp) != 1) {
+		clearerr(fp);
+		return (dt_set_errno(dtp, errno));
+	}
+
+	return ((int)len);
+}
+
+/*
+ * Format an integer conversion without calling into printf, if format is a
+ * bare integer conversion:  a '%', an optional length modifier and one of the
+ * d, i, u, o, x or X conversions, with no flags, width or precision.  The
+ * value is truncated to the size implied by the length modifier, as printf
+ * would.  Returns the length of the string formatted into buf, which must
+ * have room for DT_FORMAT_INTLEN bytes, or -1 if format is anything else.
+ */
+int
+dt_format_int(char *buf, const char *format, uint64_t val)
+{
+	static const char ldigits[] = "0123456789abcdef";
+	static const char udigits[] = "0123456789ABCDEF";
+	const char *digits = ldigits;
+	char tmp[DT_FORMAT_INTLEN];
+	int bits = 32, base, neg = 0, i = 0, n = 0;
+	const char *f = format;
+
+	if (*f++ != '%')
+		return (-1);
+
+	if (f[0] == 'h') {
+		bits = (f[1] == 'h') ? 8 : 16;
+		f += (f[1] == 'h') ? 2 : 1;
+	} else if (f[0] == 'l' || f[0] == 'j' || f[0] == 'z' || f[0] == 't') {
+		bits = 64;
+		f += (f[0] == 'l' && f[1] == 'l') ? 2 : 1;
+	}
+
+	switch (*f++) {
+	case 'd':
+	case 'i':
+		base = 10;
+		if (bits < 64)
+			val = (uint64_t)((int64_t)(val << (64 - bits)) >>
+			    (64 - bits));
+		if ((int64_t)val < 0) {
+			neg = 1;
+			val = -val;
+		}
+		bits = 64;
+		break;
+	case 'u':
+		base = 10;
+		break;
+	case 'o':
+		base = 8;
+		break;
+	case 'X':
+		digits = udigits;
+		/*FALLTHRU*/
+	case 'x':
+		base = 16;
+		break;
+	default:
+		return (-1);
+	}
+
+	if (*f != '\0')
+		return (-1);
+
+	if (bits < 64)
+		val &= (1ULL << bits) - 1;
+
+	do {
+		tmp[i++] = digits[val % base];
+		val /= base;
+	} while (val != 0);
+
+	if (neg)
+		buf[n++] = '-';
+
+	while (i > 0)
+		buf[n++] = tmp[--i];
+
+	buf[n] = '\0';
+
+	return (n);
+}
+
 int
 dt_buffered_flush(dtrace_hdl_t *dtp, dtrace_probedata_t *pdata,
     const dtrace_recdesc_t *rec, const dtrace_aggdata_t *agg, uint32_t flags)
@@ -823,6 +973,48 @@ dt_popcb(const ulong_t *bp, ulong_t n)
 	return (popc + dt_popc(bp[maxw] & ((1UL << maxb) - 1)));
 }
 
+static uint64_t
+dt_hash64_mix(uint64_t h, uint64_t k)
+{
+	k *= 0x87c37b91114253d5ULL;
+	k = (k << 31) | (k >> 33);
+	k *= 0x4cf5ad432745937fULL;
+
+	h ^= k;
+	h = (h << 27) | (h >> 37);
+
+	return (h * 5 + 0x52dce729);
+}
+
+/*
+ * dt_hash64() returns a 64-bit hash of the 'len' bytes at 'buf'.  The result
+ * depends on the order of the bytes, and the hash may be chained across
+ * discontiguous pieces of data by passing the previous result as 'h'.  The
+ * data is consumed a 64-bit word at a time, using the mixing steps of
+ * MurmurHash3 (which is in the public domain).
+ */
+uint64_t
+dt_hash64(const void *buf, size_t len, uint64_t h)
+{
+	const uint8_t *p = buf;
+	uint64_t k;
+
+	h ^= len * 0x9e3779b97f4a7c15ULL;
+
+	for (; len >= sizeof (k); p += sizeof (k), len -= sizeof (k)) {
+		bcopy(p, &k, sizeof (k));
+		h = dt_hash64_mix(h, k);
+	}
+
+	if (len != 0) {
+		k = 0;
+		bcopy(p, &k, len);
+		h = dt_hash64_mix(h, k);
+	}
+
+	return (h);
+}
+
 struct _rwlock;
 struct _lwp_mutex;
 
@@ -877,37 +1069,29 @@ dt_string2str(char *s, char *str, int nbytes)
 int
 dtrace_addr2str(dtrace_hdl_t *dtp, uint64_t addr, char *str, int nbytes)
 {
-        dtrace_syminfo_t dts;
-        GElf_Sym sym;
-        char aux_symbol_name[32];
-        
+	const dt_ksym_t *dks = dt_module_lookup_ksym(dtp, addr);
 	size_t n = 20; /* for 0x%llx\0 */
 	char *s;
-	int err;
 
-	if ((err = dtrace_lookup_by_addr(dtp, addr, aux_symbol_name, sizeof(aux_symbol_name), &sym, &dts)) == 0)
-		n += strlen(dts.dts_object) + strlen(dts.dts_name) + 2; /* +` */
+	if (dks != NULL) {
+		n += strlen(dks->dks_object) + 2; /* +` */
+		if (dks->dks_flags & DT_KSYM_SYM)
+			n += strlen(dks->dks_name);
+	}
 
 	s = alloca(n);
 
-	if (err == 0 && addr != sym.st_value) {
-		(void) snprintf(s, n, "%s`%s+0x%llx", dts.dts_object,
-		    dts.dts_name, (u_longlong_t)addr - sym.st_value);
-	} else if (err == 0) {
-		(void) snprintf(s, n, "%s`%s",
-		    dts.dts_object, dts.dts_name);
+	if (dks == NULL) {
+		(void) snprintf(s, n, "0x%llx", (u_longlong_t)addr);
+	} else if (!(dks->dks_flags & DT_KSYM_SYM)) {
+		(void) snprintf(s, n, "%s`0x%llx", dks->dks_object,
+		    (u_longlong_t)addr);
+	} else if (addr != dks->dks_sym.st_value) {
+		(void) snprintf(s, n, "%s`%s+0x%llx", dks->dks_object,
+		    dks->dks_name, (u_longlong_t)addr - dks->dks_sym.st_value);
 	} else {
-		/*
-		 * We'll repeat the lookup, but this time we'll specify a NULL
-		 * GElf_Sym -- indicating that we're only interested in the
-		 * containing module.
-		 */
-		if (dtrace_lookup_by_addr(dtp, addr, NULL, 0, NULL, &dts) == 0) {
-			(void) snprintf(s, n, "%s`0x%llx", dts.dts_object,
-			    (u_longlong_t)addr);
-		} else {
-			(void) snprintf(s, n, "0x%llx", (u_longlong_t)addr);
-		}
+		(void) snprintf(s, n, "%s`%s",
+		    dks->dks_object, dks->dks_name);
 	}
 
 	return (dt_string2str(s, str, nbytes));
@@ -917,42 +1101,37 @@ int
 dtrace_uaddr2str(dtrace_hdl_t *dtp, pid_t pid,
     uint64_t addr, char *str, int nbytes)
 {
-	char name[PATH_MAX], objname[PATH_MAX], c[PATH_MAX * 2];
-	struct ps_prochandle *P = NULL;
-	GElf_Sym sym;
+	char c[PATH_MAX * 2];
+	const dt_usym_t *dus = NULL;
 	char *obj;
 
 	if (pid != 0)
-		P = dt_proc_grab(dtp, pid, PGRAB_RDONLY | PGRAB_FORCE, 0);
+		dus = dt_proc_usym_lookup(dtp, pid, addr);
 
-	if (P == NULL) {
+	if (dus == NULL) {
 		(void) snprintf(c, sizeof (c), "0x%llx", addr);
 		return (dt_string2str(c, str, nbytes));
 	}
 
-	dt_proc_lock(dtp, P);
+	if (dus->dus_flags & DT_USYM_SYM) {
+		obj = (dus->dus_flags & DT_USYM_OBJ) ?
+		    dt_basename(dus->dus_objname) : "";
 
-	if (Plookup_by_addr(P, addr, name, sizeof (name), &sym) == 0) {
-		(void) Pobjname(P, addr, objname, sizeof (objname));
-
-		obj = dt_basename(objname);
-
-		if (addr > sym.st_value) {
+		if (addr > dus->dus_sym.st_value) {
 			(void) snprintf(c, sizeof (c), "%s`%s+0x%llx", obj,
-			    name, (u_longlong_t)(addr - sym.st_value));
+			    dus->dus_name,
+			    (u_longlong_t)(addr - dus->dus_sym.st_value));
 		} else {
-			(void) snprintf(c, sizeof (c), "%s`%s", obj, name);
+			(void) snprintf(c, sizeof (c), "%s`%s", obj,
+			    dus->dus_name);
 		}
-	} else if (Pobjname(P, addr, objname, sizeof (objname)) != NULL) {
+	} else if (dus->dus_flags & DT_USYM_OBJ) {
 		(void) snprintf(c, sizeof (c), "%s`0x%llx",
-		    dt_basename(objname), addr);
+		    dt_basename(dus->dus_objname), addr);
 	} else {
 		(void) snprintf(c, sizeof (c), "0x%llx", addr);
 	}
 
-	dt_proc_unlock(dtp, P);
-	dt_proc_release(dtp, P);
-
 	return (dt_string2str(c, str, nbytes));
 }
 
@@ -235,6 +235,8 @@ dtrace_go(dtrace_hdl_t *dtp)
 	if (dt_options_load(dtp) == -1)
 		return (dt_set_errno(dtp, errno));
 
+	dt_map_prefetch(dtp);
+
 	return (dt_aggregate_go(dtp));
 }
 
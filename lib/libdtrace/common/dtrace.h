@@ -426,6 +426,8 @@ extern int dtrace_handle_setopt(dtrace_hdl_t *,
 #define	DTRACE_A_MINMAXBIN	0x0010
 #define	DTRACE_A_HASNEGATIVES	0x0020
 #define	DTRACE_A_HASPOSITIVES	0x0040
+#define	DTRACE_A_TRUNC		0x0080
+#define	DTRACE_A_DELTA		0x0100
 
 #define	DTRACE_AGGZOOM_MAX	0.95  /* height of max bar */
 
@@ -497,6 +499,18 @@ extern int dtrace_aggregate_walk_keyvarrevsorted(dtrace_hdl_t *,
 extern int dtrace_aggregate_walk_valvarrevsorted(dtrace_hdl_t *,
     dtrace_aggregate_f *, void *);
 
+extern int dtrace_aggregate_walk_delta(dtrace_hdl_t *, uint64_t *,
+    dtrace_aggregate_f *, void *);
+
+typedef struct dtrace_aggstat {
+	uint64_t dtas_nentries;			/* number of aggregation keys */
+	uint64_t dtas_nslots;			/* size of consumer hash table */
+	uint64_t dtas_maxprobe;			/* longest hash probe sequence */
+	uint64_t dtas_memsize;			/* bytes held for the entries */
+} dtrace_aggstat_t;
+
+extern int dtrace_aggregate_stat(dtrace_hdl_t *, dtrace_aggstat_t *);
+
 #define	DTRACE_AGD_PRINTED	0x1	/* aggregation printed in program */
 
 /*
@@ -519,6 +533,15 @@ extern const pstatus_t* dtrace_proc_status(dtrace_hdl_t *, struct ps_prochandle
 extern int dtrace_proc_lookup_by_addr(dtrace_hdl_t *, struct ps_prochandle *,
     mach_vm_address_t, char *, size_t, GElf_Sym *, prsyminfo_t *);
 
+typedef struct dtrace_symstat {
+	uint64_t dtss_lookups;			/* user address lookups */
+	uint64_t dtss_hits;			/* lookups satisfied from cache */
+	uint64_t dtss_entries;			/* addresses currently cached */
+	uint64_t dtss_flushes;			/* per-process cache flushes */
+} dtrace_symstat_t;
+
+extern int dtrace_proc_symstat(dtrace_hdl_t *, dtrace_symstat_t *);
+
 /*
  * DTrace Object, Symbol, and Type Interfaces
  *
@@ -66,23 +66,22 @@ dt_pid_create_entry_probe(struct ps_prochandle *P, dtrace_hdl_t *dtp,
 	ftp->ftps_noffs = 1;
 	ftp->ftps_offs[0] = 0;
 
-	if (ioctl(dtp->dt_ftfd, FASTTRAPIOC_MAKEPROBE, ftp) != 0) {
-		dt_dprintf("fasttrap probe creation ioctl failed: %s",
-		    strerror(errno));
-		return (dt_set_errno(dtp, errno));
-	}
+	if (dt_pid_makeprobe(dtp, ftp) != 0)
+		return (-1);
 
 	return (1);
 }
 
+/*
+ * Returns 1 if the function may contain a jump table, 0 if it doesn't, and -1
+ * if it can't be decoded, which callers must also treat as a jump table.
+ */
 static int
-dt_pid_has_jump_table(struct ps_prochandle *P, dtrace_hdl_t *dtp,
-    uint8_t *text, fasttrap_probe_spec_t *ftp, const GElf_Sym *symp)
+dt_pid_has_jump_table(dtrace_hdl_t *dtp, pid_t pid, char dmodel,
+    uint8_t *text, const GElf_Sym *symp)
 {
 	ulong_t i;
 	int size;
-	pid_t pid = Pstatus(P)->pr_pid;
-	char dmodel = Pstatus(P)->pr_dmodel;
 
 	/*
 	 * That's a terrible idea, but users may request to disable jump table
@@ -97,7 +96,7 @@ dt_pid_has_jump_table(struct ps_prochandle *P, dtrace_hdl_t *dtp,
 	 * jmp instruction. This could be a jump table so we have to be
 	 * ultra conservative.
 	 */
-	for (i = 0; i < ftp->ftps_size; i += size) {
+	for (i = 0; i < symp->st_size; i += size) {
 		size = dt_instr_size(&text[i], dtp, pid, symp->st_value + i,
 		    dmodel);
 
@@ -106,7 +105,7 @@ dt_pid_has_jump_table(struct ps_prochandle *P, dtrace_hdl_t *dtp,
 		 */
 		if (size <= 0) {
 			dt_dprintf("error at %#lx (assuming jump table)", i);
-			return (1);
+			return (-1);
 		}
 
 		/*
@@ -117,8 +116,8 @@ dt_pid_has_jump_table(struct ps_prochandle *P, dtrace_hdl_t *dtp,
 		if ((text[i] == 0xff && DT_MODRM_REG(text[i + 1]) == 4) ||
 		    (dmodel == PR_MODEL_LP64 && (text[i] & 0xf0) == 0x40 &&
 		    text[i + 1] == 0xff && DT_MODRM_REG(text[i + 2]) == 4)) {
-			dt_dprintf("found a suspected jump table at %s:%lx",
-			    ftp->ftps_func, i);
+			dt_dprintf("found a suspected jump table at %llx+%lx",
+			    (u_longlong_t)symp->st_value, i);
 			return (1);
 		}
 	}
@@ -126,37 +125,12 @@ dt_pid_has_jump_table(struct ps_prochandle *P, dtrace_hdl_t *dtp,
 	return (0);
 }
 
-/*ARGSUSED*/
-int
-dt_pid_create_return_probe(struct ps_prochandle *P, dtrace_hdl_t *dtp,
-    fasttrap_probe_spec_t *ftp, const GElf_Sym *symp, uint64_t *stret)
+static int
+dt_pid_return_sites(dtrace_hdl_t *dtp, pid_t pid, char dmodel, uint8_t *text,
+    const GElf_Sym *symp, fasttrap_probe_spec_t *ftp)
 {
-#pragma unused(stret)
-	uint8_t *text;
 	ulong_t i, end;
-	int size;
-	pid_t pid = Pstatus(P)->pr_pid;
-	char dmodel = Pstatus(P)->pr_dmodel;
-
-	/*
-	 * We allocate a few extra bytes at the end so we don't have to check
-	 * for overrunning the buffer.
-	 */
-	if ((text = calloc(1, symp->st_size + 4)) == NULL) {
-		dt_dprintf("mr sparkle: malloc() failed");
-		return (DT_PROC_ERR);
-	}
-
-	if (Pread(P, text, symp->st_size, symp->st_value) != symp->st_size) {
-		dt_dprintf("mr sparkle: Pread() failed");
-		free(text);
-		return (DT_PROC_ERR);
-	}
-
-	ftp->ftps_probe_type = DTFTP_RETURN;
-	ftp->ftps_pc = symp->st_value;
-	ftp->ftps_size = (size_t)symp->st_size;
-	ftp->ftps_noffs = 0;
+	int size, jt;
 
 	/*
 	 * If there's a jump table in the function we're only willing to
@@ -171,14 +145,14 @@ dt_pid_create_return_probe(struct ps_prochandle *P, dtrace_hdl_t *dtp,
 	 * We do this to avoid accidentally interpreting jump table
 	 * offsets as actual instructions.
 	 */
-	if (dt_pid_has_jump_table(P, dtp, text, ftp, symp)) {
-		for (i = 0, end = ftp->ftps_size; i < end; i += size) {
+	if ((jt = dt_pid_has_jump_table(dtp, pid, dmodel, text, symp)) != 0) {
+		for (i = 0, end = symp->st_size; i < end; i += size) {
 			size = dt_instr_size(&text[i], dtp, pid,
 			    symp->st_value + i, dmodel);
 
 			/* bail if we hit an invalid opcode */
 			if (size <= 0)
-				break;
+				return (-1);
 
 			if (text[i] == DT_LEAVE && text[i + 1] == DT_RET) {
 				dt_dprintf("leave/ret at %lx", i + 1);
@@ -204,68 +178,129 @@ dt_pid_create_return_probe(struct ps_prochandle *P, dtrace_hdl_t *dtp,
 				size = 5;
 			}
 		}
-	} else {
-		for (i = 0, end = ftp->ftps_size; i < end; i += size) {
-			size = dt_instr_size(&text[i], dtp, pid,
-			    symp->st_value + i, dmodel);
 
-			/* bail if we hit an invalid opcode */
-			if (size <= 0)
-				break;
+		return (jt < 0 ? -1 : ftp->ftps_noffs);
+	}
+
+	for (i = 0, end = symp->st_size; i < end; i += size) {
+		size = dt_instr_size(&text[i], dtp, pid, symp->st_value + i,
+		    dmodel);
 
-			/* ordinary ret */
-			if (size == 1 && text[i] == DT_RET)
-				goto is_ret;
-
-			/* two-byte ret */
-			if (size == 2 && text[i] == DT_REP &&
-			    text[i + 1] == DT_RET)
-				goto is_ret;
-
-			/* ret <imm16> */
-			if (size == 3 && text[i] == DT_RET16)
-				goto is_ret;
-
-			/* two-byte ret <imm16> */
-			if (size == 4 && text[i] == DT_REP &&
-			    text[i + 1] == DT_RET16)
-				goto is_ret;
-
-			/* 32-bit displacement jmp outside of the function */
-			if (size == 5 && text[i] == DT_JMP32 && symp->st_size <=
-			    (uintptr_t)(i + size + *(int32_t *)&text[i + 1]))
-				goto is_ret;
-
-			/* 8-bit displacement jmp outside of the function */
-			if (size == 2 && text[i] == DT_JMP8 && symp->st_size <=
-			    (uintptr_t)(i + size + *(int8_t *)&text[i + 1]))
-				goto is_ret;
-
-			/* 32-bit disp. conditional jmp outside of the func. */
-			if (size == 6 && DT_ISJ32(*(uint16_t *)&text[i]) &&
-			    symp->st_size <=
-			    (uintptr_t)(i + size + *(int32_t *)&text[i + 2]))
-				goto is_ret;
-
-			/* 8-bit disp. conditional jmp outside of the func. */
-			if (size == 2 && DT_ISJ8(text[i]) && symp->st_size <=
-			    (uintptr_t)(i + size + *(int8_t *)&text[i + 1]))
-				goto is_ret;
-
-			continue;
+		/* bail if we hit an invalid opcode */
+		if (size <= 0)
+			return (-1);
+
+		/* ordinary ret */
+		if (size == 1 && text[i] == DT_RET)
+			goto is_ret;
+
+		/* two-byte ret */
+		if (size == 2 && text[i] == DT_REP && text[i + 1] == DT_RET)
+			goto is_ret;
+
+		/* ret <imm16> */
+		if (size == 3 && text[i] == DT_RET16)
+			goto is_ret;
+
+		/* two-byte ret <imm16> */
+		if (size == 4 && text[i] == DT_REP && text[i + 1] == DT_RET16)
+			goto is_ret;
+
+		/* 32-bit displacement jmp outside of the function */
+		if (size == 5 && text[i] == DT_JMP32 && symp->st_size <=
+		    (uintptr_t)(i + size + *(int32_t *)&text[i + 1]))
+			goto is_ret;
+
+		/* 8-bit displacement jmp outside of the function */
+		if (size == 2 && text[i] == DT_JMP8 && symp->st_size <=
+		    (uintptr_t)(i + size + *(int8_t *)&text[i + 1]))
+			goto is_ret;
+
+		/* 32-bit disp. conditional jmp outside of the func. */
+		if (size == 6 && DT_ISJ32(*(uint16_t *)&text[i]) &&
+		    symp->st_size <=
+		    (uintptr_t)(i + size + *(int32_t *)&text[i + 2]))
+			goto is_ret;
+
+		/* 8-bit disp. conditional jmp outside of the func. */
+		if (size == 2 && DT_ISJ8(text[i]) && symp->st_size <=
+		    (uintptr_t)(i + size + *(int8_t *)&text[i + 1]))
+			goto is_ret;
+
+		continue;
 is_ret:
-			dt_dprintf("return at offset %lx", i);
-			ftp->ftps_offs[ftp->ftps_noffs++] = i;
-		}
+		dt_dprintf("return at offset %lx", i);
+		ftp->ftps_offs[ftp->ftps_noffs++] = i;
 	}
 
-	free(text);
+	return (ftp->ftps_noffs);
+}
+
+static int
+dt_pid_offset_sites(dtrace_hdl_t *dtp, pid_t pid, char dmodel, uint8_t *text,
+    const GElf_Sym *symp, fasttrap_probe_spec_t *ftp)
+{
+	ulong_t i, end;
+	int size, jt;
+
+	/*
+	 * We can't instrument offsets in functions with jump tables as
+	 * we might interpret a jump table offset as an instruction.
+	 */
+	if ((jt = dt_pid_has_jump_table(dtp, pid, dmodel, text, symp)) != 0)
+		return (jt < 0 ? -1 : 0);
+
+	for (i = 0, end = symp->st_size; i < end; i += size) {
+		ftp->ftps_offs[ftp->ftps_noffs++] = i;
+
+		size = dt_instr_size(&text[i], dtp, pid, symp->st_value + i,
+		    dmodel);
+
+		/* bail if we hit an invalid opcode */
+		if (size <= 0)
+			return (-1);
+	}
+
+	return (ftp->ftps_noffs);
+}
+
+/*
+ * Decode the text of the function symp, storing in ftp the offsets of its
+ * return sites (DTFTP_RETURN) or of each of its instructions (DTFTP_OFFSETS).
+ * Functions that may contain jump tables have no instruction offsets.  Returns
+ * the number of offsets found, or -1 if decoding stopped at an instruction
+ * that couldn't be decoded; ftp then holds the offsets found before it, which
+ * depend on the state of the process and mustn't be reused for another one.
+ */
+int
+dt_pid_decode_sites(dtrace_hdl_t *dtp, pid_t pid, char dmodel, uint8_t *text,
+    const GElf_Sym *symp, int type, fasttrap_probe_spec_t *ftp)
+{
+	ftp->ftps_noffs = 0;
+
+	if (type == DTFTP_RETURN)
+		return (dt_pid_return_sites(dtp, pid, dmodel, text, symp, ftp));
+
+	return (dt_pid_offset_sites(dtp, pid, dmodel, text, symp, ftp));
+}
+
+/*ARGSUSED*/
+int
+dt_pid_create_return_probe(struct ps_prochandle *P, dtrace_hdl_t *dtp,
+    fasttrap_probe_spec_t *ftp, const GElf_Sym *symp, uint64_t *stret)
+{
+#pragma unused(stret)
+	ftp->ftps_probe_type = DTFTP_RETURN;
+	ftp->ftps_pc = symp->st_value;
+	ftp->ftps_size = (size_t)symp->st_size;
+	ftp->ftps_noffs = 0;
+
+	if (dt_pid_find_sites(P, dtp, ftp, symp, DTFTP_RETURN) != 0)
+		return (DT_PROC_ERR);
+
 	if (ftp->ftps_noffs > 0) {
-		if (ioctl(dtp->dt_ftfd, FASTTRAPIOC_MAKEPROBE, ftp) != 0) {
-			dt_dprintf("fasttrap probe creation ioctl failed: %s",
-			    strerror(errno));
-			return (dt_set_errno(dtp, errno));
-		}
+		if (dt_pid_makeprobe(dtp, ftp) != 0)
+			return (-1);
 	}
 
 	return (ftp->ftps_noffs);
@@ -284,72 +319,36 @@ dt_pid_create_offset_probe(struct ps_prochandle *P, dtrace_hdl_t *dtp,
 	if (strcmp("-", ftp->ftps_func) == 0) {
 		ftp->ftps_offs[0] = off;
 	} else {
-		uint8_t *text;
-		ulong_t i;
-		int size;
-		pid_t pid = Pstatus(P)->pr_pid;
-		char dmodel = Pstatus(P)->pr_dmodel;
-
-		if ((text = malloc(symp->st_size)) == NULL) {
-			dt_dprintf("mr sparkle: malloc() failed");
-			return (DT_PROC_ERR);
-		}
+		uint_t i;
 
-		if (Pread(P, text, symp->st_size, symp->st_value) !=
-		    symp->st_size) {
-			dt_dprintf("mr sparkle: Pread() failed");
-			free(text);
+		if (dt_pid_find_sites(P, dtp, ftp, symp, DTFTP_OFFSETS) != 0)
 			return (DT_PROC_ERR);
-		}
 
 		/*
 		 * We can't instrument offsets in functions with jump tables
 		 * as we might interpret a jump table offset as an
-		 * instruction.
+		 * instruction; such functions have no instruction offsets.
+		 * Otherwise, the given offset must lie on an instruction
+		 * boundary.
 		 */
-		if (dt_pid_has_jump_table(P, dtp, text, ftp, symp)) {
-			free(text);
+		if (ftp->ftps_noffs == 0)
 			return (0);
-		}
 
-		for (i = 0; i < symp->st_size; i += size) {
-			if (i == off) {
-				ftp->ftps_offs[0] = i;
+		for (i = 0; i < ftp->ftps_noffs; i++) {
+			if (ftp->ftps_offs[i] == off)
 				break;
-			}
-
-			/*
-			 * If we've passed the desired offset without a
-			 * match, then the given offset must not lie on a
-			 * instruction boundary.
-			 */
-			if (i > off) {
-				free(text);
-				return (DT_PROC_ALIGN);
-			}
-
-			size = dt_instr_size(&text[i], dtp, pid,
-			    symp->st_value + i, dmodel);
-
-			/*
-			 * If we hit an invalid instruction, bail as if we
-			 * couldn't find the offset.
-			 */
-			if (size <= 0) {
-				free(text);
-				return (DT_PROC_ALIGN);
-			}
 		}
 
-		free(text);
-	}
+		if (i == ftp->ftps_noffs)
+			return (DT_PROC_ALIGN);
 
-	if (ioctl(dtp->dt_ftfd, FASTTRAPIOC_MAKEPROBE, ftp) != 0) {
-		dt_dprintf("fasttrap probe creation ioctl failed: %s",
-		    strerror(errno));
-		return (dt_set_errno(dtp, errno));
+		ftp->ftps_offs[0] = off;
+		ftp->ftps_noffs = 1;
 	}
 
+	if (dt_pid_makeprobe(dtp, ftp) != 0)
+		return (-1);
+
 	return (ftp->ftps_noffs);
 }
 
@@ -358,74 +357,33 @@ int
 dt_pid_create_glob_offset_probes(struct ps_prochandle *P, dtrace_hdl_t *dtp,
     fasttrap_probe_spec_t *ftp, const GElf_Sym *symp, const char *pattern)
 {
-	uint8_t *text;
-	ulong_t i, end;
-	int size;
-	pid_t pid = Pstatus(P)->pr_pid;
-	char dmodel = Pstatus(P)->pr_dmodel;
-
-	if ((text = malloc(symp->st_size)) == NULL) {
-		dt_dprintf("mr sparkle: malloc() faile");
-		return (DT_PROC_ERR);
-	}
-
-	if (Pread(P, text, symp->st_size, symp->st_value) != symp->st_size) {
-		dt_dprintf("mr sparkle: Pread() failed");
-		free(text);
-		return (DT_PROC_ERR);
-	}
-
-	/*
-	 * We can't instrument offsets in functions with jump tables as
-	 * we might interpret a jump table offset as an instruction.
-	 */
-	if (dt_pid_has_jump_table(P, dtp, text, ftp, symp)) {
-		free(text);
-		return (0);
-	}
+	ulong_t i;
+	uint_t n;
 
 	ftp->ftps_probe_type = DTFTP_OFFSETS;
 	ftp->ftps_pc = symp->st_value;
 	ftp->ftps_size = (size_t)symp->st_size;
 	ftp->ftps_noffs = 0;
 
-	end = ftp->ftps_size;
-
-	if (strcmp("*", pattern) == 0) {
-		for (i = 0; i < end; i += size) {
-			ftp->ftps_offs[ftp->ftps_noffs++] = i;
-
-			size = dt_instr_size(&text[i], dtp, pid,
-			    symp->st_value + i, dmodel);
+	if (dt_pid_find_sites(P, dtp, ftp, symp, DTFTP_OFFSETS) != 0)
+		return (DT_PROC_ERR);
 
-			/* bail if we hit an invalid opcode */
-			if (size <= 0)
-				break;
-		}
-	} else {
+	if (strcmp("*", pattern) != 0) {
 		char name[sizeof (i) * 2 + 1];
 
-		for (i = 0; i < end; i += size) {
-			(void) snprintf(name, sizeof (name), "%lx", i);
+		for (n = 0, i = 0; i < ftp->ftps_noffs; i++) {
+			(void) snprintf(name, sizeof (name), "%lx",
+			    (ulong_t)ftp->ftps_offs[i]);
 			if (gmatch(name, pattern))
-				ftp->ftps_offs[ftp->ftps_noffs++] = i;
-
-			size = dt_instr_size(&text[i], dtp, pid,
-			    symp->st_value + i, dmodel);
-
-			/* bail if we hit an invalid opcode */
-			if (size <= 0)
-				break;
+				ftp->ftps_offs[n++] = ftp->ftps_offs[i];
 		}
+
+		ftp->ftps_noffs = n;
 	}
 
-	free(text);
 	if (ftp->ftps_noffs > 0) {
-		if (ioctl(dtp->dt_ftfd, FASTTRAPIOC_MAKEPROBE, ftp) != 0) {
-			dt_dprintf("fasttrap probe creation ioctl failed: %s",
-			    strerror(errno));
-			return (dt_set_errno(dtp, errno));
-		}
+		if (dt_pid_makeprobe(dtp, ftp) != 0)
+			return (-1);
 	}
 
 	return (ftp->ftps_noffs);
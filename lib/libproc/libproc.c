@@ -196,12 +196,15 @@ static struct ps_prochandle* createProcAndSymbolicator(pid_t pid, task_t task, i
 				
 			case kCSNotificationDyldLoad:
 				os_log(proc_log, "pid %d: kCSNotificationDyldLoad %s", CSSymbolicatorGetPid(data.symbolicator), CSSymbolOwnerGetPath(data.u.dyldLoad.symbolOwner));
+				// Counted for every handle, see Pmapgen().
+				__atomic_add_fetch(&proc->map_generation, 1, __ATOMIC_RELEASE);
 				if (should_queue_proc_activity_notices)
 					Pcreate_sync_proc_activity(proc, RD_DLACTIVITY);
 				break;
 				
 			case kCSNotificationDyldUnload:
 				os_log(proc_log, "pid %d: kCSNotificationDyldUnload %s", CSSymbolicatorGetPid(data.symbolicator), CSSymbolOwnerGetPath(data.u.dyldLoad.symbolOwner));
+				__atomic_add_fetch(&proc->map_generation, 1, __ATOMIC_RELEASE);
 				break;
 				
 			case kCSNotificationTimeout:
@@ -928,6 +931,29 @@ char
 	return NULL;
 }
 
+/*
+ * Given a virtual address, return the UUID and base address of the underlying
+ * mapped object.  Return -1 on failure (no underlying object, or an object
+ * without a UUID).
+ */
+int
+Pobjuuid(struct ps_prochandle *P, mach_vm_address_t addr, uuid_t uuid,
+    mach_vm_address_t *basep)
+{
+#if DTRACE_USE_CORESYMBOLICATION
+	CSSymbolOwnerRef owner = CSSymbolicatorGetSymbolOwnerWithAddressAtTime(P->symbolicator, addr, kCSNow);
+	const CFUUIDBytes *bytes;
+
+	if (!CSIsNull(owner) &&
+	    (bytes = CSSymbolOwnerGetCFUUIDBytes(owner)) != NULL) {
+		memcpy(uuid, bytes, sizeof (uuid_t));
+		*basep = CSSymbolOwnerGetBaseAddress(owner);
+		return 0;
+	}
+#endif /* DTRACE_USE_CORESYMBOLICATION */
+	return -1;
+}
+
 /*
  * Given a virtual address, return the link map id of the underlying mapped
  * object (file), as provided by the dynamic linker.  Return -1 on failure.
@@ -1129,6 +1155,18 @@ void Pupdate_syms(struct ps_prochandle *P) {
 #pragma unused(P)
 }
 
+//
+// Returns a count of the images loaded and unloaded by the process since it
+// was grabbed. It is maintained by the symbolicator for every handle, whether
+// or not anyone waits for the process's dyld activity, so that callers can tell
+// that the mappings changed without a control thread.
+//
+uint32_t
+Pmapgen(struct ps_prochandle *P)
+{
+	return __atomic_load_n(&P->map_generation, __ATOMIC_ACQUIRE);
+}
+
 /*
  * Given an address, Ppltdest() determines if this is part of a PLT, and if
  * so returns a pointer to the symbol name that will be used for resolution.
@@ -32,6 +32,7 @@
 #include <sys/bitmap.h>
 #include <dlfcn.h>
 #include <gelf.h>
+#include <uuid/uuid.h>
 
 #include "procfs.h"
 
@@ -155,10 +156,18 @@ extern const prmap_t *Pname_to_map(struct ps_prochandle *, const char *, prmap_t
 extern const prmap_t *Plmid_to_map(struct ps_prochandle *, Lmid_t, const char *, prmap_t*);
 
 extern char *Pobjname(struct ps_prochandle *, mach_vm_address_t, char *, size_t);
+extern int Pobjuuid(struct ps_prochandle *, mach_vm_address_t, uuid_t,
+    mach_vm_address_t *);
 extern int Plmid(struct ps_prochandle *, mach_vm_address_t, Lmid_t *);
 
 extern void Pcheckpoint_syms(struct ps_prochandle *);
 
+/*
+ * Apple only: count of the images loaded and unloaded since the process was
+ * grabbed, maintained for read-only handles as well.
+ */
+extern uint32_t Pmapgen(struct ps_prochandle *);
+
 /*
  * Apple only objc iteration interface
  */
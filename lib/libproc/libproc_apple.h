@@ -57,6 +57,7 @@ struct ps_prochandle {
 	CSSymbolicatorRef symbolicator;
 #endif /* DTRACE_USE_CORESYMBOLICATION */
 	uint32_t current_symbol_owner_generation;
+	uint32_t map_generation;	/* bumped on every dyld load/unload */
 	rd_event_msg_t rd_event;
 	struct ps_proc_activity_event* proc_activity_queue;
 	uint32_t proc_activity_queue_enabled;
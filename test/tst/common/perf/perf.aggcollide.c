@@ -0,0 +1,129 @@
+/*
+ * Aggregates on user stacks that are permutations of the same frames.  Every
+ * such key holds the same bytes in a different order, which is the worst case
+ * for a hash that is insensitive to byte order.  Checks that the consumer hash
+ * probe sequences stay short, and measures the cost of snapshotting.
+ */
+#include <darwintest.h>
+#include <darwintest_perf.h>
+#include <unistd.h>
+#include <dtrace.h>
+
+T_GLOBAL_META(T_META_NAMESPACE("dtrace.aggcollide"));
+
+#define	NFUNCS		8		/* 8! = 40320 distinct stacks */
+#define	MAXPROBE	128
+
+typedef int func_t(int, const int *);
+
+static func_t f0, f1, f2, f3, f4, f5, f6, f7;
+static func_t *funcs[NFUNCS] = { f0, f1, f2, f3, f4, f5, f6, f7 };
+
+/*
+ * The functions are distinct, but each calls the next one in the order from
+ * its single call site.  Every stack thus holds the same return addresses,
+ * one into each function, and stacks only differ in the order of them.
+ */
+#define	FUNC(name)							\
+static __attribute__((noinline)) int					\
+name(int depth, const int *order)					\
+{									\
+	int rval;							\
+									\
+	if (depth == NFUNCS)						\
+		rval = getppid();					\
+	else								\
+		rval = funcs[order[depth]](depth + 1, order);		\
+									\
+	__asm__ volatile("");						\
+	return (rval + 1);						\
+}
+
+FUNC(f0)
+FUNC(f1)
+FUNC(f2)
+FUNC(f3)
+FUNC(f4)
+FUNC(f5)
+FUNC(f6)
+FUNC(f7)
+
+static int
+permute(int *order, int n)
+{
+	int nperms = 0, i, t;
+
+	if (n == 1) {
+		(void) funcs[order[0]](1, order);
+		return (1);
+	}
+
+	for (i = 0; i < n; i++) {
+		nperms += permute(order, n - 1);
+		t = order[(n % 2) ? 0 : i];
+		order[(n % 2) ? 0 : i] = order[n - 1];
+		order[n - 1] = t;
+	}
+
+	return (nperms);
+}
+
+T_DECL(aggcollide_ustack, "aggregation on permuted ustack() keys",
+    T_META_CHECK_LEAKS(false))
+{
+	char str[256];
+	int err, i, nperms, order[NFUNCS];
+	dtrace_hdl_t *dtp;
+	dtrace_prog_t *prog;
+	dtrace_proginfo_t info;
+	dtrace_aggstat_t stat;
+	dt_stat_time_t s;
+
+	T_SETUPBEGIN;
+	dtp = dtrace_open(DTRACE_VERSION, 0, &err);
+	T_ASSERT_NOTNULL(dtp, "dtrace_open");
+
+	T_QUIET; T_ASSERT_EQ(dtrace_setopt(dtp, "aggsize", "64m"), 0, "aggsize");
+	T_QUIET; T_ASSERT_EQ(dtrace_setopt(dtp, "aggrate", "0"), 0, "aggrate");
+
+	snprintf(str, sizeof(str),
+	    "syscall::getppid:entry /pid == %d/ { @[ustack(%d)] = count(); }",
+	    getpid(), NFUNCS + 1);
+
+	prog = dtrace_program_strcompile(dtp, str, DTRACE_PROBESPEC_NAME, 0, 0, NULL);
+	T_ASSERT_NOTNULL(prog, "dtrace_program_strcompile");
+	T_ASSERT_EQ(dtrace_program_exec(dtp, prog, &info), 0, "dtrace_program_exec");
+	T_ASSERT_EQ(dtrace_go(dtp), 0, "dtrace_go");
+
+	for (i = 0; i < NFUNCS; i++)
+		order[i] = i;
+
+	nperms = permute(order, NFUNCS);
+	T_SETUPEND;
+
+	T_ASSERT_EQ(dtrace_aggregate_snap(dtp), 0, "dtrace_aggregate_snap");
+	T_ASSERT_EQ(dtrace_aggregate_stat(dtp, &stat), 0, "dtrace_aggregate_stat");
+
+	T_LOG("%llu keys in %llu slots, longest probe %llu",
+	    stat.dtas_nentries, stat.dtas_nslots, stat.dtas_maxprobe);
+
+	T_EXPECT_EQ(stat.dtas_nentries, (uint64_t)nperms, "one key per stack");
+	T_EXPECT_LE(stat.dtas_maxprobe, (uint64_t)MAXPROBE,
+	    "hash probe sequences are bounded");
+
+	/*
+	 * Each snapshot switches the kernel aggregation buffer, so generate
+	 * every stack again before each snapshot we measure.
+	 */
+	s = dt_stat_time_create("snapshot");
+	while (!dt_stat_stable(s)) {
+		(void) permute(order, NFUNCS);
+		T_STAT_MEASURE(s) {
+			(void) dtrace_aggregate_snap(dtp);
+		}
+	}
+	dt_stat_finalize(s);
+
+	(void) dtrace_stop(dtp);
+	dtrace_close(dtp);
+}
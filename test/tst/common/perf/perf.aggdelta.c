@@ -0,0 +1,183 @@
+/*
+ * Compares walking every entry of a large aggregation with walking only the
+ * entries that changed in the last snapshot, and checks that printa() of
+ * several aggregations in delta mode only prints the rows that changed.
+ */
+#include <darwintest.h>
+#include <darwintest_perf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <dtrace.h>
+
+T_GLOBAL_META(T_META_NAMESPACE("dtrace.aggdelta"));
+
+#define	NKEYS		100000
+#define	NCHANGED	10
+
+static int
+aggdelta_count(const dtrace_aggdata_t *agg, void *arg)
+{
+#pragma unused(agg)
+	(*(int *)arg)++;
+	return (DTRACE_AGGWALK_NEXT);
+}
+
+T_DECL(aggdelta, "aggregation walk of changed entries", T_META_CHECK_LEAKS(false))
+{
+	char str[256];
+	int err, i, n;
+	uint64_t gen = 0, lastgen;
+	dtrace_hdl_t *dtp;
+	dtrace_prog_t *prog;
+	dtrace_proginfo_t info;
+	dt_stat_time_t s;
+
+	T_SETUPBEGIN;
+	dtp = dtrace_open(DTRACE_VERSION, 0, &err);
+	T_ASSERT_NOTNULL(dtp, "dtrace_open");
+
+	T_QUIET; T_ASSERT_EQ(dtrace_setopt(dtp, "aggsize", "64m"), 0, "aggsize");
+	T_QUIET; T_ASSERT_EQ(dtrace_setopt(dtp, "aggrate", "0"), 0, "aggrate");
+
+	/*
+	 * getpgid() fires its probe whether or not the argument names a
+	 * process, so its argument makes a convenient aggregation key.
+	 */
+	snprintf(str, sizeof(str),
+	    "syscall::getpgid:entry /pid == %d/ { @[arg0] = count(); }", getpid());
+
+	prog = dtrace_program_strcompile(dtp, str, DTRACE_PROBESPEC_NAME, 0, 0, NULL);
+	T_ASSERT_NOTNULL(prog, "dtrace_program_strcompile");
+	T_ASSERT_EQ(dtrace_program_exec(dtp, prog, &info), 0, "dtrace_program_exec");
+	T_ASSERT_EQ(dtrace_go(dtp), 0, "dtrace_go");
+
+	for (i = 0; i < NKEYS; i++)
+		(void) getpgid(i);
+	T_SETUPEND;
+
+	T_ASSERT_EQ(dtrace_aggregate_snap(dtp), 0, "dtrace_aggregate_snap");
+
+	n = 0;
+	T_ASSERT_EQ(dtrace_aggregate_walk_delta(dtp, &gen, aggdelta_count, &n),
+	    0, "dtrace_aggregate_walk_delta");
+	T_EXPECT_EQ(n, NKEYS, "first delta walk visits every key");
+
+	for (i = 0; i < NCHANGED; i++)
+		(void) getpgid(i);
+
+	T_ASSERT_EQ(dtrace_aggregate_snap(dtp), 0, "dtrace_aggregate_snap");
+
+	n = 0;
+	lastgen = gen;
+	T_ASSERT_EQ(dtrace_aggregate_walk_delta(dtp, &gen, aggdelta_count, &n),
+	    0, "dtrace_aggregate_walk_delta");
+	T_EXPECT_EQ(n, NCHANGED, "second delta walk visits only changed keys");
+
+	s = dt_stat_time_create("walk");
+	T_STAT_MEASURE_LOOP(s) {
+		n = 0;
+		(void) dtrace_aggregate_walk(dtp, aggdelta_count, &n);
+	}
+	dt_stat_finalize(s);
+
+	s = dt_stat_time_create("delta");
+	T_STAT_MEASURE_LOOP(s) {
+		uint64_t g = lastgen;
+
+		n = 0;
+		(void) dtrace_aggregate_walk_delta(dtp, &g, aggdelta_count, &n);
+	}
+	dt_stat_finalize(s);
+
+	(void) dtrace_stop(dtp);
+	dtrace_close(dtp);
+}
+
+static int
+aggdelta_probe(const dtrace_probedata_t *data, void *arg)
+{
+#pragma unused(data, arg)
+	return (DTRACE_CONSUME_THIS);
+}
+
+static int
+aggdelta_rec(const dtrace_probedata_t *data, const dtrace_recdesc_t *rec,
+    void *arg)
+{
+#pragma unused(data, rec, arg)
+	return (DTRACE_CONSUME_THIS);
+}
+
+/*
+ * Snapshot the aggregations, have the probe that calls printa() fire, and
+ * return the number of rows that it printed.
+ */
+static int
+aggdelta_printa(dtrace_hdl_t *dtp)
+{
+	char *buf = NULL, *p;
+	size_t len = 0;
+	FILE *fp;
+	int n = 0;
+
+	fp = open_memstream(&buf, &len);
+	T_QUIET; T_ASSERT_NOTNULL(fp, "open_memstream");
+
+	T_QUIET; T_ASSERT_EQ(dtrace_aggregate_snap(dtp), 0, "dtrace_aggregate_snap");
+	(void) getppid();
+	T_QUIET; T_ASSERT_NE(dtrace_consume(dtp, fp, aggdelta_probe,
+	    aggdelta_rec, NULL), -1, "dtrace_consume");
+	(void) fclose(fp);
+
+	for (p = buf; p != NULL && *p != '\0'; p++) {
+		if (*p != '\n' && (p == buf || p[-1] == '\n'))
+			n++;
+	}
+
+	free(buf);
+	return (n);
+}
+
+T_DECL(aggdelta_joined, "printa() of several aggregations in delta mode", T_META_CHECK_LEAKS(false))
+{
+	char str[512];
+	int err, i;
+	dtrace_hdl_t *dtp;
+	dtrace_prog_t *prog;
+	dtrace_proginfo_t info;
+
+	T_SETUPBEGIN;
+	dtp = dtrace_open(DTRACE_VERSION, 0, &err);
+	T_ASSERT_NOTNULL(dtp, "dtrace_open");
+
+	T_QUIET; T_ASSERT_EQ(dtrace_setopt(dtp, "aggrate", "0"), 0, "aggrate");
+	T_QUIET; T_ASSERT_EQ(dtrace_setopt(dtp, "switchrate", "0"), 0, "switchrate");
+	T_QUIET; T_ASSERT_EQ(dtrace_setopt(dtp, "quiet", NULL), 0, "quiet");
+	T_QUIET; T_ASSERT_EQ(dtrace_setopt(dtp, "aggdelta", NULL), 0, "aggdelta");
+
+	snprintf(str, sizeof(str),
+	    "syscall::getpgid:entry /pid == %d/ "
+	    "{ @a[arg0] = count(); @b[arg0] = sum(arg0); }"
+	    "syscall::getppid:entry /pid == %d/ "
+	    "{ printa(\"%%d %%@d %%@d\\n\", @a, @b); }", getpid(), getpid());
+
+	prog = dtrace_program_strcompile(dtp, str, DTRACE_PROBESPEC_NAME, 0, 0, NULL);
+	T_ASSERT_NOTNULL(prog, "dtrace_program_strcompile");
+	T_ASSERT_EQ(dtrace_program_exec(dtp, prog, &info), 0, "dtrace_program_exec");
+	T_ASSERT_EQ(dtrace_go(dtp), 0, "dtrace_go");
+	T_SETUPEND;
+
+	for (i = 0; i < NCHANGED; i++)
+		(void) getpgid(i);
+
+	T_EXPECT_EQ(aggdelta_printa(dtp), NCHANGED, "first printa() prints every key");
+
+	(void) getpgid(1);
+
+	T_EXPECT_EQ(aggdelta_printa(dtp), 1, "second printa() prints the changed key");
+	T_EXPECT_EQ(aggdelta_printa(dtp), 0, "third printa() prints nothing");
+
+	(void) dtrace_stop(dtp);
+	dtrace_close(dtp);
+}
@@ -0,0 +1,122 @@
+/*
+ * Measures the cost of an aggregation snapshot as a function of the number
+ * of distinct keys in the aggregation.
+ */
+#include <darwintest.h>
+#include <darwintest_perf.h>
+#include <unistd.h>
+#include <dtrace.h>
+
+T_GLOBAL_META(T_META_NAMESPACE("dtrace.aggsnap"));
+
+static dtrace_hdl_t	*g_dtp;
+
+/*
+ * Enable an aggregation keyed on a counter that wraps around at nkeys, so
+ * that every nkeys firings of the probe record nkeys distinct keys, and the
+ * same keys every time.
+ */
+static void
+aggsnap_setup(int nkeys)
+{
+	char str[256];
+	int err;
+	dtrace_prog_t *prog;
+	dtrace_proginfo_t info;
+
+	T_SETUPBEGIN;
+	g_dtp = dtrace_open(DTRACE_VERSION, 0, &err);
+	T_ASSERT_NOTNULL(g_dtp, "dtrace_open");
+
+	T_QUIET; T_ASSERT_EQ(dtrace_setopt(g_dtp, "aggsize", "128m"), 0, "aggsize");
+	T_QUIET; T_ASSERT_EQ(dtrace_setopt(g_dtp, "aggrate", "0"), 0, "aggrate");
+
+	snprintf(str, sizeof(str),
+	    "syscall::getppid:entry /pid == %d/ { @[k++ %% %d] = count(); }",
+	    getpid(), nkeys);
+
+	prog = dtrace_program_strcompile(g_dtp, str, DTRACE_PROBESPEC_NAME, 0, 0, NULL);
+	T_ASSERT_NOTNULL(prog, "dtrace_program_strcompile");
+	T_ASSERT_EQ(dtrace_program_exec(g_dtp, prog, &info), 0, "dtrace_program_exec");
+	T_ASSERT_EQ(dtrace_go(g_dtp), 0, "dtrace_go");
+	T_SETUPEND;
+}
+
+/*
+ * Each snapshot switches the kernel aggregation buffer, so that the records
+ * of the probes fired since the previous snapshot are all that it copies out.
+ * Fire the probe nkeys times before every snapshot we measure.
+ */
+static void
+aggsnap_fire(int nkeys)
+{
+	int i;
+
+	for (i = 0; i < nkeys; i++)
+		(void) getppid();
+}
+
+static int
+aggsnap_remove(const dtrace_aggdata_t *agg, void *arg)
+{
+#pragma unused(agg, arg)
+	return (DTRACE_AGGWALK_REMOVE);
+}
+
+static void
+aggsnap_test(int nkeys)
+{
+	dt_stat_time_t s;
+
+	aggsnap_setup(nkeys);
+
+	/*
+	 * First measure snapshots into an empty consumer hash, where every
+	 * record results in the insertion of a new key.
+	 */
+	s = dt_stat_time_create("insert");
+	while (!dt_stat_stable(s)) {
+		(void) dtrace_aggregate_walk(g_dtp, aggsnap_remove, NULL);
+		aggsnap_fire(nkeys);
+		T_STAT_MEASURE(s) {
+			(void) dtrace_aggregate_snap(g_dtp);
+		}
+	}
+	dt_stat_finalize(s);
+
+	/*
+	 * Then measure snapshots in the steady state, where every record is
+	 * merged into an existing key.
+	 */
+	s = dt_stat_time_create("merge");
+	while (!dt_stat_stable(s)) {
+		aggsnap_fire(nkeys);
+		T_STAT_MEASURE(s) {
+			(void) dtrace_aggregate_snap(g_dtp);
+		}
+	}
+	dt_stat_finalize(s);
+
+	(void) dtrace_stop(g_dtp);
+	dtrace_close(g_dtp);
+}
+
+T_DECL(aggsnap_1k, "aggregation snapshot with 1k keys", T_META_CHECK_LEAKS(false))
+{
+	aggsnap_test(1000);
+}
+
+T_DECL(aggsnap_10k, "aggregation snapshot with 10k keys", T_META_CHECK_LEAKS(false))
+{
+	aggsnap_test(10000);
+}
+
+T_DECL(aggsnap_100k, "aggregation snapshot with 100k keys", T_META_CHECK_LEAKS(false))
+{
+	aggsnap_test(100000);
+}
+
+T_DECL(aggsnap_1m, "aggregation snapshot with 1M keys", T_META_CHECK_LEAKS(false))
+{
+	aggsnap_test(1000000);
+}
@@ -0,0 +1,112 @@
+/*
+ * Checks that truncating an aggregation returns the memory of the removed
+ * entries, and not only the entries themselves, and measures the cost of the
+ * truncation as a function of the number of keys it removes.
+ */
+#include <darwintest.h>
+#include <darwintest_perf.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <dtrace.h>
+
+T_GLOBAL_META(T_META_NAMESPACE("dtrace.aggtrunc"));
+
+#define	AGGTRUNC_KEEP	10
+
+static int
+aggtrunc_probe(const dtrace_probedata_t *data, void *arg)
+{
+#pragma unused(data, arg)
+	return (DTRACE_CONSUME_THIS);
+}
+
+static int
+aggtrunc_rec(const dtrace_probedata_t *data, const dtrace_recdesc_t *rec,
+    void *arg)
+{
+#pragma unused(data, rec, arg)
+	return (DTRACE_CONSUME_THIS);
+}
+
+/*
+ * Every firing of getppid() records a new key; a firing of getpgid()
+ * truncates the aggregation to its first AGGTRUNC_KEEP keys.
+ */
+static void
+aggtrunc_test(int nkeys)
+{
+	char str[256];
+	int i, err;
+	FILE *fp;
+	dtrace_hdl_t *dtp;
+	dtrace_prog_t *prog;
+	dtrace_proginfo_t info;
+	dtrace_aggstat_t before, after;
+	dt_stat_time_t s;
+
+	T_SETUPBEGIN;
+	dtp = dtrace_open(DTRACE_VERSION, 0, &err);
+	T_ASSERT_NOTNULL(dtp, "dtrace_open");
+
+	T_QUIET; T_ASSERT_EQ(dtrace_setopt(dtp, "aggsize", "128m"), 0, "aggsize");
+	T_QUIET; T_ASSERT_EQ(dtrace_setopt(dtp, "aggrate", "0"), 0, "aggrate");
+	T_QUIET; T_ASSERT_EQ(dtrace_setopt(dtp, "switchrate", "0"), 0, "switchrate");
+
+	snprintf(str, sizeof(str),
+	    "syscall::getppid:entry /pid == %d/ { @[k++] = count(); }"
+	    "syscall::getpgid:entry /pid == %d/ { trunc(@, %d); }",
+	    getpid(), getpid(), AGGTRUNC_KEEP);
+
+	prog = dtrace_program_strcompile(dtp, str, DTRACE_PROBESPEC_NAME, 0, 0, NULL);
+	T_ASSERT_NOTNULL(prog, "dtrace_program_strcompile");
+	T_ASSERT_EQ(dtrace_program_exec(dtp, prog, &info), 0, "dtrace_program_exec");
+	T_ASSERT_EQ(dtrace_go(dtp), 0, "dtrace_go");
+
+	fp = fopen("/dev/null", "w");
+	T_QUIET; T_ASSERT_NOTNULL(fp, "fopen");
+	T_SETUPEND;
+
+	s = dt_stat_time_create("trunc");
+	while (!dt_stat_stable(s)) {
+		for (i = 0; i < nkeys; i++)
+			(void) getppid();
+		T_QUIET; T_ASSERT_EQ(dtrace_aggregate_snap(dtp), 0,
+		    "dtrace_aggregate_snap");
+		T_QUIET; T_ASSERT_EQ(dtrace_aggregate_stat(dtp, &before), 0,
+		    "dtrace_aggregate_stat");
+		T_QUIET; T_ASSERT_GE(before.dtas_nentries, (uint64_t)nkeys,
+		    "keys before trunc()");
+
+		(void) getpgid(0);
+		T_STAT_MEASURE(s) {
+			T_QUIET; T_ASSERT_NE(dtrace_consume(dtp, fp,
+			    aggtrunc_probe, aggtrunc_rec, NULL), -1,
+			    "dtrace_consume");
+		}
+
+		T_QUIET; T_ASSERT_EQ(dtrace_aggregate_stat(dtp, &after), 0,
+		    "dtrace_aggregate_stat");
+		T_QUIET; T_ASSERT_EQ(after.dtas_nentries,
+		    (uint64_t)AGGTRUNC_KEEP, "keys after trunc()");
+		T_QUIET; T_ASSERT_LE(after.dtas_memsize,
+		    before.dtas_memsize / 4, "memory held after trunc()");
+	}
+	dt_stat_finalize(s);
+
+	T_LOG("%llu bytes held for %llu keys, %llu bytes after trunc()",
+	    before.dtas_memsize, before.dtas_nentries, after.dtas_memsize);
+
+	(void) fclose(fp);
+	(void) dtrace_stop(dtp);
+	dtrace_close(dtp);
+}
+
+T_DECL(aggtrunc_10k, "truncation of an aggregation with 10k keys", T_META_CHECK_LEAKS(false))
+{
+	aggtrunc_test(10000);
+}
+
+T_DECL(aggtrunc_100k, "truncation of an aggregation with 100k keys", T_META_CHECK_LEAKS(false))
+{
+	aggtrunc_test(100000);
+}
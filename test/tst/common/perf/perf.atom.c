@@ -0,0 +1,161 @@
+/*
+ * Measures the time it takes ctfconvert's atom table to intern every type,
+ * member and enumerator name of the kernel, from one thread and from as many
+ * threads as there are CPUs, as ctfconvert does when it extracts compilation
+ * units in parallel.  Most names recur in many compilation units, so the
+ * names are interned once before the measured passes look them up again.
+ */
+#include <darwintest.h>
+#include <darwintest_perf.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dtrace.h>
+
+#include "atom.h"
+
+T_GLOBAL_META(T_META_NAMESPACE("dtrace.atom"));
+
+#define	ATOM_MAXTHREADS	64
+
+static const char **atom_names;
+static size_t atom_nnames, atom_maxnames;
+
+static void
+atom_add_name(const char *name)
+{
+	if (name == NULL || name[0] == '\0')
+		return;
+
+	if (atom_nnames == atom_maxnames) {
+		atom_maxnames = atom_maxnames ? atom_maxnames * 2 : 4096;
+		atom_names = realloc(atom_names,
+		    atom_maxnames * sizeof (atom_names[0]));
+		T_QUIET; T_ASSERT_NOTNULL(atom_names, "realloc");
+	}
+
+	atom_names[atom_nnames] = strdup(name);
+	T_QUIET; T_ASSERT_NOTNULL(atom_names[atom_nnames], "strdup");
+	atom_nnames++;
+}
+
+static int
+atom_member(const char *name, ctf_id_t type, unsigned long off, void *arg)
+{
+#pragma unused(type, off, arg)
+	atom_add_name(name);
+	return (0);
+}
+
+static int
+atom_enum(const char *name, int value, void *arg)
+{
+#pragma unused(value, arg)
+	atom_add_name(name);
+	return (0);
+}
+
+static int
+atom_type(ctf_id_t type, void *arg)
+{
+	ctf_file_t *fp = arg;
+	char buf[512];
+
+	atom_add_name(ctf_type_name(fp, type, buf, sizeof (buf)));
+
+	switch (ctf_type_kind(fp, type)) {
+	case CTF_K_STRUCT:
+	case CTF_K_UNION:
+		(void) ctf_member_iter(fp, type, atom_member, NULL);
+		break;
+	case CTF_K_ENUM:
+		(void) ctf_enum_iter(fp, type, atom_enum, NULL);
+		break;
+	}
+
+	return (0);
+}
+
+static void
+atom_load_names(void)
+{
+	int err;
+	dtrace_hdl_t *dtp;
+	dtrace_typeinfo_t tinfo;
+
+	if (atom_nnames != 0)
+		return;
+
+	dtp = dtrace_open(DTRACE_VERSION, 0, &err);
+	T_QUIET; T_ASSERT_NOTNULL(dtp, "dtrace_open");
+	T_QUIET; T_ASSERT_EQ(dtrace_lookup_by_type(dtp, DTRACE_OBJ_KMODS,
+	    "struct proc", &tinfo), 0, "dtrace_lookup_by_type");
+
+	(void) ctf_type_iter(tinfo.dtt_ctfp, atom_type, tinfo.dtt_ctfp);
+	T_QUIET; T_ASSERT_GT(atom_nnames, (size_t)0, "kernel names");
+
+	dtrace_close(dtp);
+}
+
+/*
+ * Each thread starts at a different offset, so that threads do not all
+ * intern the same name at the same time.
+ */
+static void *
+atom_intern(void *arg)
+{
+	size_t i, start = (uintptr_t)arg % atom_nnames;
+
+	for (i = 0; i < atom_nnames; i++)
+		(void) atom_get(atom_names[(start + i) % atom_nnames]);
+
+	return (NULL);
+}
+
+static void
+atom_test(const char *name, int nthreads)
+{
+	int i;
+	pthread_t tids[ATOM_MAXTHREADS];
+	dt_stat_time_t s;
+
+	T_SETUPBEGIN;
+	atom_load_names();
+	(void) atom_intern(NULL);
+	T_SETUPEND;
+
+	s = dt_stat_time_create(name);
+
+	while (!dt_stat_stable(s)) {
+		dt_stat_token start = dt_stat_time_begin(s);
+		for (i = 0; i < nthreads; i++) {
+			T_QUIET; T_ASSERT_POSIX_ZERO(pthread_create(&tids[i],
+			    NULL, atom_intern,
+			    (void *)(uintptr_t)(i * atom_nnames / nthreads)),
+			    "pthread_create");
+		}
+		for (i = 0; i < nthreads; i++)
+			(void) pthread_join(tids[i], NULL);
+		dt_stat_time_end(s, start);
+	}
+
+	dt_stat_finalize(s);
+}
+
+T_DECL(atom, "time to intern the kernel's names from one thread", T_META_CHECK_LEAKS(false))
+{
+	atom_test("intern", 1);
+}
+
+T_DECL(atom_mt, "time to intern the kernel's names from every CPU", T_META_CHECK_LEAKS(false))
+{
+	long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (ncpus < 1)
+		ncpus = 1;
+	if (ncpus > ATOM_MAXTHREADS)
+		ncpus = ATOM_MAXTHREADS;
+
+	atom_test("intern_mt", (int)ncpus);
+}
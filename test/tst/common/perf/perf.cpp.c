@@ -0,0 +1,82 @@
+/*
+ * Measures the time it takes to compile a program that needs the C
+ * preprocessor, with the in-process preprocessor enabled by the "cppinproc"
+ * option and with the default, which runs clang for every program.
+ */
+#include <darwintest.h>
+#include <darwintest_perf.h>
+#include <stdio.h>
+#include <dtrace.h>
+
+T_GLOBAL_META(T_META_NAMESPACE("dtrace.cpp"));
+
+static const char cpp_prog[] =
+    "#define\tENTRY(f)\tsyscall::f:entry\n"
+    "#define\tNCALLS\t(1 << 4)\n"
+    "#if NCALLS > 8\n"
+    "ENTRY(read), ENTRY(write)\n"
+    "#else\n"
+    "ENTRY(getpid)\n"
+    "#endif\n"
+    "/pid != 0/\n"
+    "{\n"
+    "\t@[probefunc] = count();\n"
+    "}\n";
+
+static void
+cpp_test(const char *name, int inproc)
+{
+	int err;
+	FILE *fp;
+	dtrace_hdl_t *dtp;
+	dtrace_prog_t *prog;
+	dt_stat_time_t s;
+
+	T_SETUPBEGIN;
+	fp = tmpfile();
+	T_QUIET; T_ASSERT_NOTNULL(fp, "tmpfile");
+	T_QUIET; T_ASSERT_NE(fputs(cpp_prog, fp), EOF, "fputs");
+
+	dtp = dtrace_open(DTRACE_VERSION, 0, &err);
+	T_QUIET; T_ASSERT_NOTNULL(dtp, "dtrace_open");
+
+	if (inproc) {
+		T_QUIET; T_ASSERT_EQ(dtrace_setopt(dtp, "cppinproc", NULL), 0,
+		    "cppinproc");
+	}
+
+	/*
+	 * The first compilation loads the D libraries, and obtains the
+	 * predefined macros of the in-process preprocessor.
+	 */
+	rewind(fp);
+	prog = dtrace_program_fcompile(dtp, fp, DTRACE_C_CPP, 0, NULL);
+	T_QUIET; T_ASSERT_NOTNULL(prog, "dtrace_program_fcompile");
+	T_SETUPEND;
+
+	s = dt_stat_time_create(name);
+
+	while (!dt_stat_stable(s)) {
+		rewind(fp);
+
+		dt_stat_token start = dt_stat_time_begin(s);
+		prog = dtrace_program_fcompile(dtp, fp, DTRACE_C_CPP, 0, NULL);
+		dt_stat_time_end(s, start);
+
+		T_QUIET; T_ASSERT_NOTNULL(prog, "dtrace_program_fcompile");
+	}
+
+	dt_stat_finalize(s);
+	dtrace_close(dtp);
+	(void) fclose(fp);
+}
+
+T_DECL(cpp_inprocess, "compile time with the in-process preprocessor", T_META_CHECK_LEAKS(false))
+{
+	cpp_test("inprocess", 1);
+}
+
+T_DECL(cpp_exec, "compile time when clang preprocesses every program", T_META_CHECK_LEAKS(false))
+{
+	cpp_test("exec", 0);
+}
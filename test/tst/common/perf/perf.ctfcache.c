@@ -0,0 +1,67 @@
+/*
+ * Measures the time it takes a new handle to load the kernel's CTF data and
+ * resolve a type, with and without the "ctfcache" option.
+ */
+#include <darwintest.h>
+#include <darwintest_perf.h>
+#include <dtrace.h>
+
+T_GLOBAL_META(T_META_NAMESPACE("dtrace.ctfcache"));
+
+static dtrace_hdl_t *
+ctfcache_open(int cache)
+{
+	int err;
+	dtrace_hdl_t *dtp;
+
+	dtp = dtrace_open(DTRACE_VERSION, 0, &err);
+	T_QUIET; T_ASSERT_NOTNULL(dtp, "dtrace_open");
+
+	if (cache) {
+		T_QUIET; T_ASSERT_EQ(dtrace_setopt(dtp, "ctfcache", NULL), 0,
+		    "ctfcache");
+	}
+
+	return (dtp);
+}
+
+static void
+ctfcache_test(const char *name, int cache)
+{
+	dtrace_hdl_t *dtp;
+	dtrace_typeinfo_t tinfo;
+	dt_stat_time_t s;
+
+	/*
+	 * Populate the cache, so that only loads that map it are measured.
+	 */
+	T_SETUPBEGIN;
+	dtp = ctfcache_open(cache);
+	T_QUIET; T_ASSERT_EQ(dtrace_lookup_by_type(dtp, DTRACE_OBJ_KMODS,
+	    "struct proc", &tinfo), 0, "dtrace_lookup_by_type");
+	dtrace_close(dtp);
+	T_SETUPEND;
+
+	s = dt_stat_time_create(name);
+
+	while (!dt_stat_stable(s)) {
+		dtp = ctfcache_open(cache);
+		dt_stat_token start = dt_stat_time_begin(s);
+		(void) dtrace_lookup_by_type(dtp, DTRACE_OBJ_KMODS,
+		    "struct proc", &tinfo);
+		dt_stat_time_end(s, start);
+		dtrace_close(dtp);
+	}
+
+	dt_stat_finalize(s);
+}
+
+T_DECL(ctfcache, "CTF load time with the CTF image cache", T_META_CHECK_LEAKS(false))
+{
+	ctfcache_test("cached", 1);
+}
+
+T_DECL(noctfcache, "CTF load time without the CTF image cache", T_META_CHECK_LEAKS(false))
+{
+	ctfcache_test("uncached", 0);
+}
@@ -0,0 +1,63 @@
+/*
+ * Measures the time it takes to look up types by name in the CTF containers
+ * of every module, as the D compiler does for each type a program names.
+ */
+#include <darwintest.h>
+#include <darwintest_perf.h>
+#include <dtrace.h>
+
+T_GLOBAL_META(T_META_NAMESPACE("dtrace.ctflookup"));
+
+static const char *const ctflookup_types[] = {
+	"int",
+	"uint64_t",
+	"char *",
+	"struct proc",
+	"struct thread *",
+	"struct vnode",
+	"struct uthread",
+	"vm_map_t",
+	"proc_t",
+	"struct ctflookup_missing",
+};
+
+#define	CTFLOOKUP_NTYPES \
+	(sizeof (ctflookup_types) / sizeof (ctflookup_types[0]))
+
+T_DECL(ctflookup, "time to look up types by name in every module", T_META_CHECK_LEAKS(false))
+{
+	int err;
+	size_t i;
+	dtrace_hdl_t *dtp;
+	dtrace_typeinfo_t tinfo;
+	dt_stat_time_t s;
+
+	T_SETUPBEGIN;
+	dtp = dtrace_open(DTRACE_VERSION, 0, &err);
+	T_QUIET; T_ASSERT_NOTNULL(dtp, "dtrace_open");
+
+	/*
+	 * The first pass loads the CTF containers of every module.
+	 */
+	for (i = 0; i < CTFLOOKUP_NTYPES; i++) {
+		(void) dtrace_lookup_by_type(dtp, DTRACE_OBJ_EVERY,
+		    ctflookup_types[i], &tinfo);
+	}
+	T_QUIET; T_ASSERT_EQ(dtrace_lookup_by_type(dtp, DTRACE_OBJ_EVERY,
+	    "struct proc", &tinfo), 0, "dtrace_lookup_by_type");
+	T_SETUPEND;
+
+	s = dt_stat_time_create("lookup");
+
+	while (!dt_stat_stable(s)) {
+		dt_stat_token start = dt_stat_time_begin(s);
+		for (i = 0; i < CTFLOOKUP_NTYPES; i++) {
+			(void) dtrace_lookup_by_type(dtp, DTRACE_OBJ_EVERY,
+			    ctflookup_types[i], &tinfo);
+		}
+		dt_stat_time_end(s, start);
+	}
+
+	dt_stat_finalize(s);
+	dtrace_close(dtp);
+}
@@ -0,0 +1,78 @@
+/*
+ * Measures the time it takes to compile a program that goes through the
+ * translators of the shipped D libraries, which looks up members of their
+ * output types and of the kernel structures they translate from.
+ */
+#include <darwintest.h>
+#include <darwintest_perf.h>
+#include <dtrace.h>
+
+T_GLOBAL_META(T_META_NAMESPACE("dtrace.ctfmember"));
+
+static const char ctfmember_prog[] =
+    "proc:::exec-success\n"
+    "{\n"
+    "\ttrace(curpsinfo->pr_pid);\n"
+    "\ttrace(curpsinfo->pr_ppid);\n"
+    "\ttrace(curpsinfo->pr_pgid);\n"
+    "\ttrace(curpsinfo->pr_sid);\n"
+    "\ttrace(curpsinfo->pr_uid);\n"
+    "\ttrace(curpsinfo->pr_euid);\n"
+    "\ttrace(curpsinfo->pr_gid);\n"
+    "\ttrace(curpsinfo->pr_egid);\n"
+    "\ttrace(curpsinfo->pr_addr);\n"
+    "\ttrace(curpsinfo->pr_dmodel);\n"
+    "\ttrace(curpsinfo->pr_psargs);\n"
+    "\ttrace(curlwpsinfo->pr_lwpid);\n"
+    "\ttrace(curlwpsinfo->pr_flag);\n"
+    "\ttrace(curlwpsinfo->pr_state);\n"
+    "\ttrace(curlwpsinfo->pr_sname);\n"
+    "\ttrace(curlwpsinfo->pr_syscall);\n"
+    "\ttrace(curlwpsinfo->pr_pri);\n"
+    "\ttrace(curlwpsinfo->pr_addr);\n"
+    "\ttrace(curthread->last_processor);\n"
+    "}\n"
+    "io:::start\n"
+    "{\n"
+    "\ttrace(args[0]->b_flags);\n"
+    "\ttrace(args[0]->b_bcount);\n"
+    "\ttrace(args[0]->b_blkno);\n"
+    "\ttrace(args[1]->dev_statname);\n"
+    "\ttrace(args[1]->dev_pathname);\n"
+    "\ttrace(args[2]->fi_pathname);\n"
+    "\ttrace(args[2]->fi_offset);\n"
+    "}\n";
+
+T_DECL(ctfmember, "time to compile a program using the D library translators", T_META_CHECK_LEAKS(false))
+{
+	int err;
+	dtrace_hdl_t *dtp;
+	dtrace_prog_t *prog;
+	dt_stat_time_t s;
+
+	T_SETUPBEGIN;
+	dtp = dtrace_open(DTRACE_VERSION, 0, &err);
+	T_QUIET; T_ASSERT_NOTNULL(dtp, "dtrace_open");
+
+	/*
+	 * The first compilation loads the D libraries and their translators.
+	 */
+	prog = dtrace_program_strcompile(dtp, ctfmember_prog,
+	    DTRACE_PROBESPEC_NAME, 0, 0, NULL);
+	T_QUIET; T_ASSERT_NOTNULL(prog, "dtrace_program_strcompile");
+	T_SETUPEND;
+
+	s = dt_stat_time_create("compile");
+
+	while (!dt_stat_stable(s)) {
+		dt_stat_token start = dt_stat_time_begin(s);
+		prog = dtrace_program_strcompile(dtp, ctfmember_prog,
+		    DTRACE_PROBESPEC_NAME, 0, 0, NULL);
+		dt_stat_time_end(s, start);
+
+		T_QUIET; T_ASSERT_NOTNULL(prog, "dtrace_program_strcompile");
+	}
+
+	dt_stat_finalize(s);
+	dtrace_close(dtp);
+}
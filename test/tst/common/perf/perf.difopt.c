@@ -0,0 +1,67 @@
+/*
+ * Measures the probe effect of a clause whose predicate and actions leave
+ * room for the DIF optimizer, with and without the "nodifopt" option.
+ */
+#include <darwintest.h>
+#include <darwintest_perf.h>
+#include <unistd.h>
+#include <dtrace.h>
+
+T_GLOBAL_META(T_META_NAMESPACE("dtrace.difopt"));
+
+static const char difopt_prog[] =
+    "syscall::geteuid:entry\n"
+    "/pid == $pid && (self->n == 0 || self->n > 0)/\n"
+    "{\n"
+    "\tself->n = self->n + 1;\n"
+    "\tx = (self->n * 4 + 16) / 2 + (self->n * 4 + 16) % 3;\n"
+    "\ty = x > 8 ? x - 8 : 8 - x;\n"
+    "\t@c[probefunc] = count();\n"
+    "}\n";
+
+static void
+difopt_test(const char *name, int optimize)
+{
+	int err;
+	dtrace_hdl_t *dtp;
+	dtrace_prog_t *prog;
+	dtrace_proginfo_t info;
+	dt_stat_time_t s;
+
+	T_SETUPBEGIN;
+	dtp = dtrace_open(DTRACE_VERSION, 0, &err);
+	T_QUIET; T_ASSERT_NOTNULL(dtp, "dtrace_open");
+
+	if (!optimize) {
+		T_QUIET; T_ASSERT_EQ(dtrace_setopt(dtp, "nodifopt", NULL), 0,
+		    "nodifopt");
+	}
+
+	prog = dtrace_program_strcompile(dtp, difopt_prog,
+	    DTRACE_PROBESPEC_NAME, 0, 0, NULL);
+	T_QUIET; T_ASSERT_NOTNULL(prog, "dtrace_program_strcompile");
+	T_QUIET; T_ASSERT_EQ(dtrace_program_exec(dtp, prog, &info), 0,
+	    "dtrace_program_exec");
+	T_QUIET; T_ASSERT_EQ(dtrace_go(dtp), 0, "dtrace_go");
+	T_SETUPEND;
+
+	s = dt_stat_time_create(name);
+
+	T_STAT_MEASURE_LOOP(s) {
+		geteuid();
+	}
+
+	dt_stat_finalize(s);
+	T_QUIET; T_ASSERT_EQ(dtrace_stop(dtp), 0, "dtrace_stop");
+	dtrace_close(dtp);
+}
+
+T_DECL(difopt, "probe effect of optimized DIF", T_META_CHECK_LEAKS(false))
+{
+	difopt_test("optimized", 1);
+}
+
+T_DECL(nodifopt, "probe effect of unoptimized DIF", T_META_CHECK_LEAKS(false))
+{
+	difopt_test("unoptimized", 0);
+}
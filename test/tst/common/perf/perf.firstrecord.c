@@ -0,0 +1,86 @@
+/*
+ * Measures the time it takes to start tracing with many enablings and to
+ * consume the first record of each of them.
+ */
+#include <darwintest.h>
+#include <darwintest_perf.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <dtrace.h>
+
+T_GLOBAL_META(T_META_NAMESPACE("dtrace.firstrecord"));
+
+#define	NCLAUSES	1000
+#define	CLAUSELEN	96
+
+static int
+firstrecord_count(const dtrace_probedata_t *data, void *arg)
+{
+#pragma unused(data)
+	(*(int *)arg)++;
+	return (DTRACE_CONSUME_NEXT);
+}
+
+T_DECL(firstrecord, "time to the first record of many enablings", T_META_CHECK_LEAKS(false))
+{
+	char *str;
+	int err, i, n;
+	size_t off = 0, len = NCLAUSES * CLAUSELEN;
+	dtrace_hdl_t *dtp;
+	dtrace_prog_t *prog;
+	dtrace_proginfo_t info;
+	dt_stat_time_t go, first;
+
+	/*
+	 * Each clause results in its own enabled probe, with its own printf()
+	 * format, that fires once for every call to getppid().
+	 */
+	T_SETUPBEGIN;
+	str = malloc(len);
+	T_QUIET; T_ASSERT_NOTNULL(str, "malloc");
+
+	for (i = 0; i < NCLAUSES; i++) {
+		off += snprintf(str + off, len - off,
+		    "syscall::getppid:entry /pid == %d/ { printf(\"%d %%d\\n\", arg0); }\n",
+		    getpid(), i);
+	}
+	T_SETUPEND;
+
+	go = dt_stat_time_create("go");
+	first = dt_stat_time_create("first_record");
+
+	while (!dt_stat_stable(go) || !dt_stat_stable(first)) {
+		dt_stat_token start;
+
+		dtp = dtrace_open(DTRACE_VERSION, 0, &err);
+		T_QUIET; T_ASSERT_NOTNULL(dtp, "dtrace_open");
+
+		T_QUIET; T_ASSERT_EQ(dtrace_setopt(dtp, "bufsize", "4m"), 0, "bufsize");
+
+		prog = dtrace_program_strcompile(dtp, str, DTRACE_PROBESPEC_NAME, 0, 0, NULL);
+		T_QUIET; T_ASSERT_NOTNULL(prog, "dtrace_program_strcompile");
+		T_QUIET; T_ASSERT_EQ(dtrace_program_exec(dtp, prog, &info), 0,
+		    "dtrace_program_exec");
+
+		start = dt_stat_time_begin(go);
+		T_QUIET; T_ASSERT_EQ(dtrace_go(dtp), 0, "dtrace_go");
+		dt_stat_time_end(go, start);
+
+		(void) getppid();
+		T_QUIET; T_ASSERT_EQ(dtrace_stop(dtp), 0, "dtrace_stop");
+
+		n = 0;
+		start = dt_stat_time_begin(first);
+		T_QUIET; T_ASSERT_EQ(dtrace_consume(dtp, NULL, firstrecord_count,
+		    NULL, &n), 0, "dtrace_consume");
+		dt_stat_time_end(first, start);
+
+		T_QUIET; T_EXPECT_EQ(n, NCLAUSES, "one record per clause");
+
+		dtrace_close(dtp);
+	}
+
+	dt_stat_finalize(go);
+	dt_stat_finalize(first);
+	free(str);
+}
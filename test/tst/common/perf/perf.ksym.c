@@ -0,0 +1,81 @@
+/*
+ * Measures the cost of snapshotting and printing aggregations keyed on kernel
+ * addresses, which are normalized to their symbol or module and then printed
+ * symbolically.
+ */
+#include <darwintest.h>
+#include <darwintest_perf.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <dtrace.h>
+
+T_GLOBAL_META(T_META_NAMESPACE("dtrace.ksym"));
+
+#define	NCALLS		10000
+
+static void
+ksym_test(const char *key)
+{
+	char str[256];
+	int err, i;
+	FILE *fp;
+	dtrace_hdl_t *dtp;
+	dtrace_prog_t *prog;
+	dtrace_proginfo_t info;
+	dt_stat_time_t s;
+
+	T_SETUPBEGIN;
+	dtp = dtrace_open(DTRACE_VERSION, 0, &err);
+	T_ASSERT_NOTNULL(dtp, "dtrace_open");
+
+	T_QUIET; T_ASSERT_EQ(dtrace_setopt(dtp, "aggsize", "16m"), 0, "aggsize");
+	T_QUIET; T_ASSERT_EQ(dtrace_setopt(dtp, "stacksymbols", NULL), 0,
+	    "stacksymbols");
+
+	/*
+	 * Key the aggregation on every kernel function called on behalf of
+	 * this process, so that there are many distinct addresses to resolve.
+	 */
+	snprintf(str, sizeof(str),
+	    "fbt:mach_kernel::entry /pid == %d/ { @[%s] = count(); }",
+	    getpid(), key);
+
+	prog = dtrace_program_strcompile(dtp, str, DTRACE_PROBESPEC_NAME, 0, 0, NULL);
+	T_ASSERT_NOTNULL(prog, "dtrace_program_strcompile");
+	T_ASSERT_EQ(dtrace_program_exec(dtp, prog, &info), 0, "dtrace_program_exec");
+	T_ASSERT_EQ(dtrace_go(dtp), 0, "dtrace_go");
+
+	for (i = 0; i < NCALLS; i++)
+		(void) getpgid(i);
+
+	T_ASSERT_EQ(dtrace_stop(dtp), 0, "dtrace_stop");
+
+	fp = fopen("/dev/null", "w");
+	T_QUIET; T_ASSERT_NOTNULL(fp, "fopen");
+	T_SETUPEND;
+
+	s = dt_stat_time_create("snapshot_and_print");
+	T_STAT_MEASURE_LOOP(s) {
+		(void) dtrace_aggregate_snap(dtp);
+		(void) dtrace_aggregate_print(dtp, fp, NULL);
+	}
+	dt_stat_finalize(s);
+
+	(void) fclose(fp);
+	dtrace_close(dtp);
+}
+
+T_DECL(ksym_sym, "aggregation on sym() keys", T_META_CHECK_LEAKS(false))
+{
+	ksym_test("sym(caller)");
+}
+
+T_DECL(ksym_mod, "aggregation on mod() keys", T_META_CHECK_LEAKS(false))
+{
+	ksym_test("mod(caller)");
+}
+
+T_DECL(ksym_stack, "aggregation on stack() keys", T_META_CHECK_LEAKS(false))
+{
+	ksym_test("stack()");
+}
@@ -0,0 +1,59 @@
+/*
+ * Measures the time it takes to open a handle and compile a first program,
+ * with the D libraries, with the D libraries but without the cache of their
+ * dependencies, and without the D libraries at all.  The first two differ by
+ * the dependency scan that the cache saves; the last is the floor.
+ */
+#include <darwintest.h>
+#include <darwintest_perf.h>
+#include <dtrace.h>
+
+T_GLOBAL_META(T_META_NAMESPACE("dtrace.libload"));
+
+static void
+libload_test(const char *name, const char *opt)
+{
+	int err;
+	dtrace_hdl_t *dtp;
+	dtrace_prog_t *prog;
+	dt_stat_time_t s;
+
+	s = dt_stat_time_create(name);
+
+	while (!dt_stat_stable(s)) {
+		dt_stat_token start = dt_stat_time_begin(s);
+
+		dtp = dtrace_open(DTRACE_VERSION, 0, &err);
+		T_QUIET; T_ASSERT_NOTNULL(dtp, "dtrace_open");
+
+		if (opt != NULL) {
+			T_QUIET; T_ASSERT_EQ(dtrace_setopt(dtp, opt, NULL),
+			    0, "%s", opt);
+		}
+
+		prog = dtrace_program_strcompile(dtp, "BEGIN { exit(0); }",
+		    DTRACE_PROBESPEC_NAME, 0, 0, NULL);
+		T_QUIET; T_ASSERT_NOTNULL(prog, "dtrace_program_strcompile");
+
+		dt_stat_time_end(s, start);
+
+		dtrace_close(dtp);
+	}
+
+	dt_stat_finalize(s);
+}
+
+T_DECL(libload, "time to open a handle and load the D libraries", T_META_CHECK_LEAKS(false))
+{
+	libload_test("open_and_compile", NULL);
+}
+
+T_DECL(libload_nocache, "time to open a handle and load the D libraries without the dependency cache", T_META_CHECK_LEAKS(false))
+{
+	libload_test("open_and_compile_nocache", "nolibcache");
+}
+
+T_DECL(libload_nolibs, "time to open a handle without the D libraries", T_META_CHECK_LEAKS(false))
+{
+	libload_test("open_and_compile_nolibs", "nolibs");
+}
@@ -0,0 +1,90 @@
+/*
+ * Measures the time it takes to compile an enabling of every function entry
+ * or return in a process, which creates a pid provider probe for each function
+ * of the process's binary and of every library it has loaded.  Return probes
+ * also require the text of every function to be read and decoded, which the
+ * "pidthreads" option spreads across several threads.
+ */
+#include <darwintest.h>
+#include <darwintest_perf.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <dtrace.h>
+
+T_GLOBAL_META(T_META_NAMESPACE("dtrace.pidcompile"));
+
+static void
+pidcompile_test(const char *name, const char *threads)
+{
+	char str[64];
+	int err, status;
+	pid_t pid;
+	dtrace_hdl_t *dtp;
+	dtrace_prog_t *prog;
+	struct ps_prochandle *P;
+	dt_stat_time_t s;
+
+	/*
+	 * The target is a child of this test, so it has the test harness and
+	 * all of its libraries loaded.
+	 */
+	T_SETUPBEGIN;
+	pid = fork();
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(pid, "fork");
+	if (pid == 0) {
+		for (;;)
+			(void) pause();
+	}
+
+	snprintf(str, sizeof(str), "pid%d:::%s { }", pid, name);
+	T_SETUPEND;
+
+	s = dt_stat_time_create("compile");
+
+	while (!dt_stat_stable(s)) {
+		dt_stat_token start;
+
+		dtp = dtrace_open(DTRACE_VERSION, 0, &err);
+		T_QUIET; T_ASSERT_NOTNULL(dtp, "dtrace_open");
+
+		if (threads != NULL) {
+			T_QUIET; T_ASSERT_EQ(dtrace_setopt(dtp, "pidthreads",
+			    threads), 0, "pidthreads");
+		}
+
+		P = dtrace_proc_grab(dtp, pid, 0);
+		T_QUIET; T_ASSERT_NOTNULL(P, "dtrace_proc_grab");
+
+		start = dt_stat_time_begin(s);
+		prog = dtrace_program_strcompile(dtp, str, DTRACE_PROBESPEC_NAME,
+		    0, 0, NULL);
+		dt_stat_time_end(s, start);
+		T_QUIET; T_ASSERT_NOTNULL(prog, "dtrace_program_strcompile");
+
+		dtrace_proc_release(dtp, P);
+		dtrace_close(dtp);
+	}
+
+	dt_stat_finalize(s);
+
+	(void) kill(pid, SIGKILL);
+	(void) waitpid(pid, &status, 0);
+}
+
+T_DECL(pidcompile_entry, "compile pid$target:::entry", T_META_CHECK_LEAKS(false))
+{
+	pidcompile_test("entry", NULL);
+}
+
+T_DECL(pidcompile_return, "compile pid$target:::return", T_META_CHECK_LEAKS(false))
+{
+	pidcompile_test("return", NULL);
+}
+
+T_DECL(pidcompile_return_threads, "compile pid$target:::return with pidthreads=8",
+    T_META_CHECK_LEAKS(false))
+{
+	pidcompile_test("return", "8");
+}
@@ -0,0 +1,76 @@
+/*
+ * Measures the probe effect of an expression that needs more registers than
+ * the DIF register file holds, compiled into a single clause that spills a
+ * value to a clause-local variable, and split by hand across two clauses.
+ */
+#include <darwintest.h>
+#include <darwintest_perf.h>
+#include <unistd.h>
+#include <dtrace.h>
+
+T_GLOBAL_META(T_META_NAMESPACE("dtrace.spill"));
+
+static const char spill_single_prog[] =
+    "syscall::geteuid:entry\n"
+    "/pid == $pid/\n"
+    "{\n"
+    "\tx = (self->a + 1) * ((self->a + 2) * ((self->a + 3) *\n"
+    "\t    ((self->a + 4) * ((self->a + 5) * ((self->a + 6) *\n"
+    "\t    (self->a + 7))))));\n"
+    "}\n";
+
+static const char spill_split_prog[] =
+    "syscall::geteuid:entry\n"
+    "/pid == $pid/\n"
+    "{\n"
+    "\tthis->t = (self->a + 5) * ((self->a + 6) * (self->a + 7));\n"
+    "}\n"
+    "\n"
+    "syscall::geteuid:entry\n"
+    "/pid == $pid/\n"
+    "{\n"
+    "\tx = (self->a + 1) * ((self->a + 2) * ((self->a + 3) *\n"
+    "\t    ((self->a + 4) * this->t)));\n"
+    "}\n";
+
+static void
+spill_test(const char *name, const char *src)
+{
+	int err;
+	dtrace_hdl_t *dtp;
+	dtrace_prog_t *prog;
+	dtrace_proginfo_t info;
+	dt_stat_time_t s;
+
+	T_SETUPBEGIN;
+	dtp = dtrace_open(DTRACE_VERSION, 0, &err);
+	T_QUIET; T_ASSERT_NOTNULL(dtp, "dtrace_open");
+
+	prog = dtrace_program_strcompile(dtp, src,
+	    DTRACE_PROBESPEC_NAME, 0, 0, NULL);
+	T_QUIET; T_ASSERT_NOTNULL(prog, "dtrace_program_strcompile");
+	T_QUIET; T_ASSERT_EQ(dtrace_program_exec(dtp, prog, &info), 0,
+	    "dtrace_program_exec");
+	T_QUIET; T_ASSERT_EQ(dtrace_go(dtp), 0, "dtrace_go");
+	T_SETUPEND;
+
+	s = dt_stat_time_create(name);
+
+	T_STAT_MEASURE_LOOP(s) {
+		geteuid();
+	}
+
+	dt_stat_finalize(s);
+	T_QUIET; T_ASSERT_EQ(dtrace_stop(dtp), 0, "dtrace_stop");
+	dtrace_close(dtp);
+}
+
+T_DECL(spill_single, "probe effect of a large expression in one clause", T_META_CHECK_LEAKS(false))
+{
+	spill_test("single", spill_single_prog);
+}
+
+T_DECL(spill_split, "probe effect of a large expression split across clauses", T_META_CHECK_LEAKS(false))
+{
+	spill_test("split", spill_split_prog);
+}
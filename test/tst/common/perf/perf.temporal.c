@@ -0,0 +1,112 @@
+/*
+ * Measures the rate at which records traced on several CPUs are consumed,
+ * with and without the "temporal" option.  In temporal mode, the records of
+ * all CPUs are merged in the order they were traced.
+ */
+#include <darwintest.h>
+#include <darwintest_perf.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <dtrace.h>
+
+T_GLOBAL_META(T_META_NAMESPACE("dtrace.temporal"));
+
+#define	NTHREADS	8
+#define	NRECS		20000		/* records traced by each thread */
+
+static void *
+temporal_fire(void *arg)
+{
+#pragma unused(arg)
+	int i;
+
+	for (i = 0; i < NRECS; i++)
+		(void) getpgid(i);
+
+	return (NULL);
+}
+
+static int
+temporal_count(const dtrace_probedata_t *data, void *arg)
+{
+#pragma unused(data)
+	(*(uint64_t *)arg)++;
+	return (DTRACE_CONSUME_NEXT);
+}
+
+/*
+ * Trace NRECS records on each of NTHREADS threads, stop tracing and then time
+ * the consumption of all of the records in a single pass.
+ */
+static double
+temporal_pass(int temporal)
+{
+	char str[256];
+	int err, i;
+	uint64_t n = 0, start, end;
+	dtrace_hdl_t *dtp;
+	dtrace_prog_t *prog;
+	dtrace_proginfo_t info;
+	pthread_t tids[NTHREADS];
+
+	dtp = dtrace_open(DTRACE_VERSION, 0, &err);
+	T_QUIET; T_ASSERT_NOTNULL(dtp, "dtrace_open");
+
+	T_QUIET; T_ASSERT_EQ(dtrace_setopt(dtp, "bufsize", "64m"), 0, "bufsize");
+	if (temporal) {
+		T_QUIET; T_ASSERT_EQ(dtrace_setopt(dtp, "temporal", NULL), 0,
+		    "temporal");
+	}
+
+	snprintf(str, sizeof(str),
+	    "syscall::getpgid:entry /pid == %d/ { trace(arg0); }", getpid());
+
+	prog = dtrace_program_strcompile(dtp, str, DTRACE_PROBESPEC_NAME, 0, 0, NULL);
+	T_QUIET; T_ASSERT_NOTNULL(prog, "dtrace_program_strcompile");
+	T_QUIET; T_ASSERT_EQ(dtrace_program_exec(dtp, prog, &info), 0,
+	    "dtrace_program_exec");
+	T_QUIET; T_ASSERT_EQ(dtrace_go(dtp), 0, "dtrace_go");
+
+	for (i = 0; i < NTHREADS; i++) {
+		T_QUIET; T_ASSERT_POSIX_ZERO(pthread_create(&tids[i], NULL,
+		    temporal_fire, NULL), "pthread_create");
+	}
+
+	for (i = 0; i < NTHREADS; i++)
+		(void) pthread_join(tids[i], NULL);
+
+	T_QUIET; T_ASSERT_EQ(dtrace_stop(dtp), 0, "dtrace_stop");
+
+	start = clock_gettime_nsec_np(CLOCK_MONOTONIC_RAW);
+	T_QUIET; T_ASSERT_EQ(dtrace_consume(dtp, NULL, temporal_count, NULL, &n),
+	    0, "dtrace_consume");
+	end = clock_gettime_nsec_np(CLOCK_MONOTONIC_RAW);
+
+	T_QUIET; T_EXPECT_EQ(n, (uint64_t)NTHREADS * NRECS, "consumed every record");
+
+	dtrace_close(dtp);
+
+	return ((double)n * 1000000000 / (end - start));
+}
+
+static void
+temporal_test(const char *name, int temporal)
+{
+	dt_stat_t s = dt_stat_create("records/s", name);
+
+	while (!dt_stat_stable(s))
+		dt_stat_add(s, temporal_pass(temporal));
+
+	dt_stat_finalize(s);
+}
+
+T_DECL(temporal_off, "consumption of records in CPU order", T_META_CHECK_LEAKS(false))
+{
+	temporal_test("unordered", 0);
+}
+
+T_DECL(temporal_on, "consumption of records in temporal order", T_META_CHECK_LEAKS(false))
+{
+	temporal_test("temporal", 1);
+}
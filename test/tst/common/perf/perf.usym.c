@@ -0,0 +1,89 @@
+/*
+ * Measures the cost of printing an aggregation keyed on user stacks, where
+ * every key shares most of its frames with the others, and reports how many
+ * of the address lookups were satisfied by the symbolization cache.
+ */
+#include <darwintest.h>
+#include <darwintest_perf.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <dtrace.h>
+
+T_GLOBAL_META(T_META_NAMESPACE("dtrace.usym"));
+
+#define	NKEYS		1000
+#define	MAXDEPTH	32
+
+/*
+ * Recurse to a depth that depends on the key, so that each key results in a
+ * distinct stack made up of a small set of return addresses.
+ */
+static __attribute__((noinline)) int
+usym_recurse(int depth, int key)
+{
+	int rval;
+
+	if (depth == 0)
+		rval = getpgid(key);
+	else
+		rval = usym_recurse(depth - 1, key);
+
+	__asm__ volatile("");
+	return (rval + 1);
+}
+
+T_DECL(usym_ustack, "printing of an aggregation on ustack() keys",
+    T_META_CHECK_LEAKS(false))
+{
+	char str[256];
+	int err, i;
+	FILE *fp;
+	dtrace_hdl_t *dtp;
+	dtrace_prog_t *prog;
+	dtrace_proginfo_t info;
+	dtrace_symstat_t stat;
+	dt_stat_time_t s;
+
+	T_SETUPBEGIN;
+	dtp = dtrace_open(DTRACE_VERSION, 0, &err);
+	T_ASSERT_NOTNULL(dtp, "dtrace_open");
+
+	T_QUIET; T_ASSERT_EQ(dtrace_setopt(dtp, "aggsize", "16m"), 0, "aggsize");
+	T_QUIET; T_ASSERT_EQ(dtrace_setopt(dtp, "stacksymbols", NULL), 0,
+	    "stacksymbols");
+
+	snprintf(str, sizeof(str),
+	    "syscall::getpgid:entry /pid == %d/ { @[arg0, ustack(%d)] = count(); }",
+	    getpid(), MAXDEPTH + 8);
+
+	prog = dtrace_program_strcompile(dtp, str, DTRACE_PROBESPEC_NAME, 0, 0, NULL);
+	T_ASSERT_NOTNULL(prog, "dtrace_program_strcompile");
+	T_ASSERT_EQ(dtrace_program_exec(dtp, prog, &info), 0, "dtrace_program_exec");
+	T_ASSERT_EQ(dtrace_go(dtp), 0, "dtrace_go");
+
+	for (i = 0; i < NKEYS; i++)
+		(void) usym_recurse(i % MAXDEPTH, i);
+
+	T_ASSERT_EQ(dtrace_aggregate_snap(dtp), 0, "dtrace_aggregate_snap");
+
+	fp = fopen("/dev/null", "w");
+	T_QUIET; T_ASSERT_NOTNULL(fp, "fopen");
+	T_SETUPEND;
+
+	s = dt_stat_time_create("print");
+	T_STAT_MEASURE_LOOP(s) {
+		(void) dtrace_aggregate_print(dtp, fp, NULL);
+	}
+	dt_stat_finalize(s);
+
+	T_ASSERT_EQ(dtrace_proc_symstat(dtp, &stat), 0, "dtrace_proc_symstat");
+	T_LOG("%llu lookups, %llu hits, %llu addresses cached, %llu flushes",
+	    stat.dtss_lookups, stat.dtss_hits, stat.dtss_entries,
+	    stat.dtss_flushes);
+	T_EXPECT_GT(stat.dtss_hits, stat.dtss_lookups / 2,
+	    "most lookups are satisfied by the cache");
+
+	(void) fclose(fp);
+	(void) dtrace_stop(dtp);
+	dtrace_close(dtp);
+}
@@ -25,33 +25,134 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <mutex>
 
 #include "memory.h"
 #include "atom.h"
 #include "llvm-ADT/DenseSet.h"
 
-llvm::DenseSet<const char *> atoms{4096};
+/*
+ * dw_read() extracts compilation units, and thus creates atoms, from several
+ * threads at once.  To keep them from serializing on a single table, atoms
+ * are spread over ATOM_NSHARDS tables, each with its own lock, picked by the
+ * top bits of the name's hash.  The hash is kept next to each atom so that
+ * neither probing nor growing a table has to rehash the names it holds.
+ *
+ * Names are copied into per-shard arena chunks rather than allocated one by
+ * one, since atoms live until the process exits.
+ */
+#define	ATOM_NSHARDS_SHIFT	6
+#define	ATOM_NSHARDS		(1U << ATOM_NSHARDS_SHIFT)
+#define	ATOM_ARENA_CHUNK	(32 << 10)
+#define	ATOM_ARENA_MAXSTR	(ATOM_ARENA_CHUNK / 64)
+
+struct atom_key {
+	const char *ak_str;
+	unsigned ak_hash;
+};
+
+namespace llvm {
+template<> struct DenseMapInfo<atom_key> {
+	static inline atom_key getEmptyKey() {
+		return { reinterpret_cast<const char *>(-1), 0 };
+	}
+	static inline atom_key getTombstoneKey() {
+		return { reinterpret_cast<const char *>(-2), 0 };
+	}
+	static bool isSentinel(const atom_key &k) {
+		return k.ak_str == getEmptyKey().ak_str ||
+		    k.ak_str == getTombstoneKey().ak_str;
+	}
+	static unsigned getHashValue(const atom_key &k) {
+		return k.ak_hash;
+	}
+	static bool isEqual(const atom_key &l, const atom_key &r) {
+		if (l.ak_str == r.ak_str)
+			return true;
+		if (l.ak_hash != r.ak_hash || isSentinel(l) || isSentinel(r))
+			return false;
+		return strcmp(l.ak_str, r.ak_str) == 0;
+	}
+};
+} // namespace llvm
+
+struct alignas(64) atom_shard {
+	std::mutex as_lock;
+	llvm::DenseSet<atom_key> as_atoms;
+	char *as_arena;		/* next free byte of the current chunk */
+	size_t as_avail;	/* bytes left in the current chunk */
+};
+
+static atom_shard atom_shards[ATOM_NSHARDS];
+
+static inline atom_key
+atom_key_make(const char *s, size_t len)
+{
+	size_t h = std::__murmur2_or_cityhash<size_t>()(s, len);
+
+#if __LP64__
+	h ^= h >> 32;
+#endif
+	return { s, static_cast<unsigned>(h) };
+}
+
+static inline atom_shard *
+atom_shard_get(const atom_key &key)
+{
+	return &atom_shards[key.ak_hash >> (32 - ATOM_NSHARDS_SHIFT)];
+}
+
+/* Called with as_lock held */
+static const char *
+atom_arena_dup(atom_shard *as, const char *s, size_t len)
+{
+	char *p;
+
+	if (len >= ATOM_ARENA_MAXSTR) {
+		p = static_cast<char *>(xmalloc(len + 1));
+	} else {
+		if (as->as_avail < len + 1) {
+			as->as_arena = static_cast<char *>(xmalloc(ATOM_ARENA_CHUNK));
+			as->as_avail = ATOM_ARENA_CHUNK;
+		}
+		p = as->as_arena;
+		as->as_arena += len + 1;
+		as->as_avail -= len + 1;
+	}
+
+	memcpy(p, s, len + 1);
+	return p;
+}
 
 extern "C" {
 
 atom_t *
 atom_get(const char *s)
 {
-	auto it = atoms.insert(s);
+	size_t len = strlen(s);
+	atom_key key = atom_key_make(s, len);
+	atom_shard *as = atom_shard_get(key);
+
+	std::lock_guard<std::mutex> guard(as->as_lock);
+	auto it = as->as_atoms.insert(key);
 	if (it.second) {
-		*it.first = xstrdup(s);
+		it.first->ak_str = atom_arena_dup(as, s, len);
 	}
-	return reinterpret_cast<atom_t *>(*it.first);
+	return reinterpret_cast<atom_t *>(it.first->ak_str);
 }
 
 atom_t *
 atom_get_consume(char *s)
 {
-	auto it = atoms.insert(s);
+	atom_key key = atom_key_make(s, strlen(s));
+	atom_shard *as = atom_shard_get(key);
+
+	std::lock_guard<std::mutex> guard(as->as_lock);
+	auto it = as->as_atoms.insert(key);
 	if (!it.second) {
 		free(s);
 	}
-	return reinterpret_cast<atom_t *>(*it.first);
+	return reinterpret_cast<atom_t *>(it.first->ak_str);
 }
 
 __attribute__((always_inline)) // let LTO know
@@ -85,6 +85,10 @@
 #include <stdlib.h>
 #include <strings.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
 #include <libelf.h>
 #include <libdwarf.h>
 #include <libgen.h>
@@ -137,6 +141,20 @@
 
 #define	TDESC_HASH_BUCKETS	511
 
+/*
+ * Number of CUs each extraction thread may run ahead of the merge (see the
+ * comment above cu_queue_t).
+ */
+#define	CU_WINDOW_PER_THREAD	4
+
+/*
+ * Default number of extraction threads, unless CTFCONVERT_MAX_THREADS says
+ * otherwise.  Each thread opens the file again and libdwarf reads its own copy
+ * of the DWARF sections it uses, so every thread adds about the size of the
+ * object's debug sections (hundreds of MB for the kernel) to the footprint.
+ */
+#define	CU_MAXTHREADS		8
+
 typedef struct dwarf {
 	Dwarf_Debug dw_dw;		/* for libdwarf */
 	Dwarf_Error dw_err;		/* for libdwarf */
@@ -159,9 +177,33 @@ typedef struct cu_data
 {
 	struct cu_data *cud_next;
 	atom_t *cud_name;
+	atom_t *cud_basename;		/* basename of cud_name */
 	Dwarf_Unsigned cud_nxthdr;
+	tdata_t *cud_td;		/* extracted types (NULL if none) */
+	int cud_done;			/* set once cud_td is final */
 } cu_data_t;
 
+/*
+ * The compilation units are extracted by a pool of threads, each with its own
+ * Elf and Dwarf_Debug handles, as libdwarf handles may not be shared between
+ * threads.  Threads claim CUs in file order, and dw_read() hands each CU's
+ * types to the merge in that same order no matter which thread finishes
+ * first, so the output doesn't depend on scheduling.  To bound the memory
+ * held by finished CUs that are waiting their turn, a CU may only be claimed
+ * once fewer than cuq_window CUs ahead of it are still waiting.
+ */
+typedef struct cu_queue {
+	pthread_mutex_t cuq_lock;
+	pthread_cond_t cuq_cv;		/* signalled on claim or completion */
+	cu_data_t **cuq_cus;		/* CUs to extract, in file order */
+	int cuq_ncus;			/* number of CUs in cuq_cus */
+	int cuq_next;			/* index of the next CU to claim */
+	int cuq_nsubmitted;		/* number of CUs handed to the merge */
+	int cuq_window;			/* max CUs claimed beyond cuq_nsubmitted */
+	const char *cuq_filename;	/* file to read DWARF from */
+	size_t cuq_ptrsz;		/* size of a pointer in this file */
+} cu_queue_t;
+
 
 static tdesc_t * die_create_one(dwarf_t *, Dwarf_Die);
 static void die_create(dwarf_t *, Dwarf_Die);
@@ -1404,7 +1446,7 @@ die_base_name_parse(atom_t *atom, atom_t **newp)
 {
 	const char *name = atom->value;
 	char buf[100];
-	char *base, *c;
+	char *base, *c, *last;
 	int nlong = 0, nshort = 0, nchar = 0, nint = 0;
 	int sign = 1;
 	char fmt = '\0';
@@ -1415,7 +1457,8 @@ die_base_name_parse(atom_t *atom, atom_t **newp)
 
 	strncpy(buf, name, sizeof (buf));
 
-	for (c = strtok(buf, " "); c != NULL; c = strtok(NULL, " ")) {
+	for (c = strtok_r(buf, " ", &last); c != NULL;
+	    c = strtok_r(NULL, " ", &last)) {
 		if (strcmp(c, "signed") == 0)
 			sign = 1;
 		else if (strcmp(c, "unsigned") == 0)
@@ -2070,6 +2113,149 @@ die_resolve(dwarf_t *dw)
 	} while (dw->dw_nunres != 0);
 }
 
+/*
+ * Claim the next CU to extract, waiting if the merge has fallen too far
+ * behind.  Returns -1 once every CU has been claimed.
+ */
+static int
+cu_claim(cu_queue_t *cuq)
+{
+	int i = -1;
+
+	pthread_mutex_lock(&cuq->cuq_lock);
+	while (cuq->cuq_next < cuq->cuq_ncus &&
+	    cuq->cuq_next >= cuq->cuq_nsubmitted + cuq->cuq_window)
+		pthread_cond_wait(&cuq->cuq_cv, &cuq->cuq_lock);
+
+	if (cuq->cuq_next < cuq->cuq_ncus)
+		i = cuq->cuq_next++;
+	pthread_mutex_unlock(&cuq->cuq_lock);
+
+	return (i);
+}
+
+/*
+ * Extract the types of a single CU into cudata->cud_td.  The CU must come
+ * after any CU previously extracted with the same handle, as we can only
+ * move forward through the CU headers.
+ */
+static void
+cu_extract(dwarf_t *dw, merge_cb_data_t *mcd, cu_data_t *cudata)
+{
+	Dwarf_Unsigned abboff, hdrlen, nxthdr;
+	Dwarf_Half vers, addrsz;
+	Dwarf_Error error = NULL;
+	Dwarf_Die child;
+	tdata_t *cutd;
+	int rc;
+
+	do {
+		if ((rc = dwarf_next_cu_header(dw->dw_dw, &hdrlen, &vers,
+		    &abboff, &addrsz, &nxthdr, &dw->dw_err)) != DW_DLV_OK) {
+			terminate("failed to locate compilation unit %s\n",
+			    cudata->cud_name->value);
+		}
+	} while (nxthdr != cudata->cud_nxthdr);
+
+	rc = dwarf_siblingof(dw->dw_dw, NULL, &dw->dw_cu, &error);
+	if (rc != DW_DLV_OK) {
+		terminate("Error in dwarf_siblingof on CU die (%s)\n", dwarf_errmsg(error));
+	}
+
+	dw->dw_cuoff = die_off(dw, dw->dw_cu);
+	dw->dw_cuname = cudata->cud_basename;
+
+	rc = dwarf_child(dw->dw_cu, &child, &error);
+	if (rc != DW_DLV_OK) {
+		printf("Error in dwarf_child on CU die \n");
+		return;
+	}
+
+	dw->dw_mfgtid_last = TID_MFGTID_BASE;
+	dw->dw_fwdhash = hash_new(TDESC_HASH_BUCKETS, tdesc_namehash,
+	    tdesc_namecmp);
+	dw->dw_enumhash = hash_new(TDESC_HASH_BUCKETS, tdesc_namehash,
+	    tdesc_namecmp);
+
+	dw->dw_void = NULL;
+	dw->dw_long = NULL;
+	dw->dw_maxoff = nxthdr - 1;
+
+	dw->dw_td = tdata_new();
+	die_create(dw, child);
+	die_resolve(dw);
+
+#if !defined(__APPLE__)
+	cvt_fixups(td, dw->dw_ptrsz);
+#else
+	/* Ignore Solaris gore. See on-src-20080707/usr/src/tools/ctf/cvt/fixup_tdescs.c */
+#endif
+
+	cutd = tdata_new();
+	debug(1, "mergeto %s to cutd\n", dw->dw_cuname->value);
+	merge_into_master(mcd, dw->dw_td, cutd, NULL, 1);
+	cudata->cud_td = cutd;
+
+	alist_clear(dw->dw_tidhash);
+	hash_free(dw->dw_fwdhash,  NULL, NULL);
+	hash_free(dw->dw_enumhash, NULL, NULL);
+	tdata_free(dw->dw_td);
+}
+
+/*
+ * Main loop for the CU extraction threads.
+ */
+static void *
+cu_worker(void *arg)
+{
+	cu_queue_t *cuq = arg;
+	merge_cb_data_t mcd = {0};
+	dwarf_t _dw;
+	dwarf_t *dw = &_dw;
+	cu_data_t *cudata;
+	Elf *elf;
+	int fd, i;
+
+	if ((fd = open(cuq->cuq_filename, O_RDONLY)) < 0)
+		terminate("failed to open %s", cuq->cuq_filename);
+
+	if ((elf = elf_begin(fd, ELF_C_READ, NULL)) == NULL) {
+		terminate("failed to read %s: %s\n", cuq->cuq_filename,
+		    elf_errmsg(-1));
+	}
+
+	bzero(dw, sizeof (dwarf_t));
+	dw->dw_ptrsz = cuq->cuq_ptrsz;
+
+	if (dwarf_elf_init(elf, DW_DLC_READ, NULL, NULL, &dw->dw_dw,
+	    &dw->dw_err) != DW_DLV_OK) {
+		terminate("failed to initialize DWARF: %s\n",
+		    dwarf_errmsg(dw->dw_err));
+	}
+
+	dwarf_check_str_offset(dw->dw_dw);
+	dw->dw_tidhash = alist_new(TDESC_HASH_BUCKETS);
+
+	while ((i = cu_claim(cuq)) != -1) {
+		cudata = cuq->cuq_cus[i];
+		cu_extract(dw, &mcd, cudata);
+
+		pthread_mutex_lock(&cuq->cuq_lock);
+		cudata->cud_done = 1;
+		pthread_cond_broadcast(&cuq->cuq_cv);
+		pthread_mutex_unlock(&cuq->cuq_lock);
+	}
+
+	alist_free(dw->dw_tidhash);
+	merge_cb_data_destroy(&mcd);
+
+	(void) dwarf_finish(dw->dw_dw, &dw->dw_err);
+	(void) elf_end(elf);
+	(void) close(fd);
+
+	return (NULL);
+}
+
 /*ARGSUSED*/
 int
 dw_read(Elf *elf, const char *filename, const char *unitmatch, int verbose, tdata_t **mstrtd)
@@ -2078,17 +2264,19 @@ dw_read(Elf *elf, const char *filename, const char *unitmatch, int verbose, tdat
 	dwarf_t *dw = &_dw;
 	Dwarf_Unsigned abboff, hdrlen, nxthdr;
 	Dwarf_Half vers, addrsz;
-	Dwarf_Die child;
 	char *prod;
 	int rc;
+	int i;
 	int cucount = 0;
 	int cumerged = 0;
+	int nthreads;
 	cu_data_t *cufirst = NULL;
 	cu_data_t *culast = NULL;
 	cu_data_t *cunext = NULL;
 	cu_data_t *cudata;
-	tdata_t *cutd = NULL;
-	merge_cb_data_t mcd = {0};
+	cu_queue_t cuq;
+	pthread_t *threads;
+	sigset_t sets;
 
 	bzero(dw, sizeof (dwarf_t));
 	dw->dw_ptrsz = elf_ptrsz(elf);
@@ -2191,86 +2379,85 @@ dw_read(Elf *elf, const char *filename, const char *unitmatch, int verbose, tdat
 		cucount++;
 		cudata->cud_name = dw->dw_cuname;
 		cudata->cud_nxthdr = nxthdr;
+
+		char *tmp = xstrdup(dw->dw_cuname->value);
+		cudata->cud_basename = atom_get(basename(tmp));
+		free(tmp);
 	}
 
+	debug(1, "dwarf_finish\n");
+	(void) dwarf_finish(dw->dw_dw, &dw->dw_err);
+
 	ctfmerge_prepare(cucount);
 
 	/* Second pass to extract & merge */
 
-	dw->dw_tidhash = alist_new(TDESC_HASH_BUCKETS);
-
-	for (cudata = cunext = cufirst; cudata; cudata = cunext) {
-		dw->dw_cuname = ATOM_NULL;
-		if ((rc = dwarf_next_cu_header(dw->dw_dw, &hdrlen, &vers, &abboff,
-			&addrsz, &nxthdr, &dw->dw_err)) != DW_DLV_OK) {
-			break;
-		}
-		if (nxthdr != cudata->cud_nxthdr) {
-			continue;
-		}
-		cunext = cudata->cud_next;
-
-		Dwarf_Die no_die = 0;
-		Dwarf_Error error = NULL;
-		rc = dwarf_siblingof(dw->dw_dw, no_die, &dw->dw_cu, &error);
-		if(rc != DW_DLV_OK) {
-			terminate("Error in dwarf_siblingof on CU die (%s)\n", dwarf_errmsg(error));
-		}
-
-		dw->dw_cuoff = die_off(dw, dw->dw_cu);
-		dw->dw_cuname = cudata->cud_name;
-		if (verbose && (cucount > 1)) {
-			printf("[%.02fM] %s\n", nxthdr / 1024. / 1024., dw->dw_cuname->value);
-		}
-		char *tmp = xstrdup(dw->dw_cuname->value);
-		dw->dw_cuname = atom_get(basename(tmp));
-		free(tmp);
+	bzero(&cuq, sizeof (cuq));
+	pthread_mutex_init(&cuq.cuq_lock, NULL);
+	pthread_cond_init(&cuq.cuq_cv, NULL);
+	cuq.cuq_cus = xcalloc(sizeof (cu_data_t *) * MAX(cucount, 1));
+	for (cudata = cufirst; cudata; cudata = cudata->cud_next)
+		cuq.cuq_cus[cuq.cuq_ncus++] = cudata;
+	cuq.cuq_filename = filename;
+	cuq.cuq_ptrsz = dw->dw_ptrsz;
+
+	if (getenv("CTFCONVERT_MAX_THREADS"))
+		nthreads = atoi(getenv("CTFCONVERT_MAX_THREADS"));
+	else
+		nthreads = MIN(sysconf(_SC_NPROCESSORS_ONLN), CU_MAXTHREADS);
+	nthreads = MAX(MIN(nthreads, cucount), 1);
+	cuq.cuq_window = nthreads * CU_WINDOW_PER_THREAD;
 
-		rc = dwarf_child(dw->dw_cu, &child, &error);
-		if (rc != DW_DLV_OK) {
-			printf("Error in dwarf_child on CU die \n");
-			continue;
-		}
+	debug(1, "Extracting %d CUs with %d threads\n", cucount, nthreads);
 
-		dw->dw_mfgtid_last = TID_MFGTID_BASE;
-		dw->dw_fwdhash = hash_new(TDESC_HASH_BUCKETS, tdesc_namehash,
-		    tdesc_namecmp);
-		dw->dw_enumhash = hash_new(TDESC_HASH_BUCKETS, tdesc_namehash,
-		    tdesc_namecmp);
+	/* Leave signal handling to the main thread, as ctfmerge does. */
+	sigemptyset(&sets);
+	sigaddset(&sets, SIGINT);
+	sigaddset(&sets, SIGQUIT);
+	sigaddset(&sets, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &sets, NULL);
 
-		dw->dw_void = NULL;
-		dw->dw_long = NULL;
-		dw->dw_maxoff = nxthdr - 1;
+	threads = xmalloc(sizeof (pthread_t) * nthreads);
+	for (i = 0; i < nthreads; i++)
+		pthread_create(&threads[i], NULL, cu_worker, &cuq);
 
-		dw->dw_td = tdata_new();
-		die_create(dw, child);
-		die_resolve(dw);
+	pthread_sigmask(SIG_UNBLOCK, &sets, NULL);
 
-#if !defined(__APPLE__)
-		cvt_fixups(td, dw->dw_ptrsz);
-#else
-		/* Ignore Solaris gore. See on-src-20080707/usr/src/tools/ctf/cvt/fixup_tdescs.c */
-#endif
+	for (i = 0; i < cuq.cuq_ncus; i++) {
+		cudata = cuq.cuq_cus[i];
 
-		cutd = tdata_new();
-		debug(1, "mergeto %s to cutd\n", dw->dw_cuname->value);
-		merge_into_master(&mcd, dw->dw_td, cutd, NULL, 1);
+		pthread_mutex_lock(&cuq.cuq_lock);
+		while (!cudata->cud_done)
+			pthread_cond_wait(&cuq.cuq_cv, &cuq.cuq_lock);
+		pthread_mutex_unlock(&cuq.cuq_lock);
 
-		ctfmerge_add_td(cutd, dw->dw_cuname->value);
+		if (verbose && (cucount > 1)) {
+			printf("[%.02fM] %s\n", cudata->cud_nxthdr / 1024. / 1024.,
+			    cudata->cud_name->value);
+		}
 
-		alist_clear(dw->dw_tidhash);
-		hash_free(dw->dw_fwdhash,  NULL, NULL);
-		hash_free(dw->dw_enumhash, NULL, NULL);
-		tdata_free(dw->dw_td);
+		if (cudata->cud_td != NULL) {
+			ctfmerge_add_td(cudata->cud_td, cudata->cud_basename->value);
+			cumerged++;
+		}
 
-		cumerged++;
+		pthread_mutex_lock(&cuq.cuq_lock);
+		cuq.cuq_nsubmitted++;
+		pthread_cond_broadcast(&cuq.cuq_cv);
+		pthread_mutex_unlock(&cuq.cuq_lock);
 	}
 
-	alist_free(dw->dw_tidhash);
-	merge_cb_data_destroy(&mcd);
+	for (i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
 
-	debug(1, "dwarf_finish\n");
-	(void) dwarf_finish(dw->dw_dw, &dw->dw_err);
+	for (cudata = cufirst; cudata; cudata = cunext) {
+		cunext = cudata->cud_next;
+		free(cudata);
+	}
+	free(cuq.cuq_cus);
+	pthread_cond_destroy(&cuq.cuq_cv);
+	pthread_mutex_destroy(&cuq.cuq_lock);
 
 	if (cumerged) {
 		*mstrtd = ctfmerge_done();